@@ -77,9 +77,29 @@ struct bitstream {
 	uint32_t bits;
 	int remaining_bits;
 	uint16_t *table;
+	uint32_t *fast_table;
 };
 
 
+/*
+ * The decompressor looks up the next LZX_HUFF_FAST_BITS bits of the stream
+ * in bitstream->fast_table, which resolves all the codes that are no longer
+ * than that in one step, rather than walking the tree a bit at a time. Each
+ * entry holds a symbol and its code length, and if the symbol is a literal
+ * and the remaining bits hold another complete literal, that literal too.
+ *
+ * A zero code length means the code is longer than LZX_HUFF_FAST_BITS, and
+ * the rest of it is found in the tree in bitstream->table.
+ */
+#define LZX_HUFF_FAST_BITS 11
+#define LZX_HUFF_FAST_MASK ((1 << LZX_HUFF_FAST_BITS) - 1)
+
+#define FAST_SYMBOL(e)  ((e) & 511)
+#define FAST_LEN(e)     (((e) >> 9) & 15)
+#define FAST_SYMBOL2(e) (((e) >> 13) & 255)
+#define FAST_LEN2(e)    (((e) >> 21) & 15)
+
+
 #if ! defined __has_builtin
 #define __has_builtin(x) 0
 #endif
@@ -118,6 +138,14 @@ static inline int bitlen_nonzero_16(uint16_t x)
 }
 
 
+/*
+ * match_len_fn counts the matching bytes of an LZ77 match, see
+ * match_len_scalar() and friends below.
+ */
+typedef size_t (*match_len_fn)(const uint8_t *here,
+			       const uint8_t *there,
+			       size_t max_len);
+
 struct lzxhuff_compressor_context {
 	const uint8_t *input_bytes;
 	size_t input_size;
@@ -126,6 +154,7 @@ struct lzxhuff_compressor_context {
 	uint8_t *output;
 	size_t available_size;
 	size_t output_pos;
+	match_len_fn match_len;
 };
 
 static int compare_huffman_node_count(struct huffman_node *a,
@@ -637,33 +666,24 @@ static inline void store_match(uint16_t *hash_table,
 			       uint16_t offset)
 {
 	int i;
-	uint16_t o = hash_table[h];
 	uint16_t h2;
-	uint16_t worst_h;
-	int worst_score;
+	uint16_t worst_h = h;
+	int worst_score = -1;
 
-	if (o == 0xffff) {
-		/* there is nothing there yet */
-		hash_table[h] = offset;
-		return;
-	}
-	for (i = 1; i < LZX_HUFF_COMP_HASH_SEARCH_ATTEMPTS; i++) {
-		h2 = (h + i) & HASH_MASK;
-		if (hash_table[h2] == 0xffff) {
-			hash_table[h2] = offset;
-			return;
-		}
-	}
 	/*
-	 * There are no slots, but we really want to store this, so we'll kick
-	 * out the one with the longest distance.
+	 * We take the first empty slot, but if there are no empty slots we
+	 * really want to store this anyway, so we'll kick out the one with
+	 * the longest distance.
 	 */
-	worst_h = h;
-	worst_score = offset - o;
-	for (i = 1; i < LZX_HUFF_COMP_HASH_SEARCH_ATTEMPTS; i++) {
+	for (i = 0; i < LZX_HUFF_COMP_HASH_SEARCH_ATTEMPTS; i++) {
+		uint16_t o;
 		int score;
 		h2 = (h + i) & HASH_MASK;
 		o = hash_table[h2];
+		if (o == 0xffff) {
+			hash_table[h2] = offset;
+			return;
+		}
 		score = offset - o;
 		if (score > worst_score) {
 			worst_score = score;
@@ -683,14 +703,123 @@ struct match {
 };
 
 
+/*
+ * match_len_*() count how many bytes at the start of 'here' and 'there' are
+ * equal, up to max_len. This is where the LZ77 stage spends its time when
+ * the data is repetitive, so we compare as many bytes at once as we can.
+ *
+ * The SSE2 version is always available on x86_64. The AVX2 version is
+ * chosen at runtime by select_match_len_fn() if the CPU supports it, so we
+ * don't need to compile the whole library with -mavx2. (SSE4.2 has string
+ * comparison instructions, but they are slower than SSE2 compare and
+ * movemask for this).
+ */
+static inline int first_set_byte_64(uint64_t x)
+{
+#if __has_builtin(__builtin_ctzll)
+	return __builtin_ctzll(x) / 8;
+#else
+	int count = 0;
+	while ((x & 0xff) == 0) {
+		x >>= 8;
+		count++;
+	}
+	return count;
+#endif
+}
+
+
+static size_t match_len_scalar(const uint8_t *here,
+			       const uint8_t *there,
+			       size_t max_len)
+{
+	size_t len = 0;
+
+	while (len + 8 <= max_len) {
+		uint64_t x = PULL_LE_U64(here, len) ^ PULL_LE_U64(there, len);
+		if (x != 0) {
+			return len + first_set_byte_64(x);
+		}
+		len += 8;
+	}
+	while (len < max_len && here[len] == there[len]) {
+		len++;
+	}
+	return len;
+}
+
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+
+static size_t match_len_sse2(const uint8_t *here,
+			     const uint8_t *there,
+			     size_t max_len)
+{
+	size_t len = 0;
+
+	while (len + 16 <= max_len) {
+		__m128i a = _mm_loadu_si128((const __m128i *)(here + len));
+		__m128i b = _mm_loadu_si128((const __m128i *)(there + len));
+		uint32_t mask = _mm_movemask_epi8(_mm_cmpeq_epi8(a, b));
+		if (mask != 0xffff) {
+			return len + __builtin_ctz(~mask);
+		}
+		len += 16;
+	}
+	return len + match_len_scalar(here + len, there + len, max_len - len);
+}
+#endif /* __SSE2__ */
+
+
+#ifdef HAVE_BUILTIN_CPU_SUPPORTS_AVX2
+#include <immintrin.h>
+
+__attribute__((target("avx2")))
+static size_t match_len_avx2(const uint8_t *here,
+			     const uint8_t *there,
+			     size_t max_len)
+{
+	size_t len = 0;
+
+	while (len + 32 <= max_len) {
+		__m256i a = _mm256_loadu_si256((const __m256i *)(here + len));
+		__m256i b = _mm256_loadu_si256((const __m256i *)(there + len));
+		uint32_t mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(a, b));
+		if (mask != 0xffffffff) {
+			return len + __builtin_ctz(~mask);
+		}
+		len += 32;
+	}
+	return len + match_len_scalar(here + len, there + len, max_len - len);
+}
+#endif /* HAVE_BUILTIN_CPU_SUPPORTS_AVX2 */
+
+
+static match_len_fn select_match_len_fn(void)
+{
+#ifdef HAVE_BUILTIN_CPU_SUPPORTS_AVX2
+	if (__builtin_cpu_supports("avx2")) {
+		return match_len_avx2;
+	}
+#endif
+#ifdef __SSE2__
+	return match_len_sse2;
+#else
+	return match_len_scalar;
+#endif
+}
+
+
 static inline struct match lookup_match(uint16_t *hash_table,
 					uint16_t h,
 					const uint8_t *data,
 					const uint8_t *here,
-					size_t max_len)
+					size_t max_len,
+					match_len_fn match_len)
 {
 	int i;
-	uint16_t o = hash_table[h];
+	uint16_t o;
 	uint16_t h2;
 	size_t len;
 	const uint8_t *there = NULL;
@@ -711,6 +840,16 @@ static inline struct match lookup_match(uint16_t *hash_table,
 			continue;
 		}
 
+		/*
+		 * A match needs at least three bytes, and most candidates
+		 * are hash collisions that fail here.
+		 */
+		if (here[0] != there[0] ||
+		    here[1] != there[1] ||
+		    here[2] != there[2]) {
+			continue;
+		}
+
 		/*
 		 * When we already have a long match, we can try to avoid
 		 * measuring out another long, but shorter match.
@@ -720,21 +859,16 @@ static inline struct match lookup_match(uint16_t *hash_table,
 			continue;
 		}
 
-		for (len = 0;
-		     len < max_len && here[len] == there[len];
-		     len++) {
-			/* counting */
-		}
-		if (len > 2) {
-			/*
-			 * As a tiebreaker, we prefer the closer match which
-			 * is likely to encode smaller (and certainly no worse).
-			 */
-			if (len > best.length ||
-			    (len == best.length && there > best.there)) {
-				best.length = len;
-				best.there = there;
-			}
+		len = 3 + match_len(here + 3, there + 3, max_len - 3);
+
+		/*
+		 * As a tiebreaker, we prefer the closer match which
+		 * is likely to encode smaller (and certainly no worse).
+		 */
+		if (len > best.length ||
+		    (len == best.length && there > best.there)) {
+			best.length = len;
+			best.there = there;
 		}
 	}
 	return best;
@@ -806,7 +940,8 @@ static ssize_t lz77_encode_block(struct lzxhuff_compressor_context *cmp_ctx,
 					     h,
 					     data,
 					     here,
-					     max_len);
+					     max_len,
+					     cmp_ctx->match_len);
 
 			if (match.there == NULL && prev_hash_table != NULL) {
 				/*
@@ -820,7 +955,8 @@ static ssize_t lz77_encode_block(struct lzxhuff_compressor_context *cmp_ctx,
 						     h,
 						     prev_block,
 						     here,
-						     remaining_size - i);
+						     remaining_size - i,
+						     cmp_ctx->match_len);
 			}
 
 			store_match(hash_table, h, i);
@@ -1327,7 +1463,8 @@ ssize_t lzxpress_huffman_compress(struct lzxhuff_compressor_mem *cmp_mem,
 		.prev_block_pos = 0,
 		.output = output,
 		.available_size = available_size,
-		.output_pos = 0
+		.output_pos = 0,
+		.match_len = select_match_len_fn(),
 	};
 
 	if (input_size == 0) {
@@ -1592,6 +1729,9 @@ static bool fill_decomp_table(struct bitstream *input)
 		/* prefill the table head */
 		input->table[i] = 0xffff;
 	}
+	memset(input->fast_table,
+	       0,
+	       sizeof(input->fast_table[0]) << LZX_HUFF_FAST_BITS);
 	code = -1;
 	prev_len = 0;
 	for (i = 0; i < n_symbols; i++) {
@@ -1615,6 +1755,23 @@ static bool fill_decomp_table(struct bitstream *input)
 		    prefix = (prefix - 1) >> 1) {
 			input->table[prefix] = 0xffff;
 		}
+
+		if (len <= LZX_HUFF_FAST_BITS) {
+			/*
+			 * The code is the len-bit number x, so every fast
+			 * table index that starts with x decodes to s.
+			 */
+			size_t x = code + 1 - (1 << len);
+			size_t shift = LZX_HUFF_FAST_BITS - len;
+			size_t j;
+			if (x >= (1 << len)) {
+				/* too many codes of this length */
+				return false;
+			}
+			for (j = x << shift; j < (x + 1) << shift; j++) {
+				input->fast_table[j] = s | (len << 9);
+			}
+		}
 	}
 	if (CHECK_DEBUGLVL(10)) {
 		debug_tree_codes(input);
@@ -1628,6 +1785,31 @@ static bool fill_decomp_table(struct bitstream *input)
 	if (code != (1 << (len + 1)) - 2) {
 		return false;
 	}
+
+	/*
+	 * Where a short literal code leaves enough bits for a second literal,
+	 * we decode that too. The second lookup only looks at the symbol and
+	 * length of the entry, which this loop doesn't change.
+	 */
+	for (i = 0; i <= LZX_HUFF_FAST_MASK; i++) {
+		uint32_t e = input->fast_table[i];
+		uint32_t e2;
+		uint16_t len1 = FAST_LEN(e);
+		uint16_t len2;
+		if (len1 == 0 ||
+		    len1 == LZX_HUFF_FAST_BITS ||
+		    FAST_SYMBOL(e) > 255) {
+			continue;
+		}
+		e2 = input->fast_table[(i << len1) & LZX_HUFF_FAST_MASK];
+		len2 = FAST_LEN(e2);
+		if (len2 == 0 ||
+		    len1 + len2 > LZX_HUFF_FAST_BITS ||
+		    FAST_SYMBOL(e2) > 255) {
+			continue;
+		}
+		input->fast_table[i] = e | (FAST_SYMBOL(e2) << 13) | (len2 << 21);
+	}
 	return true;
 }
 
@@ -1681,6 +1863,33 @@ static inline ssize_t pull_bits(struct bitstream *input)
 }
 
 
+/*
+ * Drop n bits (at most 16) from the bitstream, refilling it as necessary.
+ *
+ * The bits are read 16 at a time, and there are always at least 16 bits
+ * ready after this returns successfully. This is the same as reading a
+ * word whenever we want another bit but there are only 16 left, which
+ * matters because the extra length bytes of a match are interleaved with
+ * the words of the bitstream.
+ *
+ * It also means a stream fails at the same point as it did when bits were
+ * pulled one at a time: running out while fewer than 16 bits are left is
+ * exactly the case where the old decoder would have wanted one more word.
+ * test_lzxpress_huffman_truncated_tail() checks this.
+ */
+static inline ssize_t consume_bits(struct bitstream *input, int n)
+{
+	input->remaining_bits -= n;
+	while (input->remaining_bits < 16) {
+		ssize_t ret = pull_bits(input);
+		if (ret) {
+			return ret;
+		}
+	}
+	return 0;
+}
+
+
 /*
  * Decompress a block. The actual decompressed size is returned (or -1 on
  * error). The putative block length is 64k (or shorter, if the message ends
@@ -1700,7 +1909,7 @@ static ssize_t lzx_huffman_decompress_block(struct bitstream *input,
 {
 	size_t output_pos = 0;
 	uint16_t symbol;
-	size_t index;
+	size_t index = 0;
 	uint16_t distance_bits_wanted = 0;
 	size_t distance = 0;
 	size_t length = 0;
@@ -1724,19 +1933,17 @@ static ssize_t lzx_huffman_decompress_block(struct bitstream *input,
 	input->remaining_bits = 32;
 
 	/*
-	 * This loop iterates over individual *bits*. These are read from
+	 * This loop iterates over symbols. The bits are read from
 	 * little-endian 16 bit words, most significant bit first.
 	 *
-	 * At points in the bitstream, the following are possible:
+	 * For each symbol we look at the next LZX_HUFF_FAST_BITS bits, which
+	 * is enough to decode most codewords (and sometimes two literals)
+	 * with one lookup in the fast table. Longer codewords are finished by
+	 * walking the tree one bit at a time. Then either
 	 *
-	 * # the source word is empty and needs to be refilled from the input
-	 *    stream.
-	 * # an incomplete codeword is being extended.
-	 * # a codeword is resolved, either as a literal or a match.
-	 * # a literal is written.
-	 * # a match is collecting distance bits.
-	 * # the output stream is copied, as specified by a match.
-	 * # input bytes are read for match lengths.
+	 * # one or two literals are written, or
+	 * # input bytes are read for match lengths, the match distance bits
+	 *   are read, and the output stream is copied.
 	 *
 	 * Note that we *don't* specifically check for the EOF marker (symbol
 	 * 256) in this loop, because the precondition for stopping for the
@@ -1746,92 +1953,131 @@ static ssize_t lzx_huffman_decompress_block(struct bitstream *input,
 	 * there is an EOF in another loop after we stop writing.
 	 */
 
-	index = 0;
 	while (output_pos < block_size) {
-		uint16_t b;
-		if (input->remaining_bits == 16) {
-			ssize_t ret = pull_bits(input);
-			if (ret) {
-				return ret;
-			}
-		}
-		input->remaining_bits--;
-
-		b = (input->bits >> input->remaining_bits) & 1;
-		if (length == 0) {
-			/* not in a match; pulling a codeword */
-			index <<= 1;
-			index += b + 1;
-			if (input->table[index] == 0xffff) {
-				/* incomplete codeword, the common case */
+		uint32_t entry;
+		uint16_t code_len;
+		uint16_t peek;
+		ssize_t ret;
+		size_t i;
+		size_t end;
+		uint8_t *here = NULL;
+		uint8_t *there = NULL;
+
+		peek = (input->bits >>
+			(input->remaining_bits - LZX_HUFF_FAST_BITS)) &
+			LZX_HUFF_FAST_MASK;
+		entry = input->fast_table[peek];
+		code_len = FAST_LEN(entry);
+
+		if (likely(code_len != 0)) {
+			symbol = FAST_SYMBOL(entry);
+			if (FAST_LEN2(entry) != 0 &&
+			    output_pos + 1 < block_size) {
+				/* two literals at once */
+				output[output_pos] = symbol;
+				output[output_pos + 1] = FAST_SYMBOL2(entry);
+				output_pos += 2;
+				ret = consume_bits(input,
+						   code_len + FAST_LEN2(entry));
+				if (ret) {
+					return ret;
+				}
 				continue;
 			}
-			/* found the symbol, reset the code string */
+		} else {
+			/*
+			 * A long code, which we finish by walking the tree
+			 * from the node the fast bits have taken us to.
+			 */
+			index = (1 << LZX_HUFF_FAST_BITS) - 1 + peek;
+			code_len = LZX_HUFF_FAST_BITS;
+			do {
+				uint16_t b;
+				if (code_len == 15) {
+					return LZXPRESS_ERROR;
+				}
+				code_len++;
+				b = (input->bits >>
+				     (input->remaining_bits - code_len)) & 1;
+				index <<= 1;
+				index += b + 1;
+			} while (input->table[index] == 0xffff);
 			symbol = input->table[index] & 511;
 			index = 0;
-			if (symbol < 256) {
-				/* a literal, the easy case */
-				output[output_pos] = symbol;
-				output_pos++;
-				continue;
-			}
+		}
 
-			/* the beginning of a match */
-			distance_bits_wanted = (symbol >> 4) & 15;
-			distance = 1 << distance_bits_wanted;
-			length = symbol & 15;
-			if (length == 15) {
-				CHECK_READ_8(tmp);
-				length += tmp;
-				if (length == 255 + 15) {
-					/*
-					 * note, we discard (don't add) the
-					 * length so far.
-					 */
-					CHECK_READ_16(length);
-					if (length == 0) {
-						CHECK_READ_32(length);
-					}
-				}
-			}
-			length += 3;
-		} else {
-			/* we are pulling extra distance bits */
-			distance_bits_wanted--;
-			distance |= b << distance_bits_wanted;
+		ret = consume_bits(input, code_len);
+		if (ret) {
+			return ret;
 		}
 
-		if (distance_bits_wanted == 0) {
-			/*
-			 * We have a complete match, and it is time to do the
-			 * copy (byte by byte, because the ranges can overlap,
-			 * and we might need to copy bytes we just copied in).
-			 *
-			 * It is possible that this match will extend beyond
-			 * the end of the expected block. That's fine, so long
-			 * as it doesn't extend past the total output size.
-			 */
-			size_t i;
-			size_t end = output_pos + length;
-			uint8_t *here = output + output_pos;
-			uint8_t *there = here - distance;
-			if (end > output_size ||
-			    previous_size + output_pos < distance ||
-			    unlikely(end < output_pos || there > here)) {
-				return LZXPRESS_ERROR;
+		if (symbol < 256) {
+			/* a literal, the easy case */
+			output[output_pos] = symbol;
+			output_pos++;
+			continue;
+		}
+
+		/* the beginning of a match */
+		distance_bits_wanted = (symbol >> 4) & 15;
+		distance = 1 << distance_bits_wanted;
+		length = symbol & 15;
+		if (length == 15) {
+			CHECK_READ_8(tmp);
+			length += tmp;
+			if (length == 255 + 15) {
+				/*
+				 * note, we discard (don't add) the
+				 * length so far.
+				 */
+				CHECK_READ_16(length);
+				if (length == 0) {
+					CHECK_READ_32(length);
+				}
 			}
-			for (i = 0; i < length; i++) {
-				here[i] = there[i];
+		}
+		length += 3;
+
+		if (distance_bits_wanted != 0) {
+			distance |= (input->bits >>
+				     (input->remaining_bits -
+				      distance_bits_wanted)) &
+				((1 << distance_bits_wanted) - 1);
+			ret = consume_bits(input, distance_bits_wanted);
+			if (ret) {
+				return ret;
 			}
-			output_pos += length;
-			distance = 0;
-			length = 0;
 		}
-	}
 
-	if (length != 0 || index != 0) {
-		/* it seems like we've hit an early end, mid-code */
-		return LZXPRESS_ERROR;
+		/*
+		 * We have a complete match, and it is time to do the copy.
+		 *
+		 * It is possible that this match will extend beyond the end
+		 * of the expected block. That's fine, so long as it doesn't
+		 * extend past the total output size.
+		 */
+		end = output_pos + length;
+		here = output + output_pos;
+		there = here - distance;
+		if (end > output_size ||
+		    previous_size + output_pos < distance ||
+		    unlikely(end < output_pos || there > here)) {
+			return LZXPRESS_ERROR;
+		}
+		/*
+		 * The ranges can overlap, in which case the match repeats the
+		 * last 'distance' bytes. We copy in chunks that are a
+		 * multiple of the distance in length, from the start of the
+		 * match, so that the source never overlaps the destination
+		 * and the chunks keep doubling.
+		 */
+		i = 0;
+		while (i < length) {
+			size_t n = MIN(i + distance, length - i);
+			memcpy(here + i, there, n);
+			i += n;
+		}
+		output_pos += length;
 	}
 
 	if (input->byte_pos + 256 < input->byte_size) {
@@ -1962,13 +2208,15 @@ ssize_t lzxpress_huffman_decompress(const uint8_t *input_bytes,
 				    size_t output_size)
 {
 	uint16_t table[65536];
+	uint32_t fast_table[1 << LZX_HUFF_FAST_BITS];
 	struct bitstream input = {
 		.bytes = input_bytes,
 		.byte_size = input_size,
 		.byte_pos = 0,
 		.bits = 0,
 		.remaining_bits = 0,
-		.table = table
+		.table = table,
+		.fast_table = fast_table
 	};
 
 	if (input_size > SSIZE_MAX ||
@@ -2032,6 +2280,14 @@ uint8_t *lzxpress_huffman_decompress_talloc(TALLOC_CTX *mem_ctx,
 		talloc_free(output);
 		return NULL;
 	}
+	input.fast_table = talloc_array(input.table,
+					uint32_t,
+					1 << LZX_HUFF_FAST_BITS);
+	if (input.fast_table == NULL) {
+		talloc_free(input.table);
+		talloc_free(output);
+		return NULL;
+	}
 	result = lzxpress_huffman_decompress_internal(&input,
 						      output,
 						      output_size);
@@ -0,0 +1,214 @@
+/*
+ * Samba compression library - LGPLv3
+ *
+ * Throughput measurement for LZ77 + Huffman compression.
+ *
+ *  ** NOTE! The following LGPL license applies to this file.
+ *  ** It does NOT imply that all of Samba is released under the LGPL
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 3 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Usage: lzxhuffperf [iterations [directory]]
+ *
+ * Every *.decomp file in the directory (by default the test corpus in
+ * testdata/compression/decompressed) is compressed and decompressed
+ * 'iterations' times, and the throughput is printed in MB per second of
+ * uncompressed data. The round trip is checked, so this can also be used
+ * on an arbitrary collection of files.
+ *
+ * To compare two versions of lzxpress_huffman.c, build this against each
+ * and run it on the same machine.
+ */
+
+#include "replace.h"
+#include "system/dir.h"
+#include "system/filesys.h"
+#include "system/time.h"
+#include <talloc.h>
+#include "lzxpress_huffman.h"
+
+#define DEFAULT_DIR "testdata/compression/decompressed"
+#define DEFAULT_ITERATIONS 10
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint8_t *read_file(TALLOC_CTX *mem_ctx,
+			  const char *path,
+			  size_t *_len)
+{
+	struct stat st;
+	uint8_t *buf = NULL;
+	size_t len;
+	FILE *fh = NULL;
+
+	fh = fopen(path, "rb");
+	if (fh == NULL) {
+		return NULL;
+	}
+	if (fstat(fileno(fh), &st) != 0 || st.st_size <= 0) {
+		fclose(fh);
+		return NULL;
+	}
+	buf = talloc_array(mem_ctx, uint8_t, st.st_size);
+	if (buf == NULL) {
+		fclose(fh);
+		return NULL;
+	}
+	len = fread(buf, 1, st.st_size, fh);
+	fclose(fh);
+	if (len != (size_t)st.st_size) {
+		TALLOC_FREE(buf);
+		return NULL;
+	}
+	*_len = len;
+	return buf;
+}
+
+int main(int argc, const char *argv[])
+{
+	TALLOC_CTX *mem_ctx = talloc_new(NULL);
+	struct lzxhuff_compressor_mem *cmp_mem = NULL;
+	const char *dirname = DEFAULT_DIR;
+	int iterations = DEFAULT_ITERATIONS;
+	size_t total_in = 0;
+	size_t total_out = 0;
+	double total_comp = 0;
+	double total_decomp = 0;
+	struct dirent *de = NULL;
+	DIR *dir = NULL;
+	int ret = 0;
+
+	if (argc > 1) {
+		iterations = atoi(argv[1]);
+		if (iterations < 1) {
+			fprintf(stderr,
+				"lzxhuffperf [iterations [directory]]\n");
+			exit(1);
+		}
+	}
+	if (argc > 2) {
+		dirname = argv[2];
+	}
+
+	cmp_mem = talloc(mem_ctx, struct lzxhuff_compressor_mem);
+	if (cmp_mem == NULL) {
+		exit(1);
+	}
+
+	dir = opendir(dirname);
+	if (dir == NULL) {
+		fprintf(stderr, "could not open %s: %s\n",
+			dirname, strerror(errno));
+		exit(1);
+	}
+
+	printf("%-45s %9s %9s %10s %10s\n",
+	       "file", "size", "comp", "comp MB/s", "dec MB/s");
+
+	while ((de = readdir(dir)) != NULL) {
+		TALLOC_CTX *tmp_ctx = talloc_new(mem_ctx);
+		const char *ext = strrchr(de->d_name, '.');
+		char *path = NULL;
+		uint8_t *input = NULL;
+		uint8_t *comp = NULL;
+		uint8_t *decomp = NULL;
+		size_t input_len = 0;
+		size_t comp_max;
+		ssize_t comp_len = 0;
+		ssize_t decomp_len = 0;
+		double start, comp_secs, decomp_secs;
+		double mb;
+		int i;
+
+		if (ext == NULL || strcmp(ext, ".decomp") != 0) {
+			TALLOC_FREE(tmp_ctx);
+			continue;
+		}
+
+		path = talloc_asprintf(tmp_ctx, "%s/%s", dirname, de->d_name);
+		input = read_file(tmp_ctx, path, &input_len);
+		if (input == NULL) {
+			TALLOC_FREE(tmp_ctx);
+			continue;
+		}
+
+		comp_max = lzxpress_huffman_max_compressed_size(input_len);
+		comp = talloc_array(tmp_ctx, uint8_t, comp_max);
+		decomp = talloc_array(tmp_ctx, uint8_t, input_len);
+		if (comp == NULL || decomp == NULL) {
+			exit(1);
+		}
+
+		start = now();
+		for (i = 0; i < iterations; i++) {
+			comp_len = lzxpress_huffman_compress(cmp_mem,
+							     input,
+							     input_len,
+							     comp,
+							     comp_max);
+		}
+		comp_secs = now() - start;
+		if (comp_len < 0) {
+			printf("%-45s compression failed\n", de->d_name);
+			ret = 1;
+			TALLOC_FREE(tmp_ctx);
+			continue;
+		}
+
+		start = now();
+		for (i = 0; i < iterations; i++) {
+			decomp_len = lzxpress_huffman_decompress(comp,
+								 comp_len,
+								 decomp,
+								 input_len);
+		}
+		decomp_secs = now() - start;
+		if (decomp_len != (ssize_t)input_len ||
+		    memcmp(decomp, input, input_len) != 0) {
+			printf("%-45s round trip failed\n", de->d_name);
+			ret = 1;
+			TALLOC_FREE(tmp_ctx);
+			continue;
+		}
+
+		mb = (double)input_len * iterations / (1024 * 1024);
+		printf("%-45s %9zu %9zd %10.2f %10.2f\n",
+		       de->d_name, input_len, comp_len,
+		       mb / comp_secs, mb / decomp_secs);
+
+		total_in += input_len;
+		total_out += comp_len;
+		total_comp += comp_secs;
+		total_decomp += decomp_secs;
+		TALLOC_FREE(tmp_ctx);
+	}
+	closedir(dir);
+
+	if (total_in != 0) {
+		double mb = (double)total_in * iterations / (1024 * 1024);
+		printf("%-45s %9zu %9zu %10.2f %10.2f\n",
+		       "TOTAL", total_in, total_out,
+		       mb / total_comp, mb / total_decomp);
+	}
+
+	TALLOC_FREE(mem_ctx);
+	return ret;
+}
@@ -1226,6 +1226,84 @@ static void test_lzxpress_huffman_decompress_empty_or_null(void **state)
 }
 
 
+static void test_lzxpress_huffman_truncated_tail(void **state)
+{
+	/*
+	 * The decoder refills its bit buffer 16 bits at a time, and at the
+	 * end of the stream it may only get 8. The expected results here
+	 * are those of the older bit-at-a-time decoder, which is to say the
+	 * compressed stream can lose its last byte if the final word was
+	 * a short read, but otherwise every truncation fails. Some trailing
+	 * zero bytes are tolerated.
+	 */
+	struct {
+		const char *pattern;
+		size_t length;
+		size_t ok_truncation; /* the last truncation that works */
+	} cases[] = {
+		{"a", 1, 0},
+		{"a", 20, 1},
+		{"a", 40, 0},
+		{"a", 274, 0},
+		{"adhkorux", 40, 0},
+		{"adhkorux", 42, 1},
+		{"adhkorux", 65537, 1},
+		{"abcdefghijklmnopqrstuvwxyz", 41, 1},
+		{"abcdefghijklmnopqrstuvwxyz", 42, 0},
+		{"abcdefghijklmnopqrstuvwxyz", 1000, 0},
+	};
+	TALLOC_CTX *mem_ctx = talloc_new(NULL);
+	size_t i, j;
+	ssize_t k;
+
+	for (i = 0; i < ARRAY_SIZE(cases); i++) {
+		size_t len = cases[i].length;
+		size_t plen = strlen(cases[i].pattern);
+		uint8_t *original = talloc_array(mem_ctx, uint8_t, len);
+		uint8_t *decompressed = talloc_array(mem_ctx, uint8_t, len);
+		uint8_t *compressed = NULL;
+		uint8_t *padded = NULL;
+		ssize_t comp_size;
+		ssize_t ret;
+
+		assert_non_null(original);
+		assert_non_null(decompressed);
+		for (j = 0; j < len; j++) {
+			original[j] = cases[i].pattern[(j * 7 + j / 3) % plen];
+		}
+		comp_size = lzxpress_huffman_compress_talloc(mem_ctx,
+							     original,
+							     len,
+							     &compressed);
+		assert_true(comp_size > 256);
+
+		padded = talloc_zero_array(mem_ctx, uint8_t, comp_size + 3);
+		assert_non_null(padded);
+		memcpy(padded, compressed, comp_size);
+
+		for (k = -3; k <= 8; k++) {
+			bool ok = (k <= (ssize_t)cases[i].ok_truncation);
+			ret = lzxpress_huffman_decompress(padded,
+							  comp_size - k,
+							  decompressed,
+							  len);
+			debug_message("%s × %zu, compressed %zd, "
+				      "truncated by %zd: %zd\n",
+				      cases[i].pattern, len, comp_size, k,
+				      ret);
+			if (ok) {
+				assert_int_equal(ret, len);
+				assert_memory_equal(original, decompressed,
+						    len);
+			} else {
+				assert_int_equal(ret, -1LL);
+			}
+		}
+	}
+	talloc_free(mem_ctx);
+}
+
+
 int main(void) {
 	const struct CMUnitTest tests[] = {
 		cmocka_unit_test(test_lzxpress_huffman_short_boring_strings),
@@ -1245,6 +1323,7 @@ int main(void) {
 		cmocka_unit_test(test_lzxpress_huffman_overlong_matches_abc),
 		cmocka_unit_test(test_lzxpress_huffman_overlong_matches),
 		cmocka_unit_test(test_lzxpress_huffman_decompress_empty_or_null),
+		cmocka_unit_test(test_lzxpress_huffman_truncated_tail),
 		cmocka_unit_test(test_lzxpress_huffman_compress_empty_or_null),
 	};
 	if (!isatty(1)) {
@@ -0,0 +1,1579 @@
+/*
+   Unix SMB/CIFS implementation.
+   Database interface wrapper around a shared memory hash table
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * locking.tdb and brlock.tdb are volatile databases that are hit by
+ * every open and every byte range lock. Even with mutexes tdb has to
+ * walk hash chains through the file, manage a free list and
+ * reallocate records when they grow.
+ *
+ * This backend keeps a volatile database in a file that all
+ * processes mmap. The file consists of
+ *
+ * - a header with the geometry and the sequence number,
+ *
+ * - an array of cache line aligned buckets, each with a robust
+ *   process shared mutex,
+ *
+ * - a fixed size arena per bucket holding the records of the bucket
+ *   packed as [keylen][datalen][key][data].
+ *
+ * A key hashes to exactly one bucket, so an operation takes one
+ * mutex and touches one contiguous piece of memory. There is no
+ * free list and no allocator: records are appended to the arena and
+ * deleting a record moves the rest of the arena down.
+ *
+ * A record that does not fit into its bucket goes to the overflow
+ * tdb "<name>.overflow" instead. It is still protected by the mutex
+ * of its bucket, the bucket just counts how many of its records are
+ * in the tdb, so that lookups only go there when it is non-zero.
+ *
+ * Like TDB_CLEAR_IF_FIRST, the first process to open the file
+ * initializes it. Every opener holds a read lock on the first byte
+ * of the file, the process that gets a write lock on it is the first
+ * one. A forked child takes its own read lock from a pthread_atfork()
+ * handler before it can touch the table.
+ */
+
+#include "replace.h"
+#include "system/filesys.h"
+#include "system/shmem.h"
+#include "dbwrap/dbwrap.h"
+#include "dbwrap/dbwrap_private.h"
+#include "dbwrap/dbwrap_shm.h"
+#include "lib/util/debug.h"
+#include "lib/util/samba_util.h"
+#include "lib/util/util_tdb.h"
+#include "lib/util/dlinklist.h"
+#include "libcli/util/error.h"
+#include <tevent.h>
+#include <tdb.h>
+
+#if defined(HAVE_ROBUST_MUTEXES) && \
+	defined(HAVE___ATOMIC_ADD_FETCH) && \
+	defined(HAVE___ATOMIC_ADD_LOAD)
+
+#include <pthread.h>
+
+#define DB_SHM_MAGIC "DBWSHM1"
+#define DB_SHM_VERSION 3
+
+#define DB_SHM_ALIGN(x, a) (((x) + (a) - 1) & ~((uint64_t)(a) - 1))
+#define DB_SHM_CACHELINE 64
+
+struct db_shm_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t num_buckets;
+	uint32_t bucket_size;
+	uint32_t reserved;
+	uint32_t seqnum;
+};
+
+#define DB_SHM_HEADER_SIZE \
+	DB_SHM_ALIGN(sizeof(struct db_shm_header), DB_SHM_CACHELINE)
+
+struct db_shm_bucket {
+	pthread_mutex_t mutex;
+	uint32_t used;
+	uint32_t num_records;
+	/*
+	 * Records of this bucket in the overflow tdb. Raised before
+	 * and lowered after changing the tdb, so a process dying in
+	 * between can only make us look into the tdb in vain.
+	 */
+	uint32_t num_overflow;
+	/*
+	 * Set while the arena is being changed. Whoever gets
+	 * EOWNERDEAD on the mutex of a dirty bucket can't trust
+	 * anything in it.
+	 */
+	uint32_t dirty;
+};
+
+#define DB_SHM_BUCKET_STRIDE \
+	DB_SHM_ALIGN(sizeof(struct db_shm_bucket), DB_SHM_CACHELINE)
+
+struct db_shm_rec {
+	uint32_t keylen;
+	uint32_t datalen;
+	/* followed by key and data, padded to 8 bytes */
+};
+
+#define DB_SHM_REC_SIZE(keylen, datalen) \
+	DB_SHM_ALIGN(sizeof(struct db_shm_rec) + \
+		     (uint64_t)(keylen) + (uint64_t)(datalen), 8)
+
+struct db_shm_held {
+	uint32_t bucket;
+	uint32_t count;
+};
+
+struct db_shm_ctx {
+	struct db_shm_ctx *prev, *next;
+	const char *name;
+	int fd;
+	uint8_t *map;
+	size_t map_size;
+	struct db_shm_header *hdr;
+
+	uint32_t num_buckets;
+	uint32_t bucket_size;
+	size_t arena_ofs;
+
+	bool seqnum;
+	bool readonly;
+
+	/* Records too large for their bucket */
+	struct tdb_context *overflow;
+
+	/*
+	 * fcntl locks are not inherited, a forked child has to take
+	 * its own read lock on the file.
+	 */
+	pid_t lock_pid;
+
+	/*
+	 * Bucket mutexes we hold. Like tdb chainlocks they nest, a
+	 * process can store a record while it holds the lock for it.
+	 */
+	struct db_shm_held *held;
+	size_t num_held;
+
+	struct {
+		dev_t dev;
+		ino_t ino;
+	} id;
+};
+
+/*
+ * fcntl locks are per process, a second open in the same process
+ * would take the table for its own and wipe it.
+ */
+static struct db_shm_ctx *db_shm_open_list;
+
+static NTSTATUS db_shm_storev(struct db_record *rec,
+			      const TDB_DATA *dbufs, int num_dbufs, int flag);
+static NTSTATUS db_shm_delete(struct db_record *rec);
+
+static uint32_t db_shm_bucket_idx(struct db_shm_ctx *ctx, TDB_DATA key)
+{
+	return tdb_jenkins_hash(&key) & (ctx->num_buckets - 1);
+}
+
+static struct db_shm_bucket *db_shm_bucket(struct db_shm_ctx *ctx,
+					   uint32_t idx)
+{
+	return (struct db_shm_bucket *)(
+		ctx->map + DB_SHM_HEADER_SIZE + idx * DB_SHM_BUCKET_STRIDE);
+}
+
+static uint8_t *db_shm_arena(struct db_shm_ctx *ctx, uint32_t idx)
+{
+	return ctx->map + ctx->arena_ofs + (size_t)idx * ctx->bucket_size;
+}
+
+static bool db_shm_bucket_valid(struct db_shm_ctx *ctx, uint32_t idx)
+{
+	struct db_shm_bucket *b = db_shm_bucket(ctx, idx);
+	uint8_t *arena = db_shm_arena(ctx, idx);
+	uint32_t ofs = 0;
+	uint32_t num_records = 0;
+
+	if (b->used > ctx->bucket_size) {
+		return false;
+	}
+
+	while (ofs < b->used) {
+		struct db_shm_rec *r = (struct db_shm_rec *)(arena + ofs);
+		uint64_t len;
+
+		if (b->used - ofs < sizeof(struct db_shm_rec)) {
+			return false;
+		}
+		len = DB_SHM_REC_SIZE(r->keylen, r->datalen);
+		if (len > b->used - ofs) {
+			return false;
+		}
+		ofs += len;
+		num_records += 1;
+	}
+
+	return (num_records == b->num_records);
+}
+
+static bool db_shm_take_read_lock(struct db_shm_ctx *ctx, pid_t pid)
+{
+	bool ok;
+
+	ok = fcntl_lock(ctx->fd, F_SETLKW, 0, 1, F_RDLCK);
+	if (!ok) {
+		DBG_ERR("Could not get read lock on %s: %s\n",
+			ctx->name, strerror(errno));
+		return false;
+	}
+	ctx->lock_pid = pid;
+	return true;
+}
+
+/*
+ * Until a child holds its own read lock, the parent exiting would
+ * let the next opener wipe the table under the child's feet. So the
+ * child takes it right after fork(), before anything else runs.
+ */
+static void db_shm_atfork_child(void)
+{
+	pid_t pid = getpid();
+	struct db_shm_ctx *ctx = NULL;
+
+	for (ctx = db_shm_open_list; ctx != NULL; ctx = ctx->next) {
+		db_shm_take_read_lock(ctx, pid);
+	}
+}
+
+static pthread_once_t db_shm_atfork_initialized = PTHREAD_ONCE_INIT;
+
+static void db_shm_prep_atfork(void)
+{
+	int ret;
+
+	ret = pthread_atfork(NULL, NULL, db_shm_atfork_child);
+	if (ret != 0) {
+		DBG_ERR("pthread_atfork failed: %s\n", strerror(ret));
+	}
+}
+
+/*
+ * Normally done by db_shm_atfork_child(), this catches children
+ * created without running the fork handlers.
+ */
+static bool db_shm_keep_active(struct db_shm_ctx *ctx)
+{
+	pid_t pid = tevent_cached_getpid();
+
+	if (ctx->lock_pid == pid) {
+		return true;
+	}
+
+	return db_shm_take_read_lock(ctx, pid);
+}
+
+/*
+ * Bracket changes to the arena of a locked bucket. The atomic stores
+ * keep the compiler from moving the changes out of the bracket.
+ */
+static void db_shm_begin_update(struct db_shm_bucket *b)
+{
+	__atomic_store_n(&b->dirty, 1, __ATOMIC_SEQ_CST);
+}
+
+static void db_shm_end_update(struct db_shm_bucket *b)
+{
+	__atomic_store_n(&b->dirty, 0, __ATOMIC_SEQ_CST);
+}
+
+static struct db_shm_held *db_shm_find_held(struct db_shm_ctx *ctx,
+					    uint32_t idx)
+{
+	size_t i;
+
+	for (i = 0; i < ctx->num_held; i++) {
+		if (ctx->held[i].bucket == idx) {
+			return &ctx->held[i];
+		}
+	}
+	return NULL;
+}
+
+static int db_shm_lock(struct db_shm_ctx *ctx, uint32_t idx)
+{
+	struct db_shm_held *held = NULL;
+	struct db_shm_bucket *b = NULL;
+	int ret;
+
+	held = db_shm_find_held(ctx, idx);
+	if (held != NULL) {
+		held->count += 1;
+		return 0;
+	}
+
+	if (!db_shm_keep_active(ctx)) {
+		return EIO;
+	}
+
+	held = talloc_realloc(ctx,
+			      ctx->held,
+			      struct db_shm_held,
+			      ctx->num_held + 1);
+	if (held == NULL) {
+		return ENOMEM;
+	}
+	ctx->held = held;
+
+	b = db_shm_bucket(ctx, idx);
+
+	ret = pthread_mutex_lock(&b->mutex);
+	if (ret == EOWNERDEAD) {
+		/*
+		 * The previous owner died while holding the mutex. If
+		 * it was in the middle of a store or delete, the arena
+		 * can't be trusted anymore, even if the lengths still
+		 * add up. Everything in the bucket belonged to
+		 * processes that are gone or will have to cope with a
+		 * lost record anyway.
+		 */
+		if (b->dirty) {
+			DBG_ERR("Wiping bucket %"PRIu32" left dirty by a "
+				"dead process\n",
+				idx);
+			b->used = 0;
+			b->num_records = 0;
+			db_shm_end_update(b);
+		}
+		ret = pthread_mutex_consistent(&b->mutex);
+	}
+	if (ret != 0) {
+		DBG_ERR("pthread_mutex_lock failed: %s\n", strerror(ret));
+		return ret;
+	}
+
+	ctx->held[ctx->num_held] = (struct db_shm_held) {
+		.bucket = idx, .count = 1,
+	};
+	ctx->num_held += 1;
+
+	return 0;
+}
+
+static void db_shm_unlock(struct db_shm_ctx *ctx, uint32_t idx)
+{
+	struct db_shm_held *held = db_shm_find_held(ctx, idx);
+	struct db_shm_bucket *b = NULL;
+	int ret;
+
+	if (held == NULL) {
+		DBG_ERR("Bucket %"PRIu32" not locked\n", idx);
+		return;
+	}
+
+	held->count -= 1;
+	if (held->count > 0) {
+		return;
+	}
+
+	*held = ctx->held[ctx->num_held - 1];
+	ctx->num_held -= 1;
+
+	b = db_shm_bucket(ctx, idx);
+
+	ret = pthread_mutex_unlock(&b->mutex);
+	if (ret != 0) {
+		DBG_ERR("pthread_mutex_unlock failed: %s\n", strerror(ret));
+	}
+}
+
+/*
+ * Look up key in a locked bucket. Returns the offset of the record
+ * in the arena or -1.
+ */
+static int64_t db_shm_find(struct db_shm_ctx *ctx,
+			   uint32_t idx,
+			   TDB_DATA key,
+			   TDB_DATA *value)
+{
+	struct db_shm_bucket *b = db_shm_bucket(ctx, idx);
+	uint8_t *arena = db_shm_arena(ctx, idx);
+	uint32_t ofs = 0;
+
+	while (ofs < b->used) {
+		struct db_shm_rec *r = (struct db_shm_rec *)(arena + ofs);
+		uint8_t *p = arena + ofs + sizeof(struct db_shm_rec);
+
+		if ((r->keylen == key.dsize) &&
+		    (memcmp(p, key.dptr, key.dsize) == 0))
+		{
+			if (value != NULL) {
+				*value = (TDB_DATA) {
+					.dptr = p + r->keylen,
+					.dsize = r->datalen,
+				};
+			}
+			return ofs;
+		}
+		ofs += DB_SHM_REC_SIZE(r->keylen, r->datalen);
+	}
+
+	return -1;
+}
+
+static void db_shm_remove(struct db_shm_ctx *ctx,
+			  uint32_t idx,
+			  uint32_t ofs)
+{
+	struct db_shm_bucket *b = db_shm_bucket(ctx, idx);
+	uint8_t *arena = db_shm_arena(ctx, idx);
+	struct db_shm_rec *r = (struct db_shm_rec *)(arena + ofs);
+	uint32_t len = DB_SHM_REC_SIZE(r->keylen, r->datalen);
+
+	memmove(arena + ofs, arena + ofs + len, b->used - ofs - len);
+	b->used -= len;
+	b->num_records -= 1;
+}
+
+static void db_shm_increment_seqnum(struct db_shm_ctx *ctx)
+{
+	if (ctx->seqnum) {
+		__atomic_add_fetch(&ctx->hdr->seqnum, 1, __ATOMIC_SEQ_CST);
+	}
+}
+
+static bool db_shm_in_map(struct db_shm_ctx *ctx, const uint8_t *p)
+{
+	return ((p >= ctx->map) && (p < ctx->map + ctx->map_size));
+}
+
+static bool db_shm_has_overflow(struct db_shm_ctx *ctx, uint32_t idx)
+{
+	return ((ctx->overflow != NULL) &&
+		(db_shm_bucket(ctx, idx)->num_overflow != 0));
+}
+
+/*
+ * Look up key in the overflow tdb of a locked bucket. Returns a
+ * malloc'ed copy of the value.
+ */
+static bool db_shm_overflow_fetch(struct db_shm_ctx *ctx,
+				  uint32_t idx,
+				  TDB_DATA key,
+				  TDB_DATA *value)
+{
+	if (!db_shm_has_overflow(ctx, idx)) {
+		return false;
+	}
+	*value = tdb_fetch(ctx->overflow, key);
+	return (value->dptr != NULL);
+}
+
+static bool db_shm_overflow_exists(struct db_shm_ctx *ctx,
+				   uint32_t idx,
+				   TDB_DATA key)
+{
+	if (!db_shm_has_overflow(ctx, idx)) {
+		return false;
+	}
+	return tdb_exists(ctx->overflow, key);
+}
+
+static NTSTATUS db_shm_overflow_storev(struct db_shm_ctx *ctx,
+				       uint32_t idx,
+				       TDB_DATA key,
+				       const TDB_DATA *dbufs,
+				       int num_dbufs,
+				       bool exists)
+{
+	struct db_shm_bucket *b = db_shm_bucket(ctx, idx);
+	NTSTATUS status;
+	int ret;
+
+	if (ctx->overflow == NULL) {
+		return NT_STATUS_INSUFFICIENT_RESOURCES;
+	}
+
+	if (!exists) {
+		b->num_overflow += 1;
+	}
+
+	ret = tdb_storev(ctx->overflow, key, dbufs, num_dbufs, TDB_REPLACE);
+	if (ret != 0) {
+		status = map_nt_error_from_tdb(tdb_error(ctx->overflow));
+		DBG_ERR("tdb_storev to %s.overflow failed: %s\n",
+			ctx->name,
+			nt_errstr(status));
+		if (!exists) {
+			b->num_overflow -= 1;
+		}
+		return status;
+	}
+
+	return NT_STATUS_OK;
+}
+
+static void db_shm_overflow_delete(struct db_shm_ctx *ctx,
+				   uint32_t idx,
+				   TDB_DATA key)
+{
+	struct db_shm_bucket *b = db_shm_bucket(ctx, idx);
+	int ret;
+
+	ret = tdb_delete(ctx->overflow, key);
+	if ((ret == 0) && (b->num_overflow > 0)) {
+		b->num_overflow -= 1;
+	}
+}
+
+static NTSTATUS db_shm_storev_locked(struct db_shm_ctx *ctx,
+				     uint32_t idx,
+				     TDB_DATA key,
+				     const TDB_DATA *dbufs,
+				     int num_dbufs,
+				     int flag)
+{
+	struct db_shm_bucket *b = db_shm_bucket(ctx, idx);
+	uint8_t *arena = db_shm_arena(ctx, idx);
+	TDB_DATA merged = { .dsize = 0 };
+	bool need_merge = false;
+	struct db_shm_rec *r = NULL;
+	uint8_t *p = NULL;
+	uint64_t datalen = 0;
+	uint64_t newlen, oldlen = 0;
+	bool in_overflow;
+	int64_t ofs;
+	int i;
+
+	for (i = 0; i < num_dbufs; i++) {
+		datalen += dbufs[i].dsize;
+		if (db_shm_in_map(ctx, dbufs[i].dptr)) {
+			/*
+			 * Somebody stores data from a
+			 * dbwrap_parse_record() callback, which we
+			 * might move around below.
+			 */
+			need_merge = true;
+		}
+	}
+	if ((key.dsize > UINT32_MAX) || (datalen > UINT32_MAX)) {
+		return NT_STATUS_INVALID_PARAMETER;
+	}
+
+	if (need_merge) {
+		NTSTATUS status = dbwrap_merge_dbufs(
+			&merged, talloc_tos(), dbufs, num_dbufs);
+		if (!NT_STATUS_IS_OK(status)) {
+			return status;
+		}
+		dbufs = &merged;
+		num_dbufs = 1;
+	}
+
+	ofs = db_shm_find(ctx, idx, key, NULL);
+	in_overflow = (ofs == -1) && db_shm_overflow_exists(ctx, idx, key);
+
+	if (((ofs != -1) || in_overflow) && (flag == TDB_INSERT)) {
+		TALLOC_FREE(merged.dptr);
+		return NT_STATUS_OBJECT_NAME_COLLISION;
+	}
+	if ((ofs == -1) && !in_overflow && (flag == TDB_MODIFY)) {
+		TALLOC_FREE(merged.dptr);
+		return NT_STATUS_NOT_FOUND;
+	}
+
+	if (ofs != -1) {
+		r = (struct db_shm_rec *)(arena + ofs);
+		oldlen = DB_SHM_REC_SIZE(r->keylen, r->datalen);
+	}
+	newlen = DB_SHM_REC_SIZE(key.dsize, datalen);
+
+	if (b->used - oldlen + newlen > ctx->bucket_size) {
+		NTSTATUS status;
+
+		DBG_NOTICE("No space for %"PRIu64" bytes in bucket %"PRIu32", "
+			   "%"PRIu32" of %"PRIu32" bytes used\n",
+			   newlen,
+			   idx,
+			   b->used,
+			   ctx->bucket_size);
+
+		status = db_shm_overflow_storev(
+			ctx, idx, key, dbufs, num_dbufs, in_overflow);
+		TALLOC_FREE(merged.dptr);
+		if (!NT_STATUS_IS_OK(status)) {
+			return status;
+		}
+		if (ofs != -1) {
+			db_shm_begin_update(b);
+			db_shm_remove(ctx, idx, ofs);
+			db_shm_end_update(b);
+		}
+		db_shm_increment_seqnum(ctx);
+		return NT_STATUS_OK;
+	}
+
+	db_shm_begin_update(b);
+
+	if (ofs != -1) {
+		db_shm_remove(ctx, idx, ofs);
+	}
+	if (in_overflow) {
+		db_shm_overflow_delete(ctx, idx, key);
+	}
+
+	r = (struct db_shm_rec *)(arena + b->used);
+	*r = (struct db_shm_rec) {
+		.keylen = key.dsize, .datalen = datalen,
+	};
+
+	p = arena + b->used + sizeof(struct db_shm_rec);
+	memcpy(p, key.dptr, key.dsize);
+	p += key.dsize;
+
+	for (i = 0; i < num_dbufs; i++) {
+		if (dbufs[i].dsize == 0) {
+			continue;
+		}
+		memcpy(p, dbufs[i].dptr, dbufs[i].dsize);
+		p += dbufs[i].dsize;
+	}
+	memset(p, 0, arena + b->used + newlen - p);
+
+	b->used += newlen;
+	b->num_records += 1;
+
+	db_shm_end_update(b);
+
+	TALLOC_FREE(merged.dptr);
+
+	db_shm_increment_seqnum(ctx);
+
+	return NT_STATUS_OK;
+}
+
+static NTSTATUS db_shm_storev(struct db_record *rec,
+			      const TDB_DATA *dbufs, int num_dbufs, int flag)
+{
+	struct db_shm_ctx *ctx = talloc_get_type_abort(
+		rec->private_data, struct db_shm_ctx);
+	uint32_t idx = db_shm_bucket_idx(ctx, rec->key);
+	NTSTATUS status;
+	int ret;
+
+	if (ctx->readonly) {
+		return NT_STATUS_MEDIA_WRITE_PROTECTED;
+	}
+
+	ret = db_shm_lock(ctx, idx);
+	if (ret != 0) {
+		return map_nt_error_from_unix_common(ret);
+	}
+	status = db_shm_storev_locked(
+		ctx, idx, rec->key, dbufs, num_dbufs, flag);
+	db_shm_unlock(ctx, idx);
+
+	return status;
+}
+
+static NTSTATUS db_shm_delete(struct db_record *rec)
+{
+	struct db_shm_ctx *ctx = talloc_get_type_abort(
+		rec->private_data, struct db_shm_ctx);
+	uint32_t idx = db_shm_bucket_idx(ctx, rec->key);
+	NTSTATUS status = NT_STATUS_NOT_FOUND;
+	int64_t ofs;
+	int ret;
+
+	if (ctx->readonly) {
+		return NT_STATUS_MEDIA_WRITE_PROTECTED;
+	}
+
+	ret = db_shm_lock(ctx, idx);
+	if (ret != 0) {
+		return map_nt_error_from_unix_common(ret);
+	}
+
+	ofs = db_shm_find(ctx, idx, rec->key, NULL);
+	if (ofs != -1) {
+		struct db_shm_bucket *b = db_shm_bucket(ctx, idx);
+
+		db_shm_begin_update(b);
+		db_shm_remove(ctx, idx, ofs);
+		db_shm_end_update(b);
+		db_shm_increment_seqnum(ctx);
+		status = NT_STATUS_OK;
+	} else if (db_shm_overflow_exists(ctx, idx, rec->key)) {
+		db_shm_overflow_delete(ctx, idx, rec->key);
+		db_shm_increment_seqnum(ctx);
+		status = NT_STATUS_OK;
+	}
+
+	db_shm_unlock(ctx, idx);
+
+	return status;
+}
+
+static int db_shm_record_destr(struct db_record *rec)
+{
+	struct db_shm_ctx *ctx = talloc_get_type_abort(
+		rec->private_data, struct db_shm_ctx);
+
+	db_shm_unlock(ctx, db_shm_bucket_idx(ctx, rec->key));
+	return 0;
+}
+
+static struct db_record *db_shm_fetch_locked(
+	struct db_context *db, TALLOC_CTX *mem_ctx, TDB_DATA key)
+{
+	struct db_shm_ctx *ctx = talloc_get_type_abort(
+		db->private_data, struct db_shm_ctx);
+	uint32_t idx = db_shm_bucket_idx(ctx, key);
+	struct db_record *result = NULL;
+	TDB_DATA value = { .dsize = 0 };
+	uint8_t *overflow = NULL;
+	int64_t ofs;
+	int ret;
+
+	ret = db_shm_lock(ctx, idx);
+	if (ret != 0) {
+		errno = ret;
+		return NULL;
+	}
+
+	ofs = db_shm_find(ctx, idx, key, &value);
+	if ((ofs == -1) && db_shm_overflow_fetch(ctx, idx, key, &value)) {
+		overflow = value.dptr;
+	}
+
+	result = talloc_size(
+		mem_ctx, sizeof(struct db_record) + key.dsize + value.dsize);
+	if (result == NULL) {
+		SAFE_FREE(overflow);
+		db_shm_unlock(ctx, idx);
+		return NULL;
+	}
+	talloc_set_name_const(result, "struct db_record");
+
+	*result = (struct db_record) {
+		.db = db,
+		.key = {
+			.dptr = (uint8_t *)(result + 1),
+			.dsize = key.dsize,
+		},
+		.value = {
+			.dptr = NULL,
+			.dsize = value.dsize,
+		},
+		.value_valid = true,
+		.storev = db_shm_storev,
+		.delete_rec = db_shm_delete,
+		.private_data = ctx,
+	};
+	memcpy(result->key.dptr, key.dptr, key.dsize);
+	if (value.dsize != 0) {
+		result->value.dptr = result->key.dptr + key.dsize;
+		memcpy(result->value.dptr, value.dptr, value.dsize);
+	}
+	SAFE_FREE(overflow);
+
+	talloc_set_destructor(result, db_shm_record_destr);
+
+	return result;
+}
+
+static NTSTATUS db_shm_do_locked(struct db_context *db, TDB_DATA key,
+				 void (*fn)(struct db_record *rec,
+					    TDB_DATA value,
+					    void *private_data),
+				 void *private_data)
+{
+	struct db_shm_ctx *ctx = talloc_get_type_abort(
+		db->private_data, struct db_shm_ctx);
+	uint32_t idx = db_shm_bucket_idx(ctx, key);
+	TDB_DATA value = { .dsize = 0 };
+	uint8_t *overflow = NULL;
+	uint8_t *buf = NULL;
+	struct db_record rec;
+	int64_t ofs;
+	int ret;
+
+	ret = db_shm_lock(ctx, idx);
+	if (ret != 0) {
+		return map_nt_error_from_unix_common(ret);
+	}
+
+	/*
+	 * Hand out a copy, fn may store the record and thus move
+	 * the arena around.
+	 */
+	ofs = db_shm_find(ctx, idx, key, &value);
+	if ((ofs == -1) && db_shm_overflow_fetch(ctx, idx, key, &value)) {
+		overflow = value.dptr;
+	}
+	if (value.dsize != 0) {
+		buf = talloc_memdup(ctx, value.dptr, value.dsize);
+		SAFE_FREE(overflow);
+		if (buf == NULL) {
+			db_shm_unlock(ctx, idx);
+			return NT_STATUS_NO_MEMORY;
+		}
+	}
+	SAFE_FREE(overflow);
+
+	rec = (struct db_record) {
+		.db = db, .key = key,
+		.value_valid = false,
+		.storev = db_shm_storev, .delete_rec = db_shm_delete,
+		.private_data = ctx
+	};
+
+	fn(&rec,
+	   (TDB_DATA) { .dptr = buf, .dsize = value.dsize },
+	   private_data);
+
+	db_shm_unlock(ctx, idx);
+
+	TALLOC_FREE(buf);
+
+	return NT_STATUS_OK;
+}
+
+static NTSTATUS db_shm_parse(struct db_context *db, TDB_DATA key,
+			     void (*parser)(TDB_DATA key, TDB_DATA data,
+					    void *private_data),
+			     void *private_data)
+{
+	struct db_shm_ctx *ctx = talloc_get_type_abort(
+		db->private_data, struct db_shm_ctx);
+	uint32_t idx = db_shm_bucket_idx(ctx, key);
+	TDB_DATA value;
+	int64_t ofs;
+	int ret;
+
+	ret = db_shm_lock(ctx, idx);
+	if (ret != 0) {
+		return map_nt_error_from_unix_common(ret);
+	}
+
+	ofs = db_shm_find(ctx, idx, key, &value);
+	if ((ofs == -1) && db_shm_overflow_fetch(ctx, idx, key, &value)) {
+		parser(key, value, private_data);
+		SAFE_FREE(value.dptr);
+		db_shm_unlock(ctx, idx);
+		return NT_STATUS_OK;
+	}
+	if (ofs == -1) {
+		db_shm_unlock(ctx, idx);
+		return NT_STATUS_NOT_FOUND;
+	}
+
+	parser(key, value, private_data);
+
+	db_shm_unlock(ctx, idx);
+
+	return NT_STATUS_OK;
+}
+
+static int db_shm_exists(struct db_context *db, TDB_DATA key)
+{
+	struct db_shm_ctx *ctx = talloc_get_type_abort(
+		db->private_data, struct db_shm_ctx);
+	uint32_t idx = db_shm_bucket_idx(ctx, key);
+	int64_t ofs;
+	int ret;
+
+	ret = db_shm_lock(ctx, idx);
+	if (ret != 0) {
+		return 0;
+	}
+	ofs = db_shm_find(ctx, idx, key, NULL);
+	if (ofs == -1) {
+		ofs = db_shm_overflow_exists(ctx, idx, key) ? 0 : -1;
+	}
+	db_shm_unlock(ctx, idx);
+
+	return (ofs != -1);
+}
+
+static int db_shm_wipe(struct db_context *db)
+{
+	struct db_shm_ctx *ctx = talloc_get_type_abort(
+		db->private_data, struct db_shm_ctx);
+	uint32_t idx;
+	int ret;
+
+	if (ctx->readonly) {
+		return -1;
+	}
+
+	for (idx = 0; idx < ctx->num_buckets; idx++) {
+		struct db_shm_bucket *b = db_shm_bucket(ctx, idx);
+
+		ret = db_shm_lock(ctx, idx);
+		if (ret != 0) {
+			return -1;
+		}
+		db_shm_begin_update(b);
+		b->used = 0;
+		b->num_records = 0;
+		db_shm_end_update(b);
+		db_shm_unlock(ctx, idx);
+	}
+
+	if (ctx->overflow != NULL) {
+		/*
+		 * Leave num_overflow alone, a store into the tdb
+		 * racing with us would otherwise not be found.
+		 */
+		ret = tdb_wipe_all(ctx->overflow);
+		if (ret != 0) {
+			return -1;
+		}
+	}
+
+	db_shm_increment_seqnum(ctx);
+
+	return 0;
+}
+
+static int db_shm_check(struct db_context *db)
+{
+	struct db_shm_ctx *ctx = talloc_get_type_abort(
+		db->private_data, struct db_shm_ctx);
+	uint32_t idx;
+	bool ok = true;
+	int ret;
+
+	for (idx = 0; idx < ctx->num_buckets; idx++) {
+		ret = db_shm_lock(ctx, idx);
+		if (ret != 0) {
+			return -1;
+		}
+		ok = db_shm_bucket_valid(ctx, idx);
+		db_shm_unlock(ctx, idx);
+
+		if (!ok) {
+			DBG_WARNING("Bucket %"PRIu32" is corrupt\n", idx);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+struct db_shm_overflow_snap {
+	struct db_shm_overflow_rec {
+		TDB_DATA key;
+		TDB_DATA value;
+	} *recs;
+	size_t num_recs;
+};
+
+static int db_shm_overflow_snap_fn(struct tdb_context *tdb,
+				   TDB_DATA key,
+				   TDB_DATA value,
+				   void *private_data)
+{
+	struct db_shm_overflow_snap *snap = private_data;
+	struct db_shm_overflow_rec *recs = NULL;
+	struct db_shm_overflow_rec *r = NULL;
+	size_t num_recs = snap->num_recs;
+
+	recs = talloc_realloc(talloc_tos(),
+			      snap->recs,
+			      struct db_shm_overflow_rec,
+			      num_recs + 1);
+	if (recs == NULL) {
+		return -1;
+	}
+	snap->recs = recs;
+
+	r = &recs[num_recs];
+	r->key.dptr = talloc_memdup(recs, key.dptr, key.dsize);
+	r->key.dsize = key.dsize;
+	r->value.dptr = talloc_memdup(recs, value.dptr, value.dsize);
+	r->value.dsize = value.dsize;
+	if ((r->key.dptr == NULL) ||
+	    ((value.dsize != 0) && (r->value.dptr == NULL))) {
+		return -1;
+	}
+	snap->num_recs = num_recs + 1;
+
+	return 0;
+}
+
+/*
+ * Traverse a snapshot of each bucket, so that the callback can do
+ * whatever it wants with the database, including locking records in
+ * other buckets.
+ */
+static int db_shm_traverse_internal(
+	struct db_context *db,
+	int (*f)(struct db_record *rec, void *private_data),
+	void *private_data,
+	NTSTATUS (*storev)(struct db_record *rec,
+			   const TDB_DATA *dbufs, int num_dbufs, int flag),
+	NTSTATUS (*delete_rec)(struct db_record *rec))
+{
+	struct db_shm_ctx *ctx = talloc_get_type_abort(
+		db->private_data, struct db_shm_ctx);
+	int count = 0;
+	uint32_t idx;
+	int ret;
+
+	for (idx = 0; idx < ctx->num_buckets; idx++) {
+		struct db_shm_bucket *b = db_shm_bucket(ctx, idx);
+		uint8_t *snap = NULL;
+		uint32_t used;
+		uint32_t ofs = 0;
+
+		ret = db_shm_lock(ctx, idx);
+		if (ret != 0) {
+			return -1;
+		}
+		used = b->used;
+		if (used != 0) {
+			snap = talloc_memdup(
+				talloc_tos(), db_shm_arena(ctx, idx), used);
+		}
+		db_shm_unlock(ctx, idx);
+
+		if (used == 0) {
+			continue;
+		}
+		if (snap == NULL) {
+			return -1;
+		}
+
+		while (ofs < used) {
+			struct db_shm_rec *r = (struct db_shm_rec *)(snap + ofs);
+			uint8_t *p = snap + ofs + sizeof(struct db_shm_rec);
+			struct db_record rec = {
+				.db = db,
+				.key = {
+					.dptr = p,
+					.dsize = r->keylen,
+				},
+				.value = {
+					.dptr = p + r->keylen,
+					.dsize = r->datalen,
+				},
+				.value_valid = true,
+				.storev = storev,
+				.delete_rec = delete_rec,
+				.private_data = ctx,
+			};
+
+			ofs += DB_SHM_REC_SIZE(r->keylen, r->datalen);
+			count += 1;
+
+			ret = f(&rec, private_data);
+			if (ret != 0) {
+				TALLOC_FREE(snap);
+				return count;
+			}
+		}
+
+		TALLOC_FREE(snap);
+	}
+
+	if (ctx->overflow != NULL) {
+		struct db_shm_overflow_snap osnap = { .recs = NULL };
+		size_t i;
+
+		ret = tdb_traverse_read(
+			ctx->overflow, db_shm_overflow_snap_fn, &osnap);
+		if (ret == -1) {
+			TALLOC_FREE(osnap.recs);
+			return -1;
+		}
+
+		for (i = 0; i < osnap.num_recs; i++) {
+			struct db_record rec = {
+				.db = db,
+				.key = osnap.recs[i].key,
+				.value = osnap.recs[i].value,
+				.value_valid = true,
+				.storev = storev,
+				.delete_rec = delete_rec,
+				.private_data = ctx,
+			};
+
+			count += 1;
+
+			ret = f(&rec, private_data);
+			if (ret != 0) {
+				break;
+			}
+		}
+
+		TALLOC_FREE(osnap.recs);
+	}
+
+	return count;
+}
+
+static int db_shm_traverse(struct db_context *db,
+			   int (*f)(struct db_record *rec, void *private_data),
+			   void *private_data)
+{
+	return db_shm_traverse_internal(
+		db, f, private_data, db_shm_storev, db_shm_delete);
+}
+
+static NTSTATUS db_shm_storev_deny(struct db_record *rec,
+				   const TDB_DATA *dbufs, int num_dbufs,
+				   int flag)
+{
+	return NT_STATUS_MEDIA_WRITE_PROTECTED;
+}
+
+static NTSTATUS db_shm_delete_deny(struct db_record *rec)
+{
+	return NT_STATUS_MEDIA_WRITE_PROTECTED;
+}
+
+static int db_shm_traverse_read(struct db_context *db,
+				int (*f)(struct db_record *rec,
+					 void *private_data),
+				void *private_data)
+{
+	return db_shm_traverse_internal(
+		db, f, private_data, db_shm_storev_deny, db_shm_delete_deny);
+}
+
+static int db_shm_get_seqnum(struct db_context *db)
+{
+	struct db_shm_ctx *ctx = talloc_get_type_abort(
+		db->private_data, struct db_shm_ctx);
+	uint32_t seqnum;
+
+	__atomic_load(&ctx->hdr->seqnum, &seqnum, __ATOMIC_SEQ_CST);
+	return seqnum;
+}
+
+static int db_shm_transaction_start(struct db_context *db)
+{
+	return 0;
+}
+
+static NTSTATUS db_shm_transaction_start_nonblock(struct db_context *db)
+{
+	return NT_STATUS_OK;
+}
+
+static int db_shm_transaction_commit(struct db_context *db)
+{
+	return 0;
+}
+
+static int db_shm_transaction_cancel(struct db_context *db)
+{
+	return 0;
+}
+
+static size_t db_shm_id(struct db_context *db, uint8_t *id, size_t idlen)
+{
+	struct db_shm_ctx *ctx = talloc_get_type_abort(
+		db->private_data, struct db_shm_ctx);
+
+	if (idlen >= sizeof(ctx->id)) {
+		memcpy(id, &ctx->id, sizeof(ctx->id));
+	}
+
+	return sizeof(ctx->id);
+}
+
+static int db_shm_ctx_destructor(struct db_shm_ctx *ctx)
+{
+	DLIST_REMOVE(db_shm_open_list, ctx);
+	if (ctx->overflow != NULL) {
+		tdb_close(ctx->overflow);
+		ctx->overflow = NULL;
+	}
+	if (ctx->map != NULL) {
+		munmap(ctx->map, ctx->map_size);
+		ctx->map = NULL;
+	}
+	if (ctx->fd != -1) {
+		close(ctx->fd);
+		ctx->fd = -1;
+	}
+	return 0;
+}
+
+static bool db_shm_geometry(struct db_shm_ctx *ctx,
+			    uint32_t num_buckets,
+			    uint32_t bucket_size)
+{
+	uint64_t arena_ofs, size;
+
+	if ((num_buckets == 0) || ((num_buckets & (num_buckets - 1)) != 0)) {
+		return false;
+	}
+	if ((bucket_size == 0) || (bucket_size % DB_SHM_CACHELINE) != 0) {
+		return false;
+	}
+
+	arena_ofs = DB_SHM_HEADER_SIZE +
+		(uint64_t)num_buckets * DB_SHM_BUCKET_STRIDE;
+	size = arena_ofs + (uint64_t)num_buckets * bucket_size;
+	if (size > SIZE_MAX) {
+		return false;
+	}
+
+	ctx->num_buckets = num_buckets;
+	ctx->bucket_size = bucket_size;
+	ctx->arena_ofs = arena_ofs;
+	ctx->map_size = size;
+	return true;
+}
+
+static int db_shm_map(struct db_shm_ctx *ctx)
+{
+	void *map;
+
+	map = mmap(NULL,
+		   ctx->map_size,
+		   PROT_READ|PROT_WRITE,
+		   MAP_SHARED,
+		   ctx->fd,
+		   0);
+	if (map == MAP_FAILED) {
+		return errno;
+	}
+	ctx->map = map;
+	ctx->hdr = (struct db_shm_header *)ctx->map;
+	return 0;
+}
+
+static int db_shm_init(struct db_shm_ctx *ctx)
+{
+	pthread_mutexattr_t ma;
+	uint32_t idx;
+	int ret;
+
+	ret = ftruncate(ctx->fd, 0);
+	if (ret == -1) {
+		return errno;
+	}
+	ret = ftruncate(ctx->fd, ctx->map_size);
+	if (ret == -1) {
+		return errno;
+	}
+
+	ret = db_shm_map(ctx);
+	if (ret != 0) {
+		return ret;
+	}
+
+	ret = pthread_mutexattr_init(&ma);
+	if (ret != 0) {
+		return ret;
+	}
+	ret = pthread_mutexattr_settype(&ma, PTHREAD_MUTEX_ERRORCHECK);
+	if (ret != 0) {
+		goto done;
+	}
+	ret = pthread_mutexattr_setpshared(&ma, PTHREAD_PROCESS_SHARED);
+	if (ret != 0) {
+		goto done;
+	}
+	ret = pthread_mutexattr_setrobust(&ma, PTHREAD_MUTEX_ROBUST);
+	if (ret != 0) {
+		goto done;
+	}
+
+	for (idx = 0; idx < ctx->num_buckets; idx++) {
+		struct db_shm_bucket *b = db_shm_bucket(ctx, idx);
+
+		ret = pthread_mutex_init(&b->mutex, &ma);
+		if (ret != 0) {
+			goto done;
+		}
+	}
+
+	*ctx->hdr = (struct db_shm_header) {
+		.version = DB_SHM_VERSION,
+		.num_buckets = ctx->num_buckets,
+		.bucket_size = ctx->bucket_size,
+	};
+
+	/*
+	 * The magic goes last, a crash before this leaves an
+	 * unusable file behind.
+	 */
+	memcpy(ctx->hdr->magic, DB_SHM_MAGIC, sizeof(DB_SHM_MAGIC));
+
+done:
+	pthread_mutexattr_destroy(&ma);
+	return ret;
+}
+
+static int db_shm_attach(struct db_shm_ctx *ctx)
+{
+	struct db_shm_header hdr;
+	struct stat st;
+	ssize_t nread;
+	int ret;
+
+	nread = pread(ctx->fd, &hdr, sizeof(hdr), 0);
+	if (nread == -1) {
+		return errno;
+	}
+	if ((nread != sizeof(hdr)) ||
+	    (memcmp(hdr.magic, DB_SHM_MAGIC, sizeof(DB_SHM_MAGIC)) != 0) ||
+	    (hdr.version != DB_SHM_VERSION) ||
+	    !db_shm_geometry(ctx, hdr.num_buckets, hdr.bucket_size))
+	{
+		return EINVAL;
+	}
+
+	ret = fstat(ctx->fd, &st);
+	if (ret == -1) {
+		return errno;
+	}
+	if ((uint64_t)st.st_size < ctx->map_size) {
+		return EINVAL;
+	}
+
+	return db_shm_map(ctx);
+}
+
+/*
+ * The overflow tdb lives and dies with the table: The first opener
+ * of the table wipes it, so don't use TDB_CLEAR_IF_FIRST here, that
+ * would wipe it behind the back of the bucket counters.
+ */
+static int db_shm_open_overflow(struct db_shm_ctx *ctx,
+				bool first,
+				mode_t mode)
+{
+	char *name = NULL;
+	int ret;
+
+	name = talloc_asprintf(ctx, "%s.overflow", ctx->name);
+	if (name == NULL) {
+		return ENOMEM;
+	}
+
+	ctx->overflow = tdb_open(name,
+				 0,
+				 TDB_NOSYNC|TDB_INCOMPATIBLE_HASH,
+				 ctx->readonly ? O_RDONLY : O_RDWR|O_CREAT,
+				 mode);
+	if (ctx->overflow == NULL) {
+		ret = errno;
+		if (ctx->readonly && (ret == ENOENT)) {
+			/* Nobody ever stored anything big */
+			TALLOC_FREE(name);
+			return 0;
+		}
+		DBG_WARNING("Could not open %s: %s\n", name, strerror(ret));
+		TALLOC_FREE(name);
+		return ret;
+	}
+	TALLOC_FREE(name);
+
+	if (first) {
+		ret = tdb_wipe_all(ctx->overflow);
+		if (ret != 0) {
+			return EIO;
+		}
+	}
+
+	return 0;
+}
+
+struct db_context *db_open_shm(TALLOC_CTX *mem_ctx,
+			       const char *name,
+			       uint32_t num_buckets,
+			       uint32_t bucket_size,
+			       int tdb_flags,
+			       int open_flags, mode_t mode,
+			       enum dbwrap_lock_order lock_order)
+{
+	struct db_context *result = NULL;
+	struct db_shm_ctx *ctx = NULL;
+	struct db_shm_ctx *other = NULL;
+	struct stat st;
+	bool first = false;
+	bool ok;
+	int ret;
+
+	if (!(tdb_flags & TDB_CLEAR_IF_FIRST)) {
+		DBG_WARNING("%s: only volatile databases are supported\n",
+			    name);
+		errno = EINVAL;
+		return NULL;
+	}
+
+	ret = pthread_once(&db_shm_atfork_initialized, db_shm_prep_atfork);
+	if (ret != 0) {
+		errno = ret;
+		return NULL;
+	}
+
+	result = talloc_zero(mem_ctx, struct db_context);
+	if (result == NULL) {
+		goto nomem;
+	}
+
+	result->private_data = ctx = talloc_zero(result, struct db_shm_ctx);
+	if (ctx == NULL) {
+		goto nomem;
+	}
+	ctx->fd = -1;
+	talloc_set_destructor(ctx, db_shm_ctx_destructor);
+
+	ctx->seqnum = ((tdb_flags & TDB_SEQNUM) != 0);
+	ctx->readonly = ((open_flags & O_ACCMODE) == O_RDONLY);
+
+	result->name = ctx->name = talloc_strdup(result, name);
+	if (result->name == NULL) {
+		goto nomem;
+	}
+
+	/*
+	 * Check before we open: closing another fd on the file would
+	 * drop the read lock of the existing open.
+	 */
+	ret = stat(name, &st);
+	if (ret == 0) {
+		for (other = db_shm_open_list;
+		     other != NULL;
+		     other = other->next) {
+			if ((other->id.dev == st.st_dev) &&
+			    (other->id.ino == st.st_ino)) {
+				DBG_WARNING("%s is already open\n", name);
+				ret = EBUSY;
+				goto fail;
+			}
+		}
+	}
+
+	/*
+	 * Even read-only users have to lock the bucket mutexes, so we
+	 * always need a writable mapping.
+	 */
+	ctx->fd = open(name,
+		       O_RDWR|O_CLOEXEC|(ctx->readonly ? 0 : (open_flags & O_CREAT)),
+		       mode);
+	if (ctx->fd == -1) {
+		ret = errno;
+		DBG_WARNING("Could not open %s: %s\n", name, strerror(ret));
+		goto fail;
+	}
+
+	ret = fstat(ctx->fd, &st);
+	if (ret == -1) {
+		ret = errno;
+		goto fail;
+	}
+	ctx->id.dev = st.st_dev;
+	ctx->id.ino = st.st_ino;
+
+	DLIST_ADD(db_shm_open_list, ctx);
+
+	if (!ctx->readonly) {
+		first = fcntl_lock(ctx->fd, F_SETLK, 0, 1, F_WRLCK);
+	}
+
+	if (first) {
+		ok = db_shm_geometry(ctx, num_buckets, bucket_size);
+		if (!ok) {
+			DBG_WARNING("Invalid geometry %"PRIu32"x%"PRIu32"\n",
+				    num_buckets,
+				    bucket_size);
+			ret = EINVAL;
+			goto fail;
+		}
+		ret = db_shm_init(ctx);
+		if (ret != 0) {
+			DBG_WARNING("Could not initialize %s: %s\n",
+				    name,
+				    strerror(ret));
+			goto fail;
+		}
+		ret = db_shm_open_overflow(ctx, true, mode);
+		if (ret != 0) {
+			goto fail;
+		}
+	}
+
+	/*
+	 * Downgrade our write lock or wait for the first opener to
+	 * finish initializing.
+	 */
+	ok = fcntl_lock(ctx->fd, F_SETLKW, 0, 1, F_RDLCK);
+	if (!ok) {
+		ret = errno;
+		DBG_WARNING("Could not lock %s: %s\n", name, strerror(ret));
+		goto fail;
+	}
+	ctx->lock_pid = tevent_cached_getpid();
+
+	if (!first) {
+		ret = db_shm_attach(ctx);
+		if (ret != 0) {
+			DBG_WARNING("Could not attach to %s: %s\n",
+				    name,
+				    strerror(ret));
+			goto fail;
+		}
+		ret = db_shm_open_overflow(ctx, false, mode);
+		if (ret != 0) {
+			goto fail;
+		}
+	}
+
+	result->lock_order = lock_order;
+	result->fetch_locked = db_shm_fetch_locked;
+	result->do_locked = db_shm_do_locked;
+	result->traverse = db_shm_traverse;
+	result->traverse_read = db_shm_traverse_read;
+	result->parse_record = db_shm_parse;
+	result->get_seqnum = db_shm_get_seqnum;
+	result->persistent = false;
+	result->transaction_start = db_shm_transaction_start;
+	result->transaction_start_nonblock =
+		db_shm_transaction_start_nonblock;
+	result->transaction_commit = db_shm_transaction_commit;
+	result->transaction_cancel = db_shm_transaction_cancel;
+	result->exists = db_shm_exists;
+	result->wipe = db_shm_wipe;
+	result->id = db_shm_id;
+	result->check = db_shm_check;
+
+	DBG_DEBUG("Opened %s with %"PRIu32" buckets of %"PRIu32" bytes\n",
+		  name,
+		  ctx->num_buckets,
+		  ctx->bucket_size);
+
+	return result;
+
+nomem:
+	DBG_ERR("talloc failed\n");
+	ret = ENOMEM;
+fail:
+	TALLOC_FREE(result);
+	errno = ret;
+	return NULL;
+}
+
+#else
+
+struct db_context *db_open_shm(TALLOC_CTX *mem_ctx,
+			       const char *name,
+			       uint32_t num_buckets,
+			       uint32_t bucket_size,
+			       int tdb_flags,
+			       int open_flags, mode_t mode,
+			       enum dbwrap_lock_order lock_order)
+{
+	errno = ENOSYS;
+	return NULL;
+}
+
+#endif
@@ -0,0 +1,41 @@
+/*
+   Unix SMB/CIFS implementation.
+   Database interface wrapper around a shared memory hash table
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __DBWRAP_SHM_H__
+#define __DBWRAP_SHM_H__
+
+#include "lib/dbwrap/dbwrap.h"
+
+struct db_context;
+
+/*
+ * Open a volatile (TDB_CLEAR_IF_FIRST) database in the shared memory
+ * file "name". num_buckets and bucket_size are only used by the
+ * process that creates the table, everybody else takes them from the
+ * file. Returns NULL with errno=ENOSYS if the platform does not have
+ * robust process shared mutexes.
+ */
+struct db_context *db_open_shm(TALLOC_CTX *mem_ctx,
+			       const char *name,
+			       uint32_t num_buckets,
+			       uint32_t bucket_size,
+			       int tdb_flags,
+			       int open_flags, mode_t mode,
+			       enum dbwrap_lock_order lock_order);
+
+#endif /* __DBWRAP_SHM_H__ */
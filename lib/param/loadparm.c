@@ -2672,6 +2672,7 @@ struct loadparm_context *loadparm_init(TALLOC_CTX *mem_ctx)
 	lp_ctx->sDefault->force_directory_mode = 0000;
 	lp_ctx->sDefault->aio_read_size = 1;
 	lp_ctx->sDefault->aio_write_size = 1;
+	lp_ctx->sDefault->smb2_fair_queue_weight = 1;
 	lp_ctx->sDefault->smbd_search_ask_sharemode = true;
 	lp_ctx->sDefault->smbd_getinfo_ask_sharemode = true;
 	lp_ctx->sDefault->volume_serial_number = -1;
@@ -3017,6 +3018,12 @@ struct loadparm_context *loadparm_init(TALLOC_CTX *mem_ctx)
 
 	lpcfg_do_global_parameter(lp_ctx, "durable handles", "yes");
 
+	lpcfg_do_global_parameter(lp_ctx, "smb compression", "requested");
+
+	lpcfg_do_global_parameter_var(lp_ctx, "smb compression min size", "%u", DEFAULT_SMB_COMPRESSION_MIN_SIZE);
+
+	lpcfg_do_global_parameter_var(lp_ctx, "smb encryption offload min size", "%u", DEFAULT_SMB_ENCRYPTION_OFFLOAD_MIN_SIZE);
+
 	lpcfg_do_global_parameter(lp_ctx, "max stat cache size", "512");
 
 	lpcfg_do_global_parameter(lp_ctx, "ldap passwd sync", "no");
@@ -238,6 +238,13 @@ enum inheritowner_options {
 /* mangled names options */
 enum mangled_names_options {MANGLED_NAMES_NO, MANGLED_NAMES_YES, MANGLED_NAMES_ILLEGAL};
 
+/* smb compression options */
+enum smb_compression_options {
+	SMB_COMPRESSION_NO,
+	SMB_COMPRESSION_REQUESTED,
+	SMB_COMPRESSION_YES,
+};
+
 /* Spotlight backend options */
 enum spotlight_backend_options {
 	SPOTLIGHT_BACKEND_NOINDEX,
@@ -287,6 +294,8 @@ enum acl_claims_evaluation {
 #define DEFAULT_SMB2_MAX_WRITE (8*1024*1024)
 #define DEFAULT_SMB2_MAX_TRANSACT (8*1024*1024)
 #define DEFAULT_SMB2_MAX_CREDITS 8192
+#define DEFAULT_SMB_COMPRESSION_MIN_SIZE 4096
+#define DEFAULT_SMB_ENCRYPTION_OFFLOAD_MIN_SIZE (64*1024)
 
 #define DEFAULT_SMB3_SIGNING_ALGORITHMS "AES-128-GMAC AES-128-CMAC HMAC-SHA256"
 #define DEFAULT_SMB3_ENCRYPTION_ALGORITHMS "AES-128-GCM AES-128-CCM AES-256-GCM AES-256-CCM"
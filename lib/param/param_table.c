@@ -395,6 +395,19 @@ static const struct enum_list enum_mangled_names[] = {
 	{-1, NULL}
 };
 
+static const struct enum_list enum_smb_compression_vals[] = {
+	{SMB_COMPRESSION_NO, "no"},
+	{SMB_COMPRESSION_NO, "false"},
+	{SMB_COMPRESSION_NO, "0"},
+	{SMB_COMPRESSION_NO, "off"},
+	{SMB_COMPRESSION_REQUESTED, "requested"},
+	{SMB_COMPRESSION_YES, "yes"},
+	{SMB_COMPRESSION_YES, "true"},
+	{SMB_COMPRESSION_YES, "1"},
+	{SMB_COMPRESSION_YES, "on"},
+	{-1, NULL}
+};
+
 static const struct enum_list enum_ntlm_auth[] = {
 	{NTLM_AUTH_DISABLED, "disabled"},
 	{NTLM_AUTH_NTLMV2_ONLY, "ntlmv2-only"},
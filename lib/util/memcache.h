@@ -47,6 +47,10 @@ enum memcache_number {
 	SHARE_MODE_LOCK_CACHE,	/* talloc */
 	VIRUSFILTER_SCAN_RESULTS_CACHE_TALLOC, /* talloc */
 	DFREE_CACHE,
+	SMBD_OPEN_CACHE_SD,
+	SMBD_OPEN_CACHE_DOSMODE,
+	FRUIT_META_CACHE,
+	VFS_XATTR_CACHE,
 };
 
 /*
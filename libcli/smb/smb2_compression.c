@@ -0,0 +1,712 @@
+/*
+   Unix SMB/CIFS implementation.
+   SMB2 transport compression
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "replace.h"
+#include "system/filesys.h"
+#include <talloc.h>
+#include "lib/util/data_blob.h"
+#include "lib/util/iov_buf.h"
+#include "lib/util/samba_util.h"
+#include "lib/util/debug.h"
+#include "libcli/smb/smb2_constants.h"
+#include "libcli/smb/smb2_compression.h"
+#include "lib/compression/lzxpress.h"
+#include "lib/compression/lzxpress_huffman.h"
+
+/*
+ * Runs of a single byte shorter than this are
+ * not worth a SMB2_COMPRESSION_PATTERN_V1 payload.
+ */
+#define SMB2_COMPRESSION_PATTERN_MIN 32
+
+/*
+ * Parameters for smb2_compression_is_compressible(),
+ * we look at SAMPLE_COUNT chunks of SAMPLE_SIZE bytes.
+ */
+#define SMB2_COMPRESSION_SAMPLE_SIZE 16
+#define SMB2_COMPRESSION_SAMPLE_COUNT 512
+#define SMB2_COMPRESSION_ENTROPY_MAX_PCT 90
+
+const char *smb2_compression_algorithm_name(uint16_t algo)
+{
+	switch (algo) {
+	case SMB2_COMPRESSION_NONE:
+		return "NONE";
+	case SMB2_COMPRESSION_LZNT1:
+		return "LZNT1";
+	case SMB2_COMPRESSION_LZ77:
+		return "LZ77";
+	case SMB2_COMPRESSION_LZ77_HUFFMAN:
+		return "LZ77+Huffman";
+	case SMB2_COMPRESSION_PATTERN_V1:
+		return "Pattern_V1";
+	case SMB2_COMPRESSION_LZ4:
+		return "LZ4";
+	}
+
+	return "Unknown";
+}
+
+bool smb2_compression_algorithm_supported(uint16_t algo)
+{
+	switch (algo) {
+	case SMB2_COMPRESSION_LZ77:
+	case SMB2_COMPRESSION_LZ77_HUFFMAN:
+	case SMB2_COMPRESSION_PATTERN_V1:
+		return true;
+	}
+
+	return false;
+}
+
+uint16_t smb2_compression_capabilities_select(
+		const struct smb2_compression_capabilities *c)
+{
+	uint16_t i;
+
+	for (i = 0; i < c->num_algos; i++) {
+		switch (c->algos[i]) {
+		case SMB2_COMPRESSION_LZ77:
+		case SMB2_COMPRESSION_LZ77_HUFFMAN:
+			return c->algos[i];
+		}
+	}
+
+	return SMB2_COMPRESSION_NONE;
+}
+
+static bool smb2_compression_capabilities_have(
+		const struct smb2_compression_capabilities *c,
+		uint16_t algo)
+{
+	uint16_t i;
+
+	for (i = 0; i < c->num_algos; i++) {
+		if (c->algos[i] == algo) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static unsigned int smb2_compression_ilog2_w(uint64_t v)
+{
+	unsigned int ret = 0;
+
+	/*
+	 * log2(v^4), we need the 4th power to get
+	 * some precision out of integer logarithms.
+	 */
+	v = v * v;
+	v = v * v;
+
+	while (v > 1) {
+		v >>= 1;
+		ret++;
+	}
+
+	return ret;
+}
+
+bool smb2_compression_is_compressible(const uint8_t *buf, size_t len)
+{
+	uint32_t counts[256] = { 0, };
+	size_t sample_len = 0;
+	size_t step;
+	size_t ofs;
+	uint64_t entropy_sum = 0;
+	unsigned int p_base;
+	size_t i;
+
+	if (len <= SMB2_COMPRESSION_SAMPLE_SIZE * SMB2_COMPRESSION_SAMPLE_COUNT) {
+		step = SMB2_COMPRESSION_SAMPLE_SIZE;
+	} else {
+		step = len / SMB2_COMPRESSION_SAMPLE_COUNT;
+	}
+
+	for (ofs = 0; ofs < len; ofs += step) {
+		size_t n = MIN(SMB2_COMPRESSION_SAMPLE_SIZE, len - ofs);
+
+		for (i = 0; i < n; i++) {
+			counts[buf[ofs + i]] += 1;
+		}
+		sample_len += n;
+	}
+
+	if (sample_len == 0) {
+		return false;
+	}
+
+	/*
+	 * Shannon entropy of the sample, scaled to a percentage
+	 * of the maximum of 8 bits per byte.
+	 */
+	p_base = smb2_compression_ilog2_w(sample_len);
+	for (i = 0; i < ARRAY_SIZE(counts); i++) {
+		if (counts[i] == 0) {
+			continue;
+		}
+		entropy_sum += (uint64_t)counts[i] *
+			(p_base - smb2_compression_ilog2_w(counts[i]));
+	}
+	entropy_sum /= sample_len;
+
+	return (entropy_sum * 100 / (8 * 4)) <= SMB2_COMPRESSION_ENTROPY_MAX_PCT;
+}
+
+static size_t smb2_compression_max_size(uint16_t algo, size_t len)
+{
+	switch (algo) {
+	case SMB2_COMPRESSION_LZ77:
+		/*
+		 * One uint32_t indicator per 32 literal bytes,
+		 * lzxpress_compress() silently stops when it
+		 * runs out of space, so we need the worst case.
+		 */
+		return len + (len / 32 + 2) * sizeof(uint32_t);
+	case SMB2_COMPRESSION_LZ77_HUFFMAN:
+		return lzxpress_huffman_max_compressed_size(len);
+	}
+
+	return 0;
+}
+
+static ssize_t smb2_compression_compress_buf(
+		uint16_t algo,
+		struct lzxhuff_compressor_mem *cmp_mem,
+		const uint8_t *in,
+		size_t in_len,
+		uint8_t *out,
+		size_t out_len)
+{
+	if (in_len == 0 || in_len > UINT32_MAX || out_len > UINT32_MAX) {
+		return -1;
+	}
+
+	switch (algo) {
+	case SMB2_COMPRESSION_LZ77:
+		return lzxpress_compress(in, in_len, out, out_len);
+	case SMB2_COMPRESSION_LZ77_HUFFMAN:
+		return lzxpress_huffman_compress(cmp_mem,
+						 in,
+						 in_len,
+						 out,
+						 out_len);
+	}
+
+	return -1;
+}
+
+static bool smb2_compression_decompress_buf(uint16_t algo,
+					    const uint8_t *in,
+					    size_t in_len,
+					    uint8_t *out,
+					    size_t out_len)
+{
+	ssize_t ret;
+
+	if (out_len == 0) {
+		return (in_len == 0);
+	}
+	if (in_len > UINT32_MAX || out_len > UINT32_MAX) {
+		return false;
+	}
+
+	switch (algo) {
+	case SMB2_COMPRESSION_LZ77:
+		ret = lzxpress_decompress(in, in_len, out, out_len);
+		break;
+	case SMB2_COMPRESSION_LZ77_HUFFMAN:
+		ret = lzxpress_huffman_decompress(in, in_len, out, out_len);
+		break;
+	default:
+		return false;
+	}
+
+	if (ret < 0) {
+		return false;
+	}
+
+	return ((size_t)ret == out_len);
+}
+
+static size_t smb2_compression_pattern_len(const uint8_t *buf,
+					   size_t len,
+					   bool backwards)
+{
+	size_t n;
+
+	if (len == 0) {
+		return 0;
+	}
+
+	if (backwards) {
+		uint8_t p = buf[len - 1];
+
+		for (n = 1; n < len; n++) {
+			if (buf[len - 1 - n] != p) {
+				break;
+			}
+		}
+	} else {
+		uint8_t p = buf[0];
+
+		for (n = 1; n < len; n++) {
+			if (buf[n] != p) {
+				break;
+			}
+		}
+	}
+
+	return n;
+}
+
+static uint8_t *smb2_compression_push_payload_hdr(uint8_t *p,
+						  uint16_t algo,
+						  uint16_t flags,
+						  uint32_t length)
+{
+	SSVAL(p, SMB2_COMP_PAYLOAD_ALGORITHM, algo);
+	SSVAL(p, SMB2_COMP_PAYLOAD_FLAGS, flags);
+	SIVAL(p, SMB2_COMP_PAYLOAD_LENGTH, length);
+
+	return p + SMB2_COMP_PAYLOAD_HDR_SIZE;
+}
+
+static uint8_t *smb2_compression_push_pattern(uint8_t *p,
+					      uint16_t flags,
+					      uint8_t pattern,
+					      uint32_t repetitions)
+{
+	p = smb2_compression_push_payload_hdr(p,
+					      SMB2_COMPRESSION_PATTERN_V1,
+					      flags,
+					      SMB2_COMP_PATTERN_V1_SIZE);
+	memset(p, 0, SMB2_COMP_PATTERN_V1_SIZE);
+	SCVAL(p, SMB2_COMP_PATTERN_V1_PATTERN, pattern);
+	SIVAL(p, SMB2_COMP_PATTERN_V1_REPETITIONS, repetitions);
+
+	return p + SMB2_COMP_PATTERN_V1_SIZE;
+}
+
+static NTSTATUS smb2_compression_compress_unchained(
+		TALLOC_CTX *mem_ctx,
+		uint16_t algo,
+		struct lzxhuff_compressor_mem *cmp_mem,
+		const uint8_t *buf,
+		size_t buflen,
+		size_t offset,
+		DATA_BLOB *out)
+{
+	size_t data_len = buflen - offset;
+	size_t max_len = smb2_compression_max_size(algo, data_len);
+	size_t hdr_len = SMB2_COMP_TF_HDR_SIZE + offset;
+	uint8_t *p = NULL;
+	ssize_t clen;
+
+	p = talloc_array(mem_ctx, uint8_t, hdr_len + max_len);
+	if (p == NULL) {
+		return NT_STATUS_NO_MEMORY;
+	}
+
+	clen = smb2_compression_compress_buf(algo,
+					     cmp_mem,
+					     buf + offset,
+					     data_len,
+					     p + hdr_len,
+					     max_len);
+	if (clen < 0 || (hdr_len + clen) >= buflen) {
+		TALLOC_FREE(p);
+		*out = data_blob_null;
+		return NT_STATUS_OK;
+	}
+
+	SIVAL(p, SMB2_COMP_TF_PROTOCOL_ID, SMB2_COMP_TF_MAGIC);
+	SIVAL(p, SMB2_COMP_TF_ORIG_SIZE, data_len);
+	SSVAL(p, SMB2_COMP_TF_ALGORITHM, algo);
+	SSVAL(p, SMB2_COMP_TF_FLAGS, SMB2_COMPRESSION_FLAG_NONE);
+	SIVAL(p, SMB2_COMP_TF_OFFSET, offset);
+	memcpy(p + SMB2_COMP_TF_HDR_SIZE, buf, offset);
+
+	*out = data_blob_const(p, hdr_len + clen);
+	return NT_STATUS_OK;
+}
+
+static NTSTATUS smb2_compression_compress_chained(
+		TALLOC_CTX *mem_ctx,
+		const struct smb2_compression_capabilities *c,
+		uint16_t algo,
+		struct lzxhuff_compressor_mem *cmp_mem,
+		const uint8_t *buf,
+		size_t buflen,
+		size_t offset,
+		DATA_BLOB *out)
+{
+	const uint8_t *data = buf + offset;
+	size_t data_len = buflen - offset;
+	size_t front = 0;
+	size_t back = 0;
+	size_t mid_len;
+	size_t alloc_len;
+	bool patterns;
+	uint16_t flags = SMB2_COMPRESSION_FLAG_CHAINED;
+	uint8_t *p0 = NULL;
+	uint8_t *p = NULL;
+
+	patterns = smb2_compression_capabilities_have(
+			c, SMB2_COMPRESSION_PATTERN_V1);
+	if (patterns) {
+		front = smb2_compression_pattern_len(data, data_len, false);
+		if (front < SMB2_COMPRESSION_PATTERN_MIN) {
+			front = 0;
+		}
+		back = smb2_compression_pattern_len(data + front,
+						    data_len - front,
+						    true);
+		if (back < SMB2_COMPRESSION_PATTERN_MIN) {
+			back = 0;
+		}
+	}
+	mid_len = data_len - front - back;
+
+	alloc_len = SMB2_COMP_TF_CHAINED_HDR_SIZE;
+	alloc_len += SMB2_COMP_PAYLOAD_HDR_SIZE + offset;
+	alloc_len += 2 * (SMB2_COMP_PAYLOAD_HDR_SIZE +
+			  SMB2_COMP_PATTERN_V1_SIZE);
+	alloc_len += SMB2_COMP_PAYLOAD_HDR_SIZE + sizeof(uint32_t);
+	alloc_len += MAX(mid_len, smb2_compression_max_size(algo, mid_len));
+
+	p0 = talloc_array(mem_ctx, uint8_t, alloc_len);
+	if (p0 == NULL) {
+		return NT_STATUS_NO_MEMORY;
+	}
+
+	SIVAL(p0, SMB2_COMP_TF_PROTOCOL_ID, SMB2_COMP_TF_MAGIC);
+	SIVAL(p0, SMB2_COMP_TF_ORIG_SIZE, buflen);
+	p = p0 + SMB2_COMP_TF_CHAINED_HDR_SIZE;
+
+	if (offset > 0) {
+		p = smb2_compression_push_payload_hdr(p,
+						      SMB2_COMPRESSION_NONE,
+						      flags,
+						      offset);
+		memcpy(p, buf, offset);
+		p += offset;
+		flags = SMB2_COMPRESSION_FLAG_NONE;
+	}
+
+	if (front > 0) {
+		p = smb2_compression_push_pattern(p, flags, data[0], front);
+		flags = SMB2_COMPRESSION_FLAG_NONE;
+	}
+
+	if (mid_len > 0) {
+		const uint8_t *mid = data + front;
+		uint8_t *cdata = p + SMB2_COMP_PAYLOAD_HDR_SIZE + sizeof(uint32_t);
+		size_t cmax = smb2_compression_max_size(algo, mid_len);
+		ssize_t clen;
+
+		clen = smb2_compression_compress_buf(algo,
+						     cmp_mem,
+						     mid,
+						     mid_len,
+						     cdata,
+						     cmax);
+		if (clen >= 0 && (size_t)clen + sizeof(uint32_t) < mid_len) {
+			p = smb2_compression_push_payload_hdr(
+				p, algo, flags, clen + sizeof(uint32_t));
+			SIVAL(p, 0, mid_len);
+			p += sizeof(uint32_t) + clen;
+		} else {
+			p = smb2_compression_push_payload_hdr(
+				p, SMB2_COMPRESSION_NONE, flags, mid_len);
+			memcpy(p, mid, mid_len);
+			p += mid_len;
+		}
+		flags = SMB2_COMPRESSION_FLAG_NONE;
+	}
+
+	if (back > 0) {
+		p = smb2_compression_push_pattern(p,
+						  flags,
+						  data[data_len - 1],
+						  back);
+	}
+
+	if (PTR_DIFF(p, p0) >= buflen) {
+		TALLOC_FREE(p0);
+		*out = data_blob_null;
+		return NT_STATUS_OK;
+	}
+
+	*out = data_blob_const(p0, PTR_DIFF(p, p0));
+	return NT_STATUS_OK;
+}
+
+NTSTATUS smb2_compression_compress_pdu(TALLOC_CTX *mem_ctx,
+				const struct smb2_compression_capabilities *c,
+				struct lzxhuff_compressor_mem *cmp_mem,
+				const struct iovec *vector,
+				int count,
+				size_t offset,
+				DATA_BLOB *out)
+{
+	TALLOC_CTX *frame = NULL;
+	uint16_t algo;
+	uint8_t *buf = NULL;
+	ssize_t buflen;
+	NTSTATUS status;
+
+	*out = data_blob_null;
+
+	algo = smb2_compression_capabilities_select(c);
+	if (algo == SMB2_COMPRESSION_NONE) {
+		return NT_STATUS_NOT_SUPPORTED;
+	}
+
+	buflen = iov_buflen(vector, count);
+	if (buflen == -1 || buflen > UINT32_MAX) {
+		return NT_STATUS_INVALID_PARAMETER_MIX;
+	}
+	offset = MIN(offset, (size_t)buflen);
+	if ((size_t)buflen == offset) {
+		return NT_STATUS_OK;
+	}
+
+	frame = talloc_stackframe();
+
+	buf = iov_concat(frame, vector, count);
+	if (buf == NULL) {
+		TALLOC_FREE(frame);
+		return NT_STATUS_NO_MEMORY;
+	}
+
+	if (cmp_mem == NULL && algo == SMB2_COMPRESSION_LZ77_HUFFMAN) {
+		cmp_mem = talloc(frame, struct lzxhuff_compressor_mem);
+		if (cmp_mem == NULL) {
+			TALLOC_FREE(frame);
+			return NT_STATUS_NO_MEMORY;
+		}
+	}
+
+	if (c->chained) {
+		status = smb2_compression_compress_chained(mem_ctx,
+							   c,
+							   algo,
+							   cmp_mem,
+							   buf,
+							   buflen,
+							   offset,
+							   out);
+	} else {
+		status = smb2_compression_compress_unchained(mem_ctx,
+							     algo,
+							     cmp_mem,
+							     buf,
+							     buflen,
+							     offset,
+							     out);
+	}
+
+	TALLOC_FREE(frame);
+	return status;
+}
+
+static NTSTATUS smb2_compression_decompress_chained(
+		const struct smb2_compression_capabilities *c,
+		const uint8_t *buf,
+		size_t buflen,
+		uint8_t *out,
+		size_t out_len)
+{
+	size_t ofs = SMB2_COMP_TF_CHAINED_HDR_SIZE;
+	size_t out_ofs = 0;
+
+	while (ofs < buflen) {
+		const uint8_t *hdr = buf + ofs;
+		const uint8_t *payload = NULL;
+		uint16_t algo;
+		uint32_t length;
+		uint32_t orig_size;
+		bool ok;
+
+		if ((buflen - ofs) < SMB2_COMP_PAYLOAD_HDR_SIZE) {
+			return NT_STATUS_BAD_COMPRESSION_BUFFER;
+		}
+		algo = SVAL(hdr, SMB2_COMP_PAYLOAD_ALGORITHM);
+		length = IVAL(hdr, SMB2_COMP_PAYLOAD_LENGTH);
+		ofs += SMB2_COMP_PAYLOAD_HDR_SIZE;
+
+		if ((buflen - ofs) < length) {
+			return NT_STATUS_BAD_COMPRESSION_BUFFER;
+		}
+		payload = buf + ofs;
+		ofs += length;
+
+		if ((algo != SMB2_COMPRESSION_NONE) &&
+		    !smb2_compression_capabilities_have(c, algo))
+		{
+			DBG_NOTICE("algorithm %s was not negotiated\n",
+				   smb2_compression_algorithm_name(algo));
+			return NT_STATUS_BAD_COMPRESSION_BUFFER;
+		}
+
+		switch (algo) {
+		case SMB2_COMPRESSION_NONE:
+			if ((out_len - out_ofs) < length) {
+				return NT_STATUS_BAD_COMPRESSION_BUFFER;
+			}
+			memcpy(out + out_ofs, payload, length);
+			out_ofs += length;
+			break;
+
+		case SMB2_COMPRESSION_PATTERN_V1:
+			if (length != SMB2_COMP_PATTERN_V1_SIZE) {
+				return NT_STATUS_BAD_COMPRESSION_BUFFER;
+			}
+			orig_size = IVAL(payload,
+					 SMB2_COMP_PATTERN_V1_REPETITIONS);
+			if ((out_len - out_ofs) < orig_size) {
+				return NT_STATUS_BAD_COMPRESSION_BUFFER;
+			}
+			memset(out + out_ofs,
+			       CVAL(payload, SMB2_COMP_PATTERN_V1_PATTERN),
+			       orig_size);
+			out_ofs += orig_size;
+			break;
+
+		default:
+			if (length < sizeof(uint32_t)) {
+				return NT_STATUS_BAD_COMPRESSION_BUFFER;
+			}
+			orig_size = IVAL(payload, 0);
+			if ((out_len - out_ofs) < orig_size) {
+				return NT_STATUS_BAD_COMPRESSION_BUFFER;
+			}
+			ok = smb2_compression_decompress_buf(
+				algo,
+				payload + sizeof(uint32_t),
+				length - sizeof(uint32_t),
+				out + out_ofs,
+				orig_size);
+			if (!ok) {
+				return NT_STATUS_BAD_COMPRESSION_BUFFER;
+			}
+			out_ofs += orig_size;
+			break;
+		}
+	}
+
+	if (out_ofs != out_len) {
+		return NT_STATUS_BAD_COMPRESSION_BUFFER;
+	}
+
+	return NT_STATUS_OK;
+}
+
+NTSTATUS smb2_compression_decompress_pdu(TALLOC_CTX *mem_ctx,
+				const struct smb2_compression_capabilities *c,
+				const uint8_t *buf,
+				size_t buflen,
+				size_t max_size,
+				DATA_BLOB *out)
+{
+	uint32_t orig_size;
+	uint16_t flags;
+	uint8_t *p = NULL;
+	size_t out_len;
+	NTSTATUS status;
+
+	*out = data_blob_null;
+
+	if (buflen < SMB2_COMP_TF_CHAINED_HDR_SIZE + SMB2_COMP_PAYLOAD_HDR_SIZE) {
+		return NT_STATUS_INVALID_PARAMETER;
+	}
+	if (IVAL(buf, SMB2_COMP_TF_PROTOCOL_ID) != SMB2_COMP_TF_MAGIC) {
+		return NT_STATUS_INVALID_PARAMETER;
+	}
+
+	orig_size = IVAL(buf, SMB2_COMP_TF_ORIG_SIZE);
+	flags = SVAL(buf, SMB2_COMP_TF_FLAGS);
+
+	if (flags & SMB2_COMPRESSION_FLAG_CHAINED) {
+		if (!c->chained) {
+			return NT_STATUS_INVALID_PARAMETER;
+		}
+		out_len = orig_size;
+	} else {
+		uint32_t offset;
+
+		if (buflen < SMB2_COMP_TF_HDR_SIZE) {
+			return NT_STATUS_INVALID_PARAMETER;
+		}
+		offset = IVAL(buf, SMB2_COMP_TF_OFFSET);
+		if (offset > buflen - SMB2_COMP_TF_HDR_SIZE) {
+			return NT_STATUS_INVALID_PARAMETER;
+		}
+		out_len = (size_t)offset + orig_size;
+	}
+
+	if (out_len == 0 || out_len > max_size) {
+		DBG_NOTICE("invalid original size %zu (max %zu)\n",
+			   out_len, max_size);
+		return NT_STATUS_INVALID_PARAMETER;
+	}
+
+	p = talloc_array(mem_ctx, uint8_t, out_len);
+	if (p == NULL) {
+		return NT_STATUS_NO_MEMORY;
+	}
+
+	if (flags & SMB2_COMPRESSION_FLAG_CHAINED) {
+		status = smb2_compression_decompress_chained(c,
+							     buf,
+							     buflen,
+							     p,
+							     out_len);
+	} else {
+		uint16_t algo = SVAL(buf, SMB2_COMP_TF_ALGORITHM);
+		uint32_t offset = IVAL(buf, SMB2_COMP_TF_OFFSET);
+		const uint8_t *cdata = buf + SMB2_COMP_TF_HDR_SIZE + offset;
+		size_t clen = buflen - SMB2_COMP_TF_HDR_SIZE - offset;
+		bool ok;
+
+		status = NT_STATUS_BAD_COMPRESSION_BUFFER;
+
+		memcpy(p, buf + SMB2_COMP_TF_HDR_SIZE, offset);
+
+		if (smb2_compression_capabilities_have(c, algo)) {
+			ok = smb2_compression_decompress_buf(algo,
+							     cdata,
+							     clen,
+							     p + offset,
+							     orig_size);
+			if (ok) {
+				status = NT_STATUS_OK;
+			}
+		}
+	}
+	if (!NT_STATUS_IS_OK(status)) {
+		TALLOC_FREE(p);
+		return status;
+	}
+
+	*out = data_blob_const(p, out_len);
+	return NT_STATUS_OK;
+}
@@ -0,0 +1,90 @@
+/*
+   Unix SMB/CIFS implementation.
+   SMB2 transport compression
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _LIBCLI_SMB_SMB2_COMPRESSION_H_
+#define _LIBCLI_SMB_SMB2_COMPRESSION_H_
+
+#include "lib/util/data_blob.h"
+#include "libcli/util/ntstatus.h"
+
+struct iovec;
+struct lzxhuff_compressor_mem;
+
+struct smb2_compression_capabilities {
+#define SMB2_COMPRESSION_CAPABILITIES_MAX_ALGOS 4
+	uint16_t num_algos;
+	uint16_t algos[SMB2_COMPRESSION_CAPABILITIES_MAX_ALGOS];
+	bool chained;
+};
+
+const char *smb2_compression_algorithm_name(uint16_t algo);
+
+/*
+ * Returns true if we are able to (de)compress payloads
+ * with the given algorithm.
+ */
+bool smb2_compression_algorithm_supported(uint16_t algo);
+
+/*
+ * Returns the first negotiated algorithm that
+ * can be used to compress a whole payload,
+ * SMB2_COMPRESSION_NONE if there is none.
+ */
+uint16_t smb2_compression_capabilities_select(
+		const struct smb2_compression_capabilities *c);
+
+/*
+ * A cheap estimate based on a sample of the buffer,
+ * returns false if the data looks like it's already
+ * compressed or encrypted.
+ */
+bool smb2_compression_is_compressible(const uint8_t *buf, size_t len);
+
+/*
+ * Build an SMB2_COMPRESSION_TRANSFORM message from the
+ * given SMB2 message.
+ *
+ * The first 'offset' bytes are transferred uncompressed.
+ *
+ * If the compressed message would not be smaller than
+ * the original one, NT_STATUS_OK is returned together with
+ * an empty *out, the caller should send the message as is.
+ *
+ * cmp_mem is optional, it avoids allocating the
+ * LZ77+Huffman working memory for each message.
+ */
+NTSTATUS smb2_compression_compress_pdu(TALLOC_CTX *mem_ctx,
+				const struct smb2_compression_capabilities *c,
+				struct lzxhuff_compressor_mem *cmp_mem,
+				const struct iovec *vector,
+				int count,
+				size_t offset,
+				DATA_BLOB *out);
+
+/*
+ * Decompress an SMB2_COMPRESSION_TRANSFORM message,
+ * only algorithms listed in 'c' are accepted.
+ */
+NTSTATUS smb2_compression_decompress_pdu(TALLOC_CTX *mem_ctx,
+				const struct smb2_compression_capabilities *c,
+				const uint8_t *buf,
+				size_t buflen,
+				size_t max_size,
+				DATA_BLOB *out);
+
+#endif /* _LIBCLI_SMB_SMB2_COMPRESSION_H_ */
@@ -29,6 +29,15 @@
 
 #include "lib/crypto/gnutls_helpers.h"
 
+/*
+ * gnutls_error_to_ntstatus() logs, which is not allowed in the _job
+ * variants: they hand the raw GnuTLS error code back in *job_rc.
+ */
+#define smb2_signing_gnutls_error(rc, job_rc, blocked_status) \
+	(((job_rc) != NULL) ? \
+	 (*(job_rc) = (rc), NT_STATUS_INTERNAL_ERROR) : \
+	 gnutls_error_to_ntstatus((rc), (blocked_status)))
+
 void smb2_signing_derivations_fill_const_stack(struct smb2_signing_derivations *ds,
 					       enum protocol_types protocol,
 					       const DATA_BLOB preauth_hash)
@@ -319,10 +328,34 @@ bool smb2_signing_key_valid(const struct smb2_signing_key *key)
 	return true;
 }
 
+/*
+ * Returns true if both keys produce the same signatures,
+ * so a caller can keep using an already initialized key
+ * (and its gnutls handle) instead of a fresh copy.
+ */
+bool smb2_signing_key_equal(const struct smb2_signing_key *k1,
+			    const struct smb2_signing_key *k2)
+{
+	if (!smb2_signing_key_valid(k1) || !smb2_signing_key_valid(k2)) {
+		return false;
+	}
+
+	if (k1->sign_algo_id != k2->sign_algo_id) {
+		return false;
+	}
+
+	if (k1->cipher_algo_id != k2->cipher_algo_id) {
+		return false;
+	}
+
+	return data_blob_equal_const_time(&k1->blob, &k2->blob);
+}
+
 static NTSTATUS smb2_signing_gmac(gnutls_aead_cipher_hd_t cipher_hnd,
 				  const uint8_t *iv, size_t iv_size,
 				  const giovec_t *auth_iov, uint8_t auth_iovcnt,
-				  uint8_t *tag, size_t _tag_size)
+				  uint8_t *tag, size_t _tag_size,
+				  int *job_rc)
 {
 	size_t tag_size = _tag_size;
 	int rc;
@@ -333,7 +366,7 @@ static NTSTATUS smb2_signing_gmac(gnutls_aead_cipher_hd_t cipher_hnd,
 					  NULL, 0,
 					  tag, &tag_size);
 	if (rc < 0) {
-		return gnutls_error_to_ntstatus(rc, NT_STATUS_HMAC_NOT_SUPPORTED);
+		return smb2_signing_gnutls_error(rc, job_rc, NT_STATUS_HMAC_NOT_SUPPORTED);
 	}
 
 	return NT_STATUS_OK;
@@ -343,8 +376,10 @@ static NTSTATUS smb2_signing_calc_signature(struct smb2_signing_key *signing_key
 					    uint16_t sign_algo_id,
 					    const struct iovec *vector,
 					    int count,
-					    uint8_t signature[16])
+					    uint8_t signature[16],
+					    int *job_rc)
 {
+	const bool do_log = (job_rc == NULL);
 	const uint8_t *hdr = (uint8_t *)vector[0].iov_base;
 	uint16_t opcode;
 	uint32_t flags;
@@ -369,11 +404,17 @@ static NTSTATUS smb2_signing_calc_signature(struct smb2_signing_key *signing_key
 	if (flags & SMB2_HDR_FLAG_REDIRECT) {
 		NTSTATUS pdu_status = NT_STATUS(IVAL(hdr, SMB2_HDR_STATUS));
 		if (NT_STATUS_EQUAL(pdu_status, NT_STATUS_PENDING)) {
-			DBG_ERR("opcode[%u] NT_STATUS_PENDING\n", opcode);
+			if (do_log) {
+				DBG_ERR("opcode[%u] NT_STATUS_PENDING\n",
+					opcode);
+			}
 			return NT_STATUS_INTERNAL_ERROR;
 		}
 		if (opcode == SMB2_OP_CANCEL) {
-			DBG_ERR("SMB2_OP_CANCEL response should not be signed\n");
+			if (do_log) {
+				DBG_ERR("SMB2_OP_CANCEL response "
+					"should not be signed\n");
+			}
 			return NT_STATUS_INTERNAL_ERROR;
 		}
 	}
@@ -382,7 +423,9 @@ static NTSTATUS smb2_signing_calc_signature(struct smb2_signing_key *signing_key
 		if (opcode != SMB2_OP_CANCEL ||
 		    sign_algo_id >= SMB2_SIGNING_AES128_GMAC)
 		{
-			DBG_ERR("opcode[%u] msg_id == 0\n", opcode);
+			if (do_log) {
+				DBG_ERR("opcode[%u] msg_id == 0\n", opcode);
+			}
 			return NT_STATUS_INTERNAL_ERROR;
 		}
 		/*
@@ -391,7 +434,9 @@ static NTSTATUS smb2_signing_calc_signature(struct smb2_signing_key *signing_key
 		 */
 	}
 	if (msg_id == UINT64_MAX) {
-		DBG_ERR("opcode[%u] msg_id == UINT64_MAX\n", opcode);
+		if (do_log) {
+			DBG_ERR("opcode[%u] msg_id == UINT64_MAX\n", opcode);
+		}
 		return NT_STATUS_INTERNAL_ERROR;
 	}
 
@@ -424,7 +469,7 @@ static NTSTATUS smb2_signing_calc_signature(struct smb2_signing_key *signing_key
 						     algo,
 					             &key);
 			if (rc < 0) {
-				return gnutls_error_to_ntstatus(rc,
+				return smb2_signing_gnutls_error(rc, job_rc,
 						NT_STATUS_HMAC_NOT_SUPPORTED);
 			}
 		}
@@ -454,7 +499,8 @@ static NTSTATUS smb2_signing_calc_signature(struct smb2_signing_key *signing_key
 					   auth_iov,
 					   auth_iovcnt,
 					   signature,
-					   tag_size);
+					   tag_size,
+					   job_rc);
 		if (!NT_STATUS_IS_OK(status)) {
 			return status;
 		}
@@ -487,19 +533,19 @@ static NTSTATUS smb2_signing_calc_signature(struct smb2_signing_key *signing_key
 					      key.data,
 					      key.size);
 			if (rc < 0) {
-				return gnutls_error_to_ntstatus(rc,
+				return smb2_signing_gnutls_error(rc, job_rc,
 						NT_STATUS_HMAC_NOT_SUPPORTED);
 			}
 		}
 
 		rc = gnutls_hmac(signing_key->hmac_hnd, hdr, SMB2_HDR_SIGNATURE);
 		if (rc < 0) {
-			return gnutls_error_to_ntstatus(rc,
+			return smb2_signing_gnutls_error(rc, job_rc,
 						NT_STATUS_HMAC_NOT_SUPPORTED);
 		}
 		rc = gnutls_hmac(signing_key->hmac_hnd, zero_sig, 16);
 		if (rc < 0) {
-			return gnutls_error_to_ntstatus(rc,
+			return smb2_signing_gnutls_error(rc, job_rc,
 						NT_STATUS_HMAC_NOT_SUPPORTED);
 		}
 
@@ -508,7 +554,7 @@ static NTSTATUS smb2_signing_calc_signature(struct smb2_signing_key *signing_key
 					 vector[i].iov_base,
 					 vector[i].iov_len);
 			if (rc < 0) {
-				return gnutls_error_to_ntstatus(rc,
+				return smb2_signing_gnutls_error(rc, job_rc,
 						NT_STATUS_HMAC_NOT_SUPPORTED);
 			}
 		}
@@ -521,10 +567,13 @@ static NTSTATUS smb2_signing_calc_signature(struct smb2_signing_key *signing_key
 	return NT_STATUS_HMAC_NOT_SUPPORTED;
 }
 
-NTSTATUS smb2_signing_sign_pdu(struct smb2_signing_key *signing_key,
-			       struct iovec *vector,
-			       int count)
+static NTSTATUS smb2_signing_sign_pdu_internal(
+	struct smb2_signing_key *signing_key,
+	struct iovec *vector,
+	int count,
+	int *job_rc)
 {
+	const bool do_log = (job_rc == NULL);
 	uint16_t sign_algo_id;
 	uint8_t *hdr;
 	uint64_t session_id;
@@ -554,7 +603,9 @@ NTSTATUS smb2_signing_sign_pdu(struct smb2_signing_key *signing_key,
 	}
 
 	if (!smb2_signing_key_valid(signing_key)) {
-		DBG_WARNING("No signing key for SMB2 signing\n");
+		if (do_log) {
+			DBG_WARNING("No signing key for SMB2 signing\n");
+		}
 		return NT_STATUS_ACCESS_DENIED;
 	}
 
@@ -568,8 +619,12 @@ NTSTATUS smb2_signing_sign_pdu(struct smb2_signing_key *signing_key,
 					     sign_algo_id,
 					     vector,
 					     count,
-					     res);
+					     res,
+					     job_rc);
 	if (!NT_STATUS_IS_OK(status)) {
+		if (!do_log) {
+			return status;
+		}
 		DBG_ERR("smb2_signing_calc_signature(sign_algo_id=%u) - %s\n",
 			(unsigned)sign_algo_id, nt_errstr(status));
 		if (NT_STATUS_EQUAL(status, NT_STATUS_INTERNAL_ERROR)) {
@@ -578,14 +633,39 @@ NTSTATUS smb2_signing_sign_pdu(struct smb2_signing_key *signing_key,
 		return status;
 	}
 
-	DEBUG(5,("signed SMB2 message (sign_algo_id=%u)\n",
-		 (unsigned)sign_algo_id));
+	if (do_log) {
+		DEBUG(5,("signed SMB2 message (sign_algo_id=%u)\n",
+			 (unsigned)sign_algo_id));
+	}
 
 	memcpy(hdr + SMB2_HDR_SIGNATURE, res, 16);
 
 	return NT_STATUS_OK;
 }
 
+NTSTATUS smb2_signing_sign_pdu(struct smb2_signing_key *signing_key,
+			       struct iovec *vector,
+			       int count)
+{
+	return smb2_signing_sign_pdu_internal(signing_key,
+					      vector,
+					      count,
+					      NULL);
+}
+
+NTSTATUS smb2_signing_sign_pdu_job(struct smb2_signing_key *signing_key,
+				   struct iovec *vector,
+				   int count,
+				   int *gnutls_rc)
+{
+	*gnutls_rc = 0;
+
+	return smb2_signing_sign_pdu_internal(signing_key,
+					      vector,
+					      count,
+					      gnutls_rc);
+}
+
 NTSTATUS smb2_signing_check_pdu(struct smb2_signing_key *signing_key,
 				const struct iovec *vector,
 				int count)
@@ -632,7 +712,8 @@ NTSTATUS smb2_signing_check_pdu(struct smb2_signing_key *signing_key,
 					     sign_algo_id,
 					     vector,
 					     count,
-					     res);
+					     res,
+					     NULL);
 	if (!NT_STATUS_IS_OK(status)) {
 		DBG_ERR("smb2_signing_calc_signature(sign_algo_id=%u) - %s\n",
 			(unsigned)sign_algo_id, nt_errstr(status));
@@ -653,10 +734,37 @@ NTSTATUS smb2_signing_check_pdu(struct smb2_signing_key *signing_key,
 	return NT_STATUS_OK;
 }
 
-NTSTATUS smb2_signing_encrypt_pdu(struct smb2_signing_key *encryption_key,
-				  struct iovec *vector,
-				  int count)
+bool smb2_signing_key_cipher_threadsafe(const struct smb2_signing_key *key)
 {
+	if (!smb2_signing_key_valid(key)) {
+		return false;
+	}
+
+	/*
+	 * Only the gnutls_aead_cipher_{en,de}cryptv2() code paths
+	 * work without temporary talloc memory.
+	 */
+	switch (key->cipher_algo_id) {
+	case SMB2_ENCRYPTION_AES128_GCM:
+	case SMB2_ENCRYPTION_AES256_GCM:
+		return true;
+#ifdef ALLOW_GNUTLS_AEAD_CIPHER_ENCRYPTV2_AES_CCM
+	case SMB2_ENCRYPTION_AES128_CCM:
+	case SMB2_ENCRYPTION_AES256_CCM:
+		return true;
+#endif
+	}
+
+	return false;
+}
+
+static NTSTATUS smb2_signing_encrypt_pdu_internal(
+	struct smb2_signing_key *encryption_key,
+	struct iovec *vector,
+	int count,
+	int *job_rc)
+{
+	const bool do_log = (job_rc == NULL);
 	bool use_encryptv2 = false;
 	uint16_t cipher_id;
 	uint8_t *tf;
@@ -682,7 +790,9 @@ NTSTATUS smb2_signing_encrypt_pdu(struct smb2_signing_key *encryption_key,
 	tf = (uint8_t *)vector[0].iov_base;
 
 	if (!smb2_signing_key_valid(encryption_key)) {
-		DBG_WARNING("No encryption key for SMB2 signing\n");
+		if (do_log) {
+			DBG_WARNING("No encryption key for SMB2 signing\n");
+		}
 		return NT_STATUS_ACCESS_DENIED;
 	}
 	cipher_id = encryption_key->cipher_algo_id;
@@ -752,7 +862,9 @@ NTSTATUS smb2_signing_encrypt_pdu(struct smb2_signing_key *encryption_key,
 					algo,
 					&key);
 		if (rc < 0) {
-			status = gnutls_error_to_ntstatus(rc, NT_STATUS_INTERNAL_ERROR);
+			status = smb2_signing_gnutls_error(rc,
+							   job_rc,
+							   NT_STATUS_INTERNAL_ERROR);
 			goto out;
 		}
 	}
@@ -780,7 +892,9 @@ NTSTATUS smb2_signing_encrypt_pdu(struct smb2_signing_key *encryption_key,
 						  tag,
 						  &tag_size);
 		if (rc < 0) {
-			status = gnutls_error_to_ntstatus(rc, NT_STATUS_INTERNAL_ERROR);
+			status = smb2_signing_gnutls_error(rc,
+							   job_rc,
+							   NT_STATUS_INTERNAL_ERROR);
 			goto out;
 		}
 
@@ -847,7 +961,9 @@ NTSTATUS smb2_signing_encrypt_pdu(struct smb2_signing_key *encryption_key,
 		if (rc < 0 || ctext_size != m_total + tag_size) {
 			TALLOC_FREE(ptext);
 			TALLOC_FREE(ctext);
-			status = gnutls_error_to_ntstatus(rc, NT_STATUS_INTERNAL_ERROR);
+			status = smb2_signing_gnutls_error(rc,
+							   job_rc,
+							   NT_STATUS_INTERNAL_ERROR);
 			goto out;
 		}
 
@@ -868,17 +984,49 @@ NTSTATUS smb2_signing_encrypt_pdu(struct smb2_signing_key *encryption_key,
 		TALLOC_FREE(ctext);
 	}
 
-	DBG_INFO("Encrypted SMB2 message\n");
+	if (do_log) {
+		DBG_INFO("Encrypted SMB2 message\n");
+	}
 
 	status = NT_STATUS_OK;
 out:
 	return status;
 }
 
-NTSTATUS smb2_signing_decrypt_pdu(struct smb2_signing_key *decryption_key,
+NTSTATUS smb2_signing_encrypt_pdu(struct smb2_signing_key *encryption_key,
 				  struct iovec *vector,
 				  int count)
 {
+	return smb2_signing_encrypt_pdu_internal(encryption_key,
+						 vector,
+						 count,
+						 NULL);
+}
+
+NTSTATUS smb2_signing_encrypt_pdu_job(struct smb2_signing_key *encryption_key,
+				      struct iovec *vector,
+				      int count,
+				      int *gnutls_rc)
+{
+	*gnutls_rc = 0;
+
+	if (!smb2_signing_key_cipher_threadsafe(encryption_key)) {
+		return NT_STATUS_INTERNAL_ERROR;
+	}
+
+	return smb2_signing_encrypt_pdu_internal(encryption_key,
+						 vector,
+						 count,
+						 gnutls_rc);
+}
+
+static NTSTATUS smb2_signing_decrypt_pdu_internal(
+	struct smb2_signing_key *decryption_key,
+	struct iovec *vector,
+	int count,
+	int *job_rc)
+{
+	const bool do_log = (job_rc == NULL);
 	bool use_encryptv2 = false;
 	uint16_t cipher_id;
 	uint8_t *tf;
@@ -906,7 +1054,9 @@ NTSTATUS smb2_signing_decrypt_pdu(struct smb2_signing_key *decryption_key,
 	tf = (uint8_t *)vector[0].iov_base;
 
 	if (!smb2_signing_key_valid(decryption_key)) {
-		DBG_WARNING("No decryption key for SMB2 signing\n");
+		if (do_log) {
+			DBG_WARNING("No decryption key for SMB2 signing\n");
+		}
 		return NT_STATUS_ACCESS_DENIED;
 	}
 	cipher_id = decryption_key->cipher_algo_id;
@@ -984,7 +1134,9 @@ NTSTATUS smb2_signing_decrypt_pdu(struct smb2_signing_key *decryption_key,
 					     algo,
 					     &key);
 		if (rc < 0) {
-			status = gnutls_error_to_ntstatus(rc, NT_STATUS_INTERNAL_ERROR);
+			status = smb2_signing_gnutls_error(rc,
+							   job_rc,
+							   NT_STATUS_INTERNAL_ERROR);
 			goto out;
 		}
 	}
@@ -1007,7 +1159,9 @@ NTSTATUS smb2_signing_decrypt_pdu(struct smb2_signing_key *decryption_key,
 						  tf + SMB2_TF_SIGNATURE,
 						  tag_size);
 		if (rc < 0) {
-			status = gnutls_error_to_ntstatus(rc, NT_STATUS_INTERNAL_ERROR);
+			status = smb2_signing_gnutls_error(rc,
+							   job_rc,
+							   NT_STATUS_INTERNAL_ERROR);
 			goto out;
 		}
 	} else
@@ -1078,14 +1232,18 @@ NTSTATUS smb2_signing_decrypt_pdu(struct smb2_signing_key *decryption_key,
 		if (rc < 0) {
 			TALLOC_FREE(ptext);
 			TALLOC_FREE(ctext);
-			status = gnutls_error_to_ntstatus(rc, NT_STATUS_INTERNAL_ERROR);
+			status = smb2_signing_gnutls_error(rc,
+							   job_rc,
+							   NT_STATUS_INTERNAL_ERROR);
 			goto out;
 		}
 		if (ptext_size != m_total) {
 			TALLOC_FREE(ptext);
 			TALLOC_FREE(ctext);
 			rc = GNUTLS_E_SHORT_MEMORY_BUFFER;
-			status = gnutls_error_to_ntstatus(rc, NT_STATUS_INTERNAL_ERROR);
+			status = smb2_signing_gnutls_error(rc,
+							   job_rc,
+							   NT_STATUS_INTERNAL_ERROR);
 			goto out;
 		}
 
@@ -1102,9 +1260,38 @@ NTSTATUS smb2_signing_decrypt_pdu(struct smb2_signing_key *decryption_key,
 		TALLOC_FREE(ctext);
 	}
 
-	DBG_INFO("Decrypted SMB2 message\n");
+	if (do_log) {
+		DBG_INFO("Decrypted SMB2 message\n");
+	}
 
 	status = NT_STATUS_OK;
 out:
 	return status;
 }
+
+NTSTATUS smb2_signing_decrypt_pdu(struct smb2_signing_key *decryption_key,
+				  struct iovec *vector,
+				  int count)
+{
+	return smb2_signing_decrypt_pdu_internal(decryption_key,
+						 vector,
+						 count,
+						 NULL);
+}
+
+NTSTATUS smb2_signing_decrypt_pdu_job(struct smb2_signing_key *decryption_key,
+				      struct iovec *vector,
+				      int count,
+				      int *gnutls_rc)
+{
+	*gnutls_rc = 0;
+
+	if (!smb2_signing_key_cipher_threadsafe(decryption_key)) {
+		return NT_STATUS_INTERNAL_ERROR;
+	}
+
+	return smb2_signing_decrypt_pdu_internal(decryption_key,
+						 vector,
+						 count,
+						 gnutls_rc);
+}
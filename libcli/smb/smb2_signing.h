@@ -83,6 +83,8 @@ NTSTATUS smb2_signing_key_cipher_create(TALLOC_CTX *mem_ctx,
 					struct smb2_signing_key **_key);
 
 bool smb2_signing_key_valid(const struct smb2_signing_key *key);
+bool smb2_signing_key_equal(const struct smb2_signing_key *k1,
+			    const struct smb2_signing_key *k2);
 
 NTSTATUS smb2_signing_sign_pdu(struct smb2_signing_key *signing_key,
 			       struct iovec *vector,
@@ -99,4 +101,28 @@ NTSTATUS smb2_signing_decrypt_pdu(struct smb2_signing_key *decryption_key,
 				  struct iovec *vector,
 				  int count);
 
+/*
+ * The _job variants can run in a pthreadpool job: they don't
+ * log and the encryption ones fail unless
+ * smb2_signing_key_cipher_threadsafe() is true. The caller needs
+ * a private copy of the key (see smb2_signing_key_copy()), as the
+ * GnuTLS handles are created on first use. A failing GnuTLS call
+ * returns NT_STATUS_INTERNAL_ERROR with its error code in
+ * *gnutls_rc, to be mapped with gnutls_error_to_ntstatus() back in
+ * the main thread.
+ */
+bool smb2_signing_key_cipher_threadsafe(const struct smb2_signing_key *key);
+NTSTATUS smb2_signing_sign_pdu_job(struct smb2_signing_key *signing_key,
+				   struct iovec *vector,
+				   int count,
+				   int *gnutls_rc);
+NTSTATUS smb2_signing_encrypt_pdu_job(struct smb2_signing_key *encryption_key,
+				      struct iovec *vector,
+				      int count,
+				      int *gnutls_rc);
+NTSTATUS smb2_signing_decrypt_pdu_job(struct smb2_signing_key *decryption_key,
+				      struct iovec *vector,
+				      int count,
+				      int *gnutls_rc);
+
 #endif /* _LIBCLI_SMB_SMB2_SIGNING_H_ */
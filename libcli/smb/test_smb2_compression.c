@@ -0,0 +1,259 @@
+/*
+ * Unix SMB/CIFS implementation.
+ *
+ * Tests for SMB2 transport compression
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "lib/replace/replace.h"
+#include "system/filesys.h"
+#include <talloc.h>
+
+#include "lib/util/samba_util.h"
+#include "libcli/util/ntstatus.h"
+#include "libcli/smb/smb2_constants.h"
+#include "libcli/smb/smb2_compression.h"
+
+#define MSG_HDR_LEN 80
+
+static const struct smb2_compression_capabilities caps_lz77 = {
+	.num_algos = 1,
+	.algos = { SMB2_COMPRESSION_LZ77, },
+	.chained = false,
+};
+
+static const struct smb2_compression_capabilities caps_huff = {
+	.num_algos = 1,
+	.algos = { SMB2_COMPRESSION_LZ77_HUFFMAN, },
+	.chained = false,
+};
+
+static const struct smb2_compression_capabilities caps_chained = {
+	.num_algos = 2,
+	.algos = {
+		SMB2_COMPRESSION_LZ77,
+		SMB2_COMPRESSION_PATTERN_V1,
+	},
+	.chained = true,
+};
+
+static uint8_t *text_buffer(TALLOC_CTX *mem_ctx, size_t len)
+{
+	static const char *words[] = {
+		"the ", "quick ", "brown ", "fox ", "jumps ",
+		"over ", "lazy ", "dogs ", "\n",
+	};
+	uint8_t *buf = talloc_array(mem_ctx, uint8_t, len);
+	size_t i = 0;
+	size_t w = 0;
+
+	assert_non_null(buf);
+
+	while (i < len) {
+		const char *s = words[(w * 7 + w / 3) % ARRAY_SIZE(words)];
+		size_t n = MIN(strlen(s), len - i);
+
+		memcpy(buf + i, s, n);
+		i += n;
+		w++;
+	}
+
+	return buf;
+}
+
+static uint8_t *random_buffer(TALLOC_CTX *mem_ctx, size_t len)
+{
+	uint8_t *buf = talloc_array(mem_ctx, uint8_t, len);
+	uint32_t x = 0x12345678;
+	size_t i;
+
+	assert_non_null(buf);
+
+	for (i = 0; i < len; i++) {
+		/* xorshift */
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		buf[i] = x >> 24;
+	}
+
+	return buf;
+}
+
+static void round_trip(const struct smb2_compression_capabilities *c,
+		       uint8_t *buf,
+		       size_t len,
+		       bool expect_compressed)
+{
+	TALLOC_CTX *mem_ctx = talloc_new(NULL);
+	struct iovec iov[2] = {
+		{ .iov_base = buf, .iov_len = MSG_HDR_LEN },
+		{ .iov_base = buf + MSG_HDR_LEN, .iov_len = len - MSG_HDR_LEN },
+	};
+	DATA_BLOB comp = data_blob_null;
+	DATA_BLOB decomp = data_blob_null;
+	NTSTATUS status;
+
+	status = smb2_compression_compress_pdu(mem_ctx,
+					       c,
+					       NULL,
+					       iov,
+					       ARRAY_SIZE(iov),
+					       MSG_HDR_LEN,
+					       &comp);
+	assert_true(NT_STATUS_IS_OK(status));
+
+	if (!expect_compressed) {
+		assert_int_equal(comp.length, 0);
+		TALLOC_FREE(mem_ctx);
+		return;
+	}
+
+	assert_true(comp.length > 0);
+	assert_true(comp.length < len);
+	assert_int_equal(IVAL(comp.data, 0), SMB2_COMP_TF_MAGIC);
+
+	status = smb2_compression_decompress_pdu(mem_ctx,
+						 c,
+						 comp.data,
+						 comp.length,
+						 len,
+						 &decomp);
+	assert_true(NT_STATUS_IS_OK(status));
+	assert_int_equal(decomp.length, len);
+	assert_memory_equal(decomp.data, buf, len);
+
+	/* the decompressed size must not exceed the limit */
+	status = smb2_compression_decompress_pdu(mem_ctx,
+						 c,
+						 comp.data,
+						 comp.length,
+						 len - 1,
+						 &decomp);
+	assert_false(NT_STATUS_IS_OK(status));
+
+	TALLOC_FREE(mem_ctx);
+}
+
+static void test_unchained_lz77(void **state)
+{
+	uint8_t *buf = text_buffer(NULL, 70000);
+
+	round_trip(&caps_lz77, buf, 70000, true);
+	TALLOC_FREE(buf);
+}
+
+static void test_unchained_huffman(void **state)
+{
+	uint8_t *buf = text_buffer(NULL, 200000);
+
+	round_trip(&caps_huff, buf, 200000, true);
+	TALLOC_FREE(buf);
+}
+
+static void test_chained_patterns(void **state)
+{
+	size_t len = 65536 + MSG_HDR_LEN;
+	uint8_t *buf = text_buffer(NULL, len);
+
+	/* zeros at the front, 0xff at the end */
+	memset(buf + MSG_HDR_LEN, 0, 4096);
+	memset(buf + len - 8192, 0xff, 8192);
+
+	round_trip(&caps_chained, buf, len, true);
+
+	/* only a pattern */
+	memset(buf + MSG_HDR_LEN, 0, len - MSG_HDR_LEN);
+	round_trip(&caps_chained, buf, len, true);
+
+	TALLOC_FREE(buf);
+}
+
+static void test_incompressible(void **state)
+{
+	uint8_t *buf = random_buffer(NULL, 65536);
+
+	assert_false(smb2_compression_is_compressible(buf, 65536));
+	round_trip(&caps_lz77, buf, 65536, false);
+	TALLOC_FREE(buf);
+
+	buf = text_buffer(NULL, 65536);
+	assert_true(smb2_compression_is_compressible(buf, 65536));
+	TALLOC_FREE(buf);
+}
+
+static void test_not_negotiated(void **state)
+{
+	TALLOC_CTX *mem_ctx = talloc_new(NULL);
+	uint8_t *buf = text_buffer(mem_ctx, 8192);
+	struct iovec iov = { .iov_base = buf, .iov_len = 8192 };
+	DATA_BLOB comp = data_blob_null;
+	DATA_BLOB decomp = data_blob_null;
+	NTSTATUS status;
+
+	status = smb2_compression_compress_pdu(mem_ctx,
+					       &caps_lz77,
+					       NULL,
+					       &iov,
+					       1,
+					       0,
+					       &comp);
+	assert_true(NT_STATUS_IS_OK(status));
+	assert_true(comp.length > 0);
+
+	status = smb2_compression_decompress_pdu(mem_ctx,
+						 &caps_huff,
+						 comp.data,
+						 comp.length,
+						 8192,
+						 &decomp);
+	assert_true(NT_STATUS_EQUAL(status, NT_STATUS_BAD_COMPRESSION_BUFFER));
+
+	/* a chained message is rejected if not negotiated */
+	SSVAL(comp.data, SMB2_COMP_TF_FLAGS, SMB2_COMPRESSION_FLAG_CHAINED);
+	status = smb2_compression_decompress_pdu(mem_ctx,
+						 &caps_lz77,
+						 comp.data,
+						 comp.length,
+						 8192,
+						 &decomp);
+	assert_true(NT_STATUS_EQUAL(status, NT_STATUS_INVALID_PARAMETER));
+
+	TALLOC_FREE(mem_ctx);
+}
+
+int main(int argc, char *argv[])
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_unchained_lz77),
+		cmocka_unit_test(test_unchained_huffman),
+		cmocka_unit_test(test_chained_patterns),
+		cmocka_unit_test(test_incompressible),
+		cmocka_unit_test(test_not_negotiated),
+	};
+
+	if (argc == 2) {
+		cmocka_set_test_filter(argv[1]);
+	}
+	cmocka_set_message_output(CM_OUTPUT_SUBUNIT);
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
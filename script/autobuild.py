@@ -348,6 +348,7 @@ tasks = {
             "fileserver",
             "fileserver_smb1",
             "fileserver_smb1_done",
+            "fileserver_uring",
             "maptoguest",
             "simpleserver",
             "backupfromdc",
@@ -418,6 +419,7 @@ tasks = {
             "fileserver",
             "fileserver_smb1",
             "fileserver_smb1_done",
+            "fileserver_uring",
             "maptoguest",
             "simpleserver",
             "backupfromdc",
@@ -472,6 +474,7 @@ tasks = {
             "fileserver",
             "fileserver_smb1",
             "fileserver_smb1_done",
+            "fileserver_uring",
             "maptoguest",
             "ktest", # ktest is also tested in samba-ktest-mit samba
                      # and samba-mitkrb5 but is tested here against
@@ -606,11 +606,11 @@ sub get_interface($)
 		localnt4dc2       => 3,
 		localnt4member3   => 4,
 		localshare4       => 5,
-		# 6 is spare
+		fsnameindex       => 6,
 		localktest6       => 7,
 		maptoguest        => 8,
 		localnt4dc9       => 9,
-		# 10 is spare
+		fileserveruring   => 10,
 
 		# 11-16 are used by selftest.pl for the client.conf. Most tests only
 		# use the first .11 IP. However, some tests (like winsreplication) rely
@@ -663,6 +663,7 @@ sub get_interface($)
 		admemidmapnss     => 60,
 		localadmember2    => 61,
 		admemautorid      => 62,
+		fsfairq           => 63,
 
 		rootdnsforwarder  => 64,
 
@@ -42,6 +42,23 @@ sub have_ads($) {
 	return $found_ads;
 }
 
+sub have_smb2_uring($) {
+	my ($self) = @_;
+	my $found_uring = 0;
+	my $smbd_build_options = Samba::bindir_path($self, "smbd") . " --configfile=/dev/null -b|";
+	open(IN, $smbd_build_options) or die("Unable to run $smbd_build_options: $!");
+
+	while (<IN>) {
+		if (/WITH_SMB2_URING/) {
+			$found_uring = 1;
+		}
+	}
+	close IN;
+
+	print "smbd does not have SMB2 io_uring support\n" unless $found_uring;
+	return $found_uring;
+}
+
 # return smb.conf parameters applicable to @path, based on the underlying
 # filesystem type
 sub get_fs_specific_conf($$)
@@ -239,6 +256,9 @@ sub check_env($$)
 	fileserver          => [],
 	fileserver_smb1     => [],
 	fileserver_smb1_done => ["fileserver_smb1"],
+	fileserver_uring    => [],
+	fileserver_nameidx  => [],
+	fileserver_fairq    => [],
 	maptoguest          => [],
 	ktest               => [],
 
@@ -354,6 +374,8 @@ sub setup_nt4_dc_smb1
 [global]
 	client min protocol = CORE
 	server min protocol = LANMAN1
+	dbwrap_shm:locking.tdb = yes
+	dbwrap_shm:brlock.tdb = yes
 ";
 	return $self->setup_nt4_dc($path, $conf, "NT4SMB1", "LCLNT4DC2SMB1");
 }
@@ -1970,6 +1992,10 @@ sub setup_fileserver
 	set quota command = $prefix_abs/getset_quota.py
 	veto files : user1 = /user1file/
 	veto files : +group1 = /group1file/
+[open_cache]
+	path = $share_dir
+	comment = smbd open cache test share
+	smbd open cache size = 1048576
 [tarmode]
 	path = $tarmode_sharedir
 	comment = tar test share
@@ -2085,6 +2111,13 @@ sub setup_fileserver
 	veto files : user2 = /user2file/
 	veto files : +group2 = /group2file/
 
+[veto_files_dircache]
+	path = $veto_sharedir
+	veto files = /veto_name*/
+	veto files : user2 = /user2file/
+	veto files : +group2 = /group2file/
+	smbd dir cache timeout = 60
+
 [delete_yes_unwrite]
 	read only = no
 	path = $delete_unwrite_sharedir
@@ -2117,11 +2150,29 @@ sub setup_fileserver
 	acl_xattr:security_acl_name = user.hackme
 	read only = no
 
+[ea_xattr_cache]
+	path = $share_dir
+	vfs objects = acl_xattr xattr_cache
+	acl_xattr:security_acl_name = user.hackme
+	read only = no
+
+[deferred_close]
+	path = $share_dir
+	smbd deferred close = 500
+	read only = no
+
 [io_uring]
 	path = $share_dir
 	vfs objects = acl_xattr fake_acls xattr_tdb streams_depot time_audit full_audit io_uring
 	read only = no
 
+[io_uring_async_dosmode]
+	path = $share_dir
+	vfs objects = io_uring
+	store dos attributes = yes
+	smbd async dosmode = yes
+	read only = no
+
 [homes]
 	comment = Home directories
 	browseable = No
@@ -2264,6 +2315,83 @@ sub setup_fileserver_smb1_done
 	return $self->return_alias_env($path, $dep_env);
 }
 
+sub setup_fileserver_uring
+{
+	my ($self, $path) = @_;
+
+	# Without io_uring support smbd silently falls back to the
+	# socket transport, don't pretend to test io_uring then
+	if (not $self->have_smb2_uring()) {
+		return "UNKNOWN";
+	}
+
+	my $prefix_abs = abs_path($path);
+	# The profile counters let test_smb2_uring.sh check that
+	# the connections really use the ring.
+	#
+	# vfs_io_uring and vfs_aio_pthread only do async opens
+	# without multi channel.
+	my $conf = "
+[global]
+	smb2 io uring = yes
+	smbd profiling level = count
+	server multi channel support = no
+
+[io_uring_openat]
+	path = $prefix_abs/share
+	read only = no
+	vfs objects = io_uring
+	io_uring:openat = yes
+
+[vfs_aio_pthread]
+	path = $prefix_abs/share
+	read only = no
+	vfs objects = aio_pthread
+	aio_pthread:aio open = yes
+";
+	return $self->setup_fileserver($path, $conf, "FILESERVERURING");
+}
+
+sub setup_fileserver_nameidx
+{
+	my ($self, $path) = @_;
+
+	# The profile counters let test_smbd_name_index.sh check that
+	# the lookups really use the index
+	my $conf = "
+[global]
+	smbd name index dirs = 4
+	smbd profiling level = count
+";
+	return $self->setup_fileserver($path, $conf, "FSNAMEINDEX");
+}
+
+sub setup_fileserver_fairq
+{
+	my ($self, $path) = @_;
+	my $prefix_abs = abs_path($path);
+
+	# With a single slot smb2.fairq can check the order in which
+	# the queued requests of two tree connects are served, the
+	# delayed reads make sure the requests really queue up
+	my $conf = "
+[global]
+	smb2 fair queue depth = 1
+
+[fairq]
+	path = $prefix_abs/share
+	read only = no
+	vfs objects = delay_inject
+	delay_inject:pread_send = 50
+
+[fairq_limited]
+	path = $prefix_abs/share
+	read only = no
+	smb2 bandwidth limit = 2M
+";
+	return $self->setup_fileserver($path, $conf, "FSFAIRQ");
+}
+
 sub setup_ktest
 {
 	my ($self, $prefix) = @_;
@@ -2691,6 +2819,9 @@ sub provision($$)
 	my $logdir="$prefix_abs/logs";
 	push(@dirs,$logdir);
 
+	my $sidecardir="$prefix_abs/streams_xattr_sidecar";
+	push(@dirs,$sidecardir);
+
 	my $driver32dir="$shrdir/W32X86";
 	push(@dirs,$driver32dir);
 
@@ -2805,6 +2936,11 @@ sub provision($$)
 	chmod 0755, $lockdir;
 	chmod 0755, $piddir;
 
+	##
+	## sidecardir must not be writable by others
+	##
+	chmod 0755, $sidecardir;
+
 
 	##
 	## Create a directory without permissions to enter
@@ -3327,6 +3463,24 @@ sub provision($$)
 	fruit:metadata = stream
 	fruit:veto_appledouble = no
 
+[vfs_fruit_metadata_cache]
+	path = $shrdir
+	vfs objects = catia fruit streams_xattr acl_xattr xattr_tdb
+	fruit:resource = file
+	fruit:metadata = netatalk
+	fruit:locking = netatalk
+	fruit:encoding = native
+	fruit:veto_appledouble = no
+	fruit:metadata cache size = 1M
+
+[vfs_fruit_metadata_stream_cache]
+	path = $shrdir
+	vfs objects = fruit streams_xattr acl_xattr xattr_tdb
+	fruit:resource = stream
+	fruit:metadata = stream
+	fruit:veto_appledouble = no
+	fruit:metadata cache size = 1M
+
 [vfs_fruit_stream_depot]
 	path = $shrdir
 	vfs objects = fruit streams_depot acl_xattr xattr_tdb
@@ -3368,6 +3522,15 @@ sub provision($$)
 	fruit:delete_empty_adfiles = true
 	fruit:veto_appledouble = no
 
+[vfs_fruit_copyfile_exdev]
+	path = $shrdir
+	vfs objects = fruit streams_xattr acl_xattr xattr_tdb
+	fruit:resource = file
+	fruit:metadata = stream
+	# Only the first 16 MiB segment of a copy gets copied
+	# with copy_file_range(), then the fallback has to run
+	vfs_default:copy_file_range EXDEV offset = 16777216
+
 [vfs_fruit_zero_fileid]
 	path = $shrdir
 	vfs objects = fruit streams_xattr acl_xattr xattr_tdb
@@ -3618,6 +3781,12 @@ sub provision($$)
 	copy = tmp
 	vfs objects = streams_xattr xattr_tdb
 
+[streams_xattr_sidecar]
+	copy = tmp
+	vfs objects = streams_xattr xattr_tdb
+	streams_xattr:sidecar_threshold = 4096
+	streams_xattr:sidecar_directory = $sidecardir
+
 [streams_xattr_nostrict]
 	copy = tmp
 	strict rename = no
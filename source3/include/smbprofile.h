@@ -243,6 +243,51 @@ struct tevent_context;
 	SMBPROFILE_STATS_IOBYTES(smb2_break) \
 	SMBPROFILE_STATS_SECTION_END \
 	\
+	SMBPROFILE_STATS_SECTION_START(smb2_signing, "SMB2 Signing") \
+	SMBPROFILE_STATS_BYTES(smb2_sign) \
+	SMBPROFILE_STATS_BYTES(smb2_sign_check) \
+	SMBPROFILE_STATS_SECTION_END \
+	\
+	SMBPROFILE_STATS_SECTION_START(smb2_credits, "SMB2 Credits") \
+	SMBPROFILE_STATS_COUNT(smb2_credits_window_grow) \
+	SMBPROFILE_STATS_COUNT(smb2_credits_window_shrink) \
+	SMBPROFILE_STATS_COUNT(smb2_credits_limited) \
+	SMBPROFILE_STATS_SECTION_END \
+	\
+	SMBPROFILE_STATS_SECTION_START(smb2_fairq, "SMB2 Fair Queue") \
+	SMBPROFILE_STATS_BASIC(smb2_fairq_wait) \
+	SMBPROFILE_STATS_COUNT(smb2_fairq_throttled) \
+	SMBPROFILE_STATS_SECTION_END \
+	\
+	SMBPROFILE_STATS_SECTION_START(open_cache, "Open Cache") \
+	SMBPROFILE_STATS_COUNT(open_cache_sd_hit) \
+	SMBPROFILE_STATS_COUNT(open_cache_sd_miss) \
+	SMBPROFILE_STATS_COUNT(open_cache_dosmode_hit) \
+	SMBPROFILE_STATS_COUNT(open_cache_dosmode_miss) \
+	SMBPROFILE_STATS_SECTION_END \
+	\
+	SMBPROFILE_STATS_SECTION_START(deferred_close, "Deferred Close") \
+	SMBPROFILE_STATS_COUNT(deferred_close_park) \
+	SMBPROFILE_STATS_COUNT(deferred_close_reuse) \
+	SMBPROFILE_STATS_COUNT(deferred_close_conflict) \
+	SMBPROFILE_STATS_COUNT(deferred_close_timeout) \
+	SMBPROFILE_STATS_SECTION_END \
+	\
+	SMBPROFILE_STATS_SECTION_START(name_index, "Name Index") \
+	SMBPROFILE_STATS_COUNT(name_index_build) \
+	SMBPROFILE_STATS_COUNT(name_index_hit) \
+	SMBPROFILE_STATS_COUNT(name_index_small) \
+	SMBPROFILE_STATS_COUNT(name_index_drop_all) \
+	SMBPROFILE_STATS_SECTION_END \
+	\
+	SMBPROFILE_STATS_SECTION_START(smb2_uring, "SMB2 io_uring") \
+	SMBPROFILE_STATS_COUNT(smb2_uring_start) \
+	SMBPROFILE_STATS_COUNT(smb2_uring_send) \
+	SMBPROFILE_STATS_COUNT(smb2_uring_send_zc) \
+	SMBPROFILE_STATS_COUNT(smb2_uring_send_zc_copied) \
+	SMBPROFILE_STATS_COUNT(smb2_uring_send_zc_unsupported) \
+	SMBPROFILE_STATS_SECTION_END \
+	\
 	SMBPROFILE_STATS_END
 
 /* this file defines the profile structure in the profile shared
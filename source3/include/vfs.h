@@ -381,9 +381,11 @@
  * Change to Version 49 - will ship with 4.19
  * Version 49 - remove seekdir and telldir
  * Version 49 - remove "sbuf" argument from readdir_fn()
+ * Change to Version 50 - will ship with 4.22
+ * Version 50 - Add state_epoch and state_valid to struct fsp_lease
  */
 
-#define SMB_VFS_INTERFACE_VERSION 49
+#define SMB_VFS_INTERFACE_VERSION 50
 
 /*
     All intercepted VFS operations must be declared as static functions inside module source
@@ -416,6 +418,12 @@ struct fsp_lease {
 	struct smbd_server_connection *sconn;
 	struct tevent_timer *timeout;
 	struct smb2_lease lease;
+	/*
+	 * unique_content_epoch of the file's share mode data when
+	 * "lease" was last read from leases.tdb.
+	 */
+	uint64_t state_epoch;
+	bool state_valid;
 };
 
 typedef struct files_struct {
@@ -23,6 +23,7 @@
 #include "dbwrap/dbwrap_private.h"
 #include "dbwrap/dbwrap_open.h"
 #include "dbwrap/dbwrap_tdb.h"
+#include "dbwrap/dbwrap_shm.h"
 #include "dbwrap/dbwrap_ctdb.h"
 #include "lib/param/param.h"
 #include "lib/cluster_support.h"
@@ -53,6 +54,66 @@ bool db_is_local(const char *name)
 	return true;
 }
 
+/*
+ * "dbwrap_shm:locking.tdb = yes" puts locking.tdb into the shared
+ * memory table in locking.shm. The table is sized on the tdb hash
+ * size by default.
+ */
+static struct db_context *db_open_shm_for_tdb(TALLOC_CTX *mem_ctx,
+					      const char *name,
+					      const char *base,
+					      int hash_size, int tdb_flags,
+					      int open_flags, mode_t mode,
+					      enum dbwrap_lock_order lock_order)
+{
+	struct db_context *result = NULL;
+	uint32_t num_buckets = 1;
+	uint32_t bucket_size;
+	int buckets;
+	int size;
+	size_t len = strlen(name);
+	char *shm_name = NULL;
+
+	buckets = lp_parm_int(-1,
+			       "dbwrap_shm_buckets",
+			       base,
+			       hash_size > 0 ? hash_size : 1024);
+	while ((num_buckets < (uint32_t)buckets) &&
+	       (num_buckets < (1U << 24))) {
+		num_buckets <<= 1;
+	}
+
+	size = lp_parm_int(-1, "dbwrap_shm_bucket_size", base, 8192);
+	if (size < 64) {
+		size = 64;
+	}
+	bucket_size = ((uint32_t)size + 63) & ~63U;
+
+	if ((len > 4) && (strcmp(name + len - 4, ".tdb") == 0)) {
+		shm_name = talloc_asprintf(talloc_tos(),
+					   "%.*s.shm",
+					   (int)(len - 4),
+					   name);
+	} else {
+		shm_name = talloc_asprintf(talloc_tos(), "%s.shm", name);
+	}
+	if (shm_name == NULL) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	result = db_open_shm(mem_ctx,
+			     shm_name,
+			     num_buckets,
+			     bucket_size,
+			     tdb_flags,
+			     open_flags,
+			     mode,
+			     lock_order);
+	TALLOC_FREE(shm_name);
+	return result;
+}
+
 /**
  * open a database
  */
@@ -177,6 +238,28 @@ struct db_context *db_open(TALLOC_CTX *mem_ctx,
 		}
 	}
 
+	if ((tdb_flags & TDB_CLEAR_IF_FIRST) &&
+	    lp_parm_bool(-1, "dbwrap_shm", base, false)) {
+		result = db_open_shm_for_tdb(mem_ctx,
+					     name,
+					     base,
+					     hash_size,
+					     tdb_flags,
+					     open_flags,
+					     mode,
+					     lock_order);
+		if (result != NULL) {
+			return result;
+		}
+		if (errno != ENOSYS) {
+			DBG_ERR("Could not open %s in shared memory: %s\n",
+				base,
+				strerror(errno));
+			return NULL;
+		}
+		DBG_WARNING("No robust mutexes, using tdb for %s\n", base);
+	}
+
 	lp_ctx = loadparm_init_s3(mem_ctx, loadparm_s3_helpers());
 
 	if (hash_size == 0) {
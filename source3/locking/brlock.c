@@ -42,6 +42,15 @@
 
 static struct db_context *brlock_db;
 
+/*
+ * lock_data is sorted by start offset, locks with the same start are
+ * kept in the order they were granted. max_last[i] is the highest
+ * last byte of lock_data[0..i]. Together they give the range of locks
+ * that can overlap a given range with two binary searches, see
+ * brl_overlap_candidates(). max_last is built on demand and dropped
+ * when the lock ranges change.
+ */
+
 struct byte_range_lock {
 	struct files_struct *fsp;
 	TALLOC_CTX *req_mem_ctx;
@@ -49,6 +58,7 @@ struct byte_range_lock {
 	unsigned int num_locks;
 	bool modified;
 	struct lock_struct *lock_data;
+	uint64_t *max_last;
 	struct db_record *record;
 };
 
@@ -328,6 +338,162 @@ static bool brl_conflict_other(const struct lock_struct *lock,
 	return false;
 }
 
+/****************************************************************************
+ Last byte of a lock for the overlap search. Mirrors byte_range_overlap():
+ the {0, 0} lock never overlaps anything and zero length locks cover
+ the byte in front of them.
+****************************************************************************/
+
+static uint64_t brl_last(const struct lock_struct *lck)
+{
+	if (lck->start == 0 && lck->size == 0) {
+		return 0;
+	}
+	if (!byte_range_valid(lck->start, lck->size)) {
+		return UINT64_MAX;
+	}
+	return lck->start + lck->size - 1;
+}
+
+/****************************************************************************
+ Index of the first lock starting after ofs.
+****************************************************************************/
+
+static unsigned int brl_upper_bound(const struct lock_struct *locks,
+				    unsigned int num_locks,
+				    uint64_t ofs)
+{
+	unsigned int lo = 0, hi = num_locks;
+
+	while (lo < hi) {
+		unsigned int mid = lo + (hi - lo) / 2;
+
+		if (locks[mid].start <= ofs) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+/****************************************************************************
+ Index of the first lock starting at or after ofs.
+****************************************************************************/
+
+static unsigned int brl_lower_bound(const struct lock_struct *locks,
+				    unsigned int num_locks,
+				    uint64_t ofs)
+{
+	unsigned int lo = 0, hi = num_locks;
+
+	while (lo < hi) {
+		unsigned int mid = lo + (hi - lo) / 2;
+
+		if (locks[mid].start < ofs) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+/****************************************************************************
+ Restore the sort order after POSIX splits and merges. Those only move a
+ few locks, so an insertion sort is cheap and keeps equal starts in order.
+****************************************************************************/
+
+static void brl_sort_locks(struct lock_struct *locks, unsigned int num_locks)
+{
+	unsigned int i, j;
+
+	for (i = 1; i < num_locks; i++) {
+		struct lock_struct tmp;
+
+		if (locks[i-1].start <= locks[i].start) {
+			continue;
+		}
+
+		tmp = locks[i];
+		j = brl_upper_bound(locks, i, tmp.start);
+		memmove(&locks[j+1], &locks[j], (i - j) * sizeof(*locks));
+		locks[j] = tmp;
+	}
+}
+
+static void brl_ranges_changed(struct byte_range_lock *br_lck)
+{
+	TALLOC_FREE(br_lck->max_last);
+	br_lck->modified = true;
+}
+
+static bool brl_build_max_last(struct byte_range_lock *br_lck)
+{
+	const struct lock_struct *locks = br_lck->lock_data;
+	uint64_t max_last = 0;
+	unsigned int i;
+
+	br_lck->max_last = talloc_array(br_lck, uint64_t, br_lck->num_locks);
+	if (br_lck->max_last == NULL) {
+		return false;
+	}
+
+	for (i = 0; i < br_lck->num_locks; i++) {
+		max_last = MAX(max_last, brl_last(&locks[i]));
+		br_lck->max_last[i] = max_last;
+	}
+	return true;
+}
+
+/****************************************************************************
+ Find the locks that might overlap probe: lock_data[*pfirst..*pend).
+ Locks starting after the last byte of probe can't overlap, neither can
+ locks in front of the first one whose max_last reaches probe's start.
+ Without memory for max_last we fall back to a linear scan.
+****************************************************************************/
+
+static void brl_overlap_candidates(struct byte_range_lock *br_lck,
+				   const struct lock_struct *probe,
+				   unsigned int *pfirst,
+				   unsigned int *pend)
+{
+	const uint64_t *max_last = NULL;
+	uint64_t last = brl_last(probe);
+	unsigned int lo, hi;
+
+	*pfirst = 0;
+	*pend = br_lck->num_locks;
+
+	if (br_lck->num_locks == 0) {
+		return;
+	}
+	if (probe->start == 0 && probe->size == 0) {
+		*pend = 0;
+		return;
+	}
+
+	*pend = brl_upper_bound(br_lck->lock_data, br_lck->num_locks, last);
+
+	if ((br_lck->max_last == NULL) && !brl_build_max_last(br_lck)) {
+		return;
+	}
+	max_last = br_lck->max_last;
+
+	lo = 0;
+	hi = *pend;
+	while (lo < hi) {
+		unsigned int mid = lo + (hi - lo) / 2;
+
+		if (max_last[mid] < probe->start) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	*pfirst = lo;
+}
+
 /****************************************************************************
  Open up the brlock.tdb database.
 ****************************************************************************/
@@ -378,7 +544,7 @@ void brl_shutdown(void)
 NTSTATUS brl_lock_windows_default(struct byte_range_lock *br_lck,
 				  struct lock_struct *plock)
 {
-	unsigned int i;
+	unsigned int i, end;
 	files_struct *fsp = br_lck->fsp;
 	struct lock_struct *locks = br_lck->lock_data;
 	NTSTATUS status;
@@ -391,7 +557,9 @@ NTSTATUS brl_lock_windows_default(struct byte_range_lock *br_lck,
 		return NT_STATUS_INVALID_LOCK_RANGE;
 	}
 
-	for (i=0; i < br_lck->num_locks; i++) {
+	brl_overlap_candidates(br_lck, plock, &i, &end);
+
+	for (; i < end; i++) {
 		/* Do any Windows or POSIX locks conflict ? */
 		if (brl_conflict(&locks[i], plock)) {
 			if (!serverid_exists(&locks[i].context.pid)) {
@@ -443,10 +611,14 @@ NTSTATUS brl_lock_windows_default(struct byte_range_lock *br_lck,
 		goto fail;
 	}
 
-	memcpy(&locks[br_lck->num_locks], plock, sizeof(struct lock_struct));
+	/* Behind all locks with the same start, see brl_unlock */
+	i = brl_upper_bound(locks, br_lck->num_locks, plock->start);
+	memmove(&locks[i+1], &locks[i],
+		(br_lck->num_locks - i) * sizeof(struct lock_struct));
+	memcpy(&locks[i], plock, sizeof(struct lock_struct));
 	br_lck->num_locks += 1;
 	br_lck->lock_data = locks;
-	br_lck->modified = True;
+	brl_ranges_changed(br_lck);
 
 	return NT_STATUS_OK;
  fail:
@@ -837,14 +1009,11 @@ static NTSTATUS brl_lock_posix(struct byte_range_lock *br_lck,
 					     LEVEL2_CONTEND_POSIX_BRL);
 	}
 
-	/* Try and add the lock in order, sorted by lock start. */
-	for (i=0; i < count; i++) {
-		struct lock_struct *curr_lock = &tp[i];
+	/* Splits and merges can move locks around */
+	brl_sort_locks(tp, count);
 
-		if (curr_lock->start <= plock->start) {
-			continue;
-		}
-	}
+	/* Add the lock in order, sorted by lock start. */
+	i = brl_upper_bound(tp, count, plock->start);
 
 	if (i < count) {
 		memmove(&tp[i+1], &tp[i],
@@ -900,7 +1069,7 @@ static NTSTATUS brl_lock_posix(struct byte_range_lock *br_lck,
 	TALLOC_FREE(br_lck->lock_data);
 	br_lck->lock_data = tp;
 	locks = tp;
-	br_lck->modified = True;
+	brl_ranges_changed(br_lck);
 
 	/* A successful downgrade from write to read lock can trigger a lock
 	   re-evalutation where waiting readers can now proceed. */
@@ -974,14 +1143,24 @@ bool brl_unlock_windows_default(struct byte_range_lock *br_lck,
 	SMB_ASSERT(plock->lock_type == UNLOCK_LOCK);
 
 
-	for (i = 0; i < br_lck->num_locks; i++) {
+	/*
+	 * Locks with the same start are in the order they were
+	 * granted, so stacked locks go away first in, first out.
+	 */
+	i = brl_lower_bound(locks, br_lck->num_locks, plock->start);
+
+	for (; i < br_lck->num_locks; i++) {
 		struct lock_struct *lock = &locks[i];
 
+		if (lock->start != plock->start) {
+			/* we didn't find it */
+			return False;
+		}
+
 		/* Only remove our own locks that match in start, size, and flavour. */
 		if (brl_same_context(&lock->context, &plock->context) &&
 					lock->fnum == plock->fnum &&
 					lock->lock_flav == WINDOWS_LOCK &&
-					lock->start == plock->start &&
 					lock->size == plock->size ) {
 			deleted_lock_type = lock->lock_type;
 			break;
@@ -995,7 +1174,7 @@ bool brl_unlock_windows_default(struct byte_range_lock *br_lck,
 
 	ARRAY_DEL_ELEMENT(locks, i, br_lck->num_locks);
 	br_lck->num_locks -= 1;
-	br_lck->modified = True;
+	brl_ranges_changed(br_lck);
 
 	/* Unlock the underlying POSIX regions. */
 	if(lp_posix_locking(br_lck->fsp->conn->params)) {
@@ -1121,6 +1300,8 @@ static bool brl_unlock_posix(struct byte_range_lock *br_lck,
 						count);
 	}
 
+	brl_sort_locks(tp, count);
+
 	/* Realloc so we don't leak entries per unlock call. */
 	if (count) {
 		tp = talloc_realloc(br_lck, tp, struct lock_struct, count);
@@ -1141,7 +1322,7 @@ static bool brl_unlock_posix(struct byte_range_lock *br_lck,
 	TALLOC_FREE(br_lck->lock_data);
 	locks = tp;
 	br_lck->lock_data = tp;
-	br_lck->modified = True;
+	brl_ranges_changed(br_lck);
 
 	return True;
 }
@@ -1185,12 +1366,14 @@ bool brl_locktest(struct byte_range_lock *br_lck,
 		  const struct lock_struct *rw_probe)
 {
 	bool ret = True;
-	unsigned int i;
+	unsigned int i, end;
 	struct lock_struct *locks = br_lck->lock_data;
 	files_struct *fsp = br_lck->fsp;
 
+	brl_overlap_candidates(br_lck, rw_probe, &i, &end);
+
 	/* Make sure existing locks don't conflict */
-	for (i=0; i < br_lck->num_locks; i++) {
+	for (; i < end; i++) {
 		/*
 		 * Our own locks don't conflict.
 		 */
@@ -1253,7 +1436,7 @@ NTSTATUS brl_lockquery(struct byte_range_lock *br_lck,
 		enum brl_type *plock_type,
 		enum brl_flavour lock_flav)
 {
-	unsigned int i;
+	unsigned int i, end;
 	struct lock_struct lock;
 	const struct lock_struct *locks = br_lck->lock_data;
 	files_struct *fsp = br_lck->fsp;
@@ -1267,8 +1450,10 @@ NTSTATUS brl_lockquery(struct byte_range_lock *br_lck,
 	lock.lock_type = *plock_type;
 	lock.lock_flav = lock_flav;
 
+	brl_overlap_candidates(br_lck, &lock, &i, &end);
+
 	/* Make sure existing locks don't conflict */
-	for (i=0; i < br_lck->num_locks; i++) {
+	for (; i < end; i++) {
 		const struct lock_struct *exlock = &locks[i];
 		bool conflict = False;
 
@@ -1589,7 +1774,7 @@ int brl_forall(void (*fn)(struct file_id id, struct server_id pid,
 
 static void byte_range_lock_flush(struct byte_range_lock *br_lck)
 {
-	unsigned i;
+	unsigned i, j;
 	struct lock_struct *locks = br_lck->lock_data;
 
 	if (!br_lck->modified) {
@@ -1597,20 +1782,20 @@ static void byte_range_lock_flush(struct byte_range_lock *br_lck)
 		goto done;
 	}
 
-	i = 0;
-
-	while (i < br_lck->num_locks) {
+	/*
+	 * Autocleanup of locks of processes that conflicted and do
+	 * not exist anymore, keeping the sort order.
+	 */
+	for (i = 0, j = 0; i < br_lck->num_locks; i++) {
 		if (locks[i].context.pid.pid == 0) {
-			/*
-			 * Autocleanup, the process conflicted and does not
-			 * exist anymore.
-			 */
-			locks[i] = locks[br_lck->num_locks-1];
-			br_lck->num_locks -= 1;
-		} else {
-			i += 1;
+			continue;
 		}
+		if (i != j) {
+			locks[j] = locks[i];
+		}
+		j += 1;
 	}
+	br_lck->num_locks = j;
 
 	if (br_lck->num_locks == 0) {
 		/* No locks - delete this entry. */
@@ -1667,6 +1852,12 @@ static bool brl_parse_data(struct byte_range_lock *br_lck, TDB_DATA data)
 		DEBUG(1, ("talloc_memdup failed\n"));
 		return false;
 	}
+
+	/*
+	 * Records written by an older smbd are not sorted
+	 */
+	brl_sort_locks(br_lck->lock_data, br_lck->num_locks);
+
 	return true;
 }
 
@@ -1282,6 +1282,33 @@ void share_mode_set_old_write_time(struct share_mode_lock *lck, struct timespec
 	}
 }
 
+/*
+ * The state of a lease is changed in leases.tdb while holding the
+ * share mode lock of its file. Marking the share mode data modified
+ * gives it a new unique_content_epoch, so smbd can tell from the
+ * epoch whether a lease it has in memory is still current.
+ */
+void share_mode_lease_changed(struct share_mode_lock *lck)
+{
+	struct share_mode_data *d = share_mode_lock_assert_private_data(lck);
+	d->modified = true;
+}
+
+/*
+ * Returns false if the share mode data will get a new epoch when the
+ * lock is released.
+ */
+bool share_mode_content_epoch(struct share_mode_lock *lck, uint64_t *epoch)
+{
+	struct share_mode_data *d = share_mode_lock_assert_private_data(lck);
+
+	if (d->modified) {
+		return false;
+	}
+	*epoch = d->unique_content_epoch;
+	return true;
+}
+
 const char *share_mode_servicepath(struct share_mode_lock *lck)
 {
 	struct share_mode_data *d = share_mode_lock_assert_private_data(lck);
@@ -2095,11 +2095,24 @@ static NTSTATUS vfswrap_offload_read_recv(struct tevent_req *req,
 	return NT_STATUS_OK;
 }
 
+/*
+ * copy_file_range() and FICLONERANGE run in the pthreadpool. Copies
+ * larger than a segment, like a macOS copyfile of a whole file, are
+ * split into segments, up to VFSWRAP_OFFLOAD_MAX_JOBS of them are
+ * copied at the same time.
+ */
+#define VFSWRAP_OFFLOAD_SEGMENT_SIZE (16*1024*1024)
+#define VFSWRAP_OFFLOAD_MAX_JOBS 4
+
+/* Reset on the first ENOSYS or EOPNOTSUPP */
+static bool vfswrap_try_copy_file_range = true;
+
 struct vfswrap_offload_write_state {
 	uint8_t *buf;
 	bool read_lck_locked;
 	bool write_lck_locked;
 	DATA_BLOB *token;
+	uint32_t fsctl;
 	struct tevent_context *src_ev;
 	struct files_struct *src_fsp;
 	off_t src_off;
@@ -2110,6 +2123,31 @@ struct vfswrap_offload_write_state {
 	off_t remaining;
 	off_t copied;
 	size_t next_io_size;
+
+	/* Copy jobs in the pthreadpool */
+	struct pthreadpool_tevent *pool;
+	struct vfswrap_offload_job *jobs;
+	size_t max_jobs;
+	size_t num_jobs;
+	off_t next_job_off;
+	int job_err;
+	/* copy_file_range() fails with EXDEV from here on */
+	off_t exdev_off;
+};
+
+struct vfswrap_offload_job {
+	struct vfswrap_offload_job *prev, *next;
+	/* NULL once the request is gone */
+	struct tevent_req *req;
+	bool reflink;
+	int src_fd;
+	off_t src_off;
+	int dst_fd;
+	off_t dst_off;
+	off_t len;
+	off_t copied;
+	bool exdev;
+	int err;
 };
 
 static void vfswrap_offload_write_cleanup(struct tevent_req *req,
@@ -2128,7 +2166,24 @@ static void vfswrap_offload_write_cleanup(struct tevent_req *req,
 	state->dst_fsp = NULL;
 }
 
+/*
+ * A running job can't be stopped, leave it to finish on its own
+ */
+static int vfswrap_offload_write_state_destructor(
+	struct vfswrap_offload_write_state *state)
+{
+	struct vfswrap_offload_job *job = NULL;
+
+	while ((job = state->jobs) != NULL) {
+		DLIST_REMOVE(state->jobs, job);
+		job->req = NULL;
+		talloc_steal(NULL, job);
+	}
+	return 0;
+}
+
 static NTSTATUS vfswrap_offload_fast_copy(struct tevent_req *req, int fsctl);
+static NTSTATUS vfswrap_offload_write_fallback(struct tevent_req *req);
 static NTSTATUS vfswrap_offload_write_loop(struct tevent_req *req);
 
 static struct tevent_req *vfswrap_offload_write_send(
@@ -2146,7 +2201,6 @@ static struct tevent_req *vfswrap_offload_write_send(
 	struct vfswrap_offload_write_state *state = NULL;
 	/* off_t is signed! */
 	off_t max_offset = INT64_MAX - to_copy;
-	off_t num = to_copy;
 	files_struct *src_fsp = NULL;
 	NTSTATUS status;
 	bool ok;
@@ -2159,14 +2213,27 @@ static struct tevent_req *vfswrap_offload_write_send(
 
 	*state = (struct vfswrap_offload_write_state) {
 		.token = token,
+		.fsctl = fsctl,
 		.src_off = transfer_offset,
 		.dst_ev = ev,
 		.dst_fsp = dest_fsp,
 		.dst_off = dest_off,
 		.to_copy = to_copy,
 		.remaining = to_copy,
+		.pool = handle->conn->sconn->pool,
 	};
 
+	/*
+	 * Let the segments from this offset of the range on fail
+	 * with EXDEV after the ones before were copied.
+	 *
+	 * The option is only there to test the fallback code.
+	 */
+	state->exdev_off = lp_parm_ulonglong(SNUM(handle->conn),
+					     "vfs_default",
+					     "copy_file_range EXDEV offset",
+					     INT64_MAX);
+
 	status = vfs_offload_token_ctx_init(handle->conn->sconn->client,
 					    &vfswrap_offload_ctx);
 	if (tevent_req_nterror(req, status)) {
@@ -2174,6 +2241,7 @@ static struct tevent_req *vfswrap_offload_write_send(
 	}
 
 	tevent_req_set_cleanup_fn(req, vfswrap_offload_write_cleanup);
+	talloc_set_destructor(state, vfswrap_offload_write_state_destructor);
 
 	switch (fsctl) {
 	case FSCTL_DUP_EXTENTS_TO_FILE:
@@ -2181,7 +2249,6 @@ static struct tevent_req *vfswrap_offload_write_send(
 
 	case FSCTL_SRV_COPYCHUNK:
 	case FSCTL_SRV_COPYCHUNK_WRITE:
-		num = MIN(to_copy, COPYCHUNK_MAX_TOTAL_LEN);
 		break;
 
 	case FSCTL_OFFLOAD_WRITE:
@@ -2273,20 +2340,15 @@ static struct tevent_req *vfswrap_offload_write_send(
 
 	status = vfswrap_offload_fast_copy(req, fsctl);
 	if (NT_STATUS_IS_OK(status)) {
-		tevent_req_done(req);
-		return tevent_req_post(req, ev);
+		/* The copy jobs are running */
+		return req;
 	}
 	if (!NT_STATUS_EQUAL(status, NT_STATUS_MORE_PROCESSING_REQUIRED)) {
 		tevent_req_nterror(req, status);
 		return tevent_req_post(req, ev);
 	}
 
-	state->buf = talloc_array(state, uint8_t, num);
-	if (tevent_req_nomem(state->buf, req)) {
-		return tevent_req_post(req, ev);
-	}
-
-	status = vfswrap_offload_write_loop(req);
+	status = vfswrap_offload_write_fallback(req);
 	if (!NT_STATUS_IS_OK(status)) {
 		tevent_req_nterror(req, status);
 		return tevent_req_post(req, ev);
@@ -2295,16 +2357,327 @@ static struct tevent_req *vfswrap_offload_write_send(
 	return req;
 }
 
+/*
+ * Whether the destination range of a job is a hole inside the file,
+ * as after the client set the end of file before copying. Holes in
+ * the source can then be skipped, the range reads back as zeros.
+ */
+static bool vfswrap_offload_job_dst_is_hole(struct vfswrap_offload_job *job)
+{
+#ifdef SEEK_DATA
+	struct stat st;
+	off_t data;
+	int ret;
+
+	ret = fstat(job->dst_fd, &st);
+	if ((ret == -1) || (st.st_size < job->dst_off + job->len)) {
+		return false;
+	}
+
+	data = lseek(job->dst_fd, job->dst_off, SEEK_DATA);
+	if (data == -1) {
+		/* ENXIO: no data up to the end of file */
+		return (errno == ENXIO);
+	}
+	return (data >= job->dst_off + job->len);
+#else
+	return false;
+#endif
+}
+
+static void vfswrap_offload_job_do(void *private_data)
+{
+	struct vfswrap_offload_job *job = talloc_get_type_abort(
+		private_data, struct vfswrap_offload_job);
+	off_t src_off = job->src_off;
+	off_t dst_off = job->dst_off;
+	off_t end = job->src_off + job->len;
+	bool skip_holes;
+	ssize_t nwritten;
+	int ret;
+
+	if (job->reflink) {
+		ret = copy_reflink(job->src_fd,
+				   job->src_off,
+				   job->dst_fd,
+				   job->dst_off,
+				   job->len);
+		if (ret == -1) {
+			job->err = errno;
+			return;
+		}
+		job->copied = job->len;
+		return;
+	}
+
+	if (job->exdev) {
+		job->err = EXDEV;
+		return;
+	}
+
+	skip_holes = vfswrap_offload_job_dst_is_hole(job);
+
+	while (src_off < end) {
+		off_t n = end - src_off;
+
+#ifdef SEEK_DATA
+		if (skip_holes) {
+			off_t data, hole;
+
+			data = lseek(job->src_fd, src_off, SEEK_DATA);
+			if ((data == -1) && (errno == ENXIO)) {
+				/* Only a hole up to the end of file */
+				data = end;
+			} else if (data == -1) {
+				skip_holes = false;
+				continue;
+			}
+			if (data > src_off) {
+				data = MIN(data, end);
+				job->copied += data - src_off;
+				dst_off += data - src_off;
+				src_off = data;
+				continue;
+			}
+
+			hole = lseek(job->src_fd, src_off, SEEK_HOLE);
+			if (hole > src_off) {
+				n = MIN(n, hole - src_off);
+			}
+		}
+#endif
+
+		nwritten = copy_file_range(job->src_fd,
+					   &src_off,
+					   job->dst_fd,
+					   &dst_off,
+					   n,
+					   0);
+		if (nwritten == -1) {
+			job->err = errno;
+			return;
+		}
+		if (nwritten == 0) {
+			break;
+		}
+		if (nwritten > n) {
+			job->err = EIO;
+			return;
+		}
+		job->copied += nwritten;
+	}
+}
+
+static int vfswrap_offload_job_destructor(struct vfswrap_offload_job *job)
+{
+	return -1;
+}
+
+static void vfswrap_offload_job_done(struct tevent_req *subreq);
+
+/*
+ * Start copy jobs up to state->max_jobs. An allocation failure is
+ * reported in state->job_err once the running jobs are done.
+ */
+static void vfswrap_offload_next_jobs(struct tevent_req *req)
+{
+	struct vfswrap_offload_write_state *state = tevent_req_data(
+		req, struct vfswrap_offload_write_state);
+
+	while ((state->job_err == 0) &&
+	       (state->num_jobs < state->max_jobs) &&
+	       (state->next_job_off < state->to_copy))
+	{
+		struct vfswrap_offload_job *job = NULL;
+		struct tevent_req *subreq = NULL;
+		off_t len = state->to_copy - state->next_job_off;
+		bool ok;
+
+		if (state->fsctl != FSCTL_DUP_EXTENTS_TO_FILE) {
+			len = MIN(len, VFSWRAP_OFFLOAD_SEGMENT_SIZE);
+		}
+
+		job = talloc(state, struct vfswrap_offload_job);
+		if (job == NULL) {
+			state->job_err = ENOMEM;
+			return;
+		}
+		*job = (struct vfswrap_offload_job) {
+			.req = req,
+			.reflink = (state->fsctl == FSCTL_DUP_EXTENTS_TO_FILE),
+			.src_fd = fsp_get_io_fd(state->src_fsp),
+			.src_off = state->src_off + state->next_job_off,
+			.dst_fd = fsp_get_io_fd(state->dst_fsp),
+			.dst_off = state->dst_off + state->next_job_off,
+			.len = len,
+			.exdev = (state->next_job_off >= state->exdev_off),
+		};
+
+		subreq = pthreadpool_tevent_job_send(job,
+						     state->dst_ev,
+						     state->pool,
+						     vfswrap_offload_job_do,
+						     job);
+		if (subreq == NULL) {
+			TALLOC_FREE(job);
+			state->job_err = ENOMEM;
+			return;
+		}
+		tevent_req_set_callback(subreq, vfswrap_offload_job_done, job);
+
+		talloc_set_destructor(job, vfswrap_offload_job_destructor);
+
+		DLIST_ADD(state->jobs, job);
+		state->next_job_off += len;
+		state->num_jobs += 1;
+
+		/*
+		 * The job uses the fds of both handles, a close has
+		 * to wait for it.
+		 */
+		ok = aio_add_req_to_fsp(state->src_fsp, subreq);
+		if (ok && (state->dst_fsp != state->src_fsp)) {
+			ok = aio_add_req_to_fsp(state->dst_fsp, subreq);
+		}
+		if (!ok) {
+			state->job_err = ENOMEM;
+			return;
+		}
+	}
+}
+
+static void vfswrap_offload_fast_copy_finish(struct tevent_req *req);
+
+static void vfswrap_offload_job_done(struct tevent_req *subreq)
+{
+	struct vfswrap_offload_job *job = tevent_req_callback_data(
+		subreq, struct vfswrap_offload_job);
+	struct tevent_req *req = job->req;
+	struct vfswrap_offload_write_state *state = NULL;
+	int ret;
+
+	ret = pthreadpool_tevent_job_recv(subreq);
+	TALLOC_FREE(subreq);
+	talloc_set_destructor(job, NULL);
+
+	if (req == NULL) {
+		/* Nobody waits for us anymore */
+		TALLOC_FREE(job);
+		return;
+	}
+	state = tevent_req_data(req, struct vfswrap_offload_write_state);
+	DLIST_REMOVE(state->jobs, job);
+
+	if (ret != 0) {
+		if (ret != EAGAIN) {
+			job->err = ret;
+		} else {
+			/*
+			 * The pthreadpool failed to create a new
+			 * thread, copy synchronously.
+			 */
+			vfswrap_offload_job_do(job);
+		}
+	}
+
+	state->num_jobs -= 1;
+
+	if (job->err != 0) {
+		DBG_DEBUG("%s src [%s]:[%jd] dst [%s]:[%jd] n [%jd] "
+			  "failed: %s\n",
+			  job->reflink ? "copy_reflink" : "copy_file_range",
+			  fsp_str_dbg(state->src_fsp),
+			  (intmax_t)job->src_off,
+			  fsp_str_dbg(state->dst_fsp),
+			  (intmax_t)job->dst_off,
+			  (intmax_t)job->len,
+			  strerror(job->err));
+		if (state->job_err == 0) {
+			state->job_err = job->err;
+		}
+	} else {
+		state->copied += job->copied;
+	}
+	TALLOC_FREE(job);
+
+	vfswrap_offload_next_jobs(req);
+	if (state->num_jobs != 0) {
+		return;
+	}
+
+	vfswrap_offload_fast_copy_finish(req);
+}
+
+static void vfswrap_offload_fast_copy_finish(struct tevent_req *req)
+{
+	struct vfswrap_offload_write_state *state = tevent_req_data(
+		req, struct vfswrap_offload_write_state);
+	NTSTATUS status;
+
+	if (state->job_err == 0) {
+		state->remaining = state->to_copy - state->copied;
+		tevent_req_done(req);
+		return;
+	}
+
+	if (state->fsctl == FSCTL_DUP_EXTENTS_TO_FILE) {
+		DBG_INFO("copy_reflink() failed: %s\n",
+			 strerror(state->job_err));
+		tevent_req_nterror(req, map_nt_error_from_unix(state->job_err));
+		return;
+	}
+
+	switch (state->job_err) {
+	case EOPNOTSUPP:
+	case ENOSYS:
+		vfswrap_try_copy_file_range = false;
+		FALL_THROUGH;
+	case EXDEV:
+		/*
+		 * Start over with reads and writes, rewriting what
+		 * other jobs copied already.
+		 */
+		state->copied = 0;
+		state->remaining = state->to_copy;
+		status = vfswrap_offload_write_fallback(req);
+		break;
+	default:
+		status = map_nt_error_from_unix(state->job_err);
+		if (NT_STATUS_EQUAL(status, NT_STATUS_MORE_PROCESSING_REQUIRED)) {
+			/* Avoid triggering the fallback */
+			status = NT_STATUS_INTERNAL_ERROR;
+		}
+		break;
+	}
+
+	if (tevent_req_nterror(req, status)) {
+		return;
+	}
+}
+
+/*
+ * Start the copy jobs, returns NT_STATUS_OK if they are running
+ */
+static NTSTATUS vfswrap_offload_start_jobs(struct tevent_req *req)
+{
+	struct vfswrap_offload_write_state *state = tevent_req_data(
+		req, struct vfswrap_offload_write_state);
+
+	vfswrap_offload_next_jobs(req);
+	if (state->num_jobs == 0) {
+		return map_nt_error_from_unix(state->job_err);
+	}
+	return NT_STATUS_OK;
+}
+
 static NTSTATUS vfswrap_offload_fast_copy(struct tevent_req *req, int fsctl)
 {
 	struct vfswrap_offload_write_state *state = tevent_req_data(
 		req, struct vfswrap_offload_write_state);
 	struct lock_struct lck;
-	ssize_t nwritten;
-	NTSTATUS status;
+	size_t max_threads;
 	bool same_file;
 	bool ok;
-	static bool try_copy_file_range = true;
 
 	same_file = file_id_equal(&state->src_fsp->file_id,
 				  &state->dst_fsp->file_id);
@@ -2330,28 +2703,17 @@ static NTSTATUS vfswrap_offload_fast_copy(struct tevent_req *req, int fsctl)
 	}
 
 	if (fsctl == FSCTL_DUP_EXTENTS_TO_FILE) {
-		int ret;
-
 		ok = change_to_user_and_service_by_fsp(state->dst_fsp);
 		if (!ok) {
 			return NT_STATUS_INTERNAL_ERROR;
 		}
 
-		ret = copy_reflink(fsp_get_io_fd(state->src_fsp),
-				   state->src_off,
-				   fsp_get_io_fd(state->dst_fsp),
-				   state->dst_off,
-				   state->to_copy);
-		if (ret == -1) {
-			DBG_INFO("copy_reflink() failed: %s\n", strerror(errno));
-			return map_nt_error_from_unix(errno);
-		}
-
-		state->copied = state->to_copy;
-		goto done;
+		/* A single FICLONERANGE */
+		state->max_jobs = 1;
+		return vfswrap_offload_start_jobs(req);
 	}
 
-	if (!try_copy_file_range) {
+	if (!vfswrap_try_copy_file_range) {
 		return NT_STATUS_MORE_PROCESSING_REQUIRED;
 	}
 
@@ -2390,69 +2752,35 @@ static NTSTATUS vfswrap_offload_fast_copy(struct tevent_req *req, int fsctl)
 		return NT_STATUS_FILE_LOCK_CONFLICT;
 	}
 
-	while (state->remaining > 0) {
-		nwritten = copy_file_range(fsp_get_io_fd(state->src_fsp),
-					   &state->src_off,
-					   fsp_get_io_fd(state->dst_fsp),
-					   &state->dst_off,
-					   state->remaining,
-					   0);
-		if (nwritten == -1) {
-			DBG_DEBUG("copy_file_range src [%s]:[%jd] dst [%s]:[%jd] "
-				  "n [%jd] failed: %s\n",
-				  fsp_str_dbg(state->src_fsp),
-				  (intmax_t)state->src_off,
-				  fsp_str_dbg(state->dst_fsp),
-				  (intmax_t)state->dst_off,
-				  (intmax_t)state->remaining,
-				  strerror(errno));
-			switch (errno) {
-			case EOPNOTSUPP:
-			case ENOSYS:
-				try_copy_file_range = false;
-				status = NT_STATUS_MORE_PROCESSING_REQUIRED;
-				break;
-			case EXDEV:
-				status = NT_STATUS_MORE_PROCESSING_REQUIRED;
-				break;
-			default:
-				status = map_nt_error_from_unix(errno);
-				if (NT_STATUS_EQUAL(
-					    status,
-					    NT_STATUS_MORE_PROCESSING_REQUIRED))
-				{
-					/* Avoid triggering the fallback */
-					status = NT_STATUS_INTERNAL_ERROR;
-				}
-				break;
-			}
-			return status;
-		}
+	max_threads = pthreadpool_tevent_max_threads(state->pool);
+	state->max_jobs = MAX(1, MIN(max_threads, VFSWRAP_OFFLOAD_MAX_JOBS));
 
-		if (state->remaining < nwritten) {
-			DBG_DEBUG("copy_file_range src [%s] dst [%s] "
-				  "n [%jd] remaining [%jd]\n",
-				  fsp_str_dbg(state->src_fsp),
-				  fsp_str_dbg(state->dst_fsp),
-				  (intmax_t)nwritten,
-				  (intmax_t)state->remaining);
-			return NT_STATUS_INTERNAL_ERROR;
-		}
+	return vfswrap_offload_start_jobs(req);
+}
 
-		if (nwritten == 0) {
-			break;
-		}
-		state->copied += nwritten;
-		state->remaining -= nwritten;
+/*
+ * Copy with reads and writes: for streams, overlapping ranges in the
+ * same file and where copy_file_range() does not work.
+ */
+static NTSTATUS vfswrap_offload_write_fallback(struct tevent_req *req)
+{
+	struct vfswrap_offload_write_state *state = tevent_req_data(
+		req, struct vfswrap_offload_write_state);
+	bool ok;
+
+	state->buf = talloc_array(state,
+				  uint8_t,
+				  MIN(state->to_copy, COPYCHUNK_MAX_TOTAL_LEN));
+	if (state->buf == NULL) {
+		return NT_STATUS_NO_MEMORY;
 	}
 
-done:
-	/*
-	 * Tell the req cleanup function there's no need to call
-	 * change_to_user_and_service_by_fsp() on the dst handle.
-	 */
-	state->dst_fsp = NULL;
-	return NT_STATUS_OK;
+	ok = change_to_user_and_service_by_fsp(state->src_fsp);
+	if (!ok) {
+		return NT_STATUS_INTERNAL_ERROR;
+	}
+
+	return vfswrap_offload_write_loop(req);
 }
 
 static void vfswrap_offload_write_read_done(struct tevent_req *subreq);
@@ -37,6 +37,7 @@
 #include "lib/adouble.h"
 #include "lib/util_macstreams.h"
 #include "source3/smbd/dir.h"
+#include "lib/util/memcache.h"
 
 /*
  * Enhanced OS X and Netatalk compatibility
@@ -102,7 +103,6 @@ static int vfs_fruit_debug_level = DBGC_VFS;
 
 static struct global_fruit_config {
 	bool nego_aapl;	/* client negotiated AAPL */
-
 } global_fruit_config;
 
 #undef DBGC_CLASS
@@ -148,6 +148,12 @@ struct fruit_config_data {
 	bool readdir_attr_rsize;
 	bool readdir_attr_finder_info;
 	bool readdir_attr_max_access;
+	struct memcache *meta_cache; /* "fruit:metadata cache size" */
+	/*
+	 * Streams are xattrs of the base file, changing them changes
+	 * the base file's ctime
+	 */
+	bool meta_cache_streams;
 	/* Recursion guard. Will go away when we have STATX. */
 	bool in_openat_pathref_fsp;
 };
@@ -279,6 +285,7 @@ static int init_fruit_config(vfs_handle_struct *handle)
 	struct fruit_config_data *config;
 	int enumval = -1;
 	const char *tm_size_str = NULL;
+	size_t cache_size;
 
 	config = talloc_zero(handle->conn, struct fruit_config_data);
 	if (!config) {
@@ -384,6 +391,25 @@ static int init_fruit_config(vfs_handle_struct *handle)
 		SNUM(handle->conn), FRUIT_PARAM_TYPE_NAME,
 		"validate_afpinfo", true);
 
+	config->meta_cache_streams =
+		str_list_check(lp_vfs_objects(SNUM(handle->conn)),
+			       "streams_xattr") &&
+		(conv_str_size(lp_parm_const_string(SNUM(handle->conn),
+						    "streams_xattr",
+						    "sidecar_threshold",
+						    NULL)) == 0);
+
+	cache_size = conv_str_size(lp_parm_const_string(
+		SNUM(handle->conn), FRUIT_PARAM_TYPE_NAME,
+		"metadata cache size", NULL));
+	if (cache_size > 0) {
+		config->meta_cache = memcache_init(config, cache_size);
+		if (config->meta_cache == NULL) {
+			DBG_ERR("memcache_init failed\n");
+			return -1;
+		}
+	}
+
 	SMB_VFS_HANDLE_SET_DATA(handle, config,
 				NULL, struct fruit_config_data,
 				return -1);
@@ -474,29 +500,234 @@ static bool del_fruit_stream(TALLOC_CTX *mem_ctx, unsigned int *num_streams,
 	return true;
 }
 
-static bool ad_empty_finderinfo(const struct adouble *ad)
+static bool ai_empty_finderinfo(const AfpInfo *ai)
 {
 	int cmp;
 	char emptybuf[ADEDLEN_FINDERI] = {0};
-	char *fi = NULL;
 
-	fi = ad_get_entry(ad, ADEID_FINDERI);
-	if (fi == NULL) {
-		DBG_ERR("Missing FinderInfo in struct adouble [%p]\n", ad);
+	cmp = memcmp(emptybuf, &ai->afpi_FinderInfo[0], ADEDLEN_FINDERI);
+	return (cmp == 0);
+}
+
+/*****************************************************************************
+ * Metadata cache
+ *
+ * Every stat with Netatalk metadata and every directory entry returned
+ * with AAPL readdir_attr reads and parses the metadata and looks up the
+ * resource fork. With "fruit:metadata cache size" the results are kept
+ * per tree connect, keyed by file id. An entry is only used while
+ * the change time of the file is unchanged: writing the metadata or
+ * resource fork xattr updates it. Entries are only created for files
+ * whose change time is a few seconds in the past, as file systems
+ * update it with a coarse clock.
+ *
+ * Resource forks in AppleDouble files don't change the file's change
+ * time, their size is never cached. Neither are AFP_AfpInfo and
+ * AFP_Resource streams unless vfs_streams_xattr stores them.
+ *****************************************************************************/
+
+#define FRUIT_META_CACHE_RACY_SECS 2
+
+#define FRUIT_META_CACHE_NETATALK	0x01
+#define FRUIT_META_CACHE_AFPINFO	0x02
+#define FRUIT_META_CACHE_RFORK		0x04
+
+struct fruit_meta_cache_key {
+	struct file_id id;
+};
+
+struct fruit_meta_cache_entry {
+	struct timespec ctime;
+	uint8_t valid;		/* FRUIT_META_CACHE_* */
+	bool have_netatalk;	/* Netatalk metadata xattr exists */
+	bool have_create_date;
+	uint32_t create_date;
+	bool have_finder_info;
+	uint8_t finder_info[ADEDLEN_FINDERI];
+	uint64_t rfork_size;
+};
+
+/*
+ * The cache of the share if "what" of smb_fname can be cached
+ */
+static struct memcache *fruit_meta_cache_get(
+	vfs_handle_struct *handle,
+	const struct smb_filename *smb_fname,
+	uint8_t what)
+{
+	struct fruit_config_data *config = NULL;
+	bool cacheable = false;
+
+	SMB_VFS_HANDLE_GET_DATA(handle, config,
+				struct fruit_config_data,
+				return NULL);
+
+	if ((config->meta_cache == NULL) ||
+	    !VALID_STAT(smb_fname->st) ||
+	    (smb_fname->twrp != 0))
+	{
+		return NULL;
+	}
+
+	switch (what) {
+	case FRUIT_META_CACHE_NETATALK:
+		cacheable = true;
+		break;
+	case FRUIT_META_CACHE_AFPINFO:
+		cacheable = config->meta_cache_streams;
+		break;
+	case FRUIT_META_CACHE_RFORK:
+		if (config->rsrc == FRUIT_RSRC_XATTR) {
+			cacheable = true;
+		} else if (config->rsrc == FRUIT_RSRC_STREAM) {
+			cacheable = config->meta_cache_streams;
+		}
+		break;
+	}
+
+	return cacheable ? config->meta_cache : NULL;
+}
+
+static DATA_BLOB fruit_meta_cache_key(struct fruit_meta_cache_key *key,
+				      vfs_handle_struct *handle,
+				      const struct smb_filename *smb_fname)
+{
+	/* No padding in the key */
+	ZERO_STRUCTP(key);
+	key->id = SMB_VFS_NEXT_FILE_ID_CREATE(handle, &smb_fname->st);
+	return data_blob_const(key, sizeof(*key));
+}
+
+/*
+ * Look up what the cache knows about smb_fname. Returns true if that
+ * includes "what". Otherwise *e is what is still valid and can be
+ * completed and passed to fruit_meta_cache_store().
+ */
+static bool fruit_meta_cache_fetch(vfs_handle_struct *handle,
+				   const struct smb_filename *smb_fname,
+				   uint8_t what,
+				   struct fruit_meta_cache_entry *e)
+{
+	struct memcache *cache = NULL;
+	struct fruit_meta_cache_key k;
+	DATA_BLOB key;
+	DATA_BLOB value;
+	bool ok;
+
+	*e = (struct fruit_meta_cache_entry) {
+		.ctime = smb_fname->st.st_ex_ctime,
+	};
+
+	cache = fruit_meta_cache_get(handle, smb_fname, what);
+	if (cache == NULL) {
 		return false;
 	}
 
-	cmp = memcmp(emptybuf, fi, ADEDLEN_FINDERI);
-	return (cmp == 0);
+	key = fruit_meta_cache_key(&k, handle, smb_fname);
+
+	ok = memcache_lookup(cache, FRUIT_META_CACHE, key, &value);
+	if (!ok || (value.length != sizeof(*e))) {
+		return false;
+	}
+	memcpy(e, value.data, sizeof(*e));
+
+	if (timespec_compare(&e->ctime, &smb_fname->st.st_ex_ctime) != 0) {
+		memcache_delete(cache, FRUIT_META_CACHE, key);
+		*e = (struct fruit_meta_cache_entry) {
+			.ctime = smb_fname->st.st_ex_ctime,
+		};
+		return false;
+	}
+
+	return ((e->valid & what) == what);
 }
 
-static bool ai_empty_finderinfo(const AfpInfo *ai)
+static void fruit_meta_cache_store(vfs_handle_struct *handle,
+				   const struct smb_filename *smb_fname,
+				   uint8_t what,
+				   const struct fruit_meta_cache_entry *e)
 {
-	int cmp;
-	char emptybuf[ADEDLEN_FINDERI] = {0};
+	struct memcache *cache = NULL;
+	struct timespec now = timespec_current();
+	struct fruit_meta_cache_key k;
+	DATA_BLOB key;
 
-	cmp = memcmp(emptybuf, &ai->afpi_FinderInfo[0], ADEDLEN_FINDERI);
-	return (cmp == 0);
+	cache = fruit_meta_cache_get(handle, smb_fname, what);
+	if (cache == NULL) {
+		return;
+	}
+	if (e->ctime.tv_sec + FRUIT_META_CACHE_RACY_SECS > now.tv_sec) {
+		return;
+	}
+
+	key = fruit_meta_cache_key(&k, handle, smb_fname);
+
+	memcache_add(cache,
+		     FRUIT_META_CACHE,
+		     key,
+		     data_blob_const(e, sizeof(*e)));
+}
+
+/*
+ * The parts of the Netatalk metadata of smb_fname we care about,
+ * returns false if there is none
+ */
+static bool fruit_netatalk_meta(vfs_handle_struct *handle,
+				const struct smb_filename *smb_fname,
+				struct fruit_meta_cache_entry *e)
+{
+	struct adouble *ad = NULL;
+	uint32_t t;
+	char *fi = NULL;
+	int err;
+
+	if (fruit_meta_cache_fetch(handle,
+				   smb_fname,
+				   FRUIT_META_CACHE_NETATALK,
+				   e))
+	{
+		if (!e->have_netatalk) {
+			errno = ENOENT;
+		}
+		return e->have_netatalk;
+	}
+
+	ad = ad_get_meta_fsp(talloc_tos(), handle, smb_fname);
+	if (ad == NULL) {
+		err = errno;
+		if (err == ENOENT) {
+			e->valid |= FRUIT_META_CACHE_NETATALK;
+			e->have_netatalk = false;
+			fruit_meta_cache_store(handle,
+					       smb_fname,
+					       FRUIT_META_CACHE_NETATALK,
+					       e);
+		}
+		errno = err;
+		return false;
+	}
+
+	e->valid |= FRUIT_META_CACHE_NETATALK;
+	e->have_netatalk = true;
+
+	if (ad_getdate(ad, AD_DATE_UNIX | AD_DATE_CREATE, &t) == 0) {
+		e->have_create_date = true;
+		e->create_date = t;
+	}
+
+	fi = ad_get_entry(ad, ADEID_FINDERI);
+	if (fi != NULL) {
+		e->have_finder_info = true;
+		memcpy(e->finder_info, fi, ADEDLEN_FINDERI);
+	}
+
+	TALLOC_FREE(ad);
+
+	fruit_meta_cache_store(handle,
+			       smb_fname,
+			       FRUIT_META_CACHE_NETATALK,
+			       e);
+	return true;
 }
 
 /**
@@ -505,9 +736,8 @@ static bool ai_empty_finderinfo(const AfpInfo *ai)
 static void update_btime(vfs_handle_struct *handle,
 			 struct smb_filename *smb_fname)
 {
-	uint32_t t;
 	struct timespec creation_time = {0};
-	struct adouble *ad;
+	struct fruit_meta_cache_entry meta;
 	struct fruit_config_data *config = NULL;
 
 	SMB_VFS_HANDLE_GET_DATA(handle, config, struct fruit_config_data,
@@ -524,17 +754,14 @@ static void update_btime(vfs_handle_struct *handle,
 		return;
 	}
 
-	ad = ad_get_meta_fsp(talloc_tos(), handle, smb_fname);
-	if (ad == NULL) {
+	if (!fruit_netatalk_meta(handle, smb_fname, &meta)) {
 		return;
 	}
-	if (ad_getdate(ad, AD_DATE_UNIX | AD_DATE_CREATE, &t) != 0) {
-		TALLOC_FREE(ad);
+	if (!meta.have_create_date) {
 		return;
 	}
-	TALLOC_FREE(ad);
 
-	creation_time.tv_sec = convert_uint32_t_to_time_t(t);
+	creation_time.tv_sec = convert_uint32_t_to_time_t(meta.create_date);
 	update_stat_ex_create_time(&smb_fname->st, creation_time);
 
 	return;
@@ -938,12 +1165,27 @@ static bool readdir_attr_meta_finderi_stream(
 	AfpInfo *ai)
 {
 	struct smb_filename *stream_name = NULL;
+	struct fruit_meta_cache_entry meta;
 	files_struct *fsp = NULL;
 	ssize_t nread;
 	NTSTATUS status;
 	bool ok;
 	uint8_t buf[AFP_INFO_SIZE];
 
+	if (fruit_meta_cache_fetch(handle,
+				   smb_fname,
+				   FRUIT_META_CACHE_AFPINFO,
+				   &meta))
+	{
+		if (!meta.have_finder_info) {
+			return false;
+		}
+		memcpy(&ai->afpi_FinderInfo[0],
+		       meta.finder_info,
+		       AFP_FinderSize);
+		return true;
+	}
+
 	status = synthetic_pathref(talloc_tos(),
 				   handle->conn->cwd_fsp,
 				   smb_fname->base_name,
@@ -979,6 +1221,15 @@ static bool readdir_attr_meta_finderi_stream(
 
 	TALLOC_FREE(stream_name);
 
+	if (NT_STATUS_EQUAL(status, NT_STATUS_OBJECT_NAME_NOT_FOUND)) {
+		meta.valid |= FRUIT_META_CACHE_AFPINFO;
+		meta.have_finder_info = false;
+		fruit_meta_cache_store(handle,
+				       smb_fname,
+				       FRUIT_META_CACHE_AFPINFO,
+				       &meta);
+		return false;
+	}
 	if (!NT_STATUS_IS_OK(status)) {
 		return false;
 	}
@@ -994,6 +1245,14 @@ static bool readdir_attr_meta_finderi_stream(
 	memcpy(&ai->afpi_FinderInfo[0], &buf[AFP_OFF_FinderInfo],
 	       AFP_FinderSize);
 
+	meta.valid |= FRUIT_META_CACHE_AFPINFO;
+	meta.have_finder_info = true;
+	memcpy(meta.finder_info, &buf[AFP_OFF_FinderInfo], AFP_FinderSize);
+	fruit_meta_cache_store(handle,
+			       smb_fname,
+			       FRUIT_META_CACHE_AFPINFO,
+			       &meta);
+
 	ok = true;
 
 fail:
@@ -1009,23 +1268,18 @@ static bool readdir_attr_meta_finderi_netatalk(
 	const struct smb_filename *smb_fname,
 	AfpInfo *ai)
 {
-	struct adouble *ad = NULL;
-	char *p = NULL;
+	struct fruit_meta_cache_entry meta;
 
-	ad = ad_get_meta_fsp(talloc_tos(), handle, smb_fname);
-	if (ad == NULL) {
+	if (!fruit_netatalk_meta(handle, smb_fname, &meta)) {
 		return false;
 	}
 
-	p = ad_get_entry(ad, ADEID_FINDERI);
-	if (p == NULL) {
+	if (!meta.have_finder_info) {
 		DBG_ERR("No ADEID_FINDERI for [%s]\n", smb_fname->base_name);
-		TALLOC_FREE(ad);
 		return false;
 	}
 
-	memcpy(&ai->afpi_FinderInfo[0], p, AFP_FinderSize);
-	TALLOC_FREE(ad);
+	memcpy(&ai->afpi_FinderInfo[0], meta.finder_info, AFP_FinderSize);
 	return true;
 }
 
@@ -1114,9 +1368,18 @@ static uint64_t readdir_attr_rfork_size_stream(
 	const struct smb_filename *smb_fname)
 {
 	struct smb_filename *stream_name = NULL;
+	struct fruit_meta_cache_entry meta;
 	int ret;
 	uint64_t rfork_size;
 
+	if (fruit_meta_cache_fetch(handle,
+				   smb_fname,
+				   FRUIT_META_CACHE_RFORK,
+				   &meta))
+	{
+		return meta.rfork_size;
+	}
+
 	stream_name = synthetic_smb_fname(talloc_tos(),
 					  smb_fname->base_name,
 					  AFPRESOURCE_STREAM_NAME,
@@ -1129,6 +1392,14 @@ static uint64_t readdir_attr_rfork_size_stream(
 
 	ret = SMB_VFS_STAT(handle->conn, stream_name);
 	if (ret != 0) {
+		if (errno == ENOENT) {
+			meta.valid |= FRUIT_META_CACHE_RFORK;
+			meta.rfork_size = 0;
+			fruit_meta_cache_store(handle,
+					       smb_fname,
+					       FRUIT_META_CACHE_RFORK,
+					       &meta);
+		}
 		TALLOC_FREE(stream_name);
 		return 0;
 	}
@@ -1136,6 +1407,13 @@ static uint64_t readdir_attr_rfork_size_stream(
 	rfork_size = stream_name->st.st_ex_size;
 	TALLOC_FREE(stream_name);
 
+	meta.valid |= FRUIT_META_CACHE_RFORK;
+	meta.rfork_size = rfork_size;
+	fruit_meta_cache_store(handle,
+			       smb_fname,
+			       FRUIT_META_CACHE_RFORK,
+			       &meta);
+
 	return rfork_size;
 }
 
@@ -3252,21 +3530,19 @@ static int fruit_stat_meta_netatalk(vfs_handle_struct *handle,
 				    struct smb_filename *smb_fname,
 				    bool follow_links)
 {
-	struct adouble *ad = NULL;
+	struct fruit_meta_cache_entry meta;
 
 	/* Populate the stat struct with info from the base file. */
 	if (fruit_stat_base(handle, smb_fname, follow_links) == -1) {
 		return -1;
 	}
 
-	ad = ad_get_meta_fsp(talloc_tos(), handle, smb_fname);
-	if (ad == NULL) {
+	if (!fruit_netatalk_meta(handle, smb_fname, &meta)) {
 		DBG_INFO("fruit_stat_meta %s: %s\n",
 			 smb_fname_str_dbg(smb_fname), strerror(errno));
 		errno = ENOENT;
 		return -1;
 	}
-	TALLOC_FREE(ad);
 
 	smb_fname->st.st_ex_size = AFP_INFO_SIZE;
 	smb_fname->st.st_ex_ino = hash_inode(&smb_fname->st,
@@ -3785,7 +4061,7 @@ static NTSTATUS fruit_streaminfo_meta_netatalk(
 {
 	struct stream_struct *stream = *pstreams;
 	unsigned int num_streams = *pnum_streams;
-	struct adouble *ad = NULL;
+	struct fruit_meta_cache_entry meta;
 	bool is_fi_empty;
 	int i;
 	bool ok;
@@ -3818,13 +4094,16 @@ static NTSTATUS fruit_streaminfo_meta_netatalk(
 		}
 	}
 
-	ad = ad_get_meta_fsp(talloc_tos(), handle, smb_fname);
-	if (ad == NULL) {
+	if (!fruit_netatalk_meta(handle, smb_fname, &meta)) {
 		return NT_STATUS_OK;
 	}
 
-	is_fi_empty = ad_empty_finderinfo(ad);
-	TALLOC_FREE(ad);
+	if (!meta.have_finder_info) {
+		DBG_ERR("Missing FinderInfo for [%s]\n",
+			smb_fname_str_dbg(smb_fname));
+	}
+	is_fi_empty = meta.have_finder_info &&
+		all_zero(meta.finder_info, ADEDLEN_FINDERI);
 
 	if (is_fi_empty) {
 		return NT_STATUS_OK;
@@ -49,6 +49,8 @@ struct open_how;
 #include <liburing.h>
 
 struct vfs_io_uring_request;
+struct vfs_io_uring_personality;
+struct vfs_io_uring_open;
 
 struct vfs_io_uring_config {
 	struct io_uring uring;
@@ -59,6 +61,17 @@ struct vfs_io_uring_config {
 	bool need_retry;
 	struct vfs_io_uring_request *queue;
 	struct vfs_io_uring_request *pending;
+	/* See vfs_io_uring_getxattrat_send() */
+	bool getxattr_supported;
+	struct vfs_io_uring_personality *personalities;
+	/* See vfs_io_uring_openat() */
+	bool openat_supported;
+	struct vfs_io_uring_open *opens;
+	struct {
+		const struct files_struct *fsp;
+		int fd;
+		SMB_STRUCT_STAT st;
+	} open_stat;
 };
 
 struct vfs_io_uring_request {
@@ -139,8 +152,11 @@ static void vfs_io_uring_config_destroy(struct vfs_io_uring_config *config,
 	}
 }
 
+static void vfs_io_uring_orphan_opens(struct vfs_io_uring_config *config);
+
 static int vfs_io_uring_config_destructor(struct vfs_io_uring_config *config)
 {
+	vfs_io_uring_orphan_opens(config);
 	vfs_io_uring_config_destroy(config, -EUCLEAN, __location__);
 	return 0;
 }
@@ -181,12 +197,16 @@ static int vfs_io_uring_connect(vfs_handle_struct *handle, const char *service,
 	unsigned num_entries;
 	bool sqpoll;
 	unsigned flags = 0;
+	struct io_uring_probe *probe = NULL;
+	bool want_getxattr = false;
+	bool want_openat;
 
 	config = talloc_zero(handle->conn, struct vfs_io_uring_config);
 	if (config == NULL) {
 		DEBUG(0, ("talloc_zero() failed\n"));
 		return -1;
 	}
+	config->open_stat.fd = -1;
 
 	SMB_VFS_HANDLE_SET_DATA(handle, config,
 				NULL, struct vfs_io_uring_config,
@@ -229,6 +249,33 @@ static int vfs_io_uring_connect(vfs_handle_struct *handle, const char *service,
 	}
 #endif /* HAVE_IO_URING_RING_DONTFORK */
 
+#ifdef HAVE_IO_URING_PREP_GETXATTR
+	want_getxattr = lp_parm_bool(SNUM(handle->conn),
+				     "io_uring",
+				     "getxattr",
+				     true);
+#endif /* HAVE_IO_URING_PREP_GETXATTR */
+	want_openat = lp_parm_bool(SNUM(handle->conn),
+				   "io_uring",
+				   "openat",
+				   false);
+	if (want_getxattr || want_openat) {
+		probe = io_uring_get_probe_ring(&config->uring);
+	}
+	if (probe != NULL) {
+#ifdef HAVE_IO_URING_PREP_GETXATTR
+		config->getxattr_supported =
+			want_getxattr &&
+			io_uring_opcode_supported(probe, IORING_OP_GETXATTR) &&
+			io_uring_opcode_supported(probe, IORING_OP_FGETXATTR);
+#endif /* HAVE_IO_URING_PREP_GETXATTR */
+		config->openat_supported =
+			want_openat &&
+			io_uring_opcode_supported(probe, IORING_OP_OPENAT) &&
+			io_uring_opcode_supported(probe, IORING_OP_STATX);
+		io_uring_free_probe(probe);
+	}
+
 	config->fde = tevent_add_fd(handle->conn->sconn->ev_ctx,
 				    config,
 				    config->uring.ring_fd,
@@ -804,14 +851,835 @@ static int vfs_io_uring_fsync_recv(struct tevent_req *req,
 	return 0;
 }
 
+/*
+ * Each distinct unix token uses one personality, a connection
+ * rarely sees more than a few of them.
+ */
+#define VFS_IO_URING_MAX_PERSONALITIES 16
+
+struct vfs_io_uring_personality {
+	uid_t uid;
+	gid_t gid;
+	uint32_t ngroups;
+	gid_t *groups;
+	int id;
+};
+
+/*
+ * Requests punted to an io_uring worker or submitted later from
+ * vfs_io_uring_fd_handler() would run with whatever credentials are
+ * current at that time. Requests that are subject to permission
+ * checks carry a personality registered for the current unix token.
+ */
+static int vfs_io_uring_get_personality(struct vfs_io_uring_config *config,
+					const struct security_unix_token *tok)
+{
+	struct vfs_io_uring_personality *p = NULL;
+	size_t num = talloc_array_length(config->personalities);
+	gid_t *groups = NULL;
+	size_t i;
+	int id;
+
+	for (i = 0; i < num; i++) {
+		p = &config->personalities[i];
+
+		if ((p->uid != tok->uid) ||
+		    (p->gid != tok->gid) ||
+		    (p->ngroups != tok->ngroups))
+		{
+			continue;
+		}
+		if ((tok->ngroups == 0) ||
+		    (memcmp(p->groups,
+			    tok->groups,
+			    sizeof(gid_t) * tok->ngroups) == 0))
+		{
+			return p->id;
+		}
+	}
+
+	if (num >= VFS_IO_URING_MAX_PERSONALITIES) {
+		return -1;
+	}
+
+	if (tok->ngroups > 0) {
+		groups = talloc_memdup(config,
+				       tok->groups,
+				       sizeof(gid_t) * tok->ngroups);
+		if (groups == NULL) {
+			return -1;
+		}
+	}
+
+	p = talloc_realloc(config,
+			   config->personalities,
+			   struct vfs_io_uring_personality,
+			   num + 1);
+	if (p == NULL) {
+		TALLOC_FREE(groups);
+		return -1;
+	}
+	config->personalities = p;
+
+	id = io_uring_register_personality(&config->uring);
+	if (id < 0) {
+		DBG_DEBUG("io_uring_register_personality() failed: %s\n",
+			  strerror(-id));
+		TALLOC_FREE(groups);
+		config->personalities = talloc_realloc(
+			config,
+			config->personalities,
+			struct vfs_io_uring_personality,
+			num);
+		return -1;
+	}
+
+	config->personalities[num] = (struct vfs_io_uring_personality) {
+		.uid = tok->uid,
+		.gid = tok->gid,
+		.ngroups = tok->ngroups,
+		.groups = talloc_move(config->personalities, &groups),
+		.id = id,
+	};
+
+	return id;
+}
+
+#ifdef HAVE_IO_URING_PREP_GETXATTR
+
+struct vfs_io_uring_getxattrat_state {
+	char *path;
+	char *xattr_name;
+	uint8_t *xattr_value;
+	ssize_t xattr_size;
+	struct vfs_aio_state vfs_aio_state;
+	struct vfs_io_uring_request ur;
+};
+
+static void vfs_io_uring_getxattrat_next_done(struct tevent_req *subreq);
+static void vfs_io_uring_getxattrat_completion(struct vfs_io_uring_request *cur,
+					       const char *location);
+
+static struct tevent_req *vfs_io_uring_getxattrat_send(
+			TALLOC_CTX *mem_ctx,
+			struct tevent_context *ev,
+			struct vfs_handle_struct *handle,
+			files_struct *dir_fsp,
+			const struct smb_filename *smb_fname,
+			const char *xattr_name,
+			size_t alloc_hint)
+{
+	struct tevent_req *req = NULL;
+	struct tevent_req *subreq = NULL;
+	struct vfs_io_uring_getxattrat_state *state = NULL;
+	struct vfs_io_uring_config *config = NULL;
+	struct files_struct *fsp = smb_fname->fsp;
+	int personality = -1;
+	int fd = -1;
+
+	SMB_VFS_HANDLE_GET_DATA(handle, config,
+				struct vfs_io_uring_config,
+				smb_panic(__location__));
+
+	req = tevent_req_create(mem_ctx, &state,
+				struct vfs_io_uring_getxattrat_state);
+	if (req == NULL) {
+		return NULL;
+	}
+	state->ur.config = config;
+	state->ur.req = req;
+	state->ur.completion_fn = vfs_io_uring_getxattrat_completion;
+
+	if (fsp != NULL) {
+		fd = fsp_get_pathref_fd(fsp);
+	}
+	if (fd != -1 &&
+	    config->getxattr_supported &&
+	    alloc_hint <= UINT_MAX &&
+	    (!fsp->fsp_flags.is_pathref || fsp->fsp_flags.have_proc_fds))
+	{
+		personality = vfs_io_uring_get_personality(
+			config, get_current_utok(dir_fsp->conn));
+	}
+
+	if (personality == -1) {
+		subreq = SMB_VFS_NEXT_GETXATTRAT_SEND(state,
+						      ev,
+						      handle,
+						      dir_fsp,
+						      smb_fname,
+						      xattr_name,
+						      alloc_hint);
+		if (tevent_req_nomem(subreq, req)) {
+			return tevent_req_post(req, ev);
+		}
+		tevent_req_set_callback(subreq,
+					vfs_io_uring_getxattrat_next_done,
+					req);
+		return req;
+	}
+
+	SMBPROFILE_BYTES_ASYNC_START(syscall_asys_getxattrat, profile_p,
+				     state->ur.profile_bytes, 0);
+	SMBPROFILE_BYTES_ASYNC_SET_IDLE(state->ur.profile_bytes);
+
+	state->xattr_name = talloc_strdup(state, xattr_name);
+	if (tevent_req_nomem(state->xattr_name, req)) {
+		return tevent_req_post(req, ev);
+	}
+
+	if (alloc_hint > 0) {
+		state->xattr_value = talloc_zero_array(state,
+						       uint8_t,
+						       alloc_hint);
+		if (tevent_req_nomem(state->xattr_value, req)) {
+			return tevent_req_post(req, ev);
+		}
+	}
+
+	if (fsp->fsp_flags.is_pathref) {
+		struct sys_proc_fd_path_buf buf;
+
+		/*
+		 * Like vfswrap_fgetxattr(), an O_PATH fd only
+		 * works via /proc/self/fd
+		 */
+		state->path = talloc_strdup(state,
+					    sys_proc_fd_path(fd, &buf));
+		if (tevent_req_nomem(state->path, req)) {
+			return tevent_req_post(req, ev);
+		}
+		io_uring_prep_getxattr(&state->ur.sqe,
+				       state->xattr_name,
+				       (char *)state->xattr_value,
+				       state->path,
+				       alloc_hint);
+	} else {
+		io_uring_prep_fgetxattr(&state->ur.sqe,
+					fd,
+					state->xattr_name,
+					(char *)state->xattr_value,
+					alloc_hint);
+	}
+	state->ur.sqe.personality = personality;
+	vfs_io_uring_request_submit(&state->ur);
+
+	if (!tevent_req_is_in_progress(req)) {
+		return tevent_req_post(req, ev);
+	}
+
+	tevent_req_defer_callback(req, ev);
+	return req;
+}
+
+static void vfs_io_uring_getxattrat_next_done(struct tevent_req *subreq)
+{
+	struct tevent_req *req = tevent_req_callback_data(
+		subreq, struct tevent_req);
+	struct vfs_io_uring_getxattrat_state *state = tevent_req_data(
+		req, struct vfs_io_uring_getxattrat_state);
+
+	state->xattr_size = SMB_VFS_NEXT_GETXATTRAT_RECV(subreq,
+							 &state->vfs_aio_state,
+							 state,
+							 &state->xattr_value);
+	TALLOC_FREE(subreq);
+	if (state->xattr_size == -1) {
+		tevent_req_error(req, state->vfs_aio_state.error);
+		return;
+	}
+
+	tevent_req_done(req);
+}
+
+static void vfs_io_uring_getxattrat_completion(struct vfs_io_uring_request *cur,
+					       const char *location)
+{
+	struct vfs_io_uring_getxattrat_state *state = tevent_req_data(
+		cur->req, struct vfs_io_uring_getxattrat_state);
+
+	/*
+	 * We rely on being inside the _send() function
+	 * or tevent_req_defer_callback() being called
+	 * already.
+	 */
+
+	state->vfs_aio_state.duration = nsec_time_diff(&cur->end_time,
+						       &cur->start_time);
+
+	if (cur->cqe.res < 0) {
+		int err = -cur->cqe.res;
+		_tevent_req_error(cur->req, err, location);
+		return;
+	}
+
+	state->xattr_size = cur->cqe.res;
+
+	if (state->xattr_value != NULL) {
+		/*
+		 * shrink the buffer to the returned size.
+		 * (can't fail). It means NULL if size is 0.
+		 */
+		state->xattr_value = talloc_realloc(state,
+						    state->xattr_value,
+						    uint8_t,
+						    state->xattr_size);
+	}
+
+	tevent_req_done(cur->req);
+}
+
+static ssize_t vfs_io_uring_getxattrat_recv(struct tevent_req *req,
+					    struct vfs_aio_state *aio_state,
+					    TALLOC_CTX *mem_ctx,
+					    uint8_t **xattr_value)
+{
+	struct vfs_io_uring_getxattrat_state *state = tevent_req_data(
+		req, struct vfs_io_uring_getxattrat_state);
+	ssize_t xattr_size;
+
+	SMBPROFILE_BYTES_ASYNC_END(state->ur.profile_bytes);
+
+	if (tevent_req_is_unix_error(req, &aio_state->error)) {
+		tevent_req_received(req);
+		return -1;
+	}
+
+	*aio_state = state->vfs_aio_state;
+	xattr_size = state->xattr_size;
+	if (xattr_value != NULL) {
+		*xattr_value = talloc_move(mem_ctx, &state->xattr_value);
+	}
+
+	tevent_req_received(req);
+	return xattr_size;
+}
+
+#endif /* HAVE_IO_URING_PREP_GETXATTR */
+
+/*
+ * Like aio_pthread, vfs_io_uring can run create exclusive opens
+ * asynchronously. openat() then returns -1/EINPROGRESS, which defers
+ * the SMB2 create. Once IORING_OP_OPENAT and an IORING_OP_STATX on
+ * the new fd completed, schedule_deferred_open_message_smb() reruns
+ * the create and vfs_io_uring_openat() finds the result by mid. The
+ * statx result answers the SMB_VFS_FSTAT() that follows the open.
+ */
+
+struct vfs_io_uring_open {
+	struct vfs_io_uring_open *prev, *next;
+	struct vfs_io_uring_config *config;
+	uint64_t mid;
+	bool in_progress;
+	connection_struct *conn;
+	struct smbXsrv_connection *xconn;
+	struct smb_filename *fsp_name;
+	bool fake_dir_create_times;
+	int dir_fd;
+	/* Returns. */
+	int ret_fd;
+	int ret_errno;
+	bool have_stat;
+	SMB_STRUCT_STAT st;
+};
+
+static void vfs_io_uring_orphan_opens(struct vfs_io_uring_config *config)
+{
+	struct vfs_io_uring_open *opd = NULL, *next = NULL;
+
+	for (opd = config->opens; opd != NULL; opd = next) {
+		next = opd->next;
+		DLIST_REMOVE(config->opens, opd);
+		opd->config = NULL;
+	}
+}
+
+static int vfs_io_uring_open_destructor(struct vfs_io_uring_open *opd)
+{
+	if (opd->ret_fd != -1) {
+		close(opd->ret_fd);
+		opd->ret_fd = -1;
+	}
+	if (opd->dir_fd != -1) {
+		close(opd->dir_fd);
+		opd->dir_fd = -1;
+	}
+	if (opd->config != NULL) {
+		DLIST_REMOVE(opd->config->opens, opd);
+		opd->config = NULL;
+	}
+	return 0;
+}
+
+static int vfs_io_uring_open_inflight_destructor(struct vfs_io_uring_open *opd)
+{
+	/*
+	 * The connection is torn down. As in aio_pthread, keep opd
+	 * until the kernel is done with the buffers we gave it.
+	 */
+	DBG_NOTICE("io_uring open request for %s cancelled\n",
+		   opd->fsp_name->base_name);
+	opd->conn = NULL;
+	return -1;
+}
+
+static void vfs_io_uring_statx_to_stat_ex(const struct statx *stx,
+					  SMB_STRUCT_STAT *st,
+					  bool fake_dir_create_times)
+{
+	struct stat sbuf = {
+		.st_dev = makedev(stx->stx_dev_major, stx->stx_dev_minor),
+		.st_ino = stx->stx_ino,
+		.st_mode = stx->stx_mode,
+		.st_nlink = stx->stx_nlink,
+		.st_uid = stx->stx_uid,
+		.st_gid = stx->stx_gid,
+		.st_rdev = makedev(stx->stx_rdev_major, stx->stx_rdev_minor),
+		.st_size = stx->stx_size,
+		.st_blksize = stx->stx_blksize,
+		.st_blocks = stx->stx_blocks,
+		.st_atim = {
+			.tv_sec = stx->stx_atime.tv_sec,
+			.tv_nsec = stx->stx_atime.tv_nsec,
+		},
+		.st_mtim = {
+			.tv_sec = stx->stx_mtime.tv_sec,
+			.tv_nsec = stx->stx_mtime.tv_nsec,
+		},
+		.st_ctim = {
+			.tv_sec = stx->stx_ctime.tv_sec,
+			.tv_nsec = stx->stx_ctime.tv_nsec,
+		},
+	};
+
+	/* Like sys_fstat() */
+	if (S_ISDIR(sbuf.st_mode)) {
+		sbuf.st_size = 0;
+	}
+	init_stat_ex_from_stat(st, &sbuf, fake_dir_create_times);
+}
+
+struct vfs_io_uring_openat_state {
+	struct vfs_io_uring_open *opd;
+	char *path;
+	int personality;
+	struct statx stx;
+	struct vfs_io_uring_request ur;
+};
+
+static void vfs_io_uring_openat_completion(struct vfs_io_uring_request *cur,
+					   const char *location);
+
+static struct tevent_req *vfs_io_uring_openat_send(
+	TALLOC_CTX *mem_ctx,
+	struct tevent_context *ev,
+	struct vfs_io_uring_open *opd,
+	const char *path,
+	const struct vfs_open_how *how,
+	int personality)
+{
+	struct tevent_req *req = NULL;
+	struct vfs_io_uring_openat_state *state = NULL;
+
+	req = tevent_req_create(mem_ctx, &state,
+				struct vfs_io_uring_openat_state);
+	if (req == NULL) {
+		return NULL;
+	}
+	state->opd = opd;
+	state->personality = personality;
+	state->ur.config = opd->config;
+	state->ur.req = req;
+	state->ur.completion_fn = vfs_io_uring_openat_completion;
+
+	state->path = talloc_strdup(state, path);
+	if (tevent_req_nomem(state->path, req)) {
+		return tevent_req_post(req, ev);
+	}
+
+	io_uring_prep_openat(&state->ur.sqe,
+			     opd->dir_fd,
+			     state->path,
+			     how->flags,
+			     how->mode);
+	state->ur.sqe.personality = personality;
+	vfs_io_uring_request_submit(&state->ur);
+
+	if (!tevent_req_is_in_progress(req)) {
+		return tevent_req_post(req, ev);
+	}
+
+	tevent_req_defer_callback(req, ev);
+	return req;
+}
+
+static void vfs_io_uring_openat_completion(struct vfs_io_uring_request *cur,
+					   const char *location)
+{
+	struct vfs_io_uring_openat_state *state = tevent_req_data(
+		cur->req, struct vfs_io_uring_openat_state);
+	struct vfs_io_uring_open *opd = state->opd;
+
+	/*
+	 * We rely on being inside the _send() function
+	 * or tevent_req_defer_callback() being called
+	 * already.
+	 */
+
+	if (opd->ret_fd == -1) {
+		if (cur->cqe.res < 0) {
+			opd->ret_errno = -cur->cqe.res;
+			tevent_req_done(cur->req);
+			return;
+		}
+
+		opd->ret_fd = cur->cqe.res;
+		opd->ret_errno = 0;
+
+		/*
+		 * Now fstat the new file, the rerun of the
+		 * create needs it right after the open.
+		 */
+		io_uring_prep_statx(&cur->sqe,
+				    opd->ret_fd,
+				    "",
+				    AT_EMPTY_PATH,
+				    STATX_BASIC_STATS,
+				    &state->stx);
+		cur->sqe.personality = state->personality;
+		vfs_io_uring_request_submit(cur);
+		return;
+	}
+
+	/*
+	 * A failed statx is not fatal, the open succeeded. We
+	 * just leave the fstat to the next module then.
+	 */
+	if ((cur->cqe.res == 0) &&
+	    ((state->stx.stx_mask & STATX_BASIC_STATS) == STATX_BASIC_STATS))
+	{
+		vfs_io_uring_statx_to_stat_ex(&state->stx,
+					      &opd->st,
+					      opd->fake_dir_create_times);
+		opd->have_stat = true;
+	}
+
+	tevent_req_done(cur->req);
+}
+
+static void vfs_io_uring_open_done(struct tevent_req *req)
+{
+	struct vfs_io_uring_open *opd = tevent_req_callback_data(
+		req, struct vfs_io_uring_open);
+	int ret;
+
+	ret = tevent_req_simple_recv_unix(req);
+	TALLOC_FREE(req);
+	if (ret != 0) {
+		if (opd->ret_fd != -1) {
+			close(opd->ret_fd);
+			opd->ret_fd = -1;
+		}
+		opd->ret_errno = ret;
+	}
+
+	/*
+	 * We're no longer in flight. Remove the
+	 * destructor used to preserve opd so
+	 * a talloc_free actually removes it.
+	 */
+	talloc_set_destructor(opd, vfs_io_uring_open_destructor);
+	opd->in_progress = false;
+
+	if (opd->conn == NULL) {
+		/*
+		 * Shutdown closed in flight, nobody wants the
+		 * result. Let the client see an error for the open.
+		 */
+		DBG_NOTICE("io_uring open request for %s abandoned in "
+			   "flight\n",
+			   opd->fsp_name->base_name);
+		schedule_deferred_open_message_smb(opd->xconn, opd->mid);
+		TALLOC_FREE(opd);
+		return;
+	}
+
+	DBG_DEBUG("mid %" PRIu64 " for file %s completed: %s\n",
+		  opd->mid,
+		  opd->fsp_name->base_name,
+		  strerror(opd->ret_errno));
+
+	/* Find outstanding event and reschedule. */
+	if (!schedule_deferred_open_message_smb(opd->xconn, opd->mid)) {
+		/*
+		 * Outstanding event didn't exist or was
+		 * cancelled. Throw away the result.
+		 */
+		TALLOC_FREE(opd);
+	}
+}
+
+static int vfs_io_uring_open_async(struct vfs_io_uring_config *config,
+				   const struct files_struct *dirfsp,
+				   const struct smb_filename *smb_fname,
+				   struct files_struct *fsp,
+				   const struct vfs_open_how *how,
+				   int personality)
+{
+	struct vfs_io_uring_open *opd = NULL;
+	struct tevent_req *req = NULL;
+	int dir_fd = fsp_get_pathref_fd(dirfsp);
+
+	/*
+	 * Allocate off fsp->conn, like aio_pthread: fsp is freed
+	 * when we return EINPROGRESS and the rerun of the create
+	 * gets a new one.
+	 */
+	opd = talloc_zero(fsp->conn, struct vfs_io_uring_open);
+	if (opd == NULL) {
+		return -1;
+	}
+	*opd = (struct vfs_io_uring_open) {
+		.config = config,
+		.mid = fsp->mid,
+		.in_progress = true,
+		.conn = fsp->conn,
+		/*
+		 * As in aio_pthread, we only have one
+		 * connection, see create_private_open_data().
+		 */
+		.xconn = fsp->conn->sconn->client->connections,
+		.fake_dir_create_times = lp_fake_directory_create_times(
+			SNUM(fsp->conn)),
+		.dir_fd = -1,
+		.ret_fd = -1,
+		.ret_errno = EINPROGRESS,
+	};
+	talloc_set_destructor(opd, vfs_io_uring_open_destructor);
+
+	opd->fsp_name = cp_smb_filename(opd, fsp->fsp_name);
+	if (opd->fsp_name == NULL) {
+		TALLOC_FREE(opd);
+		return -1;
+	}
+
+	/*
+	 * The kernel looks up the directory when it runs the request,
+	 * by then dirfsp might be closed and its fd number reused.
+	 */
+	if (dir_fd == AT_FDCWD) {
+		opd->dir_fd = open(".", O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+	} else {
+		opd->dir_fd = fcntl(dir_fd, F_DUPFD_CLOEXEC, 0);
+	}
+	if (opd->dir_fd == -1) {
+		TALLOC_FREE(opd);
+		return -1;
+	}
+
+	DLIST_ADD_END(config->opens, opd);
+
+	req = vfs_io_uring_openat_send(opd,
+				       fsp->conn->sconn->ev_ctx,
+				       opd,
+				       smb_fname->base_name,
+				       how,
+				       personality);
+	if (req == NULL) {
+		TALLOC_FREE(opd);
+		return -1;
+	}
+	tevent_req_set_callback(req, vfs_io_uring_open_done, opd);
+
+	DBG_DEBUG("mid %" PRIu64 " created for file %s\n",
+		  opd->mid,
+		  opd->fsp_name->base_name);
+
+	/*
+	 * Add a destructor to protect us from connection
+	 * teardown whilst the open is in flight.
+	 */
+	talloc_set_destructor(opd, vfs_io_uring_open_inflight_destructor);
+
+	/* Cause the calling code to reschedule us. */
+	errno = EINPROGRESS; /* Maps to NT_STATUS_MORE_PROCESSING_REQUIRED. */
+	return -1;
+}
+
+static int vfs_io_uring_openat(vfs_handle_struct *handle,
+			       const struct files_struct *dirfsp,
+			       const struct smb_filename *smb_fname,
+			       struct files_struct *fsp,
+			       const struct vfs_open_how *how)
+{
+	struct vfs_io_uring_config *config = NULL;
+	struct vfs_io_uring_open *opd = NULL;
+	bool allow_async;
+	int personality;
+	int fd;
+	int err;
+
+	SMB_VFS_HANDLE_GET_DATA(handle, config,
+				struct vfs_io_uring_config,
+				smb_panic(__location__));
+
+	/* The SMB_VFS_FSTAT() after the last async open is done */
+	config->open_stat.fsp = NULL;
+	config->open_stat.fd = -1;
+
+	allow_async = config->openat_supported;
+
+	if (how->resolve != 0) {
+		allow_async = false;
+	}
+
+	if (is_named_stream(smb_fname)) {
+		allow_async = false;
+	}
+
+	if (fsp->conn->sconn->client != NULL &&
+	    fsp->conn->sconn->client->server_multi_channel_enabled) {
+		/*
+		 * Like aio_pthread, not compatible with multi
+		 * channel yet.
+		 */
+		allow_async = false;
+	}
+
+	if (fsp->fsp_flags.is_pathref) {
+		allow_async = false;
+	}
+
+	if ((how->flags & (O_CREAT|O_EXCL)) != (O_CREAT|O_EXCL)) {
+		/* Only creates with O_EXCL matter. */
+		allow_async = false;
+	}
+
+	if (!allow_async) {
+		return SMB_VFS_NEXT_OPENAT(handle,
+					   dirfsp,
+					   smb_fname,
+					   fsp,
+					   how);
+	}
+
+	/*
+	 * See if this is a reentrant call - i.e. is this a
+	 * restart of an existing open that just completed.
+	 */
+	for (opd = config->opens; opd != NULL; opd = opd->next) {
+		if (opd->mid == fsp->mid) {
+			break;
+		}
+	}
+	if (opd != NULL) {
+		if (opd->in_progress) {
+			DBG_ERR("mid %" PRIu64 " still in progress for "
+				"file %s\n",
+				opd->mid,
+				opd->fsp_name->base_name);
+			smb_panic("vfs_io_uring_openat - in_progress");
+			return -1;
+		}
+
+		fd = opd->ret_fd;
+		err = opd->ret_errno;
+		opd->ret_fd = -1;
+
+		if ((fd != -1) && opd->have_stat) {
+			config->open_stat.fsp = fsp;
+			config->open_stat.fd = fd;
+			config->open_stat.st = opd->st;
+		}
+
+		DBG_DEBUG("mid %" PRIu64 " returning fd = %d, errno = %d "
+			  "(%s) for file %s\n",
+			  opd->mid,
+			  fd,
+			  err,
+			  strerror(err),
+			  smb_fname_str_dbg(fsp->fsp_name));
+
+		TALLOC_FREE(opd);
+		errno = err;
+		return fd;
+	}
+
+	/*
+	 * The open runs in a kernel worker, it needs the
+	 * credentials of the current user.
+	 */
+	personality = vfs_io_uring_get_personality(
+		config, get_current_utok(fsp->conn));
+	if (personality == -1) {
+		return SMB_VFS_NEXT_OPENAT(handle,
+					   dirfsp,
+					   smb_fname,
+					   fsp,
+					   how);
+	}
+
+	return vfs_io_uring_open_async(config,
+				       dirfsp,
+				       smb_fname,
+				       fsp,
+				       how,
+				       personality);
+}
+
+static int vfs_io_uring_fstat(vfs_handle_struct *handle,
+			      files_struct *fsp,
+			      SMB_STRUCT_STAT *sbuf)
+{
+	struct vfs_io_uring_config *config = NULL;
+
+	SMB_VFS_HANDLE_GET_DATA(handle, config,
+				struct vfs_io_uring_config,
+				smb_panic(__location__));
+
+	if ((config->open_stat.fsp == fsp) &&
+	    (config->open_stat.fd == fsp_get_pathref_fd(fsp)))
+	{
+		*sbuf = config->open_stat.st;
+		config->open_stat.fsp = NULL;
+		config->open_stat.fd = -1;
+		return 0;
+	}
+
+	return SMB_VFS_NEXT_FSTAT(handle, fsp, sbuf);
+}
+
+static int vfs_io_uring_close(vfs_handle_struct *handle, files_struct *fsp)
+{
+	struct vfs_io_uring_config *config = NULL;
+
+	SMB_VFS_HANDLE_GET_DATA(handle, config,
+				struct vfs_io_uring_config,
+				smb_panic(__location__));
+
+	if (config->open_stat.fsp == fsp) {
+		config->open_stat.fsp = NULL;
+		config->open_stat.fd = -1;
+	}
+
+	return SMB_VFS_NEXT_CLOSE(handle, fsp);
+}
+
 static struct vfs_fn_pointers vfs_io_uring_fns = {
 	.connect_fn = vfs_io_uring_connect,
+	.openat_fn = vfs_io_uring_openat,
+	.fstat_fn = vfs_io_uring_fstat,
+	.close_fn = vfs_io_uring_close,
 	.pread_send_fn = vfs_io_uring_pread_send,
 	.pread_recv_fn = vfs_io_uring_pread_recv,
 	.pwrite_send_fn = vfs_io_uring_pwrite_send,
 	.pwrite_recv_fn = vfs_io_uring_pwrite_recv,
 	.fsync_send_fn = vfs_io_uring_fsync_send,
 	.fsync_recv_fn = vfs_io_uring_fsync_recv,
+#ifdef HAVE_IO_URING_PREP_GETXATTR
+	.getxattrat_send_fn = vfs_io_uring_getxattrat_send,
+	.getxattrat_recv_fn = vfs_io_uring_getxattrat_recv,
+#endif /* HAVE_IO_URING_PREP_GETXATTR */
 };
 
 static_decl_vfs;
@@ -38,6 +38,7 @@
 #include "lib/util_path.h"
 #include "libcli/security/security.h"
 #include "lib/util/tevent_unix.h"
+#include "lib/util/binsearch.h"
 
 struct shadow_copy2_config {
 	char *gmt_format;
@@ -53,20 +54,28 @@ struct shadow_copy2_config {
 	char *mount_point;
 	char *rel_connectpath; /* share root, relative to a snapshot root */
 	char *snapshot_basepath; /* the absolute version of snapdir */
+	int snaplist_cache_time;
 };
 
 /* Data-structure to hold the list of snap entries */
 struct shadow_copy2_snapentry {
 	char *snapname;
 	char *time_fmt;
-	struct shadow_copy2_snapentry *next;
-	struct shadow_copy2_snapentry *prev;
 };
 
 struct shadow_copy2_snaplist_info {
-	struct shadow_copy2_snapentry *snaplist; /* snapshot list */
+	/* snapshot list, sorted by time_fmt */
+	struct shadow_copy2_snapentry *snaplist;
+	size_t num_snaps;
 	regex_t *regex; /* Regex to filter snaps */
 	time_t fetch_time; /* snaplist update time */
+	/* The snapdir the list was read from and its stat at that time */
+	char *snapdir;
+	struct stat_ex snapdir_st;
+	/* Last shadow_copy2_find_snapdir() lookup with snapdirseverywhere */
+	char *lookup_path;
+	char *lookup_snapdir;
+	time_t lookup_time;
 };
 
 /*
@@ -88,45 +97,31 @@ static int shadow_copy2_get_shadow_copy_data(
 	struct shadow_copy_data *shadow_copy2_data,
 	bool labels);
 
-/**
- * This function will create a new snapshot list entry and
- * return to the caller. This entry will also be added to
- * the global snapshot list.
- *
- * @param[in]   priv	shadow_copy2 specific data structure
- * @return	Newly   created snapshot entry or NULL on failure
- */
-static struct shadow_copy2_snapentry *shadow_copy2_create_snapentry(
-					struct shadow_copy2_private *priv)
+static int shadow_copy2_snapentry_cmp(const struct shadow_copy2_snapentry *e1,
+				       const struct shadow_copy2_snapentry *e2)
 {
-	struct shadow_copy2_snapentry *tmpentry = NULL;
-
-	tmpentry = talloc_zero(priv->snaps, struct shadow_copy2_snapentry);
-	if (tmpentry == NULL) {
-		DBG_ERR("talloc_zero() failed\n");
-		errno = ENOMEM;
-		return NULL;
-	}
-
-	DLIST_ADD(priv->snaps->snaplist, tmpentry);
-
-	return tmpentry;
+	return strcmp(e1->time_fmt, e2->time_fmt);
 }
 
 /**
- * This function will delete the entire snaplist and reset
- * priv->snaps->snaplist to NULL.
+ * This function will replace the snapshot list with the entries
+ * in new_list, which must be allocated on priv->snaps. The list is
+ * sorted by time_fmt, so that it can be searched with
+ * shadow_copy2_saved_snapname().
  *
- * @param[in] priv shadow_copye specific data structure
+ * @param[in]   priv		shadow_copy2 specific data structure
+ * @param[in]   new_list	new snapshot entries
+ * @param[in]   num_snaps	number of entries in new_list
  */
-static void shadow_copy2_delete_snaplist(struct shadow_copy2_private *priv)
+static void shadow_copy2_set_snaplist(struct shadow_copy2_private *priv,
+				      struct shadow_copy2_snapentry *new_list,
+				      size_t num_snaps)
 {
-	struct shadow_copy2_snapentry *tmp = NULL;
+	TYPESAFE_QSORT(new_list, num_snaps, shadow_copy2_snapentry_cmp);
 
-	while ((tmp = priv->snaps->snaplist) != NULL) {
-		DLIST_REMOVE(priv->snaps->snaplist, tmp);
-		talloc_free(tmp);
-	}
+	TALLOC_FREE(priv->snaps->snaplist);
+	priv->snaps->snaplist = new_list;
+	priv->snaps->num_snaps = num_snaps;
 }
 
 /**
@@ -153,18 +148,19 @@ static ssize_t shadow_copy2_saved_snapname(struct shadow_copy2_private *priv,
 		return -1;
 	}
 
-	snaptime_len = -1;
-
-	for (entry = priv->snaps->snaplist; entry; entry = entry->next) {
-		if (strcmp(entry->time_fmt, snap_str) == 0) {
-			snaptime_len = snprintf(snap_str, len, "%s",
-						entry->snapname);
-			return snaptime_len;
-		}
+	BINARY_ARRAY_SEARCH(priv->snaps->snaplist,
+			    priv->snaps->num_snaps,
+			    time_fmt,
+			    snap_str,
+			    strcmp,
+			    entry);
+	if (entry != NULL) {
+		snaptime_len = snprintf(snap_str, len, "%s", entry->snapname);
+		return snaptime_len;
 	}
 
 	snap_str[0] = 0;
-	return snaptime_len;
+	return -1;
 }
 
 
@@ -200,7 +196,7 @@ static bool shadow_copy2_update_snaplist(struct vfs_handle_struct *handle,
 	 * required snapshot time is greater than the last fetched snaplist
 	 * time.
 	 */
-	if (seconds > 0 || (priv->snaps->snaplist == NULL)) {
+	if (seconds > 0 || (priv->snaps->num_snaps == 0)) {
 		smb_fname.base_name = discard_const_p(char, ".");
 		fsp.fsp_name = &smb_fname;
 
@@ -1955,6 +1951,53 @@ static char *have_snapdir(struct vfs_handle_struct *handle,
 	return NULL;
 }
 
+/**
+ * With "shadow:snaplist cache time" remember the snapshot directory
+ * found for a path, Previous Versions looks up the same path twice in
+ * a row.
+ */
+static void shadow_copy2_remember_snapdir(struct shadow_copy2_private *priv,
+					  const char *path,
+					  const char *snapdir)
+{
+	struct shadow_copy2_snaplist_info *snaps = priv->snaps;
+
+	if (priv->config->snaplist_cache_time <= 0) {
+		return;
+	}
+
+	TALLOC_FREE(snaps->lookup_path);
+	TALLOC_FREE(snaps->lookup_snapdir);
+
+	snaps->lookup_path = talloc_strdup(snaps, path);
+	snaps->lookup_snapdir = talloc_strdup(snaps, snapdir);
+	if ((snaps->lookup_path == NULL) || (snaps->lookup_snapdir == NULL)) {
+		TALLOC_FREE(snaps->lookup_path);
+		TALLOC_FREE(snaps->lookup_snapdir);
+		return;
+	}
+	snaps->lookup_time = time(NULL);
+}
+
+static const char *shadow_copy2_remembered_snapdir(
+	TALLOC_CTX *mem_ctx,
+	struct shadow_copy2_private *priv,
+	const char *path)
+{
+	struct shadow_copy2_snaplist_info *snaps = priv->snaps;
+	time_t now = time(NULL);
+
+	if ((snaps->lookup_path == NULL) ||
+	    (strcmp(snaps->lookup_path, path) != 0)) {
+		return NULL;
+	}
+	if ((now < snaps->lookup_time) ||
+	    (now - snaps->lookup_time >= priv->config->snaplist_cache_time)) {
+		return NULL;
+	}
+	return talloc_strdup(mem_ctx, snaps->lookup_snapdir);
+}
+
 /**
  * Find the snapshot directory (if any) for the given
  * filename (which is relative to the share).
@@ -1963,7 +2006,7 @@ static const char *shadow_copy2_find_snapdir(TALLOC_CTX *mem_ctx,
 					     struct vfs_handle_struct *handle,
 					     struct smb_filename *smb_fname)
 {
-	char *path, *p;
+	char *path, *dir, *p;
 	const char *snapdir;
 	struct shadow_copy2_config *config;
 	struct shadow_copy2_private *priv;
@@ -1987,22 +2030,38 @@ static const char *shadow_copy2_find_snapdir(TALLOC_CTX *mem_ctx,
 		return NULL;
 	}
 
+	snapdir = shadow_copy2_remembered_snapdir(mem_ctx, priv, path);
+	if (snapdir != NULL) {
+		TALLOC_FREE(path);
+		return snapdir;
+	}
+
 	snapdir = have_snapdir(handle, talloc_tos(), path);
 	if (snapdir != NULL) {
+		shadow_copy2_remember_snapdir(priv, path, snapdir);
 		TALLOC_FREE(path);
 		return snapdir;
 	}
 
-	while ((p = strrchr(path, '/')) && (p > path)) {
+	dir = talloc_strdup(talloc_tos(), path);
+	if (dir == NULL) {
+		TALLOC_FREE(path);
+		return NULL;
+	}
+
+	while ((p = strrchr(dir, '/')) && (p > dir)) {
 
 		p[0] = '\0';
 
-		snapdir = have_snapdir(handle, talloc_tos(), path);
+		snapdir = have_snapdir(handle, talloc_tos(), dir);
 		if (snapdir != NULL) {
+			shadow_copy2_remember_snapdir(priv, path, snapdir);
+			TALLOC_FREE(dir);
 			TALLOC_FREE(path);
 			return snapdir;
 		}
 	}
+	TALLOC_FREE(dir);
 	TALLOC_FREE(path);
 	return NULL;
 }
@@ -2136,6 +2195,105 @@ static void shadow_copy2_sort_data(vfs_handle_struct *handle,
 	}
 }
 
+/*
+ * Whether the snapshot list read from snapdir can be used without
+ * reading the directory again. With "shadow:snaplist cache time" it
+ * is used for that many seconds, unless the snapshot directory was
+ * modified.
+ */
+static bool shadow_copy2_snaplist_current(struct shadow_copy2_private *priv,
+					  const char *snapdir,
+					  const SMB_STRUCT_STAT *st)
+{
+	struct shadow_copy2_snaplist_info *snaps = priv->snaps;
+	time_t now;
+
+	if (priv->config->snaplist_cache_time <= 0) {
+		return false;
+	}
+	if ((snaps->snapdir == NULL) || (strcmp(snaps->snapdir, snapdir) != 0)) {
+		return false;
+	}
+	if ((st->st_ex_dev != snaps->snapdir_st.st_ex_dev) ||
+	    (st->st_ex_ino != snaps->snapdir_st.st_ex_ino) ||
+	    (timespec_compare(&st->st_ex_mtime,
+			      &snaps->snapdir_st.st_ex_mtime) != 0))
+	{
+		return false;
+	}
+
+	now = time(NULL);
+	if ((now < snaps->fetch_time) ||
+	    (now - snaps->fetch_time >= priv->config->snaplist_cache_time)) {
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * Read the snapshot directory into the snapshot list
+ */
+static int shadow_copy2_read_snapdir(vfs_handle_struct *handle,
+				     struct shadow_copy2_private *priv,
+				     struct files_struct *dirfsp,
+				     DIR *p)
+{
+	struct shadow_copy2_snapentry *snaplist = NULL;
+	size_t num_snaps = 0;
+	struct dirent *d;
+
+	while ((d = SMB_VFS_NEXT_READDIR(handle, dirfsp, p))) {
+		char snapshot[GMT_NAME_LEN+1];
+		struct shadow_copy2_snapentry *tmp = NULL;
+		struct shadow_copy2_snapentry *entry = NULL;
+
+		/*
+		 * ignore names not of the right form in the snapshot
+		 * directory
+		 */
+		if (!shadow_copy2_snapshot_to_gmt(
+			    handle, d->d_name,
+			    snapshot, sizeof(snapshot))) {
+
+			DBG_DEBUG("ignoring %s\n", d->d_name);
+			continue;
+		}
+		DBG_DEBUG("%s -> %s\n", d->d_name, snapshot);
+
+		tmp = talloc_realloc(priv->snaps,
+				     snaplist,
+				     struct shadow_copy2_snapentry,
+				     num_snaps + 1);
+		if (tmp == NULL) {
+			goto nomem;
+		}
+		snaplist = tmp;
+
+		entry = &snaplist[num_snaps];
+		entry->snapname = talloc_strdup(snaplist, d->d_name);
+		entry->time_fmt = talloc_strdup(snaplist, snapshot);
+		num_snaps += 1;
+
+		if ((entry->snapname == NULL) || (entry->time_fmt == NULL)) {
+			goto nomem;
+		}
+	}
+
+	shadow_copy2_set_snaplist(priv, snaplist, num_snaps);
+
+	/* Set the current time as snaplist update time */
+	time(&(priv->snaps->fetch_time));
+
+	return 0;
+
+nomem:
+	DBG_ERR("talloc failed\n");
+	TALLOC_FREE(snaplist);
+	errno = ENOMEM;
+	return -1;
+}
+
 static int shadow_copy2_get_shadow_copy_data(
 	vfs_handle_struct *handle, files_struct *fsp,
 	struct shadow_copy_data *shadow_copy2_data,
@@ -2146,14 +2304,15 @@ static int shadow_copy2_get_shadow_copy_data(
 	struct smb_filename *snapdir_smb_fname = NULL;
 	struct files_struct *dirfsp = NULL;
 	struct files_struct *fspcwd = NULL;
-	struct dirent *d;
 	TALLOC_CTX *tmp_ctx = talloc_stackframe();
 	struct shadow_copy2_private *priv = NULL;
-	struct shadow_copy2_snapentry *tmpentry = NULL;
-	bool get_snaplist = false;
+	struct shadow_copy2_snaplist_info *snaps = NULL;
+	SHADOW_COPY_LABEL *tlabels = NULL;
+	SMB_STRUCT_STAT snapdir_st;
 	struct vfs_open_how how = {
 		.flags = O_RDONLY, .mode = 0,
 	};
+	size_t i;
 	int fd;
 	int ret = -1;
 	NTSTATUS status;
@@ -2224,14 +2383,6 @@ static int shadow_copy2_get_shadow_copy_data(
 		goto done;
 	}
 
-	p = SMB_VFS_NEXT_FDOPENDIR(handle, dirfsp, NULL, 0);
-	if (!p) {
-		DBG_NOTICE("shadow_copy2: SMB_VFS_NEXT_FDOPENDIR() failed for '%s'"
-			   " - %s\n", snapdir, strerror(errno));
-		errno = ENOSYS;
-		goto done;
-	}
-
 	if (shadow_copy2_data != NULL) {
 		shadow_copy2_data->num_volumes = 0;
 		shadow_copy2_data->labels      = NULL;
@@ -2240,84 +2391,74 @@ static int shadow_copy2_get_shadow_copy_data(
 	SMB_VFS_HANDLE_GET_DATA(handle, priv, struct shadow_copy2_private,
 				goto done);
 
+	snaps = priv->snaps;
+
+	if (SMB_VFS_NEXT_FSTAT(handle, dirfsp, &snapdir_st) != 0) {
+		DBG_WARNING("SMB_VFS_NEXT_FSTAT failed for '%s'"
+			    " - %s\n", snapdir, strerror(errno));
+		goto done;
+	}
+
 	/*
 	 * Normally this function is called twice once with labels = false and
 	 * then with labels = true. When labels is false it will return the
 	 * number of volumes so that the caller can allocate memory for that
-	 * many labels. Therefore to eliminate snaplist both the times it is
-	 * good to check if labels is set or not.
+	 * many labels. With "shadow:snaplist cache time" both calls and the
+	 * ones for other files use the snapshot list read by the first one.
 	 *
 	 * shadow_copy2_data is NULL when we only want to update the list and
 	 * don't want any labels.
 	 */
-	if ((priv->snaps->regex != NULL) && (labels || shadow_copy2_data == NULL)) {
-		get_snaplist = true;
-		/* Reset the global snaplist */
-		shadow_copy2_delete_snaplist(priv);
-
-		/* Set the current time as snaplist update time */
-		time(&(priv->snaps->fetch_time));
-	}
-
-	while ((d = SMB_VFS_NEXT_READDIR(handle, dirfsp, p))) {
-		char snapshot[GMT_NAME_LEN+1];
-		SHADOW_COPY_LABEL *tlabels;
-
-		/*
-		 * ignore names not of the right form in the snapshot
-		 * directory
-		 */
-		if (!shadow_copy2_snapshot_to_gmt(
-			    handle, d->d_name,
-			    snapshot, sizeof(snapshot))) {
-
-			DEBUG(6, ("shadow_copy2_get_shadow_copy_data: "
-				  "ignoring %s\n", d->d_name));
-			continue;
+	if ((shadow_copy2_data == NULL) ||
+	    !shadow_copy2_snaplist_current(priv, snapdir, &snapdir_st))
+	{
+		p = SMB_VFS_NEXT_FDOPENDIR(handle, dirfsp, NULL, 0);
+		if (!p) {
+			DBG_NOTICE("shadow_copy2: SMB_VFS_NEXT_FDOPENDIR() failed for '%s'"
+				   " - %s\n", snapdir, strerror(errno));
+			errno = ENOSYS;
+			goto done;
 		}
-		DEBUG(6,("shadow_copy2_get_shadow_copy_data: %s -> %s\n",
-			 d->d_name, snapshot));
 
-		if (get_snaplist) {
-			/*
-			 * Create a snap entry for each successful
-			 * pattern match.
-			 */
-			tmpentry = shadow_copy2_create_snapentry(priv);
-			if (tmpentry == NULL) {
-				DBG_ERR("talloc_zero() failed\n");
-				goto done;
-			}
-			tmpentry->snapname = talloc_strdup(tmpentry, d->d_name);
-			tmpentry->time_fmt = talloc_strdup(tmpentry, snapshot);
+		if (shadow_copy2_read_snapdir(handle, priv, dirfsp, p) != 0) {
+			goto done;
 		}
 
-		if (shadow_copy2_data == NULL) {
-			continue;
-		}
+		TALLOC_FREE(snaps->snapdir);
+		snaps->snapdir = talloc_strdup(snaps, snapdir);
+		snaps->snapdir_st = snapdir_st;
+	}
 
-		if (!labels) {
-			/* the caller doesn't want the labels */
-			shadow_copy2_data->num_volumes++;
-			continue;
-		}
+	if (shadow_copy2_data == NULL) {
+		ret = 0;
+		goto done;
+	}
 
-		tlabels = talloc_realloc(shadow_copy2_data,
-					 shadow_copy2_data->labels,
-					 SHADOW_COPY_LABEL,
-					 shadow_copy2_data->num_volumes+1);
+	if (!labels) {
+		/* the caller doesn't want the labels */
+		shadow_copy2_data->num_volumes = snaps->num_snaps;
+		ret = 0;
+		goto done;
+	}
+
+	if (snaps->num_snaps > 0) {
+		tlabels = talloc_array(shadow_copy2_data,
+				       SHADOW_COPY_LABEL,
+				       snaps->num_snaps);
 		if (tlabels == NULL) {
 			DEBUG(0,("shadow_copy2: out of memory\n"));
 			goto done;
 		}
+	}
 
-		strlcpy(tlabels[shadow_copy2_data->num_volumes], snapshot,
+	for (i = 0; i < snaps->num_snaps; i++) {
+		strlcpy(tlabels[i], snaps->snaplist[i].time_fmt,
 			sizeof(*tlabels));
-
-		shadow_copy2_data->num_volumes++;
-		shadow_copy2_data->labels = tlabels;
 	}
 
+	shadow_copy2_data->num_volumes = snaps->num_snaps;
+	shadow_copy2_data->labels = tlabels;
+
 	shadow_copy2_sort_data(handle, shadow_copy2_data);
 	ret = 0;
 
@@ -3072,6 +3213,11 @@ static int shadow_copy2_connect(struct vfs_handle_struct *handle,
 		return -1;
 	}
 
+	config->snaplist_cache_time = lp_parm_int(SNUM(handle->conn),
+						  "shadow",
+						  "snaplist cache time",
+						  0);
+
 	mount_point = lp_parm_const_string(SNUM(handle->conn),
 					   "shadow", "mountpoint", NULL);
 	if (mount_point != NULL) {
@@ -3239,6 +3385,7 @@ static int shadow_copy2_connect(struct vfs_handle_struct *handle,
 		   "  cross mountpoints: %s\n"
 		   "  fix inodes: %s\n"
 		   "  sort order: %s\n"
+		   "  snaplist cache time: %d\n"
 		   "",
 		   handle->conn->connectpath,
 		   config->mount_point,
@@ -3252,7 +3399,8 @@ static int shadow_copy2_connect(struct vfs_handle_struct *handle,
 		   config->snapdirseverywhere ? "yes" : "no",
 		   config->crossmountpoints ? "yes" : "no",
 		   config->fixinodes ? "yes" : "no",
-		   config->sort_order
+		   config->sort_order,
+		   config->snaplist_cache_time
 		   ));
 
 
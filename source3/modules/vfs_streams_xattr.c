@@ -25,8 +25,10 @@
 #include "smbd/smbd.h"
 #include "system/filesys.h"
 #include "lib/util/tevent_unix.h"
+#include "lib/util/sys_rw.h"
 #include "librpc/gen_ndr/ioctl.h"
 #include "hash_inode.h"
+#include "lib/util_path.h"
 
 #undef DBGC_CLASS
 #define DBGC_CLASS DBGC_VFS
@@ -35,6 +37,9 @@ struct streams_xattr_config {
 	const char *prefix;
 	size_t prefix_len;
 	bool store_stream_type;
+	off_t sidecar_threshold;
+	const char *sidecar_dir;
+	int sidecar_dirfd;
 };
 
 struct stream_io {
@@ -43,10 +48,540 @@ struct stream_io {
 	void *fsp_name_ptr;
 	files_struct *fsp;
 	vfs_handle_struct *handle;
+	/* The fd of fsp is the stream's sidecar file */
+	bool sidecar;
 };
 
-static ssize_t get_xattr_size_fsp(struct files_struct *fsp,
-			          const char *xattr_name)
+/*
+ * Every xattr read or write copies the whole stream. With
+ * "streams_xattr:sidecar_threshold" set, a stream that grows beyond
+ * that many bytes is moved into a file of its own, a "sidecar"
+ * below "streams_xattr:sidecar_directory":
+ *
+ * <sidecar_directory>/XX/YY/<file_id>/<gen>/<id>
+ *
+ * <file_id> is the file id of the base file as the VFS creates it,
+ * so vfs_fileid mappings apply, XX/YY are the low bytes of its inode
+ * number. <gen> and <id> are random. Opens of such a stream get the
+ * sidecar's fd, so reads and writes are plain (async) pread/pwrite.
+ * The stream's xattr stays around for the stream listing, but it only
+ * holds a stub naming the generation and the sidecar. Stream data in
+ * xattrs always ends with a 0 byte, the stub never does.
+ *
+ * All sidecars of a base file share one generation. The first stream
+ * of a file moved into a sidecar picks a new one and removes the
+ * sidecars of other generations: they are left over from a file that
+ * had the inode before and was removed behind our back.
+ *
+ * Access to streams is checked on the base file, so the sidecar
+ * files and directories are accessed as root. The directory has to
+ * be outside of the share, below it we never follow symlinks. A
+ * sidecar is owned by the owner of its base file for quota, but
+ * only root can get to it through the 0700 directories.
+ */
+#define SIDECAR_STUB_PREFIX "streams_xattr sidecar "
+#define SIDECAR_STUB_PREFIX_LEN (sizeof(SIDECAR_STUB_PREFIX) - 1)
+#define SIDECAR_GEN_LEN 8
+#define SIDECAR_ID_LEN 16
+#define SIDECAR_STUB_LEN (SIDECAR_STUB_PREFIX_LEN + \
+			  2 * SIDECAR_GEN_LEN + 1 + 2 * SIDECAR_ID_LEN)
+
+struct sidecar_ref {
+	uint8_t gen[SIDECAR_GEN_LEN];
+	uint8_t id[SIDECAR_ID_LEN];
+};
+
+static bool sidecar_stub_parse(const DATA_BLOB *value,
+			       struct sidecar_ref *ref)
+{
+	const char *p = (const char *)value->data + SIDECAR_STUB_PREFIX_LEN;
+	size_t len;
+
+	if (value->length != SIDECAR_STUB_LEN) {
+		return false;
+	}
+	if (memcmp(value->data,
+		   SIDECAR_STUB_PREFIX,
+		   SIDECAR_STUB_PREFIX_LEN) != 0) {
+		return false;
+	}
+
+	len = strhex_to_str((char *)ref->gen,
+			    SIDECAR_GEN_LEN,
+			    p,
+			    2 * SIDECAR_GEN_LEN);
+	if (len != SIDECAR_GEN_LEN) {
+		return false;
+	}
+	p += 2 * SIDECAR_GEN_LEN;
+
+	if (*p != ' ') {
+		return false;
+	}
+	p += 1;
+
+	len = strhex_to_str((char *)ref->id,
+			    SIDECAR_ID_LEN,
+			    p,
+			    2 * SIDECAR_ID_LEN);
+	return (len == SIDECAR_ID_LEN);
+}
+
+static void sidecar_stub_push(uint8_t buf[SIDECAR_STUB_LEN + 1],
+			      const struct sidecar_ref *ref)
+{
+	char *p = (char *)buf;
+
+	memcpy(p, SIDECAR_STUB_PREFIX, SIDECAR_STUB_PREFIX_LEN);
+	p += SIDECAR_STUB_PREFIX_LEN;
+	hex_encode_buf(p, ref->gen, SIDECAR_GEN_LEN);
+	p += 2 * SIDECAR_GEN_LEN;
+	*p++ = ' ';
+	hex_encode_buf(p, ref->id, SIDECAR_ID_LEN);
+}
+
+/*
+ * The names of the directories leading to the sidecars of a base
+ * file, below config->sidecar_dirfd. The last one is the generation,
+ * it's only filled in with a ref.
+ */
+#define SIDECAR_DIR_DEPTH 4
+#define SIDECAR_FILE_DIR_DEPTH (SIDECAR_DIR_DEPTH - 1)
+#define SIDECAR_DIR_NAME_LEN 64
+
+static void sidecar_dir_names(vfs_handle_struct *handle,
+			      const SMB_STRUCT_STAT *st,
+			      const struct sidecar_ref *ref,
+			      char names[SIDECAR_DIR_DEPTH][SIDECAR_DIR_NAME_LEN])
+{
+	struct file_id id = SMB_VFS_NEXT_FILE_ID_CREATE(handle, st);
+
+	snprintf(names[0], SIDECAR_DIR_NAME_LEN, "%02X",
+		 (unsigned)(id.inode & 0xff));
+	snprintf(names[1], SIDECAR_DIR_NAME_LEN, "%02X",
+		 (unsigned)((id.inode >> 8) & 0xff));
+	snprintf(names[2], SIDECAR_DIR_NAME_LEN, "%"PRIx64".%"PRIx64".%"PRIx64,
+		 id.devid,
+		 id.inode,
+		 id.extid);
+	names[3][0] = '\0';
+	if (ref != NULL) {
+		hex_encode_buf(names[3], ref->gen, SIDECAR_GEN_LEN);
+	}
+}
+
+/*
+ * Open the first "depth" directories for the sidecars of base_fname,
+ * creating them if asked to. Nothing below config->sidecar_dirfd is
+ * trusted, so symlinks are not followed. Must be called as root.
+ */
+static int sidecar_dir_open(vfs_handle_struct *handle,
+			    const struct streams_xattr_config *config,
+			    const struct smb_filename *base_fname,
+			    const struct sidecar_ref *ref,
+			    int depth,
+			    bool create)
+{
+	char names[SIDECAR_DIR_DEPTH][SIDECAR_DIR_NAME_LEN];
+	int dirfd = config->sidecar_dirfd;
+	int i;
+
+	SMB_ASSERT(VALID_STAT(base_fname->st));
+	SMB_ASSERT(depth <= SIDECAR_DIR_DEPTH);
+	SMB_ASSERT((ref != NULL) || (depth < SIDECAR_DIR_DEPTH));
+
+	sidecar_dir_names(handle, &base_fname->st, ref, names);
+
+	for (i = 0; i < depth; i++) {
+		int fd;
+		int ret;
+
+		if (create) {
+			ret = mkdirat(dirfd, names[i], 0700);
+			if ((ret == -1) && (errno != EEXIST)) {
+				DBG_WARNING("mkdir %s in %s failed: %s\n",
+					    names[i],
+					    config->sidecar_dir,
+					    strerror(errno));
+				goto fail;
+			}
+		}
+
+		fd = openat(dirfd,
+			    names[i],
+			    O_RDONLY|O_DIRECTORY|O_NOFOLLOW|O_CLOEXEC);
+		if (fd == -1) {
+			goto fail;
+		}
+		if (dirfd != config->sidecar_dirfd) {
+			close(dirfd);
+		}
+		dirfd = fd;
+	}
+
+	return dirfd;
+
+fail:
+	if (dirfd != config->sidecar_dirfd) {
+		int saved_errno = errno;
+		close(dirfd);
+		errno = saved_errno;
+	}
+	return -1;
+}
+
+/*
+ * Open and lock the directory of base_fname that holds the
+ * generations. The lock serializes moving streams of the base file
+ * into sidecars with removing sidecars and directories. Must be
+ * called as root.
+ */
+static int sidecar_dir_lock(vfs_handle_struct *handle,
+			    const struct streams_xattr_config *config,
+			    const struct smb_filename *base_fname)
+{
+	int tries;
+
+	for (tries = 0; tries < 10; tries++) {
+		struct stat st;
+		int dirfd;
+		int ret;
+
+		dirfd = sidecar_dir_open(handle,
+					 config,
+					 base_fname,
+					 NULL,
+					 SIDECAR_FILE_DIR_DEPTH,
+					 true);
+		if (dirfd == -1) {
+			return -1;
+		}
+
+		ret = flock(dirfd, LOCK_EX);
+		if (ret == 0) {
+			ret = fstat(dirfd, &st);
+		}
+		if (ret == -1) {
+			int saved_errno = errno;
+			close(dirfd);
+			errno = saved_errno;
+			return -1;
+		}
+
+		if (st.st_nlink != 0) {
+			return dirfd;
+		}
+
+		/* Removed by sidecar_unlink() before we got the lock */
+		close(dirfd);
+	}
+
+	errno = EAGAIN;
+	return -1;
+}
+
+/*
+ * Remove the generations other than gen and their sidecars from the
+ * locked directory dirfd. Must be called as root.
+ */
+static void sidecar_remove_stale(int dirfd,
+				 const struct smb_filename *base_fname,
+				 const char *gen)
+{
+	struct dirent *de = NULL;
+	DIR *dir = NULL;
+	int fd;
+
+	fd = dup(dirfd);
+	if (fd == -1) {
+		return;
+	}
+	dir = fdopendir(fd);
+	if (dir == NULL) {
+		close(fd);
+		return;
+	}
+
+	while ((de = readdir(dir)) != NULL) {
+		struct dirent *fde = NULL;
+		DIR *gendir = NULL;
+		int genfd;
+
+		if (ISDOT(de->d_name) || ISDOTDOT(de->d_name) ||
+		    (strcmp(de->d_name, gen) == 0))
+		{
+			continue;
+		}
+
+		DBG_NOTICE("Removing stale sidecars %s of %s\n",
+			   de->d_name,
+			   base_fname->base_name);
+
+		genfd = openat(dirfd,
+			       de->d_name,
+			       O_RDONLY|O_DIRECTORY|O_NOFOLLOW|O_CLOEXEC);
+		if (genfd == -1) {
+			/* Not ours, leave it alone */
+			continue;
+		}
+		gendir = fdopendir(genfd);
+		if (gendir == NULL) {
+			close(genfd);
+			continue;
+		}
+		while ((fde = readdir(gendir)) != NULL) {
+			if (ISDOT(fde->d_name) || ISDOTDOT(fde->d_name)) {
+				continue;
+			}
+			unlinkat(genfd, fde->d_name, 0);
+		}
+		closedir(gendir);
+
+		unlinkat(dirfd, de->d_name, AT_REMOVEDIR);
+	}
+
+	closedir(dir);
+}
+
+/*
+ * Open the sidecar of the stream fsp is for. Returns the fd.
+ */
+static int sidecar_open(vfs_handle_struct *handle,
+			const struct streams_xattr_config *config,
+			files_struct *fsp,
+			const struct sidecar_ref *ref,
+			int flags)
+{
+	const struct smb_filename *base_fname = fsp->base_fsp->fsp_name;
+	char idhex[2 * SIDECAR_ID_LEN + 1];
+	int saved_errno = 0;
+	int dirfd;
+	int fd = -1;
+
+	hex_encode_buf(idhex, ref->id, SIDECAR_ID_LEN);
+
+	become_root();
+	dirfd = sidecar_dir_open(handle,
+				 config,
+				 base_fname,
+				 ref,
+				 SIDECAR_DIR_DEPTH,
+				 false);
+	if (dirfd != -1) {
+		fd = openat(dirfd, idhex, flags|O_NOFOLLOW|O_CLOEXEC);
+	}
+	if (fd == -1) {
+		saved_errno = errno;
+	}
+	if (dirfd != -1) {
+		close(dirfd);
+	}
+	unbecome_root();
+
+	if (fd == -1) {
+		DBG_DEBUG("Could not open sidecar %s of %s: %s\n",
+			  idhex,
+			  fsp_str_dbg(fsp->base_fsp),
+			  strerror(saved_errno));
+		errno = saved_errno;
+	}
+	return fd;
+}
+
+/*
+ * Create a sidecar in the generation directory dirfd. It belongs to
+ * the owner of the base file, so that it counts against their quota.
+ */
+static int sidecar_create(int dirfd,
+			  const struct smb_filename *base_fname,
+			  const struct sidecar_ref *ref)
+{
+	char idhex[2 * SIDECAR_ID_LEN + 1];
+	int saved_errno = 0;
+	int fd;
+	int ret;
+
+	hex_encode_buf(idhex, ref->id, SIDECAR_ID_LEN);
+
+	become_root();
+	fd = openat(dirfd,
+		    idhex,
+		    O_RDWR|O_CREAT|O_EXCL|O_NOFOLLOW|O_CLOEXEC,
+		    0600);
+	if (fd == -1) {
+		saved_errno = errno;
+	} else {
+		ret = fchown(fd,
+			     base_fname->st.st_ex_uid,
+			     base_fname->st.st_ex_gid);
+		if (ret == -1) {
+			saved_errno = errno;
+			unlinkat(dirfd, idhex, 0);
+			close(fd);
+			fd = -1;
+		}
+	}
+	unbecome_root();
+
+	if (fd == -1) {
+		DBG_WARNING("Could not create sidecar %s of %s: %s\n",
+			    idhex,
+			    base_fname->base_name,
+			    strerror(saved_errno));
+		errno = saved_errno;
+	}
+	return fd;
+}
+
+static off_t sidecar_size(vfs_handle_struct *handle,
+			  const struct streams_xattr_config *config,
+			  const struct smb_filename *base_fname,
+			  const struct sidecar_ref *ref)
+{
+	char idhex[2 * SIDECAR_ID_LEN + 1];
+	struct stat st;
+	int saved_errno = 0;
+	int dirfd;
+	int ret = -1;
+
+	hex_encode_buf(idhex, ref->id, SIDECAR_ID_LEN);
+
+	become_root();
+	dirfd = sidecar_dir_open(handle,
+				 config,
+				 base_fname,
+				 ref,
+				 SIDECAR_DIR_DEPTH,
+				 false);
+	if (dirfd != -1) {
+		ret = fstatat(dirfd, idhex, &st, AT_SYMLINK_NOFOLLOW);
+		if ((ret == 0) && !S_ISREG(st.st_mode)) {
+			errno = EINVAL;
+			ret = -1;
+		}
+	}
+	if (ret == -1) {
+		saved_errno = errno;
+	}
+	if (dirfd != -1) {
+		close(dirfd);
+	}
+	unbecome_root();
+
+	if (ret == -1) {
+		errno = saved_errno;
+		return -1;
+	}
+	return st.st_size;
+}
+
+static void sidecar_unlink(vfs_handle_struct *handle,
+			   const struct streams_xattr_config *config,
+			   const struct smb_filename *base_fname,
+			   const struct sidecar_ref *ref)
+{
+	char names[SIDECAR_DIR_DEPTH][SIDECAR_DIR_NAME_LEN];
+	char idhex[2 * SIDECAR_ID_LEN + 1];
+	int parentfd = -1;
+	int dirfd = -1;
+	int genfd = -1;
+	int ret;
+
+	hex_encode_buf(idhex, ref->id, SIDECAR_ID_LEN);
+	sidecar_dir_names(handle, &base_fname->st, ref, names);
+
+	become_root();
+
+	parentfd = sidecar_dir_open(handle,
+				    config,
+				    base_fname,
+				    NULL,
+				    SIDECAR_FILE_DIR_DEPTH - 1,
+				    false);
+	if (parentfd == -1) {
+		goto done;
+	}
+	dirfd = openat(parentfd,
+		       names[SIDECAR_FILE_DIR_DEPTH - 1],
+		       O_RDONLY|O_DIRECTORY|O_NOFOLLOW|O_CLOEXEC);
+	if (dirfd == -1) {
+		goto done;
+	}
+	ret = flock(dirfd, LOCK_EX);
+	if (ret == -1) {
+		goto done;
+	}
+	genfd = openat(dirfd,
+		       names[SIDECAR_DIR_DEPTH - 1],
+		       O_RDONLY|O_DIRECTORY|O_NOFOLLOW|O_CLOEXEC);
+	if (genfd == -1) {
+		goto done;
+	}
+
+	ret = unlinkat(genfd, idhex, 0);
+	if (ret == -1) {
+		DBG_DEBUG("unlink %s of %s failed: %s\n",
+			  idhex,
+			  base_fname->base_name,
+			  strerror(errno));
+	}
+
+	/*
+	 * Remove the directories of the base file with its last
+	 * sidecar, this fails with ENOTEMPTY for all others.
+	 */
+	ret = unlinkat(dirfd, names[SIDECAR_DIR_DEPTH - 1], AT_REMOVEDIR);
+	if (ret == 0) {
+		unlinkat(parentfd,
+			 names[SIDECAR_FILE_DIR_DEPTH - 1],
+			 AT_REMOVEDIR);
+	}
+
+done:
+	if (genfd != -1) {
+		close(genfd);
+	}
+	if (dirfd != -1) {
+		close(dirfd);
+	}
+	if (parentfd != -1) {
+		close(parentfd);
+	}
+	unbecome_root();
+}
+
+/*
+ * The size of the stream whose xattr value is "value" on base_fsp
+ */
+static off_t streams_xattr_value_size(vfs_handle_struct *handle,
+				      struct files_struct *base_fsp,
+				      const DATA_BLOB *value)
+{
+	struct streams_xattr_config *config = NULL;
+	struct sidecar_ref ref;
+	off_t size;
+
+	SMB_VFS_HANDLE_GET_DATA(handle, config, struct streams_xattr_config,
+				return -1);
+
+	if (!sidecar_stub_parse(value, &ref)) {
+		return value->length - 1;
+	}
+
+	size = sidecar_size(handle, config, base_fsp->fsp_name, &ref);
+	if (size == -1) {
+		DBG_WARNING("Sidecar of %s is gone: %s\n",
+			    fsp_str_dbg(base_fsp),
+			    strerror(errno));
+		return -1;
+	}
+
+	return size;
+}
+
+static ssize_t get_xattr_size_fsp(vfs_handle_struct *handle,
+				  struct files_struct *fsp,
+				  const char *xattr_name)
 {
 	NTSTATUS status;
 	struct ea_struct ea;
@@ -60,7 +595,7 @@ static ssize_t get_xattr_size_fsp(struct files_struct *fsp,
 		return -1;
 	}
 
-	result = ea.value.length-1;
+	result = streams_xattr_value_size(handle, fsp, &ea.value);
 	TALLOC_FREE(ea.value.data);
 	return result;
 }
@@ -193,8 +728,20 @@ static int streams_xattr_fstat(vfs_handle_struct *handle, files_struct *fsp,
 		return -1;
 	}
 
-	sbuf->st_ex_size = get_xattr_size_fsp(fsp->base_fsp,
-					      io->xattr_name);
+	if (io->sidecar) {
+		SMB_STRUCT_STAT st;
+
+		ret = SMB_VFS_NEXT_FSTAT(handle, fsp, &st);
+		if (ret == -1) {
+			SET_STAT_INVALID(*sbuf);
+			return -1;
+		}
+		sbuf->st_ex_size = st.st_ex_size;
+	} else {
+		sbuf->st_ex_size = get_xattr_size_fsp(handle,
+						      fsp->base_fsp,
+						      io->xattr_name);
+	}
 	if (sbuf->st_ex_size == -1) {
 		SET_STAT_INVALID(*sbuf);
 		return -1;
@@ -269,7 +816,8 @@ static int streams_xattr_stat(vfs_handle_struct *handle,
 		fsp = fsp->base_fsp;
 	}
 
-	smb_fname->st.st_ex_size = get_xattr_size_fsp(fsp,
+	smb_fname->st.st_ex_size = get_xattr_size_fsp(handle,
+						      fsp,
 						      xattr_name);
 	if (smb_fname->st.st_ex_size == -1) {
 		TALLOC_FREE(xattr_name);
@@ -318,8 +866,10 @@ static int streams_xattr_openat(struct vfs_handle_struct *handle,
 	struct stream_io *sio = NULL;
 	struct ea_struct ea;
 	char *xattr_name = NULL;
+	struct sidecar_ref ref = { .gen = { 0 } };
 	int fakefd = -1;
 	bool set_empty_xattr = false;
+	bool sidecar = false;
 	int ret;
 
 	SMB_VFS_HANDLE_GET_DATA(handle, config, struct streams_xattr_config,
@@ -378,9 +928,17 @@ static int streams_xattr_openat(struct vfs_handle_struct *handle,
 		}
 
 		set_empty_xattr = true;
+	} else if (!fsp->fsp_flags.is_pathref &&
+		   sidecar_stub_parse(&ea.value, &ref))
+	{
+		if ((how->flags & (O_CREAT|O_EXCL)) == (O_CREAT|O_EXCL)) {
+			errno = EEXIST;
+			goto fail;
+		}
+		sidecar = true;
 	}
 
-	if (how->flags & O_TRUNC) {
+	if ((how->flags & O_TRUNC) && !sidecar) {
 		set_empty_xattr = true;
 	}
 
@@ -406,7 +964,18 @@ static int streams_xattr_openat(struct vfs_handle_struct *handle,
 		}
 	}
 
-	fakefd = vfs_fake_fd();
+	if (sidecar) {
+		fakefd = sidecar_open(handle,
+				      config,
+				      fsp,
+				      &ref,
+				      O_RDWR | (how->flags & O_TRUNC));
+		if (fakefd == -1) {
+			goto fail;
+		}
+	} else {
+		fakefd = vfs_fake_fd();
+	}
 
         sio = VFS_ADD_FSP_EXTENSION(handle, fsp, struct stream_io, NULL);
         if (sio == NULL) {
@@ -438,12 +1007,17 @@ static int streams_xattr_openat(struct vfs_handle_struct *handle,
 	sio->fsp_name_ptr = fsp->fsp_name;
 	sio->handle = handle;
 	sio->fsp = fsp;
+	sio->sidecar = sidecar;
 
 	return fakefd;
 
  fail:
 	if (fakefd >= 0) {
-		vfs_fake_fd_close(fakefd);
+		if (sidecar) {
+			close(fakefd);
+		} else {
+			vfs_fake_fd_close(fakefd);
+		}
 		fakefd = -1;
 	}
 
@@ -453,6 +1027,8 @@ static int streams_xattr_openat(struct vfs_handle_struct *handle,
 static int streams_xattr_close(vfs_handle_struct *handle,
 			       files_struct *fsp)
 {
+	struct stream_io *sio =
+		(struct stream_io *)VFS_FETCH_FSP_EXTENSION(handle, fsp);
 	int ret;
 	int fd;
 
@@ -465,6 +1041,11 @@ static int streams_xattr_close(vfs_handle_struct *handle,
 		return SMB_VFS_NEXT_CLOSE(handle, fsp);
 	}
 
+	if ((sio != NULL) && sio->sidecar) {
+		sio->sidecar = false;
+		return SMB_VFS_NEXT_CLOSE(handle, fsp);
+	}
+
 	ret = vfs_fake_fd_close(fd);
 	fsp_set_fd(fsp, -1);
 
@@ -481,6 +1062,10 @@ static int streams_xattr_unlinkat(vfs_handle_struct *handle,
 	char *xattr_name = NULL;
 	struct smb_filename *pathref = NULL;
 	struct files_struct *fsp = smb_fname->fsp;
+	struct streams_xattr_config *config = NULL;
+	struct ea_struct ea;
+	struct sidecar_ref ref = { .gen = { 0 } };
+	bool sidecar = false;
 
 	if (!is_named_stream(smb_fname)) {
 		return SMB_VFS_NEXT_UNLINKAT(handle,
@@ -489,6 +1074,9 @@ static int streams_xattr_unlinkat(vfs_handle_struct *handle,
 					flags);
 	}
 
+	SMB_VFS_HANDLE_GET_DATA(handle, config, struct streams_xattr_config,
+				return -1);
+
 	/* A stream can never be rmdir'ed */
 	SMB_ASSERT((flags & AT_REMOVEDIR) == 0);
 
@@ -518,6 +1106,12 @@ static int streams_xattr_unlinkat(vfs_handle_struct *handle,
 		fsp = fsp->base_fsp;
 	}
 
+	status = get_ea_value_fsp(talloc_tos(), fsp, xattr_name, &ea);
+	if (NT_STATUS_IS_OK(status)) {
+		sidecar = sidecar_stub_parse(&ea.value, &ref);
+		TALLOC_FREE(ea.value.data);
+	}
+
 	ret = SMB_VFS_FREMOVEXATTR(fsp, xattr_name);
 
 	if ((ret == -1) && (errno == ENOATTR)) {
@@ -525,6 +1119,10 @@ static int streams_xattr_unlinkat(vfs_handle_struct *handle,
 		goto fail;
 	}
 
+	if (sidecar) {
+		sidecar_unlink(handle, config, fsp->fsp_name, &ref);
+	}
+
 	ret = 0;
 
  fail:
@@ -547,11 +1145,18 @@ static int streams_xattr_renameat(vfs_handle_struct *handle,
 	ssize_t oret;
 	ssize_t nret;
 	struct ea_struct ea;
+	struct ea_struct dst_ea;
+	struct streams_xattr_config *config = NULL;
+	struct sidecar_ref ref = { .gen = { 0 } };
+	bool dst_sidecar = false;
 	struct smb_filename *pathref_src = NULL;
 	struct smb_filename *pathref_dst = NULL;
 	struct smb_filename *full_src = NULL;
 	struct smb_filename *full_dst = NULL;
 
+	SMB_VFS_HANDLE_GET_DATA(handle, config, struct streams_xattr_config,
+				return -1);
+
 	src_is_stream = is_ntfs_stream_smb_fname(smb_fname_src);
 	dst_is_stream = is_ntfs_stream_smb_fname(smb_fname_dst);
 
@@ -645,6 +1250,23 @@ static int streams_xattr_renameat(vfs_handle_struct *handle,
 		goto fail;
 	}
 
+	if (sidecar_stub_parse(&ea.value, &ref) &&
+	    !check_same_dev_ino(&pathref_src->st, &pathref_dst->st))
+	{
+		/* The sidecar is filed under the file id of the base file */
+		errno = EXDEV;
+		goto fail;
+	}
+
+	status = get_ea_value_fsp(talloc_tos(),
+				  pathref_dst->fsp,
+				  dst_xattr_name,
+				  &dst_ea);
+	if (NT_STATUS_IS_OK(status)) {
+		dst_sidecar = sidecar_stub_parse(&dst_ea.value, &ref);
+		TALLOC_FREE(dst_ea.value.data);
+	}
+
 	/* (Over)write the new stream on the base file fsp. */
 	nret = SMB_VFS_FSETXATTR(
 			pathref_dst->fsp,
@@ -671,6 +1293,11 @@ static int streams_xattr_renameat(vfs_handle_struct *handle,
 		goto fail;
 	}
 
+	if (dst_sidecar) {
+		/* The data of the overwritten stream */
+		sidecar_unlink(handle, config, pathref_dst, &ref);
+	}
+
  done:
 	errno = 0;
 	ret = 0;
@@ -795,6 +1422,7 @@ static bool add_one_stream(TALLOC_CTX *mem_ctx, unsigned int *num_streams,
 struct streaminfo_state {
 	TALLOC_CTX *mem_ctx;
 	vfs_handle_struct *handle;
+	files_struct *fsp;
 	unsigned int num_streams;
 	struct stream_struct *streams;
 	NTSTATUS status;
@@ -804,12 +1432,17 @@ static bool collect_one_stream(struct ea_struct *ea, void *private_data)
 {
 	struct streaminfo_state *state =
 		(struct streaminfo_state *)private_data;
+	off_t size;
+
+	size = streams_xattr_value_size(state->handle, state->fsp, &ea->value);
+	if (size == -1) {
+		return true;
+	}
 
 	if (!add_one_stream(state->mem_ctx,
 			    &state->num_streams, &state->streams,
-			    ea->name, ea->value.length-1,
-			    smb_roundup(state->handle->conn,
-					ea->value.length-1))) {
+			    ea->name, size,
+			    smb_roundup(state->handle->conn, size))) {
 		state->status = NT_STATUS_NO_MEMORY;
 		return false;
 	}
@@ -830,6 +1463,7 @@ static NTSTATUS streams_xattr_fstreaminfo(vfs_handle_struct *handle,
 	state.num_streams = *pnum_streams;
 	state.mem_ctx = mem_ctx;
 	state.handle = handle;
+	state.fsp = fsp;
 	state.status = NT_STATUS_OK;
 
 	status = walk_xattr_streams(handle,
@@ -864,10 +1498,96 @@ static uint32_t streams_xattr_fs_capabilities(struct vfs_handle_struct *handle,
 	return SMB_VFS_NEXT_FS_CAPABILITIES(handle, p_ts_res) | FILE_NAMED_STREAMS;
 }
 
+static int streams_xattr_config_destructor(struct streams_xattr_config *config)
+{
+	if (config->sidecar_dirfd != -1) {
+		close(config->sidecar_dirfd);
+		config->sidecar_dirfd = -1;
+	}
+	return 0;
+}
+
+/*
+ * Sidecars are accessed as root. Their directory has to be outside
+ * of the share, so that users can't plant symlinks or files there,
+ * and only the user smbd was started as may write to it.
+ */
+static int streams_xattr_sidecar_setup(vfs_handle_struct *handle,
+				       struct streams_xattr_config *config)
+{
+	const char *connectpath = handle->conn->connectpath;
+	const char *relative = NULL;
+	char *dir = NULL;
+	struct stat st;
+	int saved_errno = 0;
+	int ret;
+
+	if ((config->sidecar_dir == NULL) || (config->sidecar_dir[0] != '/')) {
+		DBG_ERR("streams_xattr:sidecar_threshold needs an absolute "
+			"streams_xattr:sidecar_directory\n");
+		return EINVAL;
+	}
+
+	dir = sys_realpath(config->sidecar_dir);
+	if (dir == NULL) {
+		ret = errno;
+		DBG_ERR("realpath(%s) failed: %s\n",
+			config->sidecar_dir,
+			strerror(ret));
+		return ret;
+	}
+
+	if (subdir_of(connectpath, strlen(connectpath), dir, &relative) ||
+	    subdir_of(dir, strlen(dir), connectpath, &relative))
+	{
+		DBG_ERR("streams_xattr:sidecar_directory %s overlaps with "
+			"the share path %s\n",
+			dir,
+			connectpath);
+		SAFE_FREE(dir);
+		return EINVAL;
+	}
+
+	become_root();
+	config->sidecar_dirfd = open(dir, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+	if (config->sidecar_dirfd == -1) {
+		saved_errno = errno;
+	}
+	unbecome_root();
+
+	if (config->sidecar_dirfd == -1) {
+		DBG_ERR("Could not open %s: %s\n", dir, strerror(saved_errno));
+		SAFE_FREE(dir);
+		return saved_errno;
+	}
+
+	ret = fstat(config->sidecar_dirfd, &st);
+	if (ret == -1) {
+		ret = errno;
+		SAFE_FREE(dir);
+		return ret;
+	}
+	if (((st.st_uid != sec_initial_uid()) && !uid_wrapper_enabled()) ||
+	    ((st.st_mode & (S_IWGRP|S_IWOTH)) != 0))
+	{
+		DBG_ERR("%s must be owned by uid %u and not be writable "
+			"by group or others\n",
+			dir,
+			(unsigned)sec_initial_uid());
+		SAFE_FREE(dir);
+		return EPERM;
+	}
+
+	SAFE_FREE(dir);
+	return 0;
+}
+
 static int streams_xattr_connect(vfs_handle_struct *handle,
 				 const char *service, const char *user)
 {
 	struct streams_xattr_config *config;
+	const struct loadparm_substitution *lp_sub =
+		loadparm_s3_global_substitution();
 	const char *default_prefix = SAMBA_XATTR_DOSSTREAM_PREFIX;
 	const char *prefix;
 	int rc;
@@ -901,6 +1621,30 @@ static int streams_xattr_connect(vfs_handle_struct *handle,
 						 "store_stream_type",
 						 true);
 
+	config->sidecar_dirfd = -1;
+	talloc_set_destructor(config, streams_xattr_config_destructor);
+
+	config->sidecar_threshold = conv_str_size(
+		lp_parm_const_string(SNUM(handle->conn),
+				     "streams_xattr",
+				     "sidecar_threshold",
+				     NULL));
+
+	if (config->sidecar_threshold != 0) {
+		config->sidecar_dir = lp_parm_substituted_string(
+			config,
+			lp_sub,
+			SNUM(handle->conn),
+			"streams_xattr",
+			"sidecar_directory",
+			NULL);
+		rc = streams_xattr_sidecar_setup(handle, config);
+		if (rc != 0) {
+			errno = rc;
+			return -1;
+		}
+	}
+
 	SMB_VFS_HANDLE_SET_DATA(handle, config,
 				NULL, struct stream_xattr_config,
 				return -1);
@@ -908,6 +1652,268 @@ static int streams_xattr_connect(vfs_handle_struct *handle,
 	return 0;
 }
 
+/*
+ * If value is a stub, make the sidecar the fd of sio->fsp. Returns
+ * whether the stream is in a sidecar.
+ */
+static int streams_xattr_sidecar_switch(struct stream_io *sio,
+					const DATA_BLOB *value)
+{
+	struct streams_xattr_config *config = NULL;
+	struct sidecar_ref ref;
+	int fd;
+
+	SMB_VFS_HANDLE_GET_DATA(sio->handle, config,
+				struct streams_xattr_config,
+				return -1);
+
+	if (!sidecar_stub_parse(value, &ref)) {
+		return 0;
+	}
+
+	/*
+	 * Another open moved the stream out of the xattr
+	 */
+	fd = sidecar_open(sio->handle, config, sio->fsp, &ref, O_RDWR);
+	if (fd == -1) {
+		return -1;
+	}
+
+	vfs_fake_fd_close(fsp_get_pathref_fd(sio->fsp));
+	fsp_set_fd(sio->fsp, fd);
+	sio->sidecar = true;
+
+	return 1;
+}
+
+struct sidecar_gen_state {
+	struct sidecar_ref ref;
+	bool found;
+};
+
+static bool sidecar_gen_fn(struct ea_struct *ea, void *private_data)
+{
+	struct sidecar_gen_state *state = private_data;
+
+	state->found = sidecar_stub_parse(&ea->value, &state->ref);
+	return !state->found;
+}
+
+/*
+ * Fill in the generation for a new sidecar of the stream sio is for.
+ * Must be called with the sidecar directory of the base file locked
+ * as dirfd.
+ */
+static int sidecar_gen_get(struct stream_io *sio,
+			   int dirfd,
+			   struct sidecar_ref *ref)
+{
+	files_struct *base_fsp = sio->fsp->base_fsp;
+	struct sidecar_gen_state state = { .found = false };
+	char gen[2 * SIDECAR_GEN_LEN + 1];
+	NTSTATUS status;
+
+	status = walk_xattr_streams(sio->handle,
+				    base_fsp,
+				    base_fsp->fsp_name,
+				    sidecar_gen_fn,
+				    &state);
+	if (!NT_STATUS_IS_OK(status)) {
+		errno = map_errno_from_nt_status(status);
+		return -1;
+	}
+
+	if (state.found) {
+		memcpy(ref->gen, state.ref.gen, SIDECAR_GEN_LEN);
+		return 0;
+	}
+
+	/*
+	 * This is the first sidecar of the file, anything already in
+	 * the directory belongs to a file that had the inode before.
+	 */
+	generate_random_buffer(ref->gen, SIDECAR_GEN_LEN);
+	hex_encode_buf(gen, ref->gen, SIDECAR_GEN_LEN);
+
+	become_root();
+	sidecar_remove_stale(dirfd, base_fsp->fsp_name, gen);
+	unbecome_root();
+
+	return 0;
+}
+
+/*
+ * Move the stream from the xattr into a new sidecar. Returns 1 if
+ * the stream is in a sidecar now.
+ *
+ * Two writers could both find the stream in the xattr and move it
+ * into a sidecar each, losing what the first one writes there. So
+ * the move happens under the lock of the base file's sidecar
+ * directory, with the xattr read again once we have it.
+ */
+static int streams_xattr_sidecar_create(struct stream_io *sio)
+{
+	struct streams_xattr_config *config = NULL;
+	const struct smb_filename *base_fname = sio->fsp->base_fsp->fsp_name;
+	struct ea_struct ea = { .name = NULL };
+	struct sidecar_ref ref;
+	char gen[2 * SIDECAR_GEN_LEN + 1];
+	uint8_t stub[SIDECAR_STUB_LEN + 1];
+	ssize_t nwritten;
+	NTSTATUS status;
+	int saved_errno;
+	int dirfd;
+	int genfd = -1;
+	int fd = -1;
+	int ret;
+
+	SMB_VFS_HANDLE_GET_DATA(sio->handle, config,
+				struct streams_xattr_config,
+				return -1);
+
+	become_root();
+	dirfd = sidecar_dir_lock(sio->handle, config, base_fname);
+	saved_errno = errno;
+	unbecome_root();
+	if (dirfd == -1) {
+		errno = saved_errno;
+		return -1;
+	}
+
+	status = get_ea_value_fsp(talloc_tos(),
+				  sio->fsp->base_fsp,
+				  sio->xattr_name,
+				  &ea);
+	if (!NT_STATUS_IS_OK(status)) {
+		errno = map_errno_from_nt_status(status);
+		goto fail;
+	}
+
+	ret = streams_xattr_sidecar_switch(sio, &ea.value);
+	if (ret != 0) {
+		/* Somebody else was faster */
+		TALLOC_FREE(ea.value.data);
+		close(dirfd);
+		return ret;
+	}
+
+	DBG_DEBUG("Moving %s of %s into a sidecar\n",
+		  sio->xattr_name,
+		  fsp_str_dbg(sio->fsp->base_fsp));
+
+	ret = sidecar_gen_get(sio, dirfd, &ref);
+	if (ret == -1) {
+		goto fail;
+	}
+	generate_random_buffer(ref.id, SIDECAR_ID_LEN);
+
+	hex_encode_buf(gen, ref.gen, SIDECAR_GEN_LEN);
+
+	become_root();
+	ret = mkdirat(dirfd, gen, 0700);
+	if ((ret == 0) || (errno == EEXIST)) {
+		genfd = openat(dirfd,
+			       gen,
+			       O_RDONLY|O_DIRECTORY|O_NOFOLLOW|O_CLOEXEC);
+	}
+	saved_errno = errno;
+	unbecome_root();
+	if (genfd == -1) {
+		errno = saved_errno;
+		goto fail;
+	}
+
+	fd = sidecar_create(genfd, base_fname, &ref);
+	if (fd == -1) {
+		goto fail;
+	}
+
+	nwritten = sys_pwrite_full(fd, ea.value.data, ea.value.length - 1, 0);
+	if (nwritten != ea.value.length - 1) {
+		goto fail;
+	}
+
+	sidecar_stub_push(stub, &ref);
+
+	ret = SMB_VFS_FSETXATTR(sio->fsp->base_fsp,
+				sio->xattr_name,
+				stub,
+				SIDECAR_STUB_LEN,
+				0);
+	if (ret == -1) {
+		goto fail;
+	}
+
+	TALLOC_FREE(ea.value.data);
+	close(genfd);
+	close(dirfd);
+
+	vfs_fake_fd_close(fsp_get_pathref_fd(sio->fsp));
+	fsp_set_fd(sio->fsp, fd);
+	sio->sidecar = true;
+
+	return 1;
+
+fail:
+	saved_errno = errno;
+	TALLOC_FREE(ea.value.data);
+	if (fd != -1) {
+		char idhex[2 * SIDECAR_ID_LEN + 1];
+
+		hex_encode_buf(idhex, ref.id, SIDECAR_ID_LEN);
+		close(fd);
+		become_root();
+		unlinkat(genfd, idhex, 0);
+		unbecome_root();
+	}
+	if (genfd != -1) {
+		close(genfd);
+	}
+	close(dirfd);
+	errno = saved_errno;
+	return -1;
+}
+
+/*
+ * Read the stream's xattr. Returns 1 if the stream turns out to be
+ * in a sidecar or is moved there because it grows beyond "size".
+ */
+static int streams_xattr_get_value(struct stream_io *sio,
+				   off_t size,
+				   struct ea_struct *ea)
+{
+	struct streams_xattr_config *config = NULL;
+	NTSTATUS status;
+	int ret;
+
+	SMB_VFS_HANDLE_GET_DATA(sio->handle, config,
+				struct streams_xattr_config,
+				return -1);
+
+	status = get_ea_value_fsp(talloc_tos(),
+				  sio->fsp->base_fsp,
+				  sio->xattr_name,
+				  ea);
+	if (!NT_STATUS_IS_OK(status)) {
+		errno = map_errno_from_nt_status(status);
+		return -1;
+	}
+
+	ret = streams_xattr_sidecar_switch(sio, &ea->value);
+	if (ret != 0) {
+		TALLOC_FREE(ea->value.data);
+		return ret;
+	}
+
+	if ((config->sidecar_threshold == 0) ||
+	    (size <= config->sidecar_threshold)) {
+		return 0;
+	}
+
+	TALLOC_FREE(ea->value.data);
+	return streams_xattr_sidecar_create(sio);
+}
+
 static ssize_t streams_xattr_pwrite(vfs_handle_struct *handle,
 				    files_struct *fsp, const void *data,
 				    size_t n, off_t offset)
@@ -915,12 +1921,11 @@ static ssize_t streams_xattr_pwrite(vfs_handle_struct *handle,
         struct stream_io *sio =
 		(struct stream_io *)VFS_FETCH_FSP_EXTENSION(handle, fsp);
 	struct ea_struct ea;
-	NTSTATUS status;
 	int ret;
 
 	DEBUG(10, ("streams_xattr_pwrite called for %d bytes\n", (int)n));
 
-	if (sio == NULL) {
+	if (sio == NULL || sio->sidecar) {
 		return SMB_VFS_NEXT_PWRITE(handle, fsp, data, n, offset);
 	}
 
@@ -928,6 +1933,14 @@ static ssize_t streams_xattr_pwrite(vfs_handle_struct *handle,
 		return -1;
 	}
 
+	ret = streams_xattr_get_value(sio, offset + n, &ea);
+	if (ret == -1) {
+		return -1;
+	}
+	if (ret == 1) {
+		return SMB_VFS_NEXT_PWRITE(handle, fsp, data, n, offset);
+	}
+
 	if ((offset + n) >= lp_smbd_max_xattr_size(SNUM(handle->conn))) {
 		/*
 		 * Requested write is beyond what can be read based on
@@ -945,18 +1958,11 @@ static ssize_t streams_xattr_pwrite(vfs_handle_struct *handle,
 			"smbd max xattr size = <bytes>. Consult OS and "
 			"filesystem manpages prior to increasing this limit.\n",
 			sio->xattr_name, sio->base);
+		TALLOC_FREE(ea.value.data);
 		errno = EOVERFLOW;
 		return -1;
 	}
 
-	status = get_ea_value_fsp(talloc_tos(),
-				  fsp->base_fsp,
-				  sio->xattr_name,
-				  &ea);
-	if (!NT_STATUS_IS_OK(status)) {
-		return -1;
-	}
-
         if ((offset + n) > ea.value.length-1) {
 		uint8_t *tmp;
 
@@ -996,13 +2002,13 @@ static ssize_t streams_xattr_pread(vfs_handle_struct *handle,
         struct stream_io *sio =
 		(struct stream_io *)VFS_FETCH_FSP_EXTENSION(handle, fsp);
 	struct ea_struct ea;
-	NTSTATUS status;
 	size_t length, overlap;
+	int ret;
 
 	DEBUG(10, ("streams_xattr_pread: offset=%d, size=%d\n",
 		   (int)offset, (int)n));
 
-	if (sio == NULL) {
+	if (sio == NULL || sio->sidecar) {
 		return SMB_VFS_NEXT_PREAD(handle, fsp, data, n, offset);
 	}
 
@@ -1010,13 +2016,14 @@ static ssize_t streams_xattr_pread(vfs_handle_struct *handle,
 		return -1;
 	}
 
-	status = get_ea_value_fsp(talloc_tos(),
-				  fsp->base_fsp,
-				  sio->xattr_name,
-				  &ea);
-	if (!NT_STATUS_IS_OK(status)) {
+	/* Reads never move the stream */
+	ret = streams_xattr_get_value(sio, 0, &ea);
+	if (ret == -1) {
 		return -1;
 	}
+	if (ret == 1) {
+		return SMB_VFS_NEXT_PREAD(handle, fsp, data, n, offset);
+	}
 
 	length = ea.value.length-1;
 
@@ -1062,7 +2069,7 @@ static struct tevent_req *streams_xattr_pread_send(
 		return NULL;
 	}
 
-	if (sio == NULL) {
+	if (sio == NULL || sio->sidecar) {
 		subreq = SMB_VFS_NEXT_PREAD_SEND(state, ev, handle, fsp,
 						 data, n, offset);
 		if (tevent_req_nomem(req, subreq)) {
@@ -1142,7 +2149,7 @@ static struct tevent_req *streams_xattr_pwrite_send(
 		return NULL;
 	}
 
-	if (sio == NULL) {
+	if (sio == NULL || sio->sidecar) {
 		subreq = SMB_VFS_NEXT_PWRITE_SEND(state, ev, handle, fsp,
 						  data, n, offset);
 		if (tevent_req_nomem(req, subreq)) {
@@ -1202,14 +2209,13 @@ static int streams_xattr_ftruncate(struct vfs_handle_struct *handle,
 	int ret;
 	uint8_t *tmp;
 	struct ea_struct ea;
-	NTSTATUS status;
         struct stream_io *sio =
 		(struct stream_io *)VFS_FETCH_FSP_EXTENSION(handle, fsp);
 
 	DEBUG(10, ("streams_xattr_ftruncate called for file %s offset %.0f\n",
 		   fsp_str_dbg(fsp), (double)offset));
 
-	if (sio == NULL) {
+	if (sio == NULL || sio->sidecar) {
 		return SMB_VFS_NEXT_FTRUNCATE(handle, fsp, offset);
 	}
 
@@ -1217,13 +2223,13 @@ static int streams_xattr_ftruncate(struct vfs_handle_struct *handle,
 		return -1;
 	}
 
-	status = get_ea_value_fsp(talloc_tos(),
-				  fsp->base_fsp,
-				  sio->xattr_name,
-				  &ea);
-	if (!NT_STATUS_IS_OK(status)) {
+	ret = streams_xattr_get_value(sio, offset, &ea);
+	if (ret == -1) {
 		return -1;
 	}
+	if (ret == 1) {
+		return SMB_VFS_NEXT_FTRUNCATE(handle, fsp, offset);
+	}
 
 	tmp = talloc_realloc(talloc_tos(), ea.value.data, uint8_t,
 				   offset + 1);
@@ -1272,7 +2278,7 @@ static int streams_xattr_fallocate(struct vfs_handle_struct *handle,
 		"len = %.0f\n",
 		fsp_str_dbg(fsp), (double)offset, (double)len));
 
-	if (sio == NULL) {
+	if (sio == NULL || sio->sidecar) {
 		return SMB_VFS_NEXT_FALLOCATE(handle, fsp, mode, offset, len);
 	}
 
@@ -1404,7 +2410,7 @@ static struct tevent_req *streams_xattr_fsync_send(
 		return NULL;
 	}
 
-	if (sio == NULL) {
+	if (sio == NULL || sio->sidecar) {
 		subreq = SMB_VFS_NEXT_FSYNC_SEND(state, ev, handle, fsp);
 		if (tevent_req_nomem(req, subreq)) {
 			return tevent_req_post(req, ev);
@@ -0,0 +1,780 @@
+/*
+ * Unix SMB/CIFS implementation.
+ * Cache the extended attributes of files per process
+ * Cache the extended attributes of a file on its fsp
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * smbd itself (DOS attributes, EAs) and modules like acl_xattr,
+ * streams_xattr and fruit each fetch the xattrs they need from the
+ * file system, so a directory listing or an open issues several
+ * getxattr calls per file, many of them for xattrs that don't exist
+ * and some of them more than once.
+ *
+ * This module keeps what it learned about the xattrs of a file in a
+ * per-process memcache, keyed by share and file id, so it outlives
+ * the pathref and open fsps of the file:
+ *
+ * - the list of all xattr names, read with one flistxattr the first
+ *   time an fsp of the file asks for an xattr,
+ *
+ * - values that were read,
+ *
+ * - names that were found not to exist.
+ *
+ * From then on flistxattr, fgetxattr and getxattrat_send (the async
+ * DOS attribute reads of directory listings) are answered from the
+ * cache where possible.
+ *
+ * Every xattr change updates the ctime of the file. An entry carries
+ * the ctime it was created for and is thrown away as soon as a caller
+ * comes with another one. The ctime is the one smbd already has,
+ * fsp->fsp_name->st or the smb_filename of getxattrat_send, the
+ * module doesn't stat the file itself. smbd refreshes that stat when
+ * it opens a file, lists a directory or returns file information, so
+ * a change by another process is seen from then on. A handle that was
+ * kept open and is used without any of those might get an old value
+ * until then. Changes through this module drop the entry right away.
+ *
+ * As the ctime comes from a coarse clock, no entries are created for
+ * files changed in the last two seconds.
+ *
+ * The module must be listed last in "vfs objects" so it sees the
+ * xattr calls of all other modules.
+ */
+
+#include "includes.h"
+#include "system/filesys.h"
+#include "smbd/smbd.h"
+#include "lib/util/memcache.h"
+#include "lib/util/tevent_unix.h"
+
+#define MODULE "xattr_cache"
+
+#define XATTR_CACHE_MAX_NAMES_SIZE 65536
+
+/* How old the change time must be to create an entry */
+#define XATTR_CACHE_RACY_SECS 2
+
+/* The name list is in the entry */
+#define XATTR_CACHE_NAMES_VALID		0x01
+/* flistxattr failed, don't try again for this ctime */
+#define XATTR_CACHE_NAMES_FAILED	0x02
+
+struct xattr_cache_key {
+	int snum;
+	struct file_id id;
+};
+
+/*
+ * A memcache entry is a struct xattr_cache_hdr, followed by names_len
+ * bytes of names and num_values times a struct xattr_cache_value_hdr,
+ * each followed by the NUL terminated name and the value.
+ */
+struct xattr_cache_hdr {
+	struct timespec ctime;
+	uint32_t flags;
+	uint32_t names_len;
+	uint32_t num_values;
+};
+
+struct xattr_cache_value_hdr {
+	uint32_t name_len;
+	int32_t length;		/* -1: the xattr does not exist */
+};
+
+struct xattr_cache_value {
+	const char *name;
+	const uint8_t *data;
+	ssize_t length;
+};
+
+/* An entry taken apart, pointing into a private copy */
+struct xattr_cache_entry {
+	struct timespec ctime;
+	uint32_t flags;
+	const char *names;
+	size_t names_len;
+	struct xattr_cache_value *values;
+	size_t num_values;
+};
+
+struct xattr_cache_config {
+	size_t max_value_size;
+};
+
+static struct memcache *xattr_cache_memcache;
+
+static int xattr_cache_connect(struct vfs_handle_struct *handle,
+			       const char *service,
+			       const char *user)
+{
+	struct xattr_cache_config *config = NULL;
+	int ret;
+
+	ret = SMB_VFS_NEXT_CONNECT(handle, service, user);
+	if (ret < 0) {
+		return ret;
+	}
+
+	config = talloc_zero(handle->conn, struct xattr_cache_config);
+	if (config == NULL) {
+		SMB_VFS_NEXT_DISCONNECT(handle);
+		errno = ENOMEM;
+		return -1;
+	}
+
+	config->max_value_size = conv_str_size(lp_parm_const_string(
+		SNUM(handle->conn), MODULE, "max value size", "65536"));
+
+	if (xattr_cache_memcache == NULL) {
+		size_t cache_size = conv_str_size(lp_parm_const_string(
+			-1, MODULE, "cache size", "1M"));
+
+		xattr_cache_memcache = memcache_init(NULL, cache_size);
+		if (xattr_cache_memcache == NULL) {
+			TALLOC_FREE(config);
+			SMB_VFS_NEXT_DISCONNECT(handle);
+			errno = ENOMEM;
+			return -1;
+		}
+	}
+
+	SMB_VFS_HANDLE_SET_DATA(handle,
+				config,
+				NULL,
+				struct xattr_cache_config,
+				return -1);
+	return 0;
+}
+
+static bool xattr_cache_usable(const struct smb_filename *smb_fname)
+{
+	return VALID_STAT(smb_fname->st) &&
+	       (smb_fname->stream_name == NULL) &&
+	       (smb_fname->twrp == 0);
+}
+
+static DATA_BLOB xattr_cache_key(struct xattr_cache_key *key,
+				 struct vfs_handle_struct *handle,
+				 const SMB_STRUCT_STAT *st)
+{
+	/* No padding in the key */
+	ZERO_STRUCTP(key);
+	key->snum = SNUM(handle->conn);
+	key->id = SMB_VFS_NEXT_FILE_ID_CREATE(handle, st);
+	return data_blob_const(key, sizeof(*key));
+}
+
+static bool xattr_cache_parse(TALLOC_CTX *mem_ctx,
+			      DATA_BLOB blob,
+			      struct xattr_cache_entry *e)
+{
+	struct xattr_cache_hdr hdr;
+	uint8_t *buf = NULL;
+	size_t ofs;
+	uint32_t i;
+
+	if (blob.length < sizeof(hdr)) {
+		return false;
+	}
+	memcpy(&hdr, blob.data, sizeof(hdr));
+
+	buf = talloc_memdup(mem_ctx, blob.data, blob.length);
+	if (buf == NULL) {
+		return false;
+	}
+	ofs = sizeof(hdr);
+
+	*e = (struct xattr_cache_entry) {
+		.ctime = hdr.ctime,
+		.flags = hdr.flags,
+		.names = (const char *)buf + ofs,
+		.names_len = hdr.names_len,
+	};
+	if (hdr.names_len > blob.length - ofs) {
+		goto fail;
+	}
+	ofs += hdr.names_len;
+
+	e->values = talloc_array(mem_ctx,
+				 struct xattr_cache_value,
+				 hdr.num_values);
+	if (e->values == NULL) {
+		goto fail;
+	}
+
+	for (i = 0; i < hdr.num_values; i++) {
+		struct xattr_cache_value_hdr vhdr;
+		size_t datalen;
+
+		if (sizeof(vhdr) > blob.length - ofs) {
+			goto fail;
+		}
+		memcpy(&vhdr, buf + ofs, sizeof(vhdr));
+		ofs += sizeof(vhdr);
+
+		datalen = (vhdr.length > 0) ? vhdr.length : 0;
+		if ((vhdr.name_len == 0) ||
+		    (vhdr.name_len > blob.length - ofs) ||
+		    (datalen > blob.length - ofs - vhdr.name_len) ||
+		    (buf[ofs + vhdr.name_len - 1] != '\0'))
+		{
+			goto fail;
+		}
+
+		e->values[i] = (struct xattr_cache_value) {
+			.name = (const char *)buf + ofs,
+			.data = buf + ofs + vhdr.name_len,
+			.length = vhdr.length,
+		};
+		ofs += vhdr.name_len + datalen;
+	}
+	e->num_values = hdr.num_values;
+
+	return true;
+fail:
+	TALLOC_FREE(e->values);
+	TALLOC_FREE(buf);
+	return false;
+}
+
+/*
+ * Fetch the entry for the file st describes. Without a valid entry *e
+ * is an empty one for the current ctime.
+ */
+static void xattr_cache_fetch(TALLOC_CTX *mem_ctx,
+			      struct vfs_handle_struct *handle,
+			      const SMB_STRUCT_STAT *st,
+			      struct xattr_cache_entry *e)
+{
+	struct xattr_cache_key k;
+	DATA_BLOB key = xattr_cache_key(&k, handle, st);
+	DATA_BLOB value;
+	bool ok;
+
+	ok = memcache_lookup(xattr_cache_memcache, VFS_XATTR_CACHE, key, &value);
+	if (ok) {
+		ok = xattr_cache_parse(mem_ctx, value, e);
+	}
+	if (ok && (timespec_compare(&e->ctime, &st->st_ex_ctime) == 0)) {
+		return;
+	}
+	if (ok) {
+		DBG_DEBUG("ctime changed\n");
+		memcache_delete(xattr_cache_memcache, VFS_XATTR_CACHE, key);
+	}
+
+	*e = (struct xattr_cache_entry) {
+		.ctime = st->st_ex_ctime,
+	};
+}
+
+static void xattr_cache_store(struct vfs_handle_struct *handle,
+			      const SMB_STRUCT_STAT *st,
+			      const struct xattr_cache_entry *e)
+{
+	struct timespec now = timespec_current();
+	struct xattr_cache_key k;
+	struct xattr_cache_hdr hdr = {
+		.ctime = e->ctime,
+		.flags = e->flags,
+		.names_len = e->names_len,
+		.num_values = e->num_values,
+	};
+	uint8_t *buf = NULL;
+	size_t len;
+	size_t ofs;
+	size_t i;
+
+	if (e->ctime.tv_sec + XATTR_CACHE_RACY_SECS > now.tv_sec) {
+		DBG_DEBUG("changed recently\n");
+		return;
+	}
+
+	len = sizeof(hdr) + e->names_len;
+	for (i = 0; i < e->num_values; i++) {
+		const struct xattr_cache_value *v = &e->values[i];
+
+		len += sizeof(struct xattr_cache_value_hdr) +
+		       strlen(v->name) + 1 +
+		       ((v->length > 0) ? v->length : 0);
+	}
+
+	buf = talloc_size(talloc_tos(), len);
+	if (buf == NULL) {
+		return;
+	}
+
+	memcpy(buf, &hdr, sizeof(hdr));
+	ofs = sizeof(hdr);
+	if (e->names_len != 0) {
+		memcpy(buf + ofs, e->names, e->names_len);
+	}
+	ofs += e->names_len;
+
+	for (i = 0; i < e->num_values; i++) {
+		const struct xattr_cache_value *v = &e->values[i];
+		struct xattr_cache_value_hdr vhdr = {
+			.name_len = strlen(v->name) + 1,
+			.length = v->length,
+		};
+
+		memcpy(buf + ofs, &vhdr, sizeof(vhdr));
+		ofs += sizeof(vhdr);
+		memcpy(buf + ofs, v->name, vhdr.name_len);
+		ofs += vhdr.name_len;
+		if (v->length > 0) {
+			memcpy(buf + ofs, v->data, v->length);
+			ofs += v->length;
+		}
+	}
+
+	memcache_add(xattr_cache_memcache,
+		     VFS_XATTR_CACHE,
+		     xattr_cache_key(&k, handle, st),
+		     data_blob_const(buf, len));
+	TALLOC_FREE(buf);
+}
+
+static void xattr_cache_drop(struct vfs_handle_struct *handle,
+			     struct files_struct *fsp)
+{
+	struct xattr_cache_key k;
+
+	if (!VALID_STAT(fsp->fsp_name->st)) {
+		return;
+	}
+	memcache_delete(xattr_cache_memcache,
+			VFS_XATTR_CACHE,
+			xattr_cache_key(&k, handle, &fsp->fsp_name->st));
+}
+
+/*
+ * Add what a getxattr returned to e, returns false if there's nothing
+ * worth storing.
+ */
+static bool xattr_cache_entry_add(TALLOC_CTX *mem_ctx,
+				  struct xattr_cache_config *config,
+				  struct xattr_cache_entry *e,
+				  const char *name,
+				  const void *data,
+				  ssize_t length)
+{
+	struct xattr_cache_value *values = NULL;
+
+	if ((length > 0) && ((size_t)length > config->max_value_size)) {
+		return false;
+	}
+
+	values = talloc_realloc(mem_ctx,
+				e->values,
+				struct xattr_cache_value,
+				e->num_values + 1);
+	if (values == NULL) {
+		return false;
+	}
+	e->values = values;
+
+	values[e->num_values] = (struct xattr_cache_value) {
+		.name = name,
+		.data = data,
+		.length = length,
+	};
+	e->num_values += 1;
+	return true;
+}
+
+static bool xattr_cache_entry_has_name(const struct xattr_cache_entry *e,
+				       const char *name)
+{
+	const char *p = e->names;
+	const char *end = e->names + e->names_len;
+
+	while (p < end) {
+		if (strcmp(p, name) == 0) {
+			return true;
+		}
+		p += strlen(p) + 1;
+	}
+	return false;
+}
+
+/*
+ * Is name known? Returns a value with length -1 for xattrs known not
+ * to exist, NULL if the xattr has to be read.
+ */
+static const struct xattr_cache_value *xattr_cache_entry_lookup(
+	const struct xattr_cache_entry *e,
+	const char *name)
+{
+	static const struct xattr_cache_value missing = {
+		.length = -1,
+	};
+	size_t i;
+
+	for (i = 0; i < e->num_values; i++) {
+		if (strcmp(e->values[i].name, name) == 0) {
+			return &e->values[i];
+		}
+	}
+	if ((e->flags & XATTR_CACHE_NAMES_VALID) &&
+	    !xattr_cache_entry_has_name(e, name))
+	{
+		return &missing;
+	}
+	return NULL;
+}
+
+/*
+ * Make sure e has the names of all xattrs, reading them with fsp.
+ * Returns false if the names can't be read.
+ */
+static bool xattr_cache_entry_names(TALLOC_CTX *mem_ctx,
+				    struct vfs_handle_struct *handle,
+				    struct files_struct *fsp,
+				    struct xattr_cache_entry *e)
+{
+	struct timespec now = timespec_current();
+	char *names = NULL;
+	size_t size = 1024;
+	ssize_t ret;
+
+	if (e->flags & XATTR_CACHE_NAMES_VALID) {
+		return true;
+	}
+	if (e->flags & XATTR_CACHE_NAMES_FAILED) {
+		return false;
+	}
+	if (e->ctime.tv_sec + XATTR_CACHE_RACY_SECS > now.tv_sec) {
+		/* Not worth it, the entry is not stored anyway */
+		return false;
+	}
+
+again:
+	names = talloc_realloc(mem_ctx, names, char, size);
+	if (names == NULL) {
+		return false;
+	}
+
+	ret = SMB_VFS_NEXT_FLISTXATTR(handle, fsp, names, size);
+	if ((ret == -1) && (errno == ERANGE) &&
+	    (size < XATTR_CACHE_MAX_NAMES_SIZE))
+	{
+		size = XATTR_CACHE_MAX_NAMES_SIZE;
+		goto again;
+	}
+	if ((ret == -1) || ((ret > 0) && (names[ret - 1] != '\0'))) {
+		DBG_DEBUG("flistxattr on %s failed: %s\n",
+			  fsp_str_dbg(fsp),
+			  (ret == -1) ? strerror(errno) : "not terminated");
+		TALLOC_FREE(names);
+		e->flags |= XATTR_CACHE_NAMES_FAILED;
+		xattr_cache_store(handle, &fsp->fsp_name->st, e);
+		return false;
+	}
+
+	e->names = names;
+	e->names_len = ret;
+	e->flags |= XATTR_CACHE_NAMES_VALID;
+	xattr_cache_store(handle, &fsp->fsp_name->st, e);
+	return true;
+}
+
+static bool xattr_cache_fsp_usable(struct files_struct *fsp)
+{
+	return !fsp_is_alternate_stream(fsp) &&
+	       (fsp_get_pathref_fd(fsp) != -1) &&
+	       xattr_cache_usable(fsp->fsp_name);
+}
+
+static ssize_t xattr_cache_fgetxattr(struct vfs_handle_struct *handle,
+				     struct files_struct *fsp,
+				     const char *name,
+				     void *value,
+				     size_t size)
+{
+	struct xattr_cache_config *config = NULL;
+	struct xattr_cache_entry e;
+	const struct xattr_cache_value *v = NULL;
+	TALLOC_CTX *frame = NULL;
+	ssize_t ret;
+	int err;
+
+	SMB_VFS_HANDLE_GET_DATA(handle,
+				config,
+				struct xattr_cache_config,
+				return -1);
+
+	if (!xattr_cache_fsp_usable(fsp)) {
+		return SMB_VFS_NEXT_FGETXATTR(handle, fsp, name, value, size);
+	}
+
+	frame = talloc_stackframe();
+
+	xattr_cache_fetch(frame, handle, &fsp->fsp_name->st, &e);
+	xattr_cache_entry_names(frame, handle, fsp, &e);
+
+	v = xattr_cache_entry_lookup(&e, name);
+	if ((v != NULL) && (v->length == -1)) {
+		TALLOC_FREE(frame);
+		errno = ENOATTR;
+		return -1;
+	}
+	if (v != NULL) {
+		ret = v->length;
+		if ((size != 0) && ((size_t)ret > size)) {
+			errno = ERANGE;
+			ret = -1;
+		} else if (size != 0) {
+			memcpy(value, v->data, ret);
+		}
+		TALLOC_FREE(frame);
+		return ret;
+	}
+
+	ret = SMB_VFS_NEXT_FGETXATTR(handle, fsp, name, value, size);
+	err = errno;
+
+	if (((ret >= 0) && (size != 0)) ||
+	    ((ret == -1) && (err == ENOATTR)))
+	{
+		if (xattr_cache_entry_add(frame, config, &e, name, value, ret)) {
+			xattr_cache_store(handle, &fsp->fsp_name->st, &e);
+		}
+	}
+
+	TALLOC_FREE(frame);
+	errno = err;
+	return ret;
+}
+
+static ssize_t xattr_cache_flistxattr(struct vfs_handle_struct *handle,
+				      struct files_struct *fsp,
+				      char *list,
+				      size_t size)
+{
+	struct xattr_cache_entry e;
+	TALLOC_CTX *frame = NULL;
+	ssize_t ret;
+
+	if (!xattr_cache_fsp_usable(fsp)) {
+		return SMB_VFS_NEXT_FLISTXATTR(handle, fsp, list, size);
+	}
+
+	frame = talloc_stackframe();
+
+	xattr_cache_fetch(frame, handle, &fsp->fsp_name->st, &e);
+	if (!xattr_cache_entry_names(frame, handle, fsp, &e)) {
+		TALLOC_FREE(frame);
+		return SMB_VFS_NEXT_FLISTXATTR(handle, fsp, list, size);
+	}
+
+	ret = e.names_len;
+	if ((size != 0) && (e.names_len > size)) {
+		errno = ERANGE;
+		ret = -1;
+	} else if (size != 0) {
+		memcpy(list, e.names, e.names_len);
+	}
+
+	TALLOC_FREE(frame);
+	return ret;
+}
+
+struct xattr_cache_getxattrat_state {
+	struct vfs_handle_struct *handle;
+	const struct smb_filename *smb_fname;
+	const char *xattr_name;
+	struct xattr_cache_entry e;
+	struct vfs_aio_state aio_state;
+	ssize_t xattr_size;
+	uint8_t *xattr_value;
+};
+
+static void xattr_cache_getxattrat_done(struct tevent_req *subreq);
+
+static struct tevent_req *xattr_cache_getxattrat_send(
+			TALLOC_CTX *mem_ctx,
+			struct tevent_context *ev,
+			struct vfs_handle_struct *handle,
+			files_struct *dir_fsp,
+			const struct smb_filename *smb_fname,
+			const char *xattr_name,
+			size_t alloc_hint)
+{
+	struct tevent_req *req = NULL;
+	struct tevent_req *subreq = NULL;
+	struct xattr_cache_getxattrat_state *state = NULL;
+	const struct xattr_cache_value *v = NULL;
+	bool usable = xattr_cache_usable(smb_fname);
+
+	req = tevent_req_create(mem_ctx, &state,
+				struct xattr_cache_getxattrat_state);
+	if (req == NULL) {
+		return NULL;
+	}
+	*state = (struct xattr_cache_getxattrat_state) {
+		.handle = handle,
+		.smb_fname = smb_fname,
+		.xattr_name = xattr_name,
+	};
+
+	if (usable) {
+		xattr_cache_fetch(state, handle, &smb_fname->st, &state->e);
+		v = xattr_cache_entry_lookup(&state->e, xattr_name);
+	}
+	if ((v != NULL) && (v->length == -1)) {
+		tevent_req_error(req, ENOATTR);
+		return tevent_req_post(req, ev);
+	}
+	if (v != NULL) {
+		state->xattr_size = v->length;
+		state->xattr_value = talloc_memdup(state,
+						   v->data,
+						   v->length);
+		if ((v->length != 0) &&
+		    tevent_req_nomem(state->xattr_value, req))
+		{
+			return tevent_req_post(req, ev);
+		}
+		tevent_req_done(req);
+		return tevent_req_post(req, ev);
+	}
+	if (!usable) {
+		state->smb_fname = NULL;
+	}
+
+	subreq = SMB_VFS_NEXT_GETXATTRAT_SEND(state,
+					      ev,
+					      handle,
+					      dir_fsp,
+					      smb_fname,
+					      xattr_name,
+					      alloc_hint);
+	if (tevent_req_nomem(subreq, req)) {
+		return tevent_req_post(req, ev);
+	}
+	tevent_req_set_callback(subreq, xattr_cache_getxattrat_done, req);
+
+	return req;
+}
+
+static void xattr_cache_getxattrat_done(struct tevent_req *subreq)
+{
+	struct tevent_req *req = tevent_req_callback_data(
+		subreq, struct tevent_req);
+	struct xattr_cache_getxattrat_state *state = tevent_req_data(
+		req, struct xattr_cache_getxattrat_state);
+	struct xattr_cache_config *config = NULL;
+	bool store = false;
+
+	state->xattr_size = SMB_VFS_NEXT_GETXATTRAT_RECV(subreq,
+							 &state->aio_state,
+							 state,
+							 &state->xattr_value);
+	TALLOC_FREE(subreq);
+
+	SMB_VFS_HANDLE_GET_DATA(state->handle,
+				config,
+				struct xattr_cache_config,
+				smb_panic(__location__));
+
+	if ((state->smb_fname != NULL) &&
+	    ((state->xattr_size >= 0) ||
+	     (state->aio_state.error == ENOATTR)))
+	{
+		store = xattr_cache_entry_add(state,
+					      config,
+					      &state->e,
+					      state->xattr_name,
+					      state->xattr_value,
+					      state->xattr_size);
+	}
+	if (store) {
+		xattr_cache_store(state->handle,
+				  &state->smb_fname->st,
+				  &state->e);
+	}
+
+	if (state->xattr_size == -1) {
+		tevent_req_error(req, state->aio_state.error);
+		return;
+	}
+
+	tevent_req_done(req);
+}
+
+static ssize_t xattr_cache_getxattrat_recv(struct tevent_req *req,
+					   struct vfs_aio_state *aio_state,
+					   TALLOC_CTX *mem_ctx,
+					   uint8_t **xattr_value)
+{
+	struct xattr_cache_getxattrat_state *state = tevent_req_data(
+		req, struct xattr_cache_getxattrat_state);
+	ssize_t xattr_size;
+
+	if (tevent_req_is_unix_error(req, &aio_state->error)) {
+		tevent_req_received(req);
+		return -1;
+	}
+
+	*aio_state = state->aio_state;
+	xattr_size = state->xattr_size;
+	if (xattr_value != NULL) {
+		*xattr_value = talloc_move(mem_ctx, &state->xattr_value);
+	}
+
+	tevent_req_received(req);
+	return xattr_size;
+}
+
+static int xattr_cache_fremovexattr(struct vfs_handle_struct *handle,
+				    struct files_struct *fsp,
+				    const char *name)
+{
+	xattr_cache_drop(handle, fsp);
+	return SMB_VFS_NEXT_FREMOVEXATTR(handle, fsp, name);
+}
+
+static int xattr_cache_fsetxattr(struct vfs_handle_struct *handle,
+				 struct files_struct *fsp,
+				 const char *name,
+				 const void *value,
+				 size_t size,
+				 int flags)
+{
+	xattr_cache_drop(handle, fsp);
+	return SMB_VFS_NEXT_FSETXATTR(handle, fsp, name, value, size, flags);
+}
+
+static struct vfs_fn_pointers vfs_xattr_cache_fns = {
+	.connect_fn = xattr_cache_connect,
+	.getxattrat_send_fn = xattr_cache_getxattrat_send,
+	.getxattrat_recv_fn = xattr_cache_getxattrat_recv,
+	.fgetxattr_fn = xattr_cache_fgetxattr,
+	.flistxattr_fn = xattr_cache_flistxattr,
+	.fremovexattr_fn = xattr_cache_fremovexattr,
+	.fsetxattr_fn = xattr_cache_fsetxattr,
+};
+
+static_decl_vfs;
+NTSTATUS vfs_xattr_cache_init(TALLOC_CTX *ctx)
+{
+	return smb_register_vfs(SMB_VFS_INTERFACE_VERSION,
+				MODULE,
+				&vfs_xattr_cache_fns);
+}
@@ -251,6 +251,8 @@ static const struct loadparm_service _sDefault =
 	.server_smb_encrypt = SMB_ENCRYPTION_DEFAULT,
 	.kernel_share_modes = false,
 	.durable_handles = true,
+	.smb_compression = SMB_COMPRESSION_REQUESTED,
+	.smb2_fair_queue_weight = 1,
 	.check_parent_directory_delete_on_close = false,
 	.param_opt = NULL,
 	.smbd_search_ask_sharemode = true,
@@ -879,6 +881,9 @@ void loadparm_s3_init_globals(struct loadparm_context *lp_ctx,
 	Globals.smb2_max_credits = DEFAULT_SMB2_MAX_CREDITS;
 	Globals.smb2_leases = true;
 	Globals.server_multi_channel_support = true;
+	Globals.smb_compression_min_size = DEFAULT_SMB_COMPRESSION_MIN_SIZE;
+	Globals.smb_encryption_offload_min_size =
+		DEFAULT_SMB_ENCRYPTION_OFFLOAD_MIN_SIZE;
 
 	lpcfg_string_set(Globals.ctx, &Globals.ncalrpc_dir,
 			 get_dyn_NCALRPCDIR());
@@ -0,0 +1,127 @@
+#!/bin/sh
+
+# Check that SMB2 connections to a server with "smb2 io uring = yes"
+# really run over io_uring and did not silently fall back to the
+# socket transport, e.g. because the kernel refused to set up a ring,
+# and that large READ responses take the zero copy send path.
+
+if [ $# -lt 7 ]; then
+	echo "Usage: test_smb2_uring.sh SERVER_IP USERNAME PASSWORD PREFIX SMBCLIENT SMBSTATUS CONFIGURATION"
+	exit 1
+fi
+
+SERVER_IP="${1}"
+USERNAME="${2}"
+PASSWORD="${3}"
+PREFIX="${4}"
+SMBCLIENT="${5}"
+SMBSTATUS="${6}"
+CONFIGURATION="${7}"
+
+shift 7
+
+incdir=$(dirname $0)/../../../testprogs/blackbox
+. $incdir/subunit.sh
+
+failed=0
+
+profile_count()
+{
+	local name="$1"
+	local count
+
+	count=$(UID_WRAPPER_INITIAL_RUID=0 UID_WRAPPER_INITIAL_EUID=0 \
+		$SMBSTATUS $CONFIGURATION --profile |
+		sed -n "s/^${name}_count: *//p")
+	echo "${count:-0}"
+}
+
+test_smb2_uring_active()
+{
+	local tmpfile=$PREFIX/smb2_uring_file
+	local before
+	local after
+	local i
+
+	before=$(profile_count smb2_uring_start)
+
+	head -c 1048576 /dev/zero >$tmpfile
+	$SMBCLIENT $CONFIGURATION //$SERVER_IP/tmp \
+		-U$USERNAME%$PASSWORD -mSMB3 \
+		-c "put $tmpfile smb2_uring_file; get smb2_uring_file $tmpfile; del smb2_uring_file"
+	ret=$?
+	rm -f $tmpfile
+	if [ $ret -ne 0 ]; then
+		echo "Failed to transfer a file with error $ret"
+		return 1
+	fi
+
+	# smbd flushes its counters on exit, which happens
+	# asynchronously after smbclient disconnected
+	for i in 1 2 3 4 5 6 7 8 9 10; do
+		after=$(profile_count smb2_uring_start)
+		if [ "$after" -gt "$before" ]; then
+			return 0
+		fi
+		sleep 1
+	done
+
+	echo "smb2_uring_start_count did not increase ($before -> $after):"
+	echo "the connection did not use io_uring"
+	return 1
+}
+
+# READ responses of signed and encrypted sessions are sent with
+# IORING_OP_SENDMSG_ZC. Under socket_wrapper the kernel refuses
+# zero copy on the unix domain sockets, smbd then has to resend
+# the data by copying without the client noticing.
+test_smb2_uring_zc()
+{
+	local protection="$1"
+	local tmpfile=$PREFIX/smb2_uring_zc_file
+	local before
+	local after
+	local i
+
+	before=$(profile_count smb2_uring_send_zc)
+
+	head -c 4194304 /dev/urandom >$tmpfile
+	$SMBCLIENT $CONFIGURATION //$SERVER_IP/tmp \
+		-U$USERNAME%$PASSWORD -mSMB3 \
+		--client-protection=$protection \
+		-c "put $tmpfile smb2_uring_zc_file; get smb2_uring_zc_file $tmpfile.get; del smb2_uring_zc_file"
+	ret=$?
+	if [ $ret -eq 0 ]; then
+		cmp $tmpfile $tmpfile.get
+		ret=$?
+	fi
+	rm -f $tmpfile $tmpfile.get
+	if [ $ret -ne 0 ]; then
+		echo "Failed to transfer a file with error $ret"
+		return 1
+	fi
+
+	for i in 1 2 3 4 5 6 7 8 9 10; do
+		after=$(profile_count smb2_uring_send_zc)
+		if [ "$after" -gt "$before" ]; then
+			return 0
+		fi
+		sleep 1
+	done
+
+	echo "smb2_uring_send_zc_count did not increase ($before -> $after):"
+	echo "the $protection session did not use zero copy sends"
+	return 1
+}
+
+testit "smb2_uring_active" \
+	test_smb2_uring_active ||
+	failed=$(expr $failed + 1)
+testit "smb2_uring_zc_signed" \
+	test_smb2_uring_zc sign ||
+	failed=$(expr $failed + 1)
+testit "smb2_uring_zc_encrypted" \
+	test_smb2_uring_zc encrypt ||
+	failed=$(expr $failed + 1)
+
+testok $0 $failed
@@ -0,0 +1,219 @@
+#!/bin/sh
+#
+# Check that the index of "smbd name index dirs" follows changes
+# made outside smbd: case variants, renames and an overflow of the
+# inotify queue. All lookups of a test run in one smbclient session,
+# so they go to the same smbd and its index, the changes are made
+# with smbclient's "!" shell escape in between.
+
+if [ $# -lt 7 ]; then
+	echo "Usage: test_smbd_name_index.sh SERVER_IP USERNAME PASSWORD LOCAL_PATH SMBCLIENT SMBSTATUS CONFIGURATION"
+	exit 1
+fi
+
+SERVER_IP="${1}"
+USERNAME="${2}"
+PASSWORD="${3}"
+LOCAL_PATH="${4}"
+SMBCLIENT="${5}"
+SMBSTATUS="${6}"
+CONFIGURATION="${7}"
+
+shift 7
+
+incdir=$(dirname $0)/../../../testprogs/blackbox
+. $incdir/subunit.sh
+
+failed=0
+
+cd $SELFTEST_TMPDIR || exit 1
+
+dir=name_index
+local_dir=$LOCAL_PATH/$dir
+
+CLI_FORCE_INTERACTIVE=1
+export CLI_FORCE_INTERACTIVE
+
+profile_count()
+{
+	local name="$1"
+	local count
+
+	count=$(UID_WRAPPER_INITIAL_RUID=0 UID_WRAPPER_INITIAL_EUID=0 \
+		$SMBSTATUS $CONFIGURATION --profile 2>/dev/null |
+		sed -n "s/^${name}_count: *//p")
+	echo "${count:-0}"
+}
+
+# smbd flushes its counters asynchronously
+wait_profile_count()
+{
+	local name="$1"
+	local before="$2"
+	local after
+	local i
+
+	if [ "$have_profile" != "yes" ]; then
+		return 0
+	fi
+
+	for i in 1 2 3 4 5 6 7 8 9 10; do
+		after=$(profile_count $name)
+		if [ "$after" -gt "$before" ]; then
+			return 0
+		fi
+		sleep 1
+	done
+
+	echo "${name}_count did not increase ($before -> $after)"
+	return 1
+}
+
+# Without profiling data only the lookups are checked, not that
+# they really went via the index
+have_profile=no
+if UID_WRAPPER_INITIAL_RUID=0 UID_WRAPPER_INITIAL_EUID=0 \
+	$SMBSTATUS $CONFIGURATION --profile 2>/dev/null |
+	grep -q "^name_index_build_count:"; then
+	have_profile=yes
+fi
+
+setup_dir()
+{
+	rm -rf $local_dir
+	mkdir $local_dir || return 1
+	(cd $local_dir && seq -f "file_%03g" 0 299 | xargs touch)
+}
+
+# Lines of the form "found NAME" and "missing NAME" look up NAME
+# with allinfo, other lines are passed to smbclient as they are.
+# The output is matched by NAME, so use each spelling only once.
+run_lookups()
+{
+	local script="$1"
+	local cmds=name_index_cmds
+	local out=name_index_out
+	local num_found=0
+	local num_ok
+	local ret=0
+
+	echo "$script" | while read op arg; do
+		case "$op" in
+		found | missing)
+			echo "allinfo $dir/$arg"
+			;;
+		*)
+			echo "$op $arg"
+			;;
+		esac
+	done >$cmds
+	echo "exit" >>$cmds
+
+	$SMBCLIENT $CONFIGURATION //$SERVER_IP/tmp \
+		-U$USERNAME%$PASSWORD -mSMB3 <$cmds >$out 2>&1
+
+	for arg in $(echo "$script" | sed -n 's/^found //p'); do
+		num_found=$(expr $num_found + 1)
+		if grep -q "getting alt name for \\\\$dir\\\\$arg\$" $out; then
+			echo "Lookup of $arg failed:"
+			grep "getting alt name for \\\\$dir\\\\$arg\$" $out
+			ret=1
+		fi
+	done
+	for arg in $(echo "$script" | sed -n 's/^missing //p'); do
+		if ! grep -q "^NT_STATUS_OBJECT_NAME_NOT_FOUND getting alt name for \\\\$dir\\\\$arg\$" $out; then
+			echo "Lookup of $arg did not fail as expected"
+			ret=1
+		fi
+	done
+
+	# Make sure the session ran all lookups
+	num_ok=$(grep -c "^create_time:" $out)
+	if [ "$num_ok" -ne "$num_found" ]; then
+		echo "Expected $num_found successful lookups, got $num_ok"
+		ret=1
+	fi
+
+	if [ $ret -ne 0 ]; then
+		cat $out
+	fi
+	rm -f $cmds $out
+	return $ret
+}
+
+test_name_index_case_variants()
+{
+	local before=$(profile_count name_index_build)
+
+	setup_dir || return 1
+
+	run_lookups "found FILE_100
+!touch $local_dir/Variant
+found VARIANT
+!touch $local_dir/VARIANT
+found variant
+!rm $local_dir/Variant
+found vARIANT
+!rm $local_dir/VARIANT
+missing VARiant
+found File_200" || return 1
+
+	wait_profile_count name_index_build $before
+}
+
+test_name_index_rename()
+{
+	local before=$(profile_count name_index_hit)
+
+	setup_dir || return 1
+	mkdir $LOCAL_PATH/name_index_outside
+
+	run_lookups "found File_010
+!mv $local_dir/file_010 $local_dir/renamed_010
+missing FILE_010
+found RENAMED_010
+!mv $local_dir/file_011 $LOCAL_PATH/name_index_outside/file_011
+missing FILE_011
+!mv $LOCAL_PATH/name_index_outside/file_011 $local_dir/moved_back_011
+found MOVED_BACK_011
+missing File_011" || return 1
+
+	rm -rf $LOCAL_PATH/name_index_outside
+	wait_profile_count name_index_hit $before
+}
+
+test_name_index_overflow()
+{
+	local before=$(profile_count name_index_drop_all)
+	local max_events
+
+	max_events=$(cat /proc/sys/fs/inotify/max_queued_events)
+	max_events=$(expr $max_events + 100)
+
+	setup_dir || return 1
+
+	run_lookups "found File_100
+!cd $local_dir && seq -f overflow_%06g 1 $max_events | xargs touch
+found OVERFLOW_000001
+!rm $local_dir/file_100
+missing FILE_100
+!touch $local_dir/After_Overflow
+found AFTER_OVERFLOW
+found Overflow_000100" || return 1
+
+	wait_profile_count name_index_drop_all $before
+}
+
+testit "name_index_case_variants" \
+	test_name_index_case_variants ||
+	failed=$(expr $failed + 1)
+testit "name_index_rename" \
+	test_name_index_rename ||
+	failed=$(expr $failed + 1)
+testit "name_index_overflow" \
+	test_name_index_overflow ||
+	failed=$(expr $failed + 1)
+
+rm -rf $local_dir
+
+testok $0 $failed
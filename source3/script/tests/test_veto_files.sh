@@ -206,6 +206,53 @@ test_per_user()
 	return 0
 }
 
+#
+# List dir1 on the veto_files_dircache share and check whether a name
+# shows up. The share caches directory listings, which must not leak
+# one user's view of the directory to another.
+#
+smbclient_ls_expect()
+{
+	user="$1"
+	filename1="$2"
+	expected="$3"
+
+	cmd='$SMBCLIENT -U$user%$PASSWORD //$SERVER/veto_files_dircache -I$SERVER_IP -c "ls dir1/*" 2>&1'
+	eval echo "$cmd"
+	out=$(eval "$cmd")
+	ret=$?
+	if [ $ret != 0 ]; then
+		printf "%s\n" "$out"
+		printf "failed listing veto_files_dircache share with error %s\n" "$ret"
+		return 1
+	fi
+
+	printf "%s" "$out" | grep -q " $filename1 "
+	ret=$?
+	if [ "$expected" = "present" ] && [ $ret != 0 ]; then
+		printf "%s\n" "$out"
+		printf "failed - %s should see %s\n" "$user" "$filename1"
+		return 1
+	fi
+	if [ "$expected" = "absent" ] && [ $ret = 0 ]; then
+		printf "%s\n" "$out"
+		printf "failed - %s should not see %s\n" "$user" "$filename1"
+		return 1
+	fi
+	return 0
+}
+
+test_per_user_dircache()
+{
+	smbclient_ls_expect user2 user2file absent || return 1
+	smbclient_ls_expect user1 user2file present || return 1
+	smbclient_ls_expect user1 user1file absent || return 1
+	smbclient_ls_expect user2 user1file present || return 1
+	smbclient_ls_expect user2 user2file absent || return 1
+
+	return 0
+}
+
 do_cleanup
 
 echo "regular_file" > "${SHAREPATH}/regular_file"
@@ -295,6 +342,7 @@ touch "$SHAREPATH/dir1/group2file"
 testit "create_veto_file" test_create_veto_file || failed=$((failed + 1))
 testit "get_veto_file" test_get_veto_file || failed=$(("$failed" + 1))
 testit "per-user" test_per_user || failed=$(("$failed" + 1))
+testit "per-user-dircache" test_per_user_dircache || failed=$(("$failed" + 1))
 
 do_cleanup
 
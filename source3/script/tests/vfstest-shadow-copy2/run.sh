@@ -0,0 +1,93 @@
+#!/bin/sh
+if [ $# -lt 2 ]; then
+	cat <<EOF
+Usage: run.sh VFSTEST PREFIX
+EOF
+	exit 1
+fi
+
+VFSTEST=$1
+PREFIX=$2
+shift 2
+ADDARGS="$*"
+
+VFSTEST_PREFIX=vfstest
+VFSTEST_TMPDIR=$(mktemp -d ${PREFIX}/${VFSTEST_PREFIX}_XXXXXX)
+
+# Months of hourly snapshots and number of Previous Versions lookups
+MONTHS=2
+CALLS=${CALLS:-20}
+
+incdir=$(dirname $0)/../../../../testprogs/blackbox
+. $incdir/subunit.sh
+
+failed=0
+
+mkdir -p $VFSTEST_TMPDIR/share $VFSTEST_TMPDIR/.snapshots || exit 1
+
+NUM_SNAPS=0
+for m in $(seq -w 1 $MONTHS); do
+	for d in $(seq -w 1 28); do
+		for h in $(seq -w 0 23); do
+			mkdir $VFSTEST_TMPDIR/.snapshots/@GMT-2020.$m.$d-$h.00.00 ||
+				exit 1
+			NUM_SNAPS=$(expr $NUM_SNAPS + 1)
+		done
+	done
+done
+mkdir $VFSTEST_TMPDIR/.snapshots/not-a-snapshot || exit 1
+
+cd $VFSTEST_TMPDIR/share || exit 1
+
+# List the snapshots CALLS times with the given cache time, check
+# the number of snapshots found and print the time taken
+test_vfstest()
+{
+	cache_time=$1
+	out=$($VFSTEST --option=vfsobjects=shadow_copy2 \
+		--option=shadow:mountpoint=$VFSTEST_TMPDIR \
+		"--option=shadow:snaplist cache time=$cache_time" \
+		$ADDARGS \
+		-c "connect;get_shadow_copy_data . $CALLS")
+	ret=$?
+
+	if [ $ret != 0 ]; then
+		echo "$out"
+		echo "command failed"
+		false
+		return
+	fi
+
+	summary=$(echo "$out" | grep "^get_shadow_copy_data:")
+	echo "cache time $cache_time: $summary"
+
+	echo "$summary" | grep " $NUM_SNAPS snapshots," >/dev/null 2>&1
+	if [ $? != 0 ]; then
+		echo "$out"
+		echo "expected $NUM_SNAPS snapshots"
+		false
+		return
+	fi
+
+	# shadow:sort defaults to desc
+	first=$(echo "$out" | grep "^@GMT-" | head -n 1)
+	if [ "$first" != "@GMT-2020.$MONTHS.28-23.00.00" ]; then
+		echo "$out"
+		echo "bad first snapshot $first"
+		false
+		return
+	fi
+
+	true
+}
+
+testit "vfstest_shadow_copy2" test_vfstest 0 ||
+	failed=$(expr $failed + 1)
+testit "vfstest_shadow_copy2_snaplist_cache" test_vfstest 60 ||
+	failed=$(expr $failed + 1)
+
+# Cleanup: remove tempdir
+cd $PREFIX
+rm -R $VFSTEST_TMPDIR
+
+exit $failed
@@ -575,6 +575,8 @@ local_tests = [
     "LOCAL-DBWRAP-WATCH3",
     "LOCAL-DBWRAP-WATCH4",
     "LOCAL-DBWRAP-DO-LOCKED1",
+    "LOCAL-DBWRAP-SHM1",
+    "LOCAL-DBWRAP-SHM2",
     "LOCAL-G-LOCK1",
     "LOCAL-G-LOCK2",
     "LOCAL-G-LOCK3",
@@ -597,6 +599,7 @@ plantestsuite("samba.vfstest.stream_depot", "nt4_dc:local", [os.path.join(samba3
 plantestsuite("samba.vfstest.xattr-tdb-1", "nt4_dc:local", [os.path.join(samba3srcdir, "script/tests/xattr-tdb-1/run.sh"), binpath("vfstest"), "$PREFIX", configuration])
 plantestsuite("samba.vfstest.acl", "nt4_dc:local", [os.path.join(samba3srcdir, "script/tests/vfstest-acl/run.sh"), binpath("vfstest"), "$PREFIX", configuration])
 plantestsuite("samba.vfstest.catia", "nt4_dc:local", [os.path.join(samba3srcdir, "script/tests/vfstest-catia/run.sh"), binpath("vfstest"), "$PREFIX", configuration])
+plantestsuite("samba.vfstest.shadow_copy2", "nt4_dc:local", [os.path.join(samba3srcdir, "script/tests/vfstest-shadow-copy2/run.sh"), binpath("vfstest"), "$PREFIX", configuration])
 plantestsuite(
     "samba.vfstest.full_audit_segfault",
     "nt4_dc:local",
@@ -1145,6 +1148,7 @@ vfs = [
     "vfs.fruit_netatalk",
     "vfs.fruit_file_id",
     "vfs.fruit_timemachine",
+    "vfs.fruit_copyfile",
     "vfs.fruit_conversion",
     "vfs.unfruit",
 ]
@@ -1181,6 +1185,10 @@ for t in tests:
         plansmbtorture4testsuite(t, "nt4_dc_smb1", '//$SERVER_IP/brl_delay_inject2 -U$USERNAME%$PASSWORD --option=torture:localdir=$SELFTEST_PREFIX/nt4_dc_smb1/share',
                                  description="brl_delay_inject2")
         plansmbtorture4testsuite(t, "ad_dc_smb1", '//$SERVER_IP/tmpguest -U$USERNAME%$PASSWORD --option=torture:localdir=$SELFTEST_PREFIX/ad_dc_smb1/share')
+    elif t == "smb2.deferred_close":
+        # not as root, smbd doesn't check the ACL for root
+        plansmbtorture4testsuite(t, "nt4_dc", '//$SERVER_IP/tmp -Uuser1%$PASSWORD')
+        plansmbtorture4testsuite(t, "fileserver", '//$SERVER_IP/deferred_close -Uuser1%$PASSWORD', 'deferred_close')
     elif t == "smb2.samba3misc":
         plansmbtorture4testsuite(t, "nt4_dc", '//$SERVER_IP/tmpguest -U$USERNAME%$PASSWORD --option=torture:localdir=$SELFTEST_PREFIX/nt4_dc/share')
         plansmbtorture4testsuite(t, "nt4_dc", '//$SERVER_IP/brl_delay_inject1 -U$USERNAME%$PASSWORD --option=torture:localdir=$SELFTEST_PREFIX/nt4_dc/share',
@@ -1188,6 +1196,8 @@ for t in tests:
         plansmbtorture4testsuite(t, "nt4_dc", '//$SERVER_IP/brl_delay_inject2 -U$USERNAME%$PASSWORD --option=torture:localdir=$SELFTEST_PREFIX/nt4_dc/share',
                                  description="brl_delay_inject2")
         plansmbtorture4testsuite(t, "ad_dc", '//$SERVER_IP/tmpguest -U$USERNAME%$PASSWORD --option=torture:localdir=$SELFTEST_PREFIX/ad_dc/share')
+    elif t == "smb2.fairq":
+        plansmbtorture4testsuite(t, "fileserver_fairq", '//$SERVER_IP/fairq -U$USERNAME%$PASSWORD')
     elif t == "raw.chkpath":
         plansmbtorture4testsuite(t, "nt4_dc_smb1", '//$SERVER_IP/tmpcase -U$USERNAME%$PASSWORD')
         plansmbtorture4testsuite(t, "ad_dc_smb1", '//$SERVER_IP/tmpcase -U$USERNAME%$PASSWORD')
@@ -1289,12 +1299,17 @@ for t in tests:
         plansmbtorture4testsuite(t, "nt4_dc", '//$SERVER_IP/vfs_fruit_metadata_stream -U$USERNAME%$PASSWORD --option=torture:localdir=$SELFTEST_PREFIX/nt4_dc/share --option=torture:share2=vfs_wo_fruit', 'metadata_stream')
         plansmbtorture4testsuite(t, "nt4_dc", '//$SERVER_IP/vfs_fruit_stream_depot -U$USERNAME%$PASSWORD --option=torture:localdir=$SELFTEST_PREFIX/nt4_dc/share --option=torture:share2=vfs_wo_fruit_stream_depot', 'streams_depot')
         plansmbtorture4testsuite(t, "nt4_dc", '//$SERVER_IP/vfs_fruit_delete_empty_adfiles -U$USERNAME%$PASSWORD --option=torture:localdir=$SELFTEST_PREFIX/nt4_dc/share --option=torture:share2=vfs_wo_fruit', 'fruit_delete_empty_adfiles')
+        plansmbtorture4testsuite(t, "nt4_dc", '//$SERVER_IP/vfs_fruit_metadata_cache -U$USERNAME%$PASSWORD --option=torture:localdir=$SELFTEST_PREFIX/nt4_dc/share --option=torture:share2=vfs_wo_fruit', 'metadata_cache')
+        plansmbtorture4testsuite(t, "nt4_dc", '//$SERVER_IP/vfs_fruit_metadata_stream_cache -U$USERNAME%$PASSWORD --option=torture:localdir=$SELFTEST_PREFIX/nt4_dc/share --option=torture:share2=vfs_wo_fruit', 'metadata_stream_cache')
     elif t == "vfs.fruit_netatalk":
         plansmbtorture4testsuite(t, "nt4_dc", '//$SERVER_IP/vfs_fruit_xattr -U$USERNAME%$PASSWORD --option=torture:localdir=$SELFTEST_PREFIX/nt4_dc/share')
     elif t == "vfs.fruit_timemachine":
         plansmbtorture4testsuite(t, "nt4_dc", '//$SERVER_IP/vfs_fruit_timemachine -U$USERNAME%$PASSWORD --option=torture:localdir=$SELFTEST_PREFIX/nt4_dc/share')
     elif t == "vfs.fruit_file_id":
         plansmbtorture4testsuite(t, "nt4_dc", '//$SERVER_IP/vfs_fruit_zero_fileid -U$USERNAME%$PASSWORD')
+    elif t == "vfs.fruit_copyfile":
+        plansmbtorture4testsuite(t, "nt4_dc", '//$SERVER_IP/vfs_fruit -U$USERNAME%$PASSWORD')
+        plansmbtorture4testsuite(t + ".segments", "nt4_dc", '//$SERVER_IP/vfs_fruit_copyfile_exdev -U$USERNAME%$PASSWORD', 'exdev')
     elif t == "vfs.fruit_conversion":
         plansmbtorture4testsuite(t, "nt4_dc", '//$SERVER_IP/tmp -U$USERNAME%$PASSWORD --option=torture:share2=vfs_fruit_wipe_intentionally_left_blank_rfork --option=torture:delete_empty_adfiles=false', 'wipe_intentionally_left_blank_rfork')
         plansmbtorture4testsuite(t, "nt4_dc", '//$SERVER_IP/tmp -U$USERNAME%$PASSWORD --option=torture:share2=vfs_fruit_delete_empty_adfiles --option=torture:delete_empty_adfiles=true', 'delete_empty_adfiles')
@@ -1348,6 +1363,7 @@ for t in tests:
         plansmbtorture4testsuite(t, "fileserver", '//$SERVER_IP/aio_delay_inject -U$USERNAME%$PASSWORD')
     elif t == "smb2.ea":
         plansmbtorture4testsuite(t, "fileserver", '//$SERVER/ea_acl_xattr --option=torture:acl_xattr_name=hackme -U$USERNAME%$PASSWORD')
+        plansmbtorture4testsuite(t, "fileserver", '//$SERVER/ea_xattr_cache --option=torture:acl_xattr_name=hackme -U$USERNAME%$PASSWORD', 'xattr_cache')
     elif t == "rpc.samba3.netlogon" or t == "rpc.samba3.sessionkey":
         plansmbtorture4testsuite(t, "nt4_dc_smb1", '//$SERVER_IP/tmp -U$USERNAME%$PASSWORD --option=torture:wksname=samba3rpctest')
         plansmbtorture4testsuite(t, "ad_dc_smb1", '//$SERVER/tmp -U$USERNAME%$PASSWORD --option=torture:wksname=samba3rpctest')
@@ -1355,6 +1371,7 @@ for t in tests:
         plansmbtorture4testsuite(t, "nt4_dc", '//$SERVER_IP/tmp -U$USERNAME%$PASSWORD')
         plansmbtorture4testsuite(t, "ad_dc", '//$SERVER/tmp -U$USERNAME%$PASSWORD')
         plansmbtorture4testsuite(t, "nt4_dc", '//$SERVER_IP/streams_xattr -U$USERNAME%$PASSWORD', 'streams_xattr')
+        plansmbtorture4testsuite(t, "nt4_dc", '//$SERVER_IP/streams_xattr_sidecar --option=torture:stream_sidecar=yes -U$USERNAME%$PASSWORD', 'streams_xattr_sidecar')
     elif t == "smb2.aio_delay":
         plansmbtorture4testsuite(t, "nt4_dc", '//$SERVER_IP/aio_delay_inject -U$USERNAME%$PASSWORD')
     elif t == "smb2.delete-on-close-perms":
@@ -1452,6 +1469,12 @@ plansmbtorture4testsuite(
     "simpleserver",
     '//$SERVER/external_streams_depot -U$USERNAME%$PASSWORD')
 
+plansmbtorture4testsuite(
+    "smb2.acls.ACL-OTHER-CONN",
+    "fileserver",
+    '//$SERVER/open_cache -U$USERNAME%$PASSWORD',
+    "open_cache")
+
 vfs_io_uring_tests = {
     "smb2.connect",
     "smb2.credits",
@@ -1463,6 +1486,80 @@ for t in vfs_io_uring_tests:
     plansmbtorture4testsuite(t, "fileserver",
                              '//$SERVER_IP/io_uring -U$USERNAME%$PASSWORD',
                              "vfs_io_uring")
+# With async dosmode directory listings read the DOS attributes
+# with getxattrat, which vfs_io_uring submits to its ring
+for t in ["smb2.async_dosmode", "smb2.compound_find"]:
+    plansmbtorture4testsuite(t, "fileserver",
+                             '//$SERVER_IP/io_uring_async_dosmode -U$USERNAME%$PASSWORD',
+                             "vfs_io_uring")
+
+smb2_uring_tests = {
+    "smb2.connect",
+    "smb2.credits",
+    "smb2.rw",
+    "smb2.read",
+    "smb2.compound",
+    "smb2.bench",
+}
+io_uring_openat_tests = [
+    "smb2.rw",
+    "smb2.create.brlocked",
+    "smb2.create.multi",
+    "smb2.create.delete",
+    "smb2.create.mkdir-dup",
+    "smb2.bench.create-delete",
+]
+# Without liburing smbd falls back to the socket transport, the
+# fileserver_uring environment would then silently test nothing new
+if "WITH_SMB2_URING" in config_hash:
+    # smbstatus --profile needs the server's smb.conf
+    if "WITH_PROFILE" in config_hash:
+        plantestsuite("samba3.blackbox.smb2_uring", "fileserver_uring:local",
+                      [os.path.join(samba3srcdir, "script/tests/test_smb2_uring.sh"),
+                       '$SERVER_IP', '$USERNAME', '$PASSWORD', '$PREFIX',
+                       smbclient3, smbstatus, configuration])
+    else:
+        selftesthelpers.skiptestsuite("samba3.blackbox.smb2_uring(fileserver_uring:local)",
+                                      "smbd built without profiling data")
+    for t in smb2_uring_tests:
+        plansmbtorture4testsuite(t, "fileserver_uring",
+                                 '//$SERVER_IP/tmp -U$USERNAME%$PASSWORD')
+    # Encrypted READ responses are sent with zero copy sendmsg
+    for t in ["smb2.rw", "smb2.read", "smb2.bench"]:
+        plansmbtorture4testsuite(t, "fileserver_uring",
+                                 '//$SERVER_IP/tmp -U$USERNAME%$PASSWORD '
+                                 '--client-protection=encrypt',
+                                 "encrypted")
+    # Exclusive creates on [io_uring_openat] go via IORING_OP_OPENAT and
+    # IORING_OP_STATX, like "aio_pthread:aio open" on [vfs_aio_pthread]
+    plantestsuite("samba3.smbtorture_s3.vfs_io_uring(fileserver_uring).SMB2-BASIC",
+                  "fileserver_uring",
+                  [os.path.join(samba3srcdir, "script/tests/test_smbtorture_s3.sh"),
+                   "SMB2-BASIC", '//$SERVER_IP/io_uring_openat', '$USERNAME',
+                   '$PASSWORD', smbtorture3, "", "-l $LOCAL_PATH"])
+    for t in io_uring_openat_tests:
+        plansmbtorture4testsuite(t, "fileserver_uring",
+                                 '//$SERVER_IP/io_uring_openat -U$USERNAME%$PASSWORD',
+                                 "vfs_io_uring_openat")
+    plansmbtorture4testsuite("smb2.bench.create-delete", "fileserver_uring",
+                             '//$SERVER_IP/vfs_aio_pthread -U$USERNAME%$PASSWORD',
+                             "vfs_aio_pthread")
+else:
+    selftesthelpers.skiptestsuite("samba3.blackbox.smb2_uring(fileserver_uring:local)",
+                                  "smbd built without liburing")
+    for t in sorted(smb2_uring_tests):
+        selftesthelpers.skiptestsuite("samba3.%s(fileserver_uring)" % t,
+                                      "smbd built without liburing")
+    for t in io_uring_openat_tests:
+        selftesthelpers.skiptestsuite("samba3.%s vfs_io_uring_openat(fileserver_uring)" % t,
+                                      "smbd built without liburing")
+
+# The name index needs inotify, smbstatus --profile the server's smb.conf
+if have_inotify:
+    plantestsuite("samba3.blackbox.smbd_name_index", "fileserver_nameidx:local",
+                  [os.path.join(samba3srcdir, "script/tests/test_smbd_name_index.sh"),
+                   '$SERVER_IP', '$USERNAME', '$PASSWORD', '$LOCAL_PATH',
+                   smbclient3, smbstatus, configuration])
 
 test = 'rpc.lsa.lookupsids'
 auth_options = ["", "ntlm", "spnego", "spnego,ntlm", "spnego,smb1", "spnego,smb2"]
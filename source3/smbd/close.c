@@ -898,6 +898,15 @@ static NTSTATUS close_normal_file(struct smb_request *req, files_struct *fsp,
 
 	locking_close_file(fsp, close_type);
 
+	if (fsp->fsp_flags.modified) {
+		/*
+		 * Writes don't trigger change notifications,
+		 * but the size and times of the directory
+		 * entry changed.
+		 */
+		smbd_dircache_invalidate(conn, fsp->fsp_name->base_name);
+	}
+
 	/*
 	 * Ensure pending modtime is set before closing underlying fd.
 	 */
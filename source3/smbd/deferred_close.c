@@ -0,0 +1,602 @@
+/*
+   Unix SMB/CIFS implementation.
+   Deferred close of SMB2 file handles
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Many clients open a small file, read it and close it again, over
+ * and over. Every cycle resolves the path, opens the file, checks the
+ * ACL, reads the DOS attributes, adds a share mode entry to
+ * locking.tdb and, on close, removes the entry and with it the whole
+ * record.
+ *
+ * With "smbd deferred close" an SMB2 CLOSE of an unmodified file that
+ * nobody else has open is answered right away, but the fd is kept
+ * open for the configured number of milliseconds. The share mode
+ * entry is removed just like a close does, so for every other open,
+ * in this or any other smbd, the file is closed. The smbXsrv_open of
+ * the handle is released and the fsp is no longer a file system
+ * access open (fsp_flags.is_fsa), so all that is left is an fd. The
+ * parked state lives in this process only:
+ *
+ * - An open by the same session on the same share for the same name
+ *   with the same access and share mode and without oplock, lease or
+ *   create contexts gets the parked fsp back with a new smbXsrv_open,
+ *   if a fresh stat of the name still shows the same file with the
+ *   same change time, the ACL still grants the access and nobody else
+ *   has the file open. The share mode entry is added again like an
+ *   open does. Any other open of the same name through this smbd
+ *   closes the parked fsp before it starts.
+ *
+ * - Otherwise the fsp is closed when the timer fires.
+ *
+ * Parking and reusing thus write locking.tdb exactly as often as the
+ * close and open they replace.
+ */
+
+#include "includes.h"
+#include "smbd/smbd.h"
+#include "smbd/globals.h"
+#include "lib/util/server_id.h"
+#include "locking/share_mode_lock.h"
+#include "librpc/gen_ndr/open_files.h"
+#include "messages.h"
+#include "libcli/security/security.h"
+
+extern const struct generic_mapping file_generic_mapping;
+
+/* Upper limit of parked handles per smbd */
+#define SMBD_DEFERRED_CLOSE_MAX 128
+
+struct smbd_deferred_close {
+	struct smbd_deferred_close *prev, *next;
+	struct files_struct *fsp;
+	uint32_t share_access;
+	struct timespec ctime;
+	struct tevent_timer *te;
+};
+
+static struct smbd_deferred_close *smbd_deferred_closes;
+static size_t smbd_num_deferred_closes;
+
+static int smbd_deferred_close_destructor(struct smbd_deferred_close *dc)
+{
+	DLIST_REMOVE(smbd_deferred_closes, dc);
+	smbd_num_deferred_closes -= 1;
+	return 0;
+}
+
+static void smbd_deferred_close_do(struct smbd_deferred_close *dc,
+				   const char *why)
+{
+	struct files_struct *fsp = dc->fsp;
+	NTSTATUS status;
+
+	DBG_DEBUG("%s: closing %s\n", why, fsp_str_dbg(fsp));
+
+	/*
+	 * The client closed the handle already, the close must not
+	 * depend on whoever triggers it now. Without is_fsa this just
+	 * closes the fd. The destructor of dc, a talloc child of fsp,
+	 * removes it from the list.
+	 */
+	become_root();
+	status = close_file_free(NULL, &fsp, ERROR_CLOSE);
+	unbecome_root();
+	if (!NT_STATUS_IS_OK(status)) {
+		DBG_WARNING("close_file_free failed: %s\n",
+			    nt_errstr(status));
+	}
+}
+
+static void smbd_deferred_close_timeout(struct tevent_context *ev,
+					struct tevent_timer *te,
+					struct timeval now,
+					void *private_data)
+{
+	struct smbd_deferred_close *dc = talloc_get_type_abort(
+		private_data, struct smbd_deferred_close);
+
+	dc->te = NULL;
+
+	DO_PROFILE_INC(deferred_close_timeout);
+
+	smbd_deferred_close_do(dc, "timeout");
+}
+
+static bool smbd_deferred_close_eligible(struct files_struct *fsp)
+{
+	const struct loadparm_substitution *lp_sub =
+		loadparm_s3_global_substitution();
+	int snum = SNUM(fsp->conn);
+
+	if (!fsp->fsp_flags.is_fsa ||
+	    fsp->fsp_flags.is_directory ||
+	    (fsp->fake_file_handle != NULL) ||
+	    (fsp->print_file != NULL) ||
+	    fsp_is_alternate_stream(fsp) ||
+	    (fsp->stream_fsp != NULL))
+	{
+		return false;
+	}
+	if ((fsp->op == NULL) || fsp->op->global->durable) {
+		return false;
+	}
+	if (fsp->oplock_type != NO_OPLOCK) {
+		/* The client caches the handle itself */
+		return false;
+	}
+	if (fsp->fsp_flags.modified ||
+	    fsp->fsp_flags.delete_on_close ||
+	    fsp->fsp_flags.initial_delete_on_close ||
+	    fsp->fsp_flags.update_write_time_on_close ||
+	    fsp->fsp_flags.write_time_forced ||
+	    fsp->fsp_flags.kernel_share_modes_taken ||
+	    (fsp->update_write_time_event != NULL))
+	{
+		return false;
+	}
+	if ((fsp->current_lock_count != 0) ||
+	    (fsp->num_aio_requests != 0) ||
+	    (fh_get_refcount(fsp->fh) != 1))
+	{
+		return false;
+	}
+	if ((fsp->posix_flags != 0) ||
+	    (fsp->fsp_name->flags & SMB_FILENAME_POSIX_PATH) ||
+	    (fsp->fsp_name->twrp != 0))
+	{
+		return false;
+	}
+	if (lp_kernel_oplocks(snum) ||
+	    (*lp_magic_script(talloc_tos(), lp_sub, snum) != '\0'))
+	{
+		return false;
+	}
+	return true;
+}
+
+struct smbd_deferred_close_entries_state {
+	struct server_id self;
+	uint64_t share_file_id;
+	size_t num_others;
+	bool found;
+	uint32_t share_access;
+};
+
+static bool smbd_deferred_close_entries_fn(struct share_mode_entry *e,
+					   bool *modified,
+					   void *private_data)
+{
+	struct smbd_deferred_close_entries_state *state = private_data;
+
+	if (share_entry_stale_pid(e)) {
+		return false;
+	}
+
+	if (!server_id_equal(&e->pid, &state->self) ||
+	    (e->share_file_id != state->share_file_id))
+	{
+		state->num_others += 1;
+		return false;
+	}
+
+	state->found = true;
+	state->share_access = e->share_access;
+	return false;
+}
+
+/*
+ * Is fsp the only open of the file and not about to be deleted? Returns
+ * the share access of fsp.
+ */
+static bool smbd_deferred_close_alone(struct share_mode_lock *lck,
+				      struct files_struct *fsp,
+				      uint32_t *share_access)
+{
+	struct smbd_deferred_close_entries_state state = {
+		.self = messaging_server_id(fsp->conn->sconn->msg_ctx),
+		.share_file_id = fh_get_gen_id(fsp->fh),
+	};
+	bool ok;
+
+	if (is_delete_on_close_set(lck, fsp->name_hash)) {
+		return false;
+	}
+
+	ok = share_mode_forall_entries(
+		lck, smbd_deferred_close_entries_fn, &state);
+	if (!ok || !state.found || (state.num_others != 0)) {
+		return false;
+	}
+	*share_access = state.share_access;
+	return true;
+}
+
+/**
+ * Instead of closing fsp, keep it open for "smbd deferred close"
+ * milliseconds. Returns true if fsp was parked, the caller must not
+ * touch it anymore after returning to the main loop.
+ */
+bool smbd_deferred_close_park(struct files_struct *fsp)
+{
+	struct smbd_server_connection *sconn = fsp->conn->sconn;
+	int msecs = lp_smbd_deferred_close(SNUM(fsp->conn));
+	struct smbd_deferred_close *dc = NULL;
+	struct share_mode_lock *lck = NULL;
+	NTSTATUS status;
+	bool ok;
+
+	if (msecs <= 0) {
+		return false;
+	}
+	if (!smbd_deferred_close_eligible(fsp)) {
+		return false;
+	}
+
+	status = vfs_stat_fsp(fsp);
+	if (!NT_STATUS_IS_OK(status)) {
+		return false;
+	}
+
+	dc = talloc(fsp, struct smbd_deferred_close);
+	if (dc == NULL) {
+		return false;
+	}
+	*dc = (struct smbd_deferred_close) {
+		.fsp = fsp,
+		.ctime = fsp->fsp_name->st.st_ex_ctime,
+	};
+
+	dc->te = tevent_add_timer(sconn->ev_ctx,
+				  dc,
+				  timeval_current_ofs_msec(msecs),
+				  smbd_deferred_close_timeout,
+				  dc);
+	if (dc->te == NULL) {
+		TALLOC_FREE(dc);
+		return false;
+	}
+
+	lck = get_existing_share_mode_lock(talloc_tos(), fsp->file_id);
+	if (lck == NULL) {
+		TALLOC_FREE(dc);
+		return false;
+	}
+
+	ok = smbd_deferred_close_alone(lck, fsp, &dc->share_access);
+	if (!ok) {
+		TALLOC_FREE(lck);
+		TALLOC_FREE(dc);
+		return false;
+	}
+
+	/*
+	 * This is the write the close would have done, freeing lck
+	 * removes the now empty record.
+	 */
+	ok = del_share_mode(lck, fsp);
+	TALLOC_FREE(lck);
+	if (!ok) {
+		TALLOC_FREE(dc);
+		return false;
+	}
+
+	/*
+	 * The client's handle is gone, a reuse gets a new one. Without
+	 * a share mode entry fsp is no file system access open anymore.
+	 */
+	fsp->op->compat = NULL;
+	TALLOC_FREE(fsp->op);
+	fsp->fnum = FNUM_FIELD_INVALID;
+	fsp->fsp_flags.fstat_before_close = false;
+	fsp->fsp_flags.is_fsa = false;
+
+	if (smbd_num_deferred_closes >= SMBD_DEFERRED_CLOSE_MAX) {
+		smbd_deferred_close_do(smbd_deferred_closes, "limit");
+	}
+
+	DLIST_ADD_END(smbd_deferred_closes, dc);
+	smbd_num_deferred_closes += 1;
+	talloc_set_destructor(dc, smbd_deferred_close_destructor);
+
+	DO_PROFILE_INC(deferred_close_park);
+
+	DBG_DEBUG("parked %s for %d msecs\n", fsp_str_dbg(fsp), msecs);
+
+	return true;
+}
+
+/**
+ * Is fsp kept open by a deferred close?
+ */
+bool smbd_deferred_close_is_parked(const struct files_struct *fsp)
+{
+	struct smbd_deferred_close *dc = NULL;
+
+	for (dc = smbd_deferred_closes; dc != NULL; dc = dc->next) {
+		if (dc->fsp == fsp) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool smbd_deferred_close_reusable(struct smbd_deferred_close *dc,
+					 struct smb_request *req,
+					 const char *name,
+					 uint32_t access_mask,
+					 uint32_t share_access,
+					 uint32_t create_disposition,
+					 uint32_t create_options)
+{
+	struct files_struct *fsp = dc->fsp;
+	struct smb_filename smb_fname = {
+		.base_name = discard_const_p(char, name),
+	};
+	SMB_STRUCT_STAT st;
+	struct file_id id;
+	uint32_t allowed_options =
+		FILE_NON_DIRECTORY_FILE |
+		FILE_SEQUENTIAL_ONLY |
+		FILE_RANDOM_ACCESS |
+		FILE_NO_INTERMEDIATE_BUFFERING |
+		FILE_SYNCHRONOUS_IO_ALERT |
+		FILE_SYNCHRONOUS_IO_NONALERT;
+	NTSTATUS status;
+	int ret;
+
+	if ((fsp->vuid != req->vuid) ||
+	    (strcmp(fsp->fsp_name->base_name, name) != 0))
+	{
+		return false;
+	}
+	if ((create_disposition != FILE_OPEN) &&
+	    (create_disposition != FILE_OPEN_IF))
+	{
+		return false;
+	}
+	if ((create_options & ~allowed_options) != 0) {
+		return false;
+	}
+	if (access_mask & (SEC_MASK_INVALID | MAXIMUM_ALLOWED_ACCESS)) {
+		return false;
+	}
+	se_map_generic(&access_mask, &file_generic_mapping);
+	if ((access_mask != fsp->access_mask) ||
+	    (share_access != dc->share_access))
+	{
+		return false;
+	}
+
+	/*
+	 * The name must still refer to the same file, unchanged since
+	 * the close.
+	 */
+	ret = SMB_VFS_FSTATAT(fsp->conn,
+			      fsp->conn->cwd_fsp,
+			      &smb_fname,
+			      &st,
+			      AT_SYMLINK_NOFOLLOW);
+	if (ret == -1) {
+		return false;
+	}
+	if (!S_ISREG(st.st_ex_mode)) {
+		return false;
+	}
+	id = vfs_file_id_from_sbuf(fsp->conn, &st);
+	if (!file_id_equal(&id, &fsp->file_id)) {
+		return false;
+	}
+	if (timespec_compare(&st.st_ex_ctime, &dc->ctime) != 0) {
+		return false;
+	}
+
+	fsp->fsp_name->st = st;
+
+	/*
+	 * A changed ACL also changes the ctime, but the ACL module
+	 * might map something else, group memberships or the user
+	 * itself, so check the access like an open does.
+	 */
+	status = smbd_check_access_rights_fsp(fsp->conn->cwd_fsp,
+					      fsp,
+					      false,
+					      access_mask);
+	if (!NT_STATUS_IS_OK(status)) {
+		DBG_DEBUG("smbd_check_access_rights_fsp(%s) failed: %s\n",
+			  fsp_str_dbg(fsp),
+			  nt_errstr(status));
+		return false;
+	}
+
+	return true;
+}
+
+struct smbd_deferred_close_unpark_state {
+	struct share_mode_entry_prepare_state prepare_state;
+	struct files_struct *fsp;
+	struct smb_request *req;
+	uint32_t share_access;
+	NTSTATUS status;
+};
+
+static void smbd_deferred_close_unpark_fn(struct share_mode_lock *lck,
+					  bool *keep_locked,
+					  void *private_data)
+{
+	struct smbd_deferred_close_unpark_state *state = private_data;
+	struct files_struct *fsp = state->fsp;
+	struct smbd_deferred_close_entries_state entries = {
+		.self = messaging_server_id(fsp->conn->sconn->msg_ctx),
+		.share_file_id = fh_get_gen_id(fsp->fh),
+	};
+	bool ok;
+
+	*keep_locked = false;
+
+	ok = share_mode_forall_entries(
+		lck, smbd_deferred_close_entries_fn, &entries);
+	if (!ok) {
+		state->status = NT_STATUS_INTERNAL_DB_CORRUPTION;
+		return;
+	}
+	if (entries.found || (entries.num_others != 0)) {
+		/*
+		 * Someone else opened the file, let the normal open
+		 * sort out share modes and oplocks.
+		 */
+		state->status = NT_STATUS_SHARING_VIOLATION;
+		return;
+	}
+
+	share_mode_flags_set(lck, fsp->access_mask, state->share_access, 0,
+			     NULL);
+
+	ok = set_share_mode(lck,
+			    fsp,
+			    get_current_uid(fsp->conn),
+			    state->req->mid,
+			    NO_OPLOCK,
+			    NULL,
+			    state->share_access,
+			    fsp->access_mask);
+	if (!ok) {
+		state->status = NT_STATUS_NO_MEMORY;
+		return;
+	}
+
+	state->status = NT_STATUS_OK;
+}
+
+/*
+ * Give fsp a share mode entry again, if nobody else opened the file in
+ * the meantime. This is the write the open would have done.
+ */
+static bool smbd_deferred_close_unpark(struct smbd_deferred_close *dc,
+				       struct smb_request *req)
+{
+	struct files_struct *fsp = dc->fsp;
+	struct smbd_deferred_close_unpark_state state = {
+		.fsp = fsp,
+		.req = req,
+		.share_access = dc->share_access,
+		.status = NT_STATUS_INTERNAL_ERROR,
+	};
+	NTSTATUS status;
+
+	fsp->open_time = timeval_current();
+
+	status = share_mode_entry_prepare_lock_add(
+		&state.prepare_state,
+		fsp->file_id,
+		fsp->conn->connectpath,
+		fsp->fsp_name,
+		&fsp->fsp_name->st.st_ex_mtime,
+		smbd_deferred_close_unpark_fn,
+		&state);
+	if (!NT_STATUS_IS_OK(status)) {
+		DBG_WARNING("share_mode_entry_prepare_lock_add failed: %s\n",
+			    nt_errstr(status));
+		return false;
+	}
+
+	status = share_mode_entry_prepare_unlock(&state.prepare_state,
+						 NULL,
+						 NULL);
+	if (!NT_STATUS_IS_OK(status)) {
+		DBG_WARNING("share_mode_entry_prepare_unlock failed: %s\n",
+			    nt_errstr(status));
+		smb_panic("share_mode_entry_prepare_unlock failed");
+	}
+
+	if (!NT_STATUS_IS_OK(state.status)) {
+		DBG_DEBUG("not reusing %s: %s\n",
+			  fsp_str_dbg(fsp),
+			  nt_errstr(state.status));
+		return false;
+	}
+
+	fsp->fsp_flags.is_fsa = true;
+	return true;
+}
+
+/**
+ * Called for every SMB2 create before the name is resolved. Closes
+ * parked fsps of the same name, unless one of them can be handed out
+ * for this create, which is returned.
+ */
+struct files_struct *smbd_deferred_close_reclaim(struct smb_request *req,
+						 const char *name,
+						 uint32_t access_mask,
+						 uint32_t share_access,
+						 uint32_t create_disposition,
+						 uint32_t create_options,
+						 bool may_reuse)
+{
+	struct smbd_deferred_close *dc = NULL;
+	struct smbd_deferred_close *next = NULL;
+	struct files_struct *fsp = NULL;
+	NTSTATUS status;
+
+	for (dc = smbd_deferred_closes; dc != NULL; dc = next) {
+		next = dc->next;
+
+		if ((dc->fsp->conn != req->conn) ||
+		    !strequal(dc->fsp->fsp_name->base_name, name))
+		{
+			continue;
+		}
+
+		if (!may_reuse ||
+		    !smbd_deferred_close_reusable(dc,
+						  req,
+						  name,
+						  access_mask,
+						  share_access,
+						  create_disposition,
+						  create_options) ||
+		    !smbd_deferred_close_unpark(dc, req))
+		{
+			DO_PROFILE_INC(deferred_close_conflict);
+			smbd_deferred_close_do(dc, "conflict");
+			continue;
+		}
+
+		fsp = dc->fsp;
+		TALLOC_FREE(dc);
+
+		status = fsp_bind_smb(fsp, req);
+		if (!NT_STATUS_IS_OK(status)) {
+			DBG_WARNING("fsp_bind_smb failed: %s\n",
+				    nt_errstr(status));
+			close_file_free(NULL, &fsp, ERROR_CLOSE);
+			return NULL;
+		}
+
+		fsp->fsp_flags.closing = false;
+		fsp->fsp_name->st.cached_dos_attributes =
+			FILE_ATTRIBUTE_INVALID;
+
+		DO_PROFILE_INC(deferred_close_reuse);
+
+		DBG_DEBUG("reusing %s\n", fsp_str_dbg(fsp));
+
+		return fsp;
+	}
+
+	return NULL;
+}
@@ -70,6 +70,14 @@ struct dptr_struct {
 		struct smb_filename *smb_fname;
 		uint32_t mode;
 	} overflow;
+
+	/* see dptr_set_dircache() */
+	struct {
+		bool enabled;
+		bool checked;
+		bool serving;
+		struct smbd_dircache *dc;
+	} dircache;
 };
 
 static NTSTATUS OpenDir_fsp(
@@ -356,6 +364,9 @@ void dptr_RewindDir(struct dptr_struct *dptr)
 	dptr->did_stat = false;
 	TALLOC_FREE(dptr->overflow.fname);
 	TALLOC_FREE(dptr->overflow.smb_fname);
+	TALLOC_FREE(dptr->dircache.dc);
+	dptr->dircache.checked = false;
+	dptr->dircache.serving = false;
 }
 
 unsigned int dptr_FileNumber(struct dptr_struct *dptr)
@@ -507,6 +518,194 @@ files_struct *dptr_fetch_lanman2_fsp(struct smbd_server_connection *sconn,
 	return dptr->dir_hnd->fsp;
 }
 
+void dptr_set_dircache(struct dptr_struct *dptr, bool enabled)
+{
+	dptr->dircache.enabled = enabled;
+}
+
+static bool dptr_dircache_param_found(const char *string,
+				      regmatch_t matches[],
+				      void *private_data)
+{
+	bool *found = private_data;
+
+	*found = true;
+	return true; /* stop the traverse */
+}
+
+/*
+ * The cache is keyed by the path only, so we must not use it if the
+ * veto or hide lists can be different for each user: "veto files" or
+ * "hide files" with substitutions like %U or %G, or the per user and
+ * group "veto files:" and "hide files:" options.
+ */
+static bool dptr_dircache_per_user(int snum)
+{
+	const struct loadparm_substitution *lp_sub =
+		lpcfg_noop_substitution();
+	const char *params[] = {
+		"vetofiles:\\(.*\\)",
+		"hidefiles:\\(.*\\)",
+	};
+	char *veto = lp_veto_files(talloc_tos(), lp_sub, snum);
+	char *hide = lp_hide_files(talloc_tos(), lp_sub, snum);
+	bool found = false;
+	size_t i;
+
+	found |= (veto == NULL) || (strchr(veto, '%') != NULL);
+	found |= (hide == NULL) || (strchr(hide, '%') != NULL);
+	TALLOC_FREE(veto);
+	TALLOC_FREE(hide);
+
+	for (i = 0; !found && i < ARRAY_SIZE(params); i++) {
+		(void)lp_wi_scan_global_parametrics(params[i],
+						    2,
+						    dptr_dircache_param_found,
+						    &found);
+		(void)lp_wi_scan_share_parametrics(snum,
+						   params[i],
+						   2,
+						   dptr_dircache_param_found,
+						   &found);
+	}
+
+	return found;
+}
+
+static bool dptr_dircache_possible(struct dptr_struct *dirptr,
+				   const char *mask,
+				   bool dont_descend,
+				   bool get_dosmode)
+{
+	struct smb_Dir *dir_hnd = dirptr->dir_hnd;
+	struct smb_filename *dir_fname = dir_hnd->dir_smb_fname;
+	int snum = SNUM(dir_hnd->conn);
+
+	if (!dirptr->dircache.enabled) {
+		return false;
+	}
+
+	/*
+	 * Only complete listings from the start, where
+	 * each user sees the same entries and attributes.
+	 */
+	if (!dirptr->has_wild || (strcmp(mask, "*") != 0)) {
+		return false;
+	}
+	if (dont_descend || !get_dosmode) {
+		return false;
+	}
+	if (dptr_FileNumber(dirptr) != 0) {
+		return false;
+	}
+	if ((dir_fname->twrp != 0) ||
+	    (dir_fname->flags & SMB_FILENAME_POSIX_PATH))
+	{
+		return false;
+	}
+	if (lp_hide_unreadable(snum) ||
+	    lp_hide_unwriteable_files(snum) ||
+	    (lp_hide_new_files_timeout(snum) != 0) ||
+	    (lp_map_readonly(snum) == MAP_READONLY_PERMISSIONS))
+	{
+		return false;
+	}
+	if (dptr_dircache_per_user(snum)) {
+		return false;
+	}
+
+	return true;
+}
+
+static bool dptr_dircache_get_entry(TALLOC_CTX *ctx,
+				    struct dptr_struct *dirptr,
+				    const char *mask,
+				    uint32_t dirtype,
+				    bool ask_sharemode,
+				    bool (*match_fn)(TALLOC_CTX *ctx,
+						     void *private_data,
+						     const char *dname,
+						     const char *mask,
+						     char **_fname),
+				    void *private_data,
+				    char **_fname,
+				    struct smb_filename **_smb_fname,
+				    uint32_t *_mode)
+{
+	struct smb_Dir *dir_hnd = dirptr->dir_hnd;
+	connection_struct *conn = dir_hnd->conn;
+	struct smb_filename *dir_fname = dir_hnd->dir_smb_fname;
+	const bool toplevel = ISDOT(dir_fname->base_name);
+
+	while (true) {
+		const char *dname = NULL;
+		char *fname = NULL;
+		struct smb_filename *smb_fname = NULL;
+		struct stat_ex st;
+		uint32_t mode = 0;
+		bool toplevel_dotdot;
+		bool ok;
+
+		ok = smbd_dircache_next_entry(dirptr->dircache.dc,
+					      &dname,
+					      &st,
+					      &mode);
+		if (!ok) {
+			return false;
+		}
+
+		ok = match_fn(ctx, private_data, dname, mask, &fname);
+		if (!ok) {
+			continue;
+		}
+
+		if (!dir_check_ftype(mode, dirtype)) {
+			TALLOC_FREE(fname);
+			continue;
+		}
+
+		toplevel_dotdot = toplevel && ISDOTDOT(dname);
+
+		smb_fname = synthetic_smb_fname(ctx,
+						toplevel_dotdot ? "." : dname,
+						NULL,
+						&st,
+						dir_fname->twrp,
+						dir_fname->flags);
+		if (smb_fname == NULL) {
+			TALLOC_FREE(fname);
+			return false;
+		}
+
+		if (ask_sharemode && !S_ISDIR(smb_fname->st.st_ex_mode)) {
+			struct timespec write_time_ts;
+			struct file_id fileid;
+
+			fileid = vfs_file_id_from_sbuf(conn,
+						       &smb_fname->st);
+			get_file_infos(fileid, 0, NULL, &write_time_ts);
+			if (!is_omit_timespec(&write_time_ts)) {
+				update_stat_ex_mtime(&smb_fname->st,
+						     write_time_ts);
+			}
+		}
+
+		if (toplevel_dotdot) {
+			smb_fname->st.st_ex_ino = 0;
+			smb_fname->st.st_ex_dev = 0;
+			smb_fname->st.st_ex_uid = -1;
+			smb_fname->st.st_ex_gid = -1;
+		}
+
+		*_smb_fname = smb_fname;
+		*_fname = fname;
+		*_mode = mode;
+		return true;
+	}
+
+	return false;
+}
+
 bool smbd_dirptr_get_entry(TALLOC_CTX *ctx,
 			   struct dptr_struct *dirptr,
 			   const char *mask,
@@ -549,6 +748,39 @@ bool smbd_dirptr_get_entry(TALLOC_CTX *ctx,
 		return false;
 	}
 
+	if (!dirptr->dircache.checked) {
+		dirptr->dircache.checked = true;
+
+		if (dptr_dircache_possible(dirptr,
+					   mask,
+					   dont_descend,
+					   get_dosmode_in))
+		{
+			dirptr->dircache.dc = smbd_dircache_fetch(
+				dirptr, dir_hnd->fsp);
+			dirptr->dircache.serving = (dirptr->dircache.dc != NULL);
+
+			if (!dirptr->dircache.serving) {
+				/* Fill the cache while we're at it */
+				dirptr->dircache.dc = smbd_dircache_record(
+					dirptr, dir_hnd->fsp);
+			}
+		}
+	}
+
+	if (dirptr->dircache.serving) {
+		return dptr_dircache_get_entry(ctx,
+					       dirptr,
+					       mask,
+					       dirtype,
+					       ask_sharemode,
+					       match_fn,
+					       private_data,
+					       _fname,
+					       _smb_fname,
+					       _mode);
+	}
+
 	while (true) {
 		char *dname = NULL;
 		char *fname = NULL;
@@ -569,6 +801,11 @@ bool smbd_dirptr_get_entry(TALLOC_CTX *ctx,
 			  dname ? dname : "(finished)");
 
 		if (dname == NULL) {
+			if (dirptr->dircache.dc != NULL) {
+				smbd_dircache_store(dirptr->dircache.dc,
+						    dir_hnd->fsp);
+				TALLOC_FREE(dirptr->dircache.dc);
+			}
 			return false;
 		}
 
@@ -696,6 +933,26 @@ done:
 			smb_fname->st = smb_fname->fsp->fsp_name->st;
 		}
 
+		if (dirptr->dircache.dc != NULL) {
+			/*
+			 * Cached entries don't have an fsp, so
+			 * they must not need one for EAs or
+			 * reparse tags in the reply.
+			 */
+			ok = !(mode & FILE_ATTRIBUTE_REPARSE_POINT) &&
+			     (estimate_ea_size(smb_fname->fsp) == 0);
+			if (ok) {
+				ok = smbd_dircache_add_entry(
+					dirptr->dircache.dc,
+					dname,
+					&smb_fname->st,
+					mode);
+			}
+			if (!ok) {
+				TALLOC_FREE(dirptr->dircache.dc);
+			}
+		}
+
 		if (!dir_check_ftype(mode, dirtype)) {
 			DBG_INFO("[%s] attribs 0x%" PRIx32 " didn't match "
 				 "0x%" PRIx32 "\n",
@@ -46,6 +46,7 @@ const char *dptr_path(struct smbd_server_connection *sconn, int key);
 char *dptr_ReadDirName(TALLOC_CTX *ctx, struct dptr_struct *dptr);
 void dptr_RewindDir(struct dptr_struct *dptr);
 void dptr_set_priv(struct dptr_struct *dptr);
+void dptr_set_dircache(struct dptr_struct *dptr, bool enabled);
 const char *dptr_wcard(struct smbd_server_connection *sconn, int key);
 bool have_file_open_below(connection_struct *conn,
 			  const struct smb_filename *name);
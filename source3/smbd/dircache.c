@@ -0,0 +1,473 @@
+/*
+   Unix SMB/CIFS implementation.
+   Cross-process cache of directory listings
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * With "smbd dir cache timeout" the result of a full wildcard listing
+ * (name, stat and DOS attributes of every visible entry) is stored in
+ * the volatile dircache.tdb, keyed by the absolute path of the
+ * directory. Other smbd processes listing the same directory serve
+ * the entries from there without any readdir, stat or getxattr.
+ *
+ * A record is only used if
+ *
+ * - the file id, mtime and ctime of the directory still match, so
+ *   creates, unlinks and renames by anyone invalidate it,
+ *
+ * - it is younger than the timeout, which bounds the time changes
+ *   to existing files done outside of Samba stay invisible,
+ *
+ * - it was created by the same share.
+ *
+ * Listings that depend on the user are never cached, see
+ * dptr_dircache_possible(). Directories with more than
+ * SMBD_DIRCACHE_MAX_SIZE bytes of entries are not cached either.
+ *
+ * Changes done through smbd delete the record of the parent
+ * directory: notify_fname() covers everything that triggers a change
+ * notification, close_normal_file() covers writes.
+ *
+ * The records are in host byte order with the raw struct stat_ex,
+ * the version number makes sure only the same build reads them.
+ */
+
+#include "includes.h"
+#include "system/filesys.h"
+#include "smbd/smbd.h"
+#include "smbd/globals.h"
+#include "dbwrap/dbwrap.h"
+#include "dbwrap/dbwrap_open.h"
+#include "util_tdb.h"
+
+/*
+ * Don't cache directories with bigger listings, the record is read
+ * and written in one piece. With the 150 odd bytes per entry this
+ * is about 25000 entries.
+ */
+#define SMBD_DIRCACHE_MAX_SIZE (4*1024*1024)
+
+#define SMBD_DIRCACHE_VERSION (0x44430001 ^ (uint32_t)sizeof(struct stat_ex))
+
+struct smbd_dircache_hdr {
+	uint32_t version;
+	uint32_t num_entries;
+	struct file_id id;
+	struct timespec mtime;
+	struct timespec ctime;
+	time_t created;
+	char service[64];
+};
+
+struct smbd_dircache {
+	char *key;
+	struct smbd_dircache_hdr hdr;
+	uint8_t *buf;
+	size_t len;
+	size_t ofs;
+	uint32_t next_entry;
+};
+
+static struct db_context *smbd_dircache_db;
+
+static bool smbd_dircache_init(void)
+{
+	char *db_path = NULL;
+
+	if (smbd_dircache_db != NULL) {
+		return true;
+	}
+
+	db_path = lock_path(talloc_tos(), "dircache.tdb");
+	if (db_path == NULL) {
+		return false;
+	}
+
+	smbd_dircache_db = db_open(NULL, db_path,
+				   SMBD_VOLATILE_TDB_HASH_SIZE,
+				   SMBD_VOLATILE_TDB_FLAGS,
+				   O_RDWR|O_CREAT, 0644,
+				   DBWRAP_LOCK_ORDER_NONE, DBWRAP_FLAG_NONE);
+	TALLOC_FREE(db_path);
+	if (smbd_dircache_db == NULL) {
+		DBG_ERR("Failed to open dircache.tdb\n");
+		return false;
+	}
+
+	return true;
+}
+
+static char *smbd_dircache_key(TALLOC_CTX *mem_ctx,
+			       connection_struct *conn,
+			       const char *dirpath)
+{
+	if ((dirpath[0] == '\0') || ISDOT(dirpath)) {
+		return talloc_strdup(mem_ctx, conn->connectpath);
+	}
+	if (dirpath[0] == '.' && dirpath[1] == '/') {
+		dirpath += 2;
+	}
+	return talloc_asprintf(mem_ctx, "%s/%s", conn->connectpath, dirpath);
+}
+
+static bool smbd_dircache_stat_dir(struct files_struct *dirfsp,
+				   struct smbd_dircache_hdr *hdr)
+{
+	connection_struct *conn = dirfsp->conn;
+	struct stat_ex st;
+	int ret;
+
+	ret = SMB_VFS_FSTAT(dirfsp, &st);
+	if (ret == -1) {
+		DBG_DEBUG("fstat on %s failed: %s\n",
+			  fsp_str_dbg(dirfsp),
+			  strerror(errno));
+		return false;
+	}
+
+	*hdr = (struct smbd_dircache_hdr) {
+		.version = SMBD_DIRCACHE_VERSION,
+		.id = vfs_file_id_from_sbuf(conn, &st),
+		.mtime = st.st_ex_mtime,
+		.ctime = st.st_ex_ctime,
+	};
+	strlcpy(hdr->service,
+		lp_const_servicename(SNUM(conn)),
+		sizeof(hdr->service));
+
+	return true;
+}
+
+static bool smbd_dircache_hdr_match(const struct smbd_dircache_hdr *a,
+				    const struct smbd_dircache_hdr *b)
+{
+	return (a->version == b->version) &&
+	       file_id_equal(&a->id, &b->id) &&
+	       (timespec_compare(&a->mtime, &b->mtime) == 0) &&
+	       (timespec_compare(&a->ctime, &b->ctime) == 0) &&
+	       (strcmp(a->service, b->service) == 0);
+}
+
+struct smbd_dircache_fetch_state {
+	struct smbd_dircache *dc;
+	int timeout;
+	bool found;
+};
+
+static void smbd_dircache_fetch_parser(TDB_DATA key,
+				       TDB_DATA data,
+				       void *private_data)
+{
+	struct smbd_dircache_fetch_state *state = private_data;
+	struct smbd_dircache *dc = state->dc;
+	struct smbd_dircache_hdr hdr;
+	time_t now = time(NULL);
+
+	if (data.dsize < sizeof(hdr)) {
+		return;
+	}
+	memcpy(&hdr, data.dptr, sizeof(hdr));
+
+	if (!smbd_dircache_hdr_match(&hdr, &dc->hdr)) {
+		DBG_DEBUG("%s changed\n", dc->key);
+		return;
+	}
+	if ((now < hdr.created) || (now - hdr.created > state->timeout)) {
+		DBG_DEBUG("%s expired\n", dc->key);
+		return;
+	}
+
+	/*
+	 * The record can be large, but we're going to
+	 * walk through it from several requests.
+	 */
+	dc->buf = talloc_memdup(dc, data.dptr, data.dsize);
+	if (dc->buf == NULL) {
+		return;
+	}
+	dc->len = data.dsize;
+	dc->ofs = sizeof(hdr);
+	dc->hdr = hdr;
+	state->found = true;
+}
+
+/*
+ * Return the cached listing of dirfsp, NULL if there's none
+ */
+struct smbd_dircache *smbd_dircache_fetch(TALLOC_CTX *mem_ctx,
+					  struct files_struct *dirfsp)
+{
+	connection_struct *conn = dirfsp->conn;
+	struct smbd_dircache_fetch_state state = {
+		.timeout = lp_smbd_dir_cache_timeout(SNUM(conn)),
+	};
+	struct smbd_dircache *dc = NULL;
+	NTSTATUS status;
+	bool ok;
+
+	if (state.timeout <= 0) {
+		return NULL;
+	}
+	if (!smbd_dircache_init()) {
+		return NULL;
+	}
+
+	dc = talloc_zero(mem_ctx, struct smbd_dircache);
+	if (dc == NULL) {
+		return NULL;
+	}
+	state.dc = dc;
+
+	dc->key = smbd_dircache_key(dc, conn, dirfsp->fsp_name->base_name);
+	if (dc->key == NULL) {
+		TALLOC_FREE(dc);
+		return NULL;
+	}
+
+	ok = smbd_dircache_stat_dir(dirfsp, &dc->hdr);
+	if (!ok) {
+		TALLOC_FREE(dc);
+		return NULL;
+	}
+
+	status = dbwrap_parse_record(smbd_dircache_db,
+				     string_term_tdb_data(dc->key),
+				     smbd_dircache_fetch_parser,
+				     &state);
+	if (!NT_STATUS_IS_OK(status) || !state.found) {
+		TALLOC_FREE(dc);
+		return NULL;
+	}
+
+	DBG_DEBUG("serving %"PRIu32" entries of %s from the cache\n",
+		  dc->hdr.num_entries,
+		  dc->key);
+
+	return dc;
+}
+
+/*
+ * Walk through a listing returned by smbd_dircache_fetch(),
+ * *name points into dc.
+ */
+bool smbd_dircache_next_entry(struct smbd_dircache *dc,
+			      const char **name,
+			      struct stat_ex *st,
+			      uint32_t *mode)
+{
+	size_t needed = sizeof(*st) + sizeof(*mode) + sizeof(uint16_t);
+	uint16_t namelen;
+
+	if (dc->next_entry >= dc->hdr.num_entries) {
+		return false;
+	}
+	if ((dc->len - dc->ofs) < needed) {
+		goto corrupt;
+	}
+
+	memcpy(st, dc->buf + dc->ofs, sizeof(*st));
+	dc->ofs += sizeof(*st);
+	memcpy(mode, dc->buf + dc->ofs, sizeof(*mode));
+	dc->ofs += sizeof(*mode);
+	memcpy(&namelen, dc->buf + dc->ofs, sizeof(namelen));
+	dc->ofs += sizeof(namelen);
+
+	if ((namelen == 0) ||
+	    ((dc->len - dc->ofs) < namelen) ||
+	    (dc->buf[dc->ofs + namelen - 1] != '\0'))
+	{
+		goto corrupt;
+	}
+
+	*name = (const char *)(dc->buf + dc->ofs);
+	dc->ofs += namelen;
+	dc->next_entry += 1;
+	return true;
+
+corrupt:
+	DBG_WARNING("Corrupt cache record for %s\n", dc->key);
+	dc->next_entry = dc->hdr.num_entries;
+	return false;
+}
+
+/*
+ * Start recording a listing of dirfsp, to be filled with
+ * smbd_dircache_add_entry() and stored with smbd_dircache_store()
+ */
+struct smbd_dircache *smbd_dircache_record(TALLOC_CTX *mem_ctx,
+					   struct files_struct *dirfsp)
+{
+	connection_struct *conn = dirfsp->conn;
+	struct smbd_dircache *dc = NULL;
+	bool ok;
+
+	if (lp_smbd_dir_cache_timeout(SNUM(conn)) <= 0) {
+		return NULL;
+	}
+	if (!smbd_dircache_init()) {
+		return NULL;
+	}
+
+	dc = talloc_zero(mem_ctx, struct smbd_dircache);
+	if (dc == NULL) {
+		return NULL;
+	}
+
+	dc->key = smbd_dircache_key(dc, conn, dirfsp->fsp_name->base_name);
+	if (dc->key == NULL) {
+		TALLOC_FREE(dc);
+		return NULL;
+	}
+
+	ok = smbd_dircache_stat_dir(dirfsp, &dc->hdr);
+	if (!ok) {
+		TALLOC_FREE(dc);
+		return NULL;
+	}
+	dc->hdr.created = time(NULL);
+
+	dc->buf = talloc_array(dc, uint8_t, 4096);
+	if (dc->buf == NULL) {
+		TALLOC_FREE(dc);
+		return NULL;
+	}
+	dc->len = sizeof(dc->hdr);
+
+	return dc;
+}
+
+bool smbd_dircache_add_entry(struct smbd_dircache *dc,
+			     const char *name,
+			     const struct stat_ex *st,
+			     uint32_t mode)
+{
+	size_t namelen = strlen(name) + 1;
+	size_t needed = sizeof(*st) + sizeof(mode) + sizeof(uint16_t) +
+			namelen;
+	size_t alloc = talloc_array_length(dc->buf);
+	uint16_t len16 = namelen;
+
+	if ((namelen > UINT16_MAX) ||
+	    (dc->len + needed > SMBD_DIRCACHE_MAX_SIZE))
+	{
+		DBG_DEBUG("%s is too big to be cached\n", dc->key);
+		return false;
+	}
+
+	if (dc->len + needed > alloc) {
+		uint8_t *tmp = NULL;
+
+		alloc = MAX(alloc * 2, dc->len + needed);
+		tmp = talloc_realloc(dc, dc->buf, uint8_t, alloc);
+		if (tmp == NULL) {
+			return false;
+		}
+		dc->buf = tmp;
+	}
+
+	memcpy(dc->buf + dc->len, st, sizeof(*st));
+	dc->len += sizeof(*st);
+	memcpy(dc->buf + dc->len, &mode, sizeof(mode));
+	dc->len += sizeof(mode);
+	memcpy(dc->buf + dc->len, &len16, sizeof(len16));
+	dc->len += sizeof(len16);
+	memcpy(dc->buf + dc->len, name, namelen);
+	dc->len += namelen;
+
+	dc->hdr.num_entries += 1;
+	return true;
+}
+
+/*
+ * Store a complete listing, if dirfsp didn't change while
+ * we were reading it
+ */
+void smbd_dircache_store(struct smbd_dircache *dc,
+			 struct files_struct *dirfsp)
+{
+	struct smbd_dircache_hdr now;
+	TDB_DATA data;
+	NTSTATUS status;
+	bool ok;
+
+	ok = smbd_dircache_stat_dir(dirfsp, &now);
+	if (!ok) {
+		return;
+	}
+	if (!smbd_dircache_hdr_match(&now, &dc->hdr)) {
+		DBG_DEBUG("%s changed while listing it\n", dc->key);
+		return;
+	}
+
+	memcpy(dc->buf, &dc->hdr, sizeof(dc->hdr));
+	data = make_tdb_data(dc->buf, dc->len);
+
+	status = dbwrap_store(smbd_dircache_db,
+			      string_term_tdb_data(dc->key),
+			      data,
+			      0);
+	if (!NT_STATUS_IS_OK(status)) {
+		DBG_DEBUG("Storing %s failed: %s\n",
+			  dc->key,
+			  nt_errstr(status));
+		return;
+	}
+
+	DBG_DEBUG("stored %"PRIu32" entries of %s\n",
+		  dc->hdr.num_entries,
+		  dc->key);
+}
+
+/*
+ * path (relative to the share) was changed, forget
+ * the listing of the directory it's in.
+ */
+void smbd_dircache_invalidate(connection_struct *conn, const char *path)
+{
+	TALLOC_CTX *frame = NULL;
+	char *parent = NULL;
+	char *key = NULL;
+	char *p = NULL;
+
+	if (lp_smbd_dir_cache_timeout(SNUM(conn)) <= 0) {
+		return;
+	}
+	if (!smbd_dircache_init()) {
+		return;
+	}
+
+	frame = talloc_stackframe();
+
+	parent = talloc_strdup(frame, path);
+	if (parent == NULL) {
+		TALLOC_FREE(frame);
+		return;
+	}
+	p = strrchr(parent, '/');
+	if (p != NULL) {
+		*p = '\0';
+	} else {
+		parent[0] = '\0';
+	}
+
+	key = smbd_dircache_key(frame, conn, parent);
+	if (key != NULL) {
+		(void)dbwrap_delete(smbd_dircache_db,
+				    string_term_tdb_data(key));
+	}
+
+	TALLOC_FREE(frame);
+}
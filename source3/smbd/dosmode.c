@@ -732,9 +732,8 @@ uint32_t fdos_mode(struct files_struct *fsp)
 	}
 
 	/* Get the DOS attributes via the VFS if we can */
-	status = SMB_VFS_FGET_DOS_ATTRIBUTES(fsp->conn,
-					     metadata_fsp(fsp),
-					     &result);
+	status = smbd_open_cache_fget_dos_attributes(metadata_fsp(fsp),
+						     &result);
 
 	if (NT_STATUS_EQUAL(status, NT_STATUS_NOT_IMPLEMENTED)) {
 		result |= dos_mode_from_sbuf(fsp->conn,
@@ -1070,6 +1069,9 @@ done:
 	}
 	if (ret == 0) {
 		smb_fname->st.st_ex_mode = unixmode;
+		if (!newfile) {
+			smbd_open_cache_changed(metadata_fsp(smb_fname->fsp));
+		}
 	}
 
 	return( ret );
@@ -1165,6 +1167,7 @@ NTSTATUS file_set_sparse(connection_struct *conn,
 	if (!NT_STATUS_IS_OK(status)) {
 		return status;
 	}
+	smbd_open_cache_changed(fsp);
 
 	notify_fname(conn, NOTIFY_ACTION_MODIFIED,
 		     FILE_NOTIFY_CHANGE_ATTRIBUTES,
@@ -288,6 +288,14 @@ NTSTATUS get_real_filename_full_scan_at(struct files_struct *dirfsp,
 		return NT_STATUS_OBJECT_NAME_NOT_FOUND;
 	}
 
+	if (!mangled) {
+		status = smbd_name_index_lookup(
+			dirfsp, name, mem_ctx, found_name);
+		if (!NT_STATUS_EQUAL(status, NT_STATUS_NOT_SUPPORTED)) {
+			return status;
+		}
+	}
+
 	/*
 	 * The incoming name can be mangled, and if we de-mangle it
 	 * here it will not compare correctly against the filename (name2)
@@ -2146,6 +2146,9 @@ bool file_find_subpath(files_struct *dir_fsp)
 		if (fsp == dir_fsp) {
 			continue;
 		}
+		if (smbd_deferred_close_is_parked(fsp)) {
+			continue;
+		}
 
 		d1_fullname = talloc_asprintf(talloc_tos(),
 					"%s/%s",
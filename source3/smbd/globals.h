@@ -24,6 +24,7 @@
 #include "system/select.h"
 #include "librpc/gen_ndr/smbXsrv.h"
 #include "smbprofile.h"
+#include "libcli/smb/smb2_compression.h"
 
 #ifdef USE_DMAPI
 struct smbd_dmapi_context;
@@ -441,10 +442,22 @@ struct smbXsrv_connection {
 			size_t pktfull;
 			size_t pktlen;
 			uint8_t *pktbuf;
+			/*
+			 * req->crypt_job decrypts pktbuf,
+			 * don't read the next request yet.
+			 */
+			bool decrypt_pending;
 		} request_read_state;
 		struct smbd_smb2_send_queue *send_queue;
 		size_t send_queue_len;
 
+		/*
+		 * The signing and encryption jobs of this connection,
+		 * with "smb2 channel threads = yes" they run in a
+		 * thread of their own, see smbd_smb2_crypt_jobs_get().
+		 */
+		struct smbd_smb2_crypt_jobs *crypt_jobs;
+
 		struct {
 			/*
 			 * seq_low is the lowest sequence number
@@ -489,6 +502,18 @@ struct smbXsrv_connection {
 			 */
 			struct bitmap *bitmap;
 			bool multicredit;
+			/*
+			 * With "smb2 credits target latency" the client
+			 * holds at most window credits,
+			 * see smbd_smb2_credits_adjust_window().
+			 *
+			 * window is 0 if this is disabled.
+			 */
+			struct {
+				uint16_t window;
+				uint64_t latency_usecs;
+				uint64_t next_adjust_usecs;
+			} adaptive;
 		} credits;
 
 		bool allow_2ff;
@@ -510,9 +535,23 @@ struct smbXsrv_connection {
 			uint32_t max_write;
 			uint16_t sign_algo;
 			uint16_t cipher;
+			struct smb2_compression_capabilities compression;
 			bool posix_extensions_negotiated;
 		} server;
 
+		/*
+		 * LZ77+Huffman working memory, allocated
+		 * on first use.
+		 */
+		struct lzxhuff_compressor_mem *compression_mem;
+
+		/*
+		 * Optional io_uring based socket io,
+		 * see smb2_uring.c.
+		 */
+		struct smbd_smb2_uring *uring;
+		bool uring_checked;
+
 		struct smbXsrv_preauth preauth;
 
 		struct smbd_smb2_request *requests;
@@ -532,6 +571,24 @@ struct smbXsrv_connection {
 
 const char *smbXsrv_connection_dbg(const struct smbXsrv_connection *xconn);
 
+NTSTATUS smbd_smb2_advance_incoming(struct smbXsrv_connection *xconn, size_t n);
+NTSTATUS smbd_smb2_advance_send_queue(struct smbXsrv_connection *xconn,
+				      struct smbd_smb2_send_queue **_e,
+				      size_t n);
+NTSTATUS smbd_smb2_flush_send_queue(struct smbXsrv_connection *xconn);
+void smbd_smb2_crypt_jobs_orphan(struct smbXsrv_connection *xconn);
+
+/* From smbd/smb2_uring.c */
+void smbd_smb2_uring_start(struct smbXsrv_connection *xconn);
+void smbd_smb2_uring_stop(struct smbXsrv_connection *xconn);
+bool smbd_smb2_uring_active(struct smbXsrv_connection *xconn);
+void smbd_smb2_uring_resume_read(struct smbXsrv_connection *xconn);
+NTSTATUS smbd_smb2_uring_flush(struct smbXsrv_connection *xconn);
+
+/* From smbd/smb2_fairq.c */
+NTSTATUS smbd_smb2_fairq_dispatch(struct smbd_smb2_request *req);
+void smbd_smb2_fairq_release(struct smbd_smb2_request *req);
+
 NTSTATUS smbXsrv_version_global_init(const struct server_id *server_id);
 uint32_t smbXsrv_version_global_current(void);
 
@@ -604,6 +661,12 @@ struct smbd_smb2_send_queue {
 		uint64_t required_acked_bytes;
 	} ack;
 
+	/*
+	 * The vector is still being signed or encrypted by a
+	 * pthreadpool job, nothing behind it can be sent yet.
+	 */
+	bool crypt_pending;
+
 	TALLOC_CTX *mem_ctx;
 };
 
@@ -629,6 +692,8 @@ struct smbd_smb2_request {
 	bool was_encrypted;
 	/* Should we encrypt? */
 	bool do_encryption;
+	/* Should we try to compress the response? */
+	bool do_compression;
 	struct tevent_timer *async_te;
 	bool compound_related;
 	NTSTATUS compound_create_err;
@@ -640,6 +705,14 @@ struct smbd_smb2_request {
 	 */
 	bool async_internal;
 
+	/*
+	 * The request waited for something other than us, a blocked
+	 * lock or an open waiting for an oplock/lease break. Its
+	 * latency says nothing about our load, so it's not fed into
+	 * the "smb2 credits target latency" average.
+	 */
+	bool waited_for_others;
+
 	/*
 	 * the encryption key for the whole
 	 * compound chain
@@ -650,8 +723,29 @@ struct smbd_smb2_request {
 	 * request/response of a compound chain
 	 */
 	struct smb2_signing_key *last_sign_key;
+	/*
+	 * the first response of a compound chain
+	 * that still needs to be signed with
+	 * last_sign_key, 0 if there is none
+	 */
+	int first_unsigned_idx;
 	struct smbXsrv_preauth *preauth;
 
+	/*
+	 * A pthreadpool job encrypting the response
+	 * or decrypting the request, the request can't
+	 * be freed before it's done. If the connection
+	 * goes away first, the request is moved to
+	 * the job context and freed by the job's callback,
+	 * see smbd_smb2_crypt_job_orphan().
+	 */
+	struct smbd_smb2_crypt_job_state *crypt_job;
+	bool crypt_job_orphaned;
+	/* pktbuf was already decrypted by crypt_job */
+	bool tf_decrypted;
+	/* holds a slot of "smb2 fair queue depth", see smb2_fairq.c */
+	bool fairq_active;
+
 	struct timeval request_time;
 
 	SMBPROFILE_IOBYTES_ASYNC_STATE(profile);
@@ -821,6 +915,9 @@ struct smbd_server_connection {
 
 	struct pthreadpool_tevent *pool;
 
+	/* see smb2_fairq.c */
+	struct smbd_smb2_fairq *smb2_fairq;
+
 	struct smbXsrv_client *client;
 };
 
@@ -0,0 +1,621 @@
+/*
+   Unix SMB/CIFS implementation.
+   Case-insensitive name index for large directories
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Without a case-insensitive file system every lookup of a name that
+ * does not exist with the exact case given by the client ends up in
+ * get_real_filename_full_scan_at(), which reads the whole directory.
+ * Creating N files in one directory thus costs O(N^2).
+ *
+ * With "smbd name index dirs" each smbd keeps an index mapping the
+ * upper-cased name to the on-disk name for up to that many large
+ * directories. The index is built by the first full scan of the
+ * directory and kept coherent with an inotify watch that is added
+ * before the scan. The inotify queue is drained synchronously before
+ * every lookup, so changes done by any process are seen once the
+ * kernel has queued the event, which happens before the syscall
+ * making the change returns.
+ *
+ * Directories are counted before they get a watch. Small ones are
+ * remembered as such and left to the normal scan for a while.
+ *
+ * If the event queue overflows all indexes are dropped. Directories
+ * that contain names differing only in case are not indexed.
+ */
+
+#include "includes.h"
+#include "system/filesys.h"
+#include "smbd/smbd.h"
+#include "smbd/globals.h"
+#include "dbwrap/dbwrap.h"
+#include "dbwrap/dbwrap_rbt.h"
+#include "util_tdb.h"
+#include "lib/util/dlinklist.h"
+#include "lib/util/sys_rw_data.h"
+#include "source3/smbd/dir.h"
+
+#ifdef HAVE_INOTIFY
+
+#include <sys/inotify.h>
+
+/* Smaller directories are cheap enough to scan */
+#define SMBD_NAME_INDEX_MIN_ENTRIES 256
+
+#define SMBD_NAME_INDEX_MASK \
+	(IN_CREATE|IN_DELETE|IN_MOVED_FROM|IN_MOVED_TO| \
+	 IN_DELETE_SELF|IN_MOVE_SELF|IN_ONLYDIR)
+
+struct smbd_name_index_dir {
+	struct smbd_name_index_dir *prev, *next;
+	struct file_id id;
+	int wd;
+	/* Two names only differing in case seen, index unusable */
+	bool ambiguous;
+	struct db_context *names;
+};
+
+/*
+ * A directory found to be too small. Most lookups of names not
+ * found are followed by a create, so it is only counted again
+ * after as many lookups as entries were missing.
+ */
+struct smbd_name_index_small {
+	struct smbd_name_index_small *prev, *next;
+	struct file_id id;
+	size_t skip;
+};
+
+struct smbd_name_index {
+	int fd;
+	struct smbd_name_index_dir *dirs;
+	size_t num_dirs;
+	struct smbd_name_index_small *small;
+	size_t num_small;
+};
+
+static struct smbd_name_index *smbd_name_index;
+
+static int smbd_name_index_destructor(struct smbd_name_index *idx)
+{
+	if (idx->fd != -1) {
+		close(idx->fd);
+		idx->fd = -1;
+	}
+	return 0;
+}
+
+static struct smbd_name_index *smbd_name_index_get(void)
+{
+	struct smbd_name_index *idx = NULL;
+
+	if (smbd_name_index != NULL) {
+		return smbd_name_index;
+	}
+
+	idx = talloc_zero(NULL, struct smbd_name_index);
+	if (idx == NULL) {
+		return NULL;
+	}
+	idx->fd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+	if (idx->fd == -1) {
+		DBG_NOTICE("inotify_init1 failed: %s\n", strerror(errno));
+		TALLOC_FREE(idx);
+		return NULL;
+	}
+	talloc_set_destructor(idx, smbd_name_index_destructor);
+
+	smbd_name_index = idx;
+	return idx;
+}
+
+static void smbd_name_index_drop(struct smbd_name_index *idx,
+				 struct smbd_name_index_dir *d,
+				 bool rm_watch)
+{
+	if (rm_watch) {
+		inotify_rm_watch(idx->fd, d->wd);
+	}
+	DLIST_REMOVE(idx->dirs, d);
+	idx->num_dirs -= 1;
+	TALLOC_FREE(d);
+}
+
+static void smbd_name_index_drop_all(struct smbd_name_index *idx)
+{
+	DO_PROFILE_INC(name_index_drop_all);
+
+	while (idx->dirs != NULL) {
+		smbd_name_index_drop(idx, idx->dirs, true);
+	}
+}
+
+static void smbd_name_index_forget_small(struct smbd_name_index *idx,
+					 struct smbd_name_index_small *s)
+{
+	DLIST_REMOVE(idx->small, s);
+	idx->num_small -= 1;
+	TALLOC_FREE(s);
+}
+
+static void smbd_name_index_remember_small(struct smbd_name_index *idx,
+					   struct file_id id,
+					   size_t num_entries)
+{
+	struct smbd_name_index_small *s = NULL;
+
+	DO_PROFILE_INC(name_index_small);
+
+	s = talloc(idx, struct smbd_name_index_small);
+	if (s == NULL) {
+		return;
+	}
+	*s = (struct smbd_name_index_small) {
+		.id = id,
+		.skip = SMBD_NAME_INDEX_MIN_ENTRIES - num_entries,
+	};
+	DLIST_ADD(idx->small, s);
+	idx->num_small += 1;
+
+	while (idx->num_small > (size_t)lp_smbd_name_index_dirs()) {
+		smbd_name_index_forget_small(idx, DLIST_TAIL(idx->small));
+	}
+}
+
+/*
+ * Count the entries of dirfsp, up to SMBD_NAME_INDEX_MIN_ENTRIES
+ */
+static NTSTATUS smbd_name_index_count(struct files_struct *dirfsp,
+				      size_t *_num_entries)
+{
+	struct smb_Dir *dir_hnd = NULL;
+	const char *dname = NULL;
+	char *talloced = NULL;
+	size_t num_entries = 0;
+	NTSTATUS status;
+
+	status = OpenDir_from_pathref(talloc_tos(), dirfsp, NULL, 0, &dir_hnd);
+	if (!NT_STATUS_IS_OK(status)) {
+		return status;
+	}
+
+	while ((num_entries < SMBD_NAME_INDEX_MIN_ENTRIES) &&
+	       ((dname = ReadDirName(dir_hnd, &talloced)) != NULL))
+	{
+		TALLOC_FREE(talloced);
+		num_entries += 1;
+	}
+	TALLOC_FREE(dir_hnd);
+
+	*_num_entries = num_entries;
+	return NT_STATUS_OK;
+}
+
+static bool smbd_name_index_key(TALLOC_CTX *mem_ctx,
+				const char *name,
+				TDB_DATA *key)
+{
+	char *upper = talloc_strdup_upper(mem_ctx, name);
+
+	if (upper == NULL) {
+		return false;
+	}
+	*key = string_term_tdb_data(upper);
+	return true;
+}
+
+static void smbd_name_index_parse_name(TDB_DATA key,
+				       TDB_DATA data,
+				       void *private_data)
+{
+	const char **found = private_data;
+
+	if ((data.dsize == 0) || (data.dptr[data.dsize - 1] != '\0')) {
+		return;
+	}
+	*found = (const char *)data.dptr;
+}
+
+static void smbd_name_index_add(struct smbd_name_index_dir *d,
+				const char *name)
+{
+	TDB_DATA key;
+	const char *existing = NULL;
+	NTSTATUS status;
+
+	if (d->ambiguous || ISDOT(name) || ISDOTDOT(name)) {
+		return;
+	}
+
+	if (!smbd_name_index_key(talloc_tos(), name, &key)) {
+		d->ambiguous = true;
+		return;
+	}
+
+	status = dbwrap_parse_record(d->names,
+				     key,
+				     smbd_name_index_parse_name,
+				     &existing);
+	if (NT_STATUS_IS_OK(status)) {
+		if ((existing == NULL) || (strcmp(existing, name) != 0)) {
+			d->ambiguous = true;
+		}
+		goto done;
+	}
+
+	status = dbwrap_store(d->names, key, string_term_tdb_data(name), 0);
+	if (!NT_STATUS_IS_OK(status)) {
+		d->ambiguous = true;
+	}
+done:
+	TALLOC_FREE(key.dptr);
+}
+
+static void smbd_name_index_del(struct smbd_name_index_dir *d,
+				const char *name)
+{
+	TDB_DATA key;
+	const char *existing = NULL;
+	NTSTATUS status;
+
+	if (d->ambiguous) {
+		return;
+	}
+
+	if (!smbd_name_index_key(talloc_tos(), name, &key)) {
+		d->ambiguous = true;
+		return;
+	}
+
+	status = dbwrap_parse_record(d->names,
+				     key,
+				     smbd_name_index_parse_name,
+				     &existing);
+	if (NT_STATUS_IS_OK(status)) {
+		if ((existing == NULL) || (strcmp(existing, name) != 0)) {
+			/*
+			 * Removal of a case variant we never saw,
+			 * we can't tell which names are left.
+			 */
+			d->ambiguous = true;
+		} else {
+			dbwrap_delete(d->names, key);
+		}
+	}
+	TALLOC_FREE(key.dptr);
+}
+
+static struct smbd_name_index_dir *smbd_name_index_find_wd(
+	struct smbd_name_index *idx, int wd)
+{
+	struct smbd_name_index_dir *d = NULL;
+
+	for (d = idx->dirs; d != NULL; d = d->next) {
+		if (d->wd == wd) {
+			return d;
+		}
+	}
+	return NULL;
+}
+
+static void smbd_name_index_event(struct smbd_name_index *idx,
+				  const struct inotify_event *e)
+{
+	struct smbd_name_index_dir *d = NULL;
+
+	if (e->mask & IN_Q_OVERFLOW) {
+		DBG_NOTICE("inotify queue overflow, dropping all indexes\n");
+		smbd_name_index_drop_all(idx);
+		return;
+	}
+
+	d = smbd_name_index_find_wd(idx, e->wd);
+	if (d == NULL) {
+		/* Left over from a dropped index */
+		return;
+	}
+
+	if (e->mask & IN_IGNORED) {
+		smbd_name_index_drop(idx, d, false);
+		return;
+	}
+	if (e->mask & (IN_DELETE_SELF|IN_MOVE_SELF|IN_UNMOUNT)) {
+		smbd_name_index_drop(idx, d, true);
+		return;
+	}
+
+	if ((e->len == 0) || (e->name[0] == '\0')) {
+		return;
+	}
+
+	if (e->mask & (IN_CREATE|IN_MOVED_TO)) {
+		smbd_name_index_add(d, e->name);
+	}
+	if (e->mask & (IN_DELETE|IN_MOVED_FROM)) {
+		smbd_name_index_del(d, e->name);
+	}
+
+	if (d->ambiguous) {
+		smbd_name_index_drop(idx, d, true);
+	}
+}
+
+static bool smbd_name_index_drain(struct smbd_name_index *idx)
+{
+	while (true) {
+		int bufsize = 0;
+		uint8_t *buf = NULL;
+		size_t ofs = 0;
+		ssize_t ret;
+
+		if (ioctl(idx->fd, FIONREAD, &bufsize) != 0) {
+			DBG_WARNING("FIONREAD failed: %s\n", strerror(errno));
+			return false;
+		}
+		if (bufsize == 0) {
+			return true;
+		}
+
+		buf = talloc_size(talloc_tos(), bufsize);
+		if (buf == NULL) {
+			return false;
+		}
+
+		ret = read_data(idx->fd, buf, bufsize);
+		if (ret != bufsize) {
+			DBG_WARNING("Failed to read inotify data: %s\n",
+				    strerror(errno));
+			TALLOC_FREE(buf);
+			return false;
+		}
+
+		while (ofs + sizeof(struct inotify_event) <= (size_t)bufsize) {
+			const struct inotify_event *e =
+				(const struct inotify_event *)(buf + ofs);
+
+			if (ofs + sizeof(*e) + e->len > (size_t)bufsize) {
+				break;
+			}
+			smbd_name_index_event(idx, e);
+			ofs += sizeof(*e) + e->len;
+		}
+		TALLOC_FREE(buf);
+	}
+}
+
+static NTSTATUS smbd_name_index_search(struct smbd_name_index_dir *d,
+				       const char *name,
+				       TALLOC_CTX *mem_ctx,
+				       char **found_name)
+{
+	TDB_DATA key;
+	const char *existing = NULL;
+	NTSTATUS status;
+
+	if (!smbd_name_index_key(talloc_tos(), name, &key)) {
+		return NT_STATUS_NO_MEMORY;
+	}
+
+	status = dbwrap_parse_record(d->names,
+				     key,
+				     smbd_name_index_parse_name,
+				     &existing);
+	TALLOC_FREE(key.dptr);
+	if (NT_STATUS_EQUAL(status, NT_STATUS_NOT_FOUND)) {
+		return NT_STATUS_OBJECT_NAME_NOT_FOUND;
+	}
+	if (!NT_STATUS_IS_OK(status)) {
+		return status;
+	}
+	if (existing == NULL) {
+		return NT_STATUS_INTERNAL_DB_CORRUPTION;
+	}
+
+	*found_name = talloc_strdup(mem_ctx, existing);
+	if (*found_name == NULL) {
+		return NT_STATUS_NO_MEMORY;
+	}
+	return NT_STATUS_OK;
+}
+
+static NTSTATUS smbd_name_index_build(struct smbd_name_index *idx,
+				      struct files_struct *dirfsp,
+				      struct file_id id,
+				      const char *name,
+				      TALLOC_CTX *mem_ctx,
+				      char **found_name)
+{
+	struct smbd_name_index_dir *d = NULL;
+	struct smb_Dir *dir_hnd = NULL;
+	struct sys_proc_fd_path_buf buf;
+	const char *dname = NULL;
+	char *talloced = NULL;
+	size_t num_entries = 0;
+	NTSTATUS status;
+	int wd;
+
+	/*
+	 * Don't pay for a watch and a second scan
+	 * where the caller's scan is cheap.
+	 */
+	status = smbd_name_index_count(dirfsp, &num_entries);
+	if (!NT_STATUS_IS_OK(status)) {
+		return status;
+	}
+	if (num_entries < SMBD_NAME_INDEX_MIN_ENTRIES) {
+		smbd_name_index_remember_small(idx, id, num_entries);
+		return NT_STATUS_NOT_SUPPORTED;
+	}
+
+	wd = inotify_add_watch(idx->fd,
+			       sys_proc_fd_path(fsp_get_pathref_fd(dirfsp),
+						&buf),
+			       SMBD_NAME_INDEX_MASK);
+	if (wd == -1) {
+		DBG_DEBUG("inotify_add_watch for %s failed: %s\n",
+			  fsp_str_dbg(dirfsp),
+			  strerror(errno));
+		return NT_STATUS_NOT_SUPPORTED;
+	}
+
+	d = talloc_zero(idx, struct smbd_name_index_dir);
+	if (d == NULL) {
+		inotify_rm_watch(idx->fd, wd);
+		return NT_STATUS_NO_MEMORY;
+	}
+	d->id = id;
+	d->wd = wd;
+	d->names = db_open_rbt(d);
+	if (d->names == NULL) {
+		inotify_rm_watch(idx->fd, wd);
+		TALLOC_FREE(d);
+		return NT_STATUS_NO_MEMORY;
+	}
+
+	/*
+	 * Link it before the scan so that events racing with the
+	 * readdir are applied below.
+	 */
+	DLIST_ADD(idx->dirs, d);
+	idx->num_dirs += 1;
+
+	status = OpenDir_from_pathref(talloc_tos(), dirfsp, NULL, 0, &dir_hnd);
+	if (!NT_STATUS_IS_OK(status)) {
+		smbd_name_index_drop(idx, d, true);
+		return status;
+	}
+
+	num_entries = 0;
+	while ((dname = ReadDirName(dir_hnd, &talloced)) != NULL) {
+		smbd_name_index_add(d, dname);
+		TALLOC_FREE(talloced);
+		num_entries += 1;
+		if (d->ambiguous) {
+			break;
+		}
+	}
+	TALLOC_FREE(dir_hnd);
+
+	if (!smbd_name_index_drain(idx)) {
+		smbd_name_index_drop_all(idx);
+		return NT_STATUS_NOT_SUPPORTED;
+	}
+
+	/* The drain might have dropped it */
+	if (smbd_name_index_find_wd(idx, wd) != d) {
+		return NT_STATUS_NOT_SUPPORTED;
+	}
+
+	if (d->ambiguous) {
+		DBG_DEBUG("%s has names only differing in case\n",
+			  fsp_str_dbg(dirfsp));
+		smbd_name_index_drop(idx, d, true);
+		return NT_STATUS_NOT_SUPPORTED;
+	}
+
+	DBG_DEBUG("Indexed %zu names of %s\n",
+		  num_entries,
+		  fsp_str_dbg(dirfsp));
+	DO_PROFILE_INC(name_index_build);
+
+	status = smbd_name_index_search(d, name, mem_ctx, found_name);
+
+	while (idx->num_dirs > (size_t)lp_smbd_name_index_dirs()) {
+		struct smbd_name_index_dir *last = DLIST_TAIL(idx->dirs);
+		smbd_name_index_drop(idx, last, true);
+	}
+
+	return status;
+}
+
+/**
+ * Look up a name case-insensitively in dirfsp via the name index.
+ *
+ * Returns NT_STATUS_OK with found_name set on a hit,
+ * NT_STATUS_OBJECT_NAME_NOT_FOUND on a miss and NT_STATUS_NOT_SUPPORTED
+ * if the caller has to scan the directory itself.
+ */
+NTSTATUS smbd_name_index_lookup(struct files_struct *dirfsp,
+				const char *name,
+				TALLOC_CTX *mem_ctx,
+				char **found_name)
+{
+	struct connection_struct *conn = dirfsp->conn;
+	struct smbd_name_index *idx = NULL;
+	struct smbd_name_index_dir *d = NULL;
+	struct smbd_name_index_small *s = NULL;
+	struct file_id id;
+
+	if (lp_smbd_name_index_dirs() <= 0) {
+		return NT_STATUS_NOT_SUPPORTED;
+	}
+	if (!conn->have_proc_fds || (fsp_get_pathref_fd(dirfsp) == -1)) {
+		return NT_STATUS_NOT_SUPPORTED;
+	}
+
+	idx = smbd_name_index_get();
+	if (idx == NULL) {
+		return NT_STATUS_NOT_SUPPORTED;
+	}
+
+	if (!smbd_name_index_drain(idx)) {
+		smbd_name_index_drop_all(idx);
+		return NT_STATUS_NOT_SUPPORTED;
+	}
+
+	id = vfs_file_id_from_sbuf(conn, &dirfsp->fsp_name->st);
+
+	for (d = idx->dirs; d != NULL; d = d->next) {
+		if (file_id_equal(&d->id, &id)) {
+			break;
+		}
+	}
+
+	if (d != NULL) {
+		DLIST_PROMOTE(idx->dirs, d);
+		DO_PROFILE_INC(name_index_hit);
+		return smbd_name_index_search(d, name, mem_ctx, found_name);
+	}
+
+	for (s = idx->small; s != NULL; s = s->next) {
+		if (file_id_equal(&s->id, &id)) {
+			break;
+		}
+	}
+	if (s != NULL) {
+		if (s->skip > 0) {
+			s->skip -= 1;
+			DLIST_PROMOTE(idx->small, s);
+			return NT_STATUS_NOT_SUPPORTED;
+		}
+		smbd_name_index_forget_small(idx, s);
+	}
+
+	return smbd_name_index_build(idx, dirfsp, id, name, mem_ctx, found_name);
+}
+
+#else /* HAVE_INOTIFY */
+
+NTSTATUS smbd_name_index_lookup(struct files_struct *dirfsp,
+				const char *name,
+				TALLOC_CTX *mem_ctx,
+				char **found_name)
+{
+	return NT_STATUS_NOT_SUPPORTED;
+}
+
+#endif /* HAVE_INOTIFY */
@@ -586,6 +586,8 @@ void notify_fname(connection_struct *conn, uint32_t action, uint32_t filter,
 		path += 2;
 	}
 
+	smbd_dircache_invalidate(conn, path);
+
 	notify_trigger(notify_ctx, action, filter, conn->connectpath, path);
 }
 
@@ -311,12 +311,12 @@ NTSTATUS smbd_check_access_rights_fsp(struct files_struct *dirfsp,
 		return status;
 	}
 
-	status = SMB_VFS_FGET_NT_ACL(metadata_fsp(fsp),
-				     (SECINFO_OWNER |
-				      SECINFO_GROUP |
-				      SECINFO_DACL),
-				     talloc_tos(),
-				     &sd);
+	status = smbd_open_cache_fget_nt_acl(metadata_fsp(fsp),
+					     (SECINFO_OWNER |
+					      SECINFO_GROUP |
+					      SECINFO_DACL),
+					     talloc_tos(),
+					     &sd);
 	if (!NT_STATUS_IS_OK(status)) {
 		DBG_DEBUG("Could not get acl on %s: %s\n",
 			  fsp_str_dbg(fsp),
@@ -356,10 +356,11 @@ NTSTATUS check_parent_access_fsp(struct files_struct *fsp,
 		goto out;
 	}
 
-	status = SMB_VFS_FGET_NT_ACL(fsp,
-				(SECINFO_OWNER | SECINFO_GROUP | SECINFO_DACL),
-				frame,
-				&parent_sd);
+	status = smbd_open_cache_fget_nt_acl(
+		fsp,
+		(SECINFO_OWNER | SECINFO_GROUP | SECINFO_DACL),
+		frame,
+		&parent_sd);
 
 	if (!NT_STATUS_IS_OK(status)) {
 		DBG_INFO("SMB_VFS_FGET_NT_ACL failed for "
@@ -2206,6 +2207,32 @@ static bool file_has_brlocks(files_struct *fsp)
 	return (brl_num_locks(br_lck) > 0);
 }
 
+/*
+ * The lease another open in this smbd holds on "id" under lease_key
+ */
+static struct fsp_lease *find_local_fsp_lease(
+	struct smbd_server_connection *sconn,
+	struct file_id id,
+	const struct smb2_lease_key *key)
+{
+	struct files_struct *fsp;
+
+	for (fsp = file_find_di_first(sconn, id, true);
+	     fsp != NULL;
+	     fsp = file_find_di_next(fsp, true)) {
+
+		if ((fsp->oplock_type != LEASE_OPLOCK) ||
+		    (fsp->lease == NULL)) {
+			continue;
+		}
+		if (smb2_lease_key_equal(&fsp->lease->lease.lease_key, key)) {
+			return fsp->lease;
+		}
+	}
+
+	return NULL;
+}
+
 struct fsp_lease *find_fsp_lease(struct files_struct *new_fsp,
 				 const struct smb2_lease_key *key,
 				 uint32_t current_state,
@@ -2346,13 +2373,74 @@ static NTSTATUS try_lease_upgrade(struct files_struct *fsp,
 				  nt_errstr(set_status));
 			return set_status;
 		}
+
+		share_mode_lease_changed(lck);
 	}
 
 	fsp_lease_update(fsp);
 
+	/*
+	 * Nobody can change the lease while we hold the share mode
+	 * lock, fsp->lease is what the database has.
+	 */
+	fsp->lease->state_valid = share_mode_content_epoch(
+		lck, &fsp->lease->state_epoch);
+
 	return NT_STATUS_OK;
 }
 
+/*
+ * A client reopening a file it holds a lease on usually gets the
+ * state it already has. If another open in this smbd holds the
+ * lease and the file's share mode data did not change since that
+ * open read the lease, there is nothing to read or write in
+ * leases.tdb: Share the lease with the other open.
+ */
+static bool reuse_unchanged_fsp_lease(struct files_struct *fsp,
+				      struct share_mode_lock *lck,
+				      const struct smb2_lease *lease,
+				      uint32_t granted)
+{
+	struct fsp_lease *l = NULL;
+	uint32_t existing;
+	uint64_t epoch;
+	bool ok;
+
+	l = find_local_fsp_lease(
+		fsp->conn->sconn, fsp->file_id, &lease->lease_key);
+	if ((l == NULL) || !l->state_valid) {
+		return false;
+	}
+
+	ok = share_mode_content_epoch(lck, &epoch);
+	if (!ok || (epoch != l->state_epoch)) {
+		return false;
+	}
+
+	if (l->lease.lease_flags & SMB2_LEASE_FLAG_BREAK_IN_PROGRESS) {
+		return false;
+	}
+
+	/*
+	 * Leave upgrades to try_lease_upgrade()
+	 */
+	existing = l->lease.lease_state;
+	if (((existing & lease->lease_state) == existing) &&
+	    (granted != existing) &&
+	    (granted == lease->lease_state)) {
+		return false;
+	}
+
+	l->ref_count += 1;
+	fsp->lease = l;
+
+	DBG_DEBUG("reusing lease state %"PRIu32" for %s\n",
+		  existing,
+		  fsp_str_dbg(fsp));
+
+	return true;
+}
+
 static NTSTATUS grant_new_fsp_lease(struct files_struct *fsp,
 				    struct share_mode_lock *lck,
 				    const struct GUID *client_guid,
@@ -2415,6 +2503,10 @@ static NTSTATUS grant_fsp_lease(struct files_struct *fsp,
 	const struct GUID *client_guid = fsp_client_guid(fsp);
 	NTSTATUS status;
 
+	if (reuse_unchanged_fsp_lease(fsp, lck, lease, granted)) {
+		return NT_STATUS_OK;
+	}
+
 	status = try_lease_upgrade(fsp, lck, client_guid, lease, granted);
 
 	if (NT_STATUS_EQUAL(status, NT_STATUS_NOT_FOUND)) {
@@ -3381,12 +3473,12 @@ static NTSTATUS smbd_calculate_maximum_allowed_access_fsp(
 		return NT_STATUS_OK;
 	}
 
-	status = SMB_VFS_FGET_NT_ACL(metadata_fsp(fsp),
-				     (SECINFO_OWNER |
-					SECINFO_GROUP |
-					SECINFO_DACL),
-				     talloc_tos(),
-				     &sd);
+	status = smbd_open_cache_fget_nt_acl(metadata_fsp(fsp),
+					     (SECINFO_OWNER |
+					      SECINFO_GROUP |
+					      SECINFO_DACL),
+					     talloc_tos(),
+					     &sd);
 
 	if (NT_STATUS_EQUAL(status, NT_STATUS_OBJECT_NAME_NOT_FOUND)) {
 		/*
@@ -3856,6 +3948,17 @@ static NTSTATUS open_file_ntcreate(connection_struct *conn,
 			if (is_deferred_open_async(open_rec)) {
 				SET_STAT_INVALID(smb_fname->st);
 				file_existed = false;
+
+				/*
+				 * The path walk of the retry found the
+				 * file the async open created. Drop its
+				 * pathref fd, a reopen via /proc/self/fd
+				 * would report the create as an open.
+				 */
+				status = fd_close(fsp);
+				if (!NT_STATUS_IS_OK(status)) {
+					return status;
+				}
 			}
 
 			/* Ensure we don't reprocess this message. */
@@ -0,0 +1,426 @@
+/*
+   Unix SMB/CIFS implementation.
+   Cache of security descriptors and DOS attributes across opens
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Clients like Office and build tools open and close the same files
+ * over and over again. Every open fetches and parses the security
+ * descriptor of the file and its parent directory and reads the DOS
+ * attributes, which is most of the work done for an open besides the
+ * openat() and fstat() that smbd needs anyway.
+ *
+ * With "smbd open cache size" set for a share, each smbd keeps what
+ * SMB_VFS_FGET_NT_ACL and SMB_VFS_FGET_DOS_ATTRIBUTES returned for it,
+ * keyed by file id, in a memcache of that size. An entry is only used
+ * if the change time in the fresh stat of the fsp is still the one the
+ * entry was created with. Any change of the ACL, the xattrs, the owner
+ * or the mode updates the change time, by whatever process it was done.
+ *
+ * File systems update the change time with a coarse clock, so a change
+ * right after the entry was created might not change it. Entries are
+ * therefore only created for files whose change time is a few seconds
+ * in the past.
+ *
+ * Not every change updates the change time: vfs_xattr_tdb and
+ * vfs_fake_acls keep their data in a tdb. So when smbd itself changes
+ * an ACL or DOS attributes it also bumps a counter in the volatile
+ * open_cache.tdb, shared by all smbd processes, and entries are only
+ * used while the counter still has the value read before the entry was
+ * created. To keep the tdb small the counters are per bucket of file
+ * ids, not per file. A file can be reached through shares with and
+ * without the cache, so the counter is bumped as soon as any share
+ * uses the cache.
+ */
+
+#include "includes.h"
+#include "smbd/smbd.h"
+#include "smbd/globals.h"
+#include "lib/util/memcache.h"
+#include "libcli/security/security.h"
+#include "dbwrap/dbwrap.h"
+#include "dbwrap/dbwrap_open.h"
+#include "util_tdb.h"
+
+/* How old the change time must be to create an entry */
+#define SMBD_OPEN_CACHE_RACY_SECS 2
+
+/* Number of change counters in open_cache.tdb */
+#define SMBD_OPEN_CACHE_BUCKETS 4096
+
+struct smbd_open_cache_key {
+	uint32_t security_info;
+	struct file_id id;
+};
+
+struct smbd_open_cache_dosmode {
+	struct timespec ctime;
+	uint32_t seqnum;
+	uint32_t dosmode;
+	bool btime_valid;
+	struct timespec btime;
+};
+
+struct smbd_open_cache_sd_hdr {
+	struct timespec ctime;
+	uint32_t seqnum;
+	/* followed by the marshalled security descriptor */
+};
+
+/* Indexed by snum */
+static struct memcache **smbd_open_caches;
+static int num_smbd_open_caches;
+static struct db_context *smbd_open_cache_db;
+
+static struct memcache *smbd_open_cache_get(int snum)
+{
+	int size;
+
+	if (snum < 0) {
+		return NULL;
+	}
+	size = lp_smbd_open_cache_size(snum);
+	if (size <= 0) {
+		return NULL;
+	}
+
+	if (snum >= num_smbd_open_caches) {
+		struct memcache **tmp = NULL;
+		int i;
+
+		tmp = talloc_realloc(NULL,
+				     smbd_open_caches,
+				     struct memcache *,
+				     snum + 1);
+		if (tmp == NULL) {
+			return NULL;
+		}
+		for (i = num_smbd_open_caches; i <= snum; i++) {
+			tmp[i] = NULL;
+		}
+		smbd_open_caches = tmp;
+		num_smbd_open_caches = snum + 1;
+	}
+
+	if (smbd_open_caches[snum] == NULL) {
+		smbd_open_caches[snum] = memcache_init(smbd_open_caches, size);
+	}
+	return smbd_open_caches[snum];
+}
+
+static bool smbd_open_cache_in_use(void)
+{
+	int num_services = lp_numservices();
+	int snum;
+
+	for (snum = 0; snum < num_services; snum++) {
+		if (lp_snum_ok(snum) && (lp_smbd_open_cache_size(snum) > 0)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool smbd_open_cache_db_init(void)
+{
+	char *db_path = NULL;
+
+	if (smbd_open_cache_db != NULL) {
+		return true;
+	}
+
+	db_path = lock_path(talloc_tos(), "open_cache.tdb");
+	if (db_path == NULL) {
+		return false;
+	}
+
+	smbd_open_cache_db = db_open(NULL, db_path,
+				     SMBD_VOLATILE_TDB_HASH_SIZE,
+				     SMBD_VOLATILE_TDB_FLAGS,
+				     O_RDWR|O_CREAT, 0644,
+				     DBWRAP_LOCK_ORDER_NONE, DBWRAP_FLAG_NONE);
+	TALLOC_FREE(db_path);
+	if (smbd_open_cache_db == NULL) {
+		DBG_ERR("Failed to open open_cache.tdb\n");
+		return false;
+	}
+
+	return true;
+}
+
+static void smbd_open_cache_bucket(struct files_struct *fsp,
+				   char *keystr,
+				   size_t keylen)
+{
+	uint64_t hash = fsp->file_id.devid ^ fsp->file_id.inode ^
+			fsp->file_id.extid;
+
+	snprintf(keystr,
+		 keylen,
+		 "%"PRIu64,
+		 hash % SMBD_OPEN_CACHE_BUCKETS);
+}
+
+/*
+ * Read the change counter for fsp. This has to happen before the
+ * data is read from the VFS, a change racing with that then leaves a
+ * stale entry that is never used.
+ */
+static bool smbd_open_cache_seqnum(struct files_struct *fsp,
+				   uint32_t *seqnum)
+{
+	char keystr[32];
+	NTSTATUS status;
+
+	if (!smbd_open_cache_db_init()) {
+		return false;
+	}
+	smbd_open_cache_bucket(fsp, keystr, sizeof(keystr));
+
+	status = dbwrap_fetch_uint32_bystring(smbd_open_cache_db,
+					      keystr,
+					      seqnum);
+	if (NT_STATUS_EQUAL(status, NT_STATUS_NOT_FOUND)) {
+		*seqnum = 0;
+		return true;
+	}
+	return NT_STATUS_IS_OK(status);
+}
+
+static bool smbd_open_cache_usable(struct files_struct *fsp)
+{
+	const struct stat_ex *st = &fsp->fsp_name->st;
+
+	if (!VALID_STAT(*st) || (fsp_get_pathref_fd(fsp) == -1)) {
+		return false;
+	}
+	if (fsp->fsp_name->twrp != 0) {
+		return false;
+	}
+	return true;
+}
+
+static bool smbd_open_cache_racy(struct files_struct *fsp)
+{
+	const struct timespec *ctime = &fsp->fsp_name->st.st_ex_ctime;
+	struct timespec now = timespec_current();
+
+	if (ctime->tv_sec + SMBD_OPEN_CACHE_RACY_SECS > now.tv_sec) {
+		return true;
+	}
+	return false;
+}
+
+static DATA_BLOB smbd_open_cache_key(struct smbd_open_cache_key *key,
+				     struct files_struct *fsp,
+				     uint32_t security_info)
+{
+	/* No padding in the key */
+	ZERO_STRUCTP(key);
+	key->security_info = security_info;
+	key->id = fsp->file_id;
+	return data_blob_const(key, sizeof(*key));
+}
+
+/**
+ * SMB_VFS_FGET_NT_ACL() with the cache in front.
+ */
+NTSTATUS smbd_open_cache_fget_nt_acl(struct files_struct *fsp,
+				     uint32_t security_info,
+				     TALLOC_CTX *mem_ctx,
+				     struct security_descriptor **psd)
+{
+	struct memcache *cache = smbd_open_cache_get(SNUM(fsp->conn));
+	struct smbd_open_cache_key k;
+	struct smbd_open_cache_sd_hdr hdr;
+	DATA_BLOB key;
+	DATA_BLOB value;
+	uint8_t *data = NULL;
+	size_t len;
+	uint32_t seqnum;
+	NTSTATUS status;
+	bool ok;
+
+	if ((cache == NULL) ||
+	    !smbd_open_cache_usable(fsp) ||
+	    !smbd_open_cache_seqnum(fsp, &seqnum))
+	{
+		return SMB_VFS_FGET_NT_ACL(fsp, security_info, mem_ctx, psd);
+	}
+
+	key = smbd_open_cache_key(&k, fsp, security_info);
+
+	ok = memcache_lookup(cache, SMBD_OPEN_CACHE_SD, key, &value);
+	if (ok && (value.length > sizeof(hdr))) {
+		memcpy(&hdr, value.data, sizeof(hdr));
+		if ((hdr.seqnum == seqnum) &&
+		    (timespec_compare(&hdr.ctime,
+				      &fsp->fsp_name->st.st_ex_ctime) == 0))
+		{
+			status = unmarshall_sec_desc(
+				mem_ctx,
+				value.data + sizeof(hdr),
+				value.length - sizeof(hdr),
+				psd);
+			if (NT_STATUS_IS_OK(status)) {
+				DO_PROFILE_INC(open_cache_sd_hit);
+				return NT_STATUS_OK;
+			}
+		}
+		memcache_delete(cache, SMBD_OPEN_CACHE_SD, key);
+	}
+
+	DO_PROFILE_INC(open_cache_sd_miss);
+
+	status = SMB_VFS_FGET_NT_ACL(fsp, security_info, mem_ctx, psd);
+	if (!NT_STATUS_IS_OK(status) || smbd_open_cache_racy(fsp)) {
+		return status;
+	}
+
+	if (!NT_STATUS_IS_OK(marshall_sec_desc(talloc_tos(),
+					       *psd,
+					       &data,
+					       &len))) {
+		return status;
+	}
+
+	value = data_blob_talloc(talloc_tos(), NULL, sizeof(hdr) + len);
+	if (value.data != NULL) {
+		hdr = (struct smbd_open_cache_sd_hdr) {
+			.ctime = fsp->fsp_name->st.st_ex_ctime,
+			.seqnum = seqnum,
+		};
+		memcpy(value.data, &hdr, sizeof(hdr));
+		memcpy(value.data + sizeof(hdr), data, len);
+		memcache_add(cache, SMBD_OPEN_CACHE_SD, key, value);
+		data_blob_free(&value);
+	}
+	TALLOC_FREE(data);
+
+	return status;
+}
+
+/**
+ * SMB_VFS_FGET_DOS_ATTRIBUTES() with the cache in front. This
+ * includes the create time the VFS put into the stat of fsp.
+ */
+NTSTATUS smbd_open_cache_fget_dos_attributes(struct files_struct *fsp,
+					     uint32_t *dosmode)
+{
+	struct memcache *cache = smbd_open_cache_get(SNUM(fsp->conn));
+	struct stat_ex *st = &fsp->fsp_name->st;
+	struct smbd_open_cache_key k;
+	struct smbd_open_cache_dosmode entry;
+	DATA_BLOB key;
+	DATA_BLOB value;
+	uint32_t seqnum;
+	NTSTATUS status;
+	bool ok;
+
+	if ((cache == NULL) ||
+	    !smbd_open_cache_usable(fsp) ||
+	    !smbd_open_cache_seqnum(fsp, &seqnum))
+	{
+		return SMB_VFS_FGET_DOS_ATTRIBUTES(fsp->conn, fsp, dosmode);
+	}
+
+	key = smbd_open_cache_key(&k, fsp, 0);
+
+	ok = memcache_lookup(cache, SMBD_OPEN_CACHE_DOSMODE, key, &value);
+	if (ok && (value.length == sizeof(entry))) {
+		memcpy(&entry, value.data, sizeof(entry));
+		if ((entry.seqnum == seqnum) &&
+		    (timespec_compare(&entry.ctime, &st->st_ex_ctime) == 0))
+		{
+			DO_PROFILE_INC(open_cache_dosmode_hit);
+			*dosmode |= entry.dosmode;
+			if (entry.btime_valid) {
+				update_stat_ex_create_time(st, entry.btime);
+			}
+			return NT_STATUS_OK;
+		}
+		memcache_delete(cache, SMBD_OPEN_CACHE_DOSMODE, key);
+	}
+
+	DO_PROFILE_INC(open_cache_dosmode_miss);
+
+	/*
+	 * Callers may have filename based attributes in
+	 * *dosmode, only cache what the VFS added.
+	 */
+	entry = (struct smbd_open_cache_dosmode) {
+		.ctime = st->st_ex_ctime,
+		.seqnum = seqnum,
+	};
+
+	status = SMB_VFS_FGET_DOS_ATTRIBUTES(fsp->conn, fsp, &entry.dosmode);
+	if (!NT_STATUS_IS_OK(status)) {
+		return status;
+	}
+	*dosmode |= entry.dosmode;
+
+	if (smbd_open_cache_racy(fsp)) {
+		return NT_STATUS_OK;
+	}
+
+	if (!(st->st_ex_iflags & ST_EX_IFLAG_CALCULATED_BTIME)) {
+		entry.btime_valid = true;
+		entry.btime = st->st_ex_btime;
+	}
+
+	memcache_add(cache,
+		     SMBD_OPEN_CACHE_DOSMODE,
+		     key,
+		     data_blob_const(&entry, sizeof(entry)));
+
+	return NT_STATUS_OK;
+}
+
+/**
+ * smbd changed the ACL or the DOS attributes of fsp, make all smbd
+ * processes drop their cache entries for it.
+ */
+void smbd_open_cache_changed(struct files_struct *fsp)
+{
+	struct memcache *cache = smbd_open_cache_get(SNUM(fsp->conn));
+	struct smbd_open_cache_key k;
+	char keystr[32];
+	uint32_t oldval = 0;
+	NTSTATUS status;
+
+	if (cache != NULL) {
+		memcache_delete(cache,
+				SMBD_OPEN_CACHE_DOSMODE,
+				smbd_open_cache_key(&k, fsp, 0));
+	} else if (!smbd_open_cache_in_use()) {
+		return;
+	}
+
+	if (!smbd_open_cache_db_init()) {
+		return;
+	}
+	smbd_open_cache_bucket(fsp, keystr, sizeof(keystr));
+
+	status = dbwrap_change_uint32_atomic_bystring(smbd_open_cache_db,
+						      keystr,
+						      &oldval,
+						      1);
+	if (!NT_STATUS_IS_OK(status)) {
+		DBG_WARNING("Could not bump %s in open_cache.tdb: %s\n",
+			    keystr,
+			    nt_errstr(status));
+	}
+}
@@ -177,6 +177,25 @@ uint64_t get_dfree_info(connection_struct *conn, struct smb_filename *fname,
 			uint64_t *bsize, uint64_t *dfree, uint64_t *dsize);
 void flush_dfree_cache(void);
 
+/* The following definitions come from smbd/dircache.c  */
+
+struct smbd_dircache;
+struct smbd_dircache *smbd_dircache_fetch(TALLOC_CTX *mem_ctx,
+					  struct files_struct *dirfsp);
+bool smbd_dircache_next_entry(struct smbd_dircache *dc,
+			      const char **name,
+			      struct stat_ex *st,
+			      uint32_t *mode);
+struct smbd_dircache *smbd_dircache_record(TALLOC_CTX *mem_ctx,
+					   struct files_struct *dirfsp);
+bool smbd_dircache_add_entry(struct smbd_dircache *dc,
+			     const char *name,
+			     const struct stat_ex *st,
+			     uint32_t mode);
+void smbd_dircache_store(struct smbd_dircache *dc,
+			 struct files_struct *dirfsp);
+void smbd_dircache_invalidate(connection_struct *conn, const char *path);
+
 /* The following definitions come from smbd/dmapi.c  */
 
 const void *dmapi_get_current_session(void);
@@ -521,6 +540,35 @@ NTSTATUS create_conn_struct_tos_cwd(struct messaging_context *msg,
 				    const struct auth_session_info *session_info,
 				    struct conn_struct_tos **_c);
 
+/* The following definitions come from smbd/name_index.c  */
+
+NTSTATUS smbd_name_index_lookup(struct files_struct *dirfsp,
+				const char *name,
+				TALLOC_CTX *mem_ctx,
+				char **found_name);
+
+/* The following definitions come from smbd/open_cache.c  */
+
+NTSTATUS smbd_open_cache_fget_nt_acl(struct files_struct *fsp,
+				     uint32_t security_info,
+				     TALLOC_CTX *mem_ctx,
+				     struct security_descriptor **psd);
+NTSTATUS smbd_open_cache_fget_dos_attributes(struct files_struct *fsp,
+					     uint32_t *dosmode);
+void smbd_open_cache_changed(struct files_struct *fsp);
+
+/* The following definitions come from smbd/deferred_close.c  */
+
+bool smbd_deferred_close_park(struct files_struct *fsp);
+bool smbd_deferred_close_is_parked(const struct files_struct *fsp);
+struct files_struct *smbd_deferred_close_reclaim(struct smb_request *req,
+						 const char *name,
+						 uint32_t access_mask,
+						 uint32_t share_access,
+						 uint32_t create_disposition,
+						 uint32_t create_options,
+						 bool may_reuse);
+
 /* The following definitions come from smbd/notify.c  */
 
 bool change_notify_fsp_has_changes(struct files_struct *fsp);
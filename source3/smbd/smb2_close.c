@@ -221,6 +221,25 @@ static NTSTATUS smbd_smb2_close(struct smbd_smb2_request *req,
 		fsp->fsp_flags.fstat_before_close = true;
 	}
 
+	if (smbd_deferred_close_park(fsp)) {
+		/*
+		 * fsp stays open for a while, its stat is fresh
+		 */
+		if (in_flags & SMB2_CLOSE_FLAGS_FULL_INFORMATION) {
+			setup_close_full_information(conn,
+					fsp->fsp_name,
+					out_creation_ts,
+					out_last_access_ts,
+					out_last_write_ts,
+					out_change_ts,
+					out_flags,
+					out_allocation_size,
+					out_end_of_file);
+		}
+		*_fsp = fsp = NULL;
+		return NT_STATUS_OK;
+	}
+
 	status = close_file_smb(smbreq, fsp, NORMAL_CLOSE);
 	if (!NT_STATUS_IS_OK(status)) {
 		DEBUG(5,("smbd_smb2_close: close_file[%s]: %s\n",
@@ -784,6 +784,7 @@ static struct tevent_req *smbd_smb2_create_send(TALLOC_CTX *mem_ctx,
 	uint32_t ucf_flags;
 	bool is_dfs = false;
 	bool is_posix = false;
+	bool may_reuse;
 
 	req = tevent_req_create(mem_ctx, &state,
 				struct smbd_smb2_create_state);
@@ -1063,6 +1064,37 @@ static struct tevent_req *smbd_smb2_create_send(TALLOC_CTX *mem_ctx,
 		return tevent_req_post(req, state->ev);
 	}
 
+	/*
+	 * A handle the client closed a moment ago might still be
+	 * open, see smbd/deferred_close.c.
+	 */
+	may_reuse = (in_context_blobs.num_blobs == 0) &&
+		(state->requested_oplock_level == SMB2_OPLOCK_LEVEL_NONE) &&
+		(in_impersonation_level <= SMB2_IMPERSONATION_DELEGATE) &&
+		(in_name[0] != '/') &&
+		(in_name[0] != '\\');
+
+	state->result = smbd_deferred_close_reclaim(
+		smb1req,
+		state->fname,
+		in_desired_access,
+		in_share_access,
+		state->in_create_disposition,
+		state->in_create_options,
+		may_reuse);
+	if (state->result != NULL) {
+		state->op = state->result->op;
+		state->info = FILE_WAS_OPENED;
+
+		smbd_smb2_create_after_exec(req);
+		if (!tevent_req_is_in_progress(req)) {
+			return tevent_req_post(req, state->ev);
+		}
+
+		smbd_smb2_create_finish(req);
+		return req;
+	}
+
 	ucf_flags = filename_create_ucf_flags(
 		smb1req, state->in_create_disposition);
 
@@ -2108,6 +2140,7 @@ bool push_deferred_open_message_smb2(struct smbd_smb2_request *smb2req,
 				true) ));
 
 	state->open_was_deferred = true;
+	smb2req->waited_for_others = true;
 
 	/* allow this request to be canceled */
 	tevent_req_set_cancel_fn(req, smbd_smb2_create_cancel);
@@ -0,0 +1,581 @@
+/*
+ * Unix SMB/CIFS implementation.
+ *
+ * Fair scheduling of SMB2 requests across tree connects
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * smbd dispatches SMB2 requests in the order they arrive. Once a
+ * session floods the process with reads, writes or directory scans,
+ * the requests of other sessions (on other channels or the same
+ * connection) wait behind them in the aio thread pool and the
+ * storage backend.
+ *
+ * With "smb2 fair queue depth" only that many requests are
+ * dispatched and still in progress at a time. Further requests are
+ * queued per flow, a flow being a tree connect of a session, and
+ * the flows are served by deficit round robin:
+ *
+ * - Every request costs its credit charge, 1 per 64 KiB of
+ *   READ/WRITE data, so a 1 MiB read weighs as much as 16 opens.
+ *
+ * - In each round a flow may dispatch requests worth
+ *   "smb2 fair queue weight" * SMBD_SMB2_FAIRQ_QUANTUM.
+ *
+ * - A flow with a "smb2 bandwidth limit" also needs tokens of a
+ *   token bucket for the READ/WRITE data. It may run into debt
+ *   with a single request, and is skipped until the debt is
+ *   paid back.
+ *
+ * Requests that may wait for the client or another client for a
+ * long time (CHANGE_NOTIFY, LOCK, named pipes) and the protocol
+ * requests without a tree connect bypass the queue and don't take
+ * one of the slots.
+ *
+ * A request keeps its slot until it's removed from
+ * xconn->smb2.requests (smbd_smb2_request_reply()) or freed, or
+ * until it goes async in smbd_smb2_request_pending_queue(): once it
+ * waits for a blocked lock or an oplock/lease break, or the client
+ * got an interim response, it no longer keeps others from running.
+ */
+
+#include "includes.h"
+#include "smbd/smbd.h"
+#include "smbd/globals.h"
+#include "source3/smbd/smbXsrv_session.h"
+#include "../libcli/smb/smb_common.h"
+#include "lib/util/dlinklist.h"
+
+#undef DBGC_CLASS
+#define DBGC_CLASS DBGC_SMB2
+
+/* The deficit a flow with weight 1 gets per round, 1 MiB of I/O. */
+#define SMBD_SMB2_FAIRQ_QUANTUM 16
+
+/* The burst a bandwidth limited flow may use at once. */
+#define SMBD_SMB2_FAIRQ_BURST_USECS (100 * 1000)
+
+struct smbd_smb2_fairq_flow;
+
+struct smbd_smb2_fairq_entry {
+	struct smbd_smb2_fairq_entry *prev, *next;
+	struct smbd_smb2_fairq_flow *flow;
+	struct smbd_smb2_request *req;
+	uint32_t cost;
+	uint64_t bytes;
+	SMBPROFILE_BASIC_ASYNC_STATE(profile_wait);
+};
+
+struct smbd_smb2_fairq_flow {
+	struct smbd_smb2_fairq_flow *prev, *next;
+	struct smbd_smb2_fairq *fairq;
+	uint64_t session_id;
+	uint32_t tree_id;
+	uint32_t quantum;
+	uint32_t deficit;
+	/* the quantum of the current round was added */
+	bool in_round;
+	/* bytes per second, 0 means unlimited */
+	uint64_t rate;
+	int64_t tokens;
+	struct timeval last_refill;
+	struct smbd_smb2_fairq_entry *queue;
+};
+
+struct smbd_smb2_fairq {
+	struct smbd_server_connection *sconn;
+	size_t num_active;
+	size_t num_queued;
+	struct smbd_smb2_fairq_flow *flows;
+	/* the flow the round robin continues with */
+	struct smbd_smb2_fairq_flow *current;
+	struct tevent_immediate *im;
+	struct tevent_timer *te;
+};
+
+static void smbd_smb2_fairq_schedule(struct smbd_smb2_fairq *fairq);
+
+static struct smbd_smb2_fairq *smbd_smb2_fairq_get(
+	struct smbd_server_connection *sconn)
+{
+	struct smbd_smb2_fairq *fairq = sconn->smb2_fairq;
+
+	if (fairq != NULL) {
+		return fairq;
+	}
+
+	fairq = talloc_zero(sconn, struct smbd_smb2_fairq);
+	if (fairq == NULL) {
+		return NULL;
+	}
+	fairq->sconn = sconn;
+
+	fairq->im = tevent_create_immediate(fairq);
+	if (fairq->im == NULL) {
+		TALLOC_FREE(fairq);
+		return NULL;
+	}
+
+	sconn->smb2_fairq = fairq;
+	return fairq;
+}
+
+static bool smbd_smb2_fairq_bypass(uint16_t opcode)
+{
+	switch (opcode) {
+	case SMB2_OP_CREATE:
+	case SMB2_OP_CLOSE:
+	case SMB2_OP_FLUSH:
+	case SMB2_OP_READ:
+	case SMB2_OP_WRITE:
+	case SMB2_OP_IOCTL:
+	case SMB2_OP_QUERY_DIRECTORY:
+	case SMB2_OP_GETINFO:
+	case SMB2_OP_SETINFO:
+		return false;
+	}
+
+	/*
+	 * NEGPROT, SESSSETUP, LOGOFF, TCON, TDIS, CANCEL, KEEPALIVE
+	 * and BREAK are needed to make progress, NOTIFY and LOCK can
+	 * wait forever.
+	 */
+	return true;
+}
+
+static void smbd_smb2_fairq_request_cost(struct smbd_smb2_request *req,
+					 uint32_t *_cost,
+					 uint64_t *_bytes)
+{
+	uint32_t cost = 0;
+	uint64_t bytes = 0;
+	int idx;
+
+	for (idx = 1;
+	     idx < req->in.vector_count;
+	     idx += SMBD_SMB2_NUM_IOV_PER_REQ)
+	{
+		const struct iovec *hdr_iov = SMBD_SMB2_IDX_HDR_IOV(req,in,idx);
+		const struct iovec *body_iov = SMBD_SMB2_IDX_BODY_IOV(req,in,idx);
+		const uint8_t *inhdr = (const uint8_t *)hdr_iov->iov_base;
+		const uint8_t *inbody = (const uint8_t *)body_iov->iov_base;
+		uint16_t opcode = SVAL(inhdr, SMB2_HDR_OPCODE);
+		uint32_t length = 0;
+
+		if ((opcode == SMB2_OP_READ || opcode == SMB2_OP_WRITE) &&
+		    (body_iov->iov_len >= 8))
+		{
+			length = IVAL(inbody, 0x04);
+		}
+
+		bytes += length;
+		cost += MAX(1, ((uint64_t)length + 65535) / 65536);
+	}
+
+	*_cost = cost;
+	*_bytes = bytes;
+}
+
+static int smbd_smb2_fairq_flow_destructor(struct smbd_smb2_fairq_flow *flow)
+{
+	struct smbd_smb2_fairq *fairq = flow->fairq;
+
+	if (fairq->current == flow) {
+		fairq->current = flow->next;
+	}
+	DLIST_REMOVE(fairq->flows, flow);
+	return 0;
+}
+
+static struct smbd_smb2_fairq_flow *smbd_smb2_fairq_flow_get(
+	struct smbd_smb2_fairq *fairq,
+	struct smbXsrv_tcon *tcon,
+	uint64_t session_id,
+	uint32_t tree_id)
+{
+	struct smbd_smb2_fairq_flow *flow = NULL;
+	int snum = SNUM(tcon->compat);
+
+	for (flow = fairq->flows; flow != NULL; flow = flow->next) {
+		if ((flow->session_id == session_id) &&
+		    (flow->tree_id == tree_id))
+		{
+			break;
+		}
+	}
+
+	if (flow == NULL) {
+		flow = talloc_zero(fairq, struct smbd_smb2_fairq_flow);
+		if (flow == NULL) {
+			return NULL;
+		}
+		flow->fairq = fairq;
+		flow->session_id = session_id;
+		flow->tree_id = tree_id;
+		flow->last_refill = timeval_current();
+		DLIST_ADD_END(fairq->flows, flow);
+		talloc_set_destructor(flow, smbd_smb2_fairq_flow_destructor);
+	}
+
+	/*
+	 * Pick up changes of the share
+	 * parameters on every request.
+	 */
+	flow->quantum = MAX(lp_smb2_fair_queue_weight(snum), 1) *
+		SMBD_SMB2_FAIRQ_QUANTUM;
+	if (flow->rate != lp_smb2_bandwidth_limit(snum)) {
+		flow->rate = lp_smb2_bandwidth_limit(snum);
+		flow->tokens = 0;
+		flow->last_refill = timeval_current();
+	}
+
+	return flow;
+}
+
+/*
+ * Returns the microseconds until the flow may send again,
+ * 0 if it's not limited right now.
+ */
+static uint64_t smbd_smb2_fairq_flow_throttled(struct smbd_smb2_fairq_flow *flow,
+					       const struct timeval *now)
+{
+	int64_t burst;
+	int64_t elapsed;
+
+	if (flow->rate == 0) {
+		return 0;
+	}
+
+	burst = flow->rate * SMBD_SMB2_FAIRQ_BURST_USECS / 1000000;
+	burst = MAX(burst, 1);
+
+	elapsed = usec_time_diff(now, &flow->last_refill);
+	if (elapsed > 0) {
+		flow->tokens += flow->rate * (elapsed / 1000000);
+		flow->tokens += flow->rate * (elapsed % 1000000) / 1000000;
+		flow->tokens = MIN(flow->tokens, burst);
+		flow->last_refill = *now;
+	}
+
+	if (flow->tokens >= 0) {
+		return 0;
+	}
+
+	return MAX((uint64_t)(-flow->tokens) * 1000000 / flow->rate, 1);
+}
+
+static int smbd_smb2_fairq_entry_destructor(struct smbd_smb2_fairq_entry *e)
+{
+	struct smbd_smb2_fairq_flow *flow = e->flow;
+
+	if (flow != NULL) {
+		DLIST_REMOVE(flow->queue, e);
+		flow->fairq->num_queued -= 1;
+		e->flow = NULL;
+	}
+	return 0;
+}
+
+static void smbd_smb2_fairq_take_slot(struct smbd_smb2_fairq *fairq,
+				      struct smbd_smb2_request *req)
+{
+	fairq->num_active += 1;
+	req->fairq_active = true;
+}
+
+NTSTATUS smbd_smb2_fairq_dispatch(struct smbd_smb2_request *req)
+{
+	struct smbXsrv_connection *xconn = req->xconn;
+	struct smbd_server_connection *sconn = req->sconn;
+	size_t depth = lp_smb2_fair_queue_depth();
+	const uint8_t *inhdr = SMBD_SMB2_IN_HDR_PTR(req);
+	uint16_t opcode = SVAL(inhdr, SMB2_HDR_OPCODE);
+	uint64_t session_id = BVAL(inhdr, SMB2_HDR_SESSION_ID);
+	uint32_t tree_id = IVAL(inhdr, SMB2_HDR_TID);
+	NTTIME now = timeval_to_nttime(&req->request_time);
+	struct smbd_smb2_fairq *fairq = NULL;
+	struct smbd_smb2_fairq_flow *flow = NULL;
+	struct smbd_smb2_fairq_entry *e = NULL;
+	struct smbXsrv_session *session = NULL;
+	struct smbXsrv_tcon *tcon = NULL;
+	NTSTATUS status;
+
+	if ((depth == 0) || smbd_smb2_fairq_bypass(opcode)) {
+		return smbd_smb2_request_dispatch(req);
+	}
+
+	status = smb2srv_session_lookup_conn(xconn, session_id, now, &session);
+	if (!NT_STATUS_IS_OK(status)) {
+		/* smbd_smb2_request_dispatch() returns the error */
+		return smbd_smb2_request_dispatch(req);
+	}
+	status = smb2srv_tcon_lookup(session, tree_id, now, &tcon);
+	if (!NT_STATUS_IS_OK(status) || IS_IPC(tcon->compat)) {
+		return smbd_smb2_request_dispatch(req);
+	}
+
+	fairq = smbd_smb2_fairq_get(sconn);
+	if (fairq == NULL) {
+		return NT_STATUS_NO_MEMORY;
+	}
+
+	flow = smbd_smb2_fairq_flow_get(fairq, tcon, session_id, tree_id);
+	if (flow == NULL) {
+		return NT_STATUS_NO_MEMORY;
+	}
+
+	e = talloc_zero(req, struct smbd_smb2_fairq_entry);
+	if (e == NULL) {
+		return NT_STATUS_NO_MEMORY;
+	}
+	e->req = req;
+	smbd_smb2_fairq_request_cost(req, &e->cost, &e->bytes);
+
+	if ((fairq->num_active < depth) &&
+	    (flow->queue == NULL) &&
+	    (smbd_smb2_fairq_flow_throttled(flow, &req->request_time) == 0))
+	{
+		/*
+		 * Nothing to be fair about,
+		 * dispatch it directly.
+		 */
+		flow->tokens -= e->bytes;
+		TALLOC_FREE(e);
+		smbd_smb2_fairq_take_slot(fairq, req);
+		return smbd_smb2_request_dispatch(req);
+	}
+
+	e->flow = flow;
+	DLIST_ADD_END(flow->queue, e);
+	fairq->num_queued += 1;
+	talloc_set_destructor(e, smbd_smb2_fairq_entry_destructor);
+
+	SMBPROFILE_BASIC_ASYNC_START(smb2_fairq_wait, profile_p, e->profile_wait);
+
+	DBG_DEBUG("queued mid %"PRIu64" on flow %"PRIx64"/%"PRIx32", "
+		  "active %zu, queued %zu\n",
+		  BVAL(inhdr, SMB2_HDR_MESSAGE_ID),
+		  session_id,
+		  tree_id,
+		  fairq->num_active,
+		  fairq->num_queued);
+
+	/*
+	 * There may be free slots if the flow is
+	 * only waiting for its bandwidth limit,
+	 * in that case the next run arms the timer.
+	 */
+	smbd_smb2_fairq_schedule(fairq);
+	return NT_STATUS_OK;
+}
+
+static void smbd_smb2_fairq_run(struct smbd_smb2_fairq *fairq);
+
+static void smbd_smb2_fairq_run_immediate(struct tevent_context *ev,
+					  struct tevent_immediate *im,
+					  void *private_data)
+{
+	struct smbd_smb2_fairq *fairq = talloc_get_type_abort(
+		private_data, struct smbd_smb2_fairq);
+
+	smbd_smb2_fairq_run(fairq);
+}
+
+static void smbd_smb2_fairq_run_timer(struct tevent_context *ev,
+				      struct tevent_timer *te,
+				      struct timeval current_time,
+				      void *private_data)
+{
+	struct smbd_smb2_fairq *fairq = talloc_get_type_abort(
+		private_data, struct smbd_smb2_fairq);
+
+	TALLOC_FREE(fairq->te);
+	smbd_smb2_fairq_run(fairq);
+}
+
+static void smbd_smb2_fairq_schedule(struct smbd_smb2_fairq *fairq)
+{
+	tevent_schedule_immediate(fairq->im,
+				  fairq->sconn->ev_ctx,
+				  smbd_smb2_fairq_run_immediate,
+				  fairq);
+}
+
+/*
+ * Returns the next entry to dispatch by deficit round robin,
+ * NULL if all flows are empty or throttled. In that case
+ * *_wait_usecs is the time until the first throttled flow
+ * may send again.
+ */
+static struct smbd_smb2_fairq_entry *smbd_smb2_fairq_next(
+	struct smbd_smb2_fairq *fairq,
+	uint64_t *_wait_usecs)
+{
+	struct timeval now = timeval_current();
+	uint64_t wait_usecs = 0;
+	size_t num_idle = 0;
+	size_t num_flows = 0;
+	struct smbd_smb2_fairq_flow *flow = NULL;
+
+	for (flow = fairq->flows; flow != NULL; flow = flow->next) {
+		num_flows += 1;
+	}
+
+	while ((num_flows > 0) && (num_idle < num_flows)) {
+		struct smbd_smb2_fairq_entry *e = NULL;
+		uint64_t throttled;
+
+		flow = fairq->current;
+		if (flow == NULL) {
+			flow = fairq->flows;
+		}
+		fairq->current = flow;
+
+		e = flow->queue;
+		throttled = smbd_smb2_fairq_flow_throttled(flow, &now);
+
+		if (e == NULL) {
+			fairq->current = flow->next;
+			flow->deficit = 0;
+			flow->in_round = false;
+			num_idle += 1;
+			if (throttled == 0) {
+				/* no debt left, forget the flow */
+				TALLOC_FREE(flow);
+				num_flows -= 1;
+				num_idle -= 1;
+			}
+			continue;
+		}
+
+		if (throttled != 0) {
+			fairq->current = flow->next;
+			flow->in_round = false;
+			num_idle += 1;
+			if ((wait_usecs == 0) || (throttled < wait_usecs)) {
+				wait_usecs = throttled;
+			}
+			continue;
+		}
+
+		num_idle = 0;
+
+		if (!flow->in_round) {
+			/*
+			 * The next round for this flow,
+			 * it stays current until its
+			 * deficit is used up.
+			 */
+			flow->deficit += flow->quantum;
+			flow->in_round = true;
+		}
+
+		if (flow->deficit < e->cost) {
+			fairq->current = flow->next;
+			flow->in_round = false;
+			continue;
+		}
+
+		flow->deficit -= e->cost;
+		flow->tokens -= e->bytes;
+		return e;
+	}
+
+	*_wait_usecs = wait_usecs;
+	return NULL;
+}
+
+static void smbd_smb2_fairq_run(struct smbd_smb2_fairq *fairq)
+{
+	size_t depth = lp_smb2_fair_queue_depth();
+	uint64_t wait_usecs = 0;
+
+	/*
+	 * With "smb2 fair queue depth = 0" after a reload
+	 * we just drain the queues.
+	 */
+	if (depth == 0) {
+		depth = SIZE_MAX;
+	}
+
+	while ((fairq->num_queued > 0) && (fairq->num_active < depth)) {
+		struct smbd_smb2_fairq_entry *e = NULL;
+		struct smbd_smb2_request *req = NULL;
+		NTSTATUS status;
+
+		e = smbd_smb2_fairq_next(fairq, &wait_usecs);
+		if (e == NULL) {
+			break;
+		}
+
+		req = e->req;
+		SMBPROFILE_BASIC_ASYNC_END(e->profile_wait);
+		TALLOC_FREE(e);
+
+		smbd_smb2_fairq_take_slot(fairq, req);
+		status = smbd_smb2_request_dispatch(req);
+		if (!NT_STATUS_IS_OK(status)) {
+			smbd_server_connection_terminate(req->xconn,
+							 nt_errstr(status));
+			/*
+			 * The connection might be gone,
+			 * continue from a fresh event loop
+			 * iteration.
+			 */
+			if (fairq->num_queued > 0) {
+				smbd_smb2_fairq_schedule(fairq);
+			}
+			return;
+		}
+	}
+
+	if ((wait_usecs != 0) && (fairq->te == NULL)) {
+		DO_PROFILE_INC(smb2_fairq_throttled);
+		fairq->te = tevent_add_timer(fairq->sconn->ev_ctx,
+					     fairq,
+					     timeval_current_ofs_usec(
+						     MIN(wait_usecs, 1000000)),
+					     smbd_smb2_fairq_run_timer,
+					     fairq);
+		if (fairq->te == NULL) {
+			/* try again in the next loop iteration */
+			smbd_smb2_fairq_schedule(fairq);
+		}
+	}
+}
+
+void smbd_smb2_fairq_release(struct smbd_smb2_request *req)
+{
+	struct smbd_smb2_fairq *fairq = req->sconn->smb2_fairq;
+
+	if (!req->fairq_active) {
+		return;
+	}
+	req->fairq_active = false;
+
+	SMB_ASSERT(fairq != NULL);
+	SMB_ASSERT(fairq->num_active > 0);
+	fairq->num_active -= 1;
+
+	if (fairq->num_queued > 0) {
+		/*
+		 * We're called from the reply of
+		 * another request, don't dispatch
+		 * the next one from here.
+		 */
+		smbd_smb2_fairq_schedule(fairq);
+	}
+}
@@ -687,6 +687,8 @@ static void smbd_smb2_lock_try(struct tevent_req *req)
 setup_retry:
 	DBG_DEBUG("Watching share mode lock\n");
 
+	state->smb2req->waited_for_others = true;
+
 	subreq = share_mode_watch_send(
 		state, state->ev, lck, blocking_pid);
 	TALLOC_FREE(lck);
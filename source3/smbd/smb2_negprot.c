@@ -217,6 +217,7 @@ NTSTATUS smbd_smb2_request_process_negprot(struct smbd_smb2_request *req)
 	struct smb2_negotiate_context *in_preauth = NULL;
 	struct smb2_negotiate_context *in_cipher = NULL;
 	struct smb2_negotiate_context *in_sign_algo = NULL;
+	struct smb2_negotiate_context *in_compression = NULL;
 	struct smb2_negotiate_contexts out_c = { .num_contexts = 0, };
 	const struct smb311_capabilities default_smb3_capabilities =
 		smb311_capabilities_parse("server",
@@ -379,6 +380,8 @@ NTSTATUS smbd_smb2_request_process_negprot(struct smbd_smb2_request *req)
 					SMB2_ENCRYPTION_CAPABILITIES);
 	in_sign_algo = smb2_negotiate_context_find(&in_c,
 					SMB2_SIGNING_CAPABILITIES);
+	in_compression = smb2_negotiate_context_find(&in_c,
+					SMB2_COMPRESSION_CAPABILITIES);
 
 	/* negprot_spnego() returns the server guid in the first 16 bytes */
 	negprot_spnego_blob = negprot_spnego(req, xconn);
@@ -680,6 +683,112 @@ NTSTATUS smbd_smb2_request_process_negprot(struct smbd_smb2_request *req)
 		}
 	}
 
+	if ((protocol >= PROTOCOL_SMB3_11) &&
+	    (in_compression != NULL) &&
+	    lp_server_smb_compression())
+	{
+		/*
+		 * The server algorithms are listed
+		 * with the lowest idx being preferred.
+		 */
+		static const uint16_t srv_algos[] = {
+			SMB2_COMPRESSION_LZ77,
+			SMB2_COMPRESSION_LZ77_HUFFMAN,
+			SMB2_COMPRESSION_PATTERN_V1,
+		};
+		struct smb2_compression_capabilities *cc =
+			&xconn->smb2.server.compression;
+		size_t needed = 8;
+		uint16_t algo_count;
+		uint32_t flags;
+		const uint8_t *p;
+		uint8_t buf[8 + 2 * SMB2_COMPRESSION_CAPABILITIES_MAX_ALGOS];
+		uint16_t out_count;
+		size_t si;
+		size_t i;
+
+		if (in_compression->data.length < needed) {
+			return smbd_smb2_request_error(req,
+					NT_STATUS_INVALID_PARAMETER);
+		}
+
+		algo_count = SVAL(in_compression->data.data, 0);
+		flags = IVAL(in_compression->data.data, 4);
+		if (algo_count == 0) {
+			return smbd_smb2_request_error(req,
+					NT_STATUS_INVALID_PARAMETER);
+		}
+
+		p = in_compression->data.data + needed;
+		needed += algo_count * 2;
+
+		if (in_compression->data.length < needed) {
+			return smbd_smb2_request_error(req,
+					NT_STATUS_INVALID_PARAMETER);
+		}
+
+		*cc = (struct smb2_compression_capabilities) {
+			.chained = (flags &
+				SMB2_COMPRESSION_CAPABILITIES_FLAG_CHAINED),
+		};
+
+		for (si = 0; si < ARRAY_SIZE(srv_algos); si++) {
+			if (srv_algos[si] == SMB2_COMPRESSION_PATTERN_V1 &&
+			    !cc->chained)
+			{
+				/* Pattern_V1 is only valid in chains */
+				continue;
+			}
+
+			for (i = 0; i < algo_count; i++) {
+				if (SVAL(p, i * 2) == srv_algos[si]) {
+					cc->algos[cc->num_algos++] =
+						srv_algos[si];
+					break;
+				}
+			}
+		}
+
+		if (smb2_compression_capabilities_select(cc) ==
+		    SMB2_COMPRESSION_NONE)
+		{
+			/*
+			 * Without a real compression algorithm
+			 * there's nothing to negotiate.
+			 */
+			*cc = (struct smb2_compression_capabilities) {
+				.num_algos = 0,
+			};
+		}
+
+		out_count = MAX(cc->num_algos, 1);
+
+		SSVAL(buf, 0, out_count); /* CompressionAlgorithmCount */
+		SSVAL(buf, 2, 0); /* Padding */
+		SIVAL(buf, 4, cc->chained ?
+		      SMB2_COMPRESSION_CAPABILITIES_FLAG_CHAINED :
+		      SMB2_COMPRESSION_CAPABILITIES_FLAG_NONE);
+		SSVAL(buf, 8, SMB2_COMPRESSION_NONE);
+		for (i = 0; i < cc->num_algos; i++) {
+			SSVAL(buf, 8 + i * 2, cc->algos[i]);
+		}
+
+		status = smb2_negotiate_context_add(
+			req,
+			&out_c,
+			SMB2_COMPRESSION_CAPABILITIES,
+			buf,
+			8 + out_count * 2);
+		if (!NT_STATUS_IS_OK(status)) {
+			return smbd_smb2_request_error(req, status);
+		}
+
+		DBG_DEBUG("compression: %s%s\n",
+			  smb2_compression_algorithm_name(
+				smb2_compression_capabilities_select(cc)),
+			  cc->chained ? " (chained)" : "");
+	}
+
 	status = smb311_capabilities_check(&default_smb3_capabilities,
 					   "smb2srv_negprot",
 					   DBGLVL_NOTICE,
@@ -166,6 +166,9 @@ NTSTATUS set_sd(files_struct *fsp, struct security_descriptor *psd,
 
 	sd_fsp = metadata_fsp(fsp);
 	status = SMB_VFS_FSET_NT_ACL(sd_fsp, security_info_sent, psd);
+	if (NT_STATUS_IS_OK(status)) {
+		smbd_open_cache_changed(sd_fsp);
+	}
 
 	TALLOC_FREE(psd);
 
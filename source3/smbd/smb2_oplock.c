@@ -681,6 +681,8 @@ NTSTATUS downgrade_lease(struct smbXsrv_client *client,
 		}
 	}
 
+	share_mode_lease_changed(lck);
+
 	DBG_DEBUG("Downgrading %s to %"PRIu32" => %s\n",
 		  file_id_str_buf(id, &idbuf),
 		  lease_state,
@@ -708,6 +710,7 @@ NTSTATUS downgrade_lease(struct smbXsrv_client *client,
 			return NT_STATUS_OBJECT_NAME_NOT_FOUND;
 		}
 
+		share_mode_lease_changed(lck);
 		fsps_lease_update(sconn, &ids[i], key);
 
 		DBG_DEBUG("Downgrading %s to %"PRIu32" => %s\n",
@@ -918,6 +921,7 @@ static void process_oplock_break_message(struct messaging_context *msg_ctx,
 		uint32_t breaking_to_requested, breaking_to_required;
 		bool breaking;
 		uint16_t lease_version, epoch;
+		bool lease_changed = false;
 		NTSTATUS status;
 
 		lck = get_existing_share_mode_lock(
@@ -960,6 +964,7 @@ static void process_oplock_break_message(struct messaging_context *msg_ctx,
 				 * Windows too...
 				 */
 				breaking_to_required = break_to;
+				lease_changed = true;
 			}
 			break_needed = false;
 		} else if (current_state == break_to) {
@@ -968,12 +973,14 @@ static void process_oplock_break_message(struct messaging_context *msg_ctx,
 			current_state = SMB2_LEASE_NONE;
 			/* Need to increment the epoch */
 			epoch += 1;
+			lease_changed = true;
 		} else {
 			breaking = true;
 			breaking_to_required = break_to;
 			breaking_to_requested = break_to;
 			/* Need to increment the epoch */
 			epoch += 1;
+			lease_changed = true;
 		}
 
 		{
@@ -996,6 +1003,15 @@ static void process_oplock_break_message(struct messaging_context *msg_ctx,
 			}
 		}
 
+		if (lease_changed) {
+			/*
+			 * Only then: Opens waiting for the break watch
+			 * the share mode record and resend the break
+			 * when woken up.
+			 */
+			share_mode_lease_changed(lck);
+		}
+
 		/* Ensure we're in sync with current lease state. */
 		fsp_lease_update(fsp);
 
@@ -1206,6 +1206,7 @@ static NTSTATUS smbd_register_ips(struct smbXsrv_connection *xconn,
 static int smbXsrv_connection_destructor(struct smbXsrv_connection *xconn)
 {
 	DBG_DEBUG("xconn[%s]\n", smbXsrv_connection_dbg(xconn));
+	smbd_smb2_crypt_jobs_orphan(xconn);
 	return 0;
 }
 
@@ -487,6 +487,7 @@ static struct tevent_req *smbd_smb2_query_directory_send(TALLOC_CTX *mem_ctx,
 		state->ask_sharemode = fsp_search_ask_sharemode(fsp);
 
 		state->async_dosmode = lp_smbd_async_dosmode(SNUM(conn));
+
 	}
 
 	if (state->ask_sharemode && lp_clustering()) {
@@ -509,6 +510,14 @@ static struct tevent_req *smbd_smb2_query_directory_send(TALLOC_CTX *mem_ctx,
 		}
 	}
 
+	/*
+	 * Cached listings have the DOS attributes,
+	 * the async path fetches them afterwards.
+	 */
+	dptr_set_dircache(fsp->dptr,
+			  (lp_smbd_dir_cache_timeout(SNUM(conn)) > 0) &&
+			  !state->async_dosmode);
+
 	if (state->async_dosmode || state->async_ask_sharemode) {
 		/*
 		 * Should we only set async_internal
@@ -97,6 +97,17 @@ NTSTATUS smbd_smb2_request_process_read(struct smbd_smb2_request *req)
 		return smbd_smb2_request_error(req, NT_STATUS_FILE_CLOSED);
 	}
 
+	if (xconn->smb2.server.compression.num_algos != 0) {
+		int policy = lp_smb_compression(SNUM(in_fsp->conn));
+
+		if ((policy == SMB_COMPRESSION_YES) ||
+		    ((policy == SMB_COMPRESSION_REQUESTED) &&
+		     (in_flags & SMB2_READFLAG_REQUEST_COMPRESSED)))
+		{
+			req->do_compression = true;
+		}
+	}
+
 	subreq = smbd_smb2_read_send(req, req->sconn->ev_ctx,
 				     req, in_fsp,
 				     in_flags,
@@ -344,6 +355,7 @@ static NTSTATUS schedule_smb2_sendfile_read(struct smbd_smb2_request *smb2req,
 	 * We cannot use sendfile if...
 	 * We were not configured to do so OR
 	 * Signing is active OR
+	 * The response might get compressed OR
 	 * This is a compound SMB2 operation OR
 	 * fsp is a STREAM file OR
 	 * It's not a regular file OR
@@ -356,6 +368,7 @@ static NTSTATUS schedule_smb2_sendfile_read(struct smbd_smb2_request *smb2req,
 	if (!lp__use_sendfile(SNUM(fsp->conn)) ||
 	    smb2req->do_signing ||
 	    smb2req->do_encryption ||
+	    smb2req->do_compression ||
 	    smbd_smb2_is_compound(smb2req) ||
 	    fsp_is_alternate_stream(fsp) ||
 	    (!S_ISREG(fsp->fsp_name->st.st_ex_mode)) ||
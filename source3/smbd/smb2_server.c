@@ -33,9 +33,11 @@
 #include "../lib/util/bitmap.h"
 #include "../librpc/gen_ndr/krb5pac.h"
 #include "lib/util/iov_buf.h"
+#include "lib/compression/lzxpress_huffman.h"
 #include "auth.h"
 #include "libcli/smb/smbXcli_base.h"
 #include "source3/lib/substitute.h"
+#include "lib/pthreadpool/pthreadpool_tevent.h"
 
 #if defined(LINUX)
 /* SIOCOUTQ TIOCOUTQ are the same */
@@ -59,7 +61,6 @@ static void smbd_smb2_connection_handler(struct tevent_context *ev,
 					 struct tevent_fd *fde,
 					 uint16_t flags,
 					 void *private_data);
-static NTSTATUS smbd_smb2_flush_send_queue(struct smbXsrv_connection *xconn);
 
 static const struct smbd_smb2_dispatch_table {
 	uint16_t opcode;
@@ -375,6 +376,13 @@ static bool smb2_setup_nbt_length(struct iovec *vector, int count)
 
 static int smbd_smb2_request_destructor(struct smbd_smb2_request *req)
 {
+	/*
+	 * A pthreadpool job still working on our buffers
+	 * keeps us alive, see smbd_smb2_crypt_job_orphan().
+	 */
+	SMB_ASSERT(req->crypt_job == NULL);
+
+	smbd_smb2_fairq_release(req);
 	TALLOC_FREE(req->first_enc_key);
 	TALLOC_FREE(req->last_sign_key);
 	return 0;
@@ -422,6 +430,375 @@ static struct smbd_smb2_request *smbd_smb2_request_allocate(struct smbXsrv_conne
 	return req;
 }
 
+/*
+ * Large encrypted messages are encrypted or decrypted
+ * in the thread pool, with "smb2 channel threads = yes"
+ * large signed responses are also signed there. The job
+ * only needs a private copy of the key and the buffers,
+ * which are owned by the request.
+ */
+enum smbd_smb2_crypt_job_op {
+	SMBD_SMB2_CRYPT_JOB_ENCRYPT,
+	SMBD_SMB2_CRYPT_JOB_DECRYPT,
+	SMBD_SMB2_CRYPT_JOB_SIGN,
+};
+
+/*
+ * The crypt jobs of a connection. It's owned by the pool
+ * running them, so a request with a running job can be
+ * moved here when the connection goes away. The channel
+ * pool is owned by the connection, in that case it's
+ * detached and freed after its last job.
+ */
+struct smbd_smb2_crypt_jobs {
+	struct pthreadpool_tevent *pool;
+	bool own_pool;
+	struct smbd_smb2_crypt_job_state *pending;
+	size_t num_jobs;
+	bool detached;
+	struct tevent_context *ev;
+	struct tevent_immediate *im;
+};
+
+struct smbd_smb2_crypt_job_state {
+	struct smbd_smb2_crypt_job_state *prev, *next;
+	struct smbd_smb2_crypt_jobs *jobs;
+	struct smbd_smb2_request *req;
+	struct tevent_req *subreq;
+	enum smbd_smb2_crypt_job_op op;
+	struct smb2_signing_key *key;
+	struct iovec *vector;
+	int count;
+	NTSTATUS status;
+	int gnutls_rc;
+};
+
+/*
+ * Runs in a helper thread: no logging and no talloc,
+ * errors are mapped in smbd_smb2_crypt_job_finish().
+ */
+static void smbd_smb2_crypt_job_do(void *private_data)
+{
+	struct smbd_smb2_crypt_job_state *state = talloc_get_type_abort(
+		private_data, struct smbd_smb2_crypt_job_state);
+
+	switch (state->op) {
+	case SMBD_SMB2_CRYPT_JOB_ENCRYPT:
+		state->status = smb2_signing_encrypt_pdu_job(state->key,
+							     state->vector,
+							     state->count,
+							     &state->gnutls_rc);
+		break;
+	case SMBD_SMB2_CRYPT_JOB_DECRYPT:
+		state->status = smb2_signing_decrypt_pdu_job(state->key,
+							     state->vector,
+							     state->count,
+							     &state->gnutls_rc);
+		break;
+	case SMBD_SMB2_CRYPT_JOB_SIGN:
+		state->status = smb2_signing_sign_pdu_job(state->key,
+							  state->vector,
+							  state->count,
+							  &state->gnutls_rc);
+		break;
+	}
+}
+
+static void smbd_smb2_crypt_jobs_free(struct smbd_smb2_crypt_jobs *jobs)
+{
+	if (jobs->own_pool) {
+		/* jobs is a child of the pool */
+		talloc_free(jobs->pool);
+		return;
+	}
+	talloc_free(jobs);
+}
+
+static void smbd_smb2_crypt_jobs_free_fn(struct tevent_context *ev,
+					 struct tevent_immediate *im,
+					 void *private_data)
+{
+	struct smbd_smb2_crypt_jobs *jobs = talloc_get_type_abort(
+		private_data, struct smbd_smb2_crypt_jobs);
+
+	smbd_smb2_crypt_jobs_free(jobs);
+}
+
+/*
+ * All channels of a multichannel client are served by the
+ * main thread of one smbd process. With "smb2 channel threads"
+ * each connection gets a pthreadpool with a single thread of
+ * its own, so the signing and encryption of the channels
+ * run in parallel and don't compete with the aio jobs
+ * for the threads of sconn->pool.
+ */
+static struct smbd_smb2_crypt_jobs *smbd_smb2_crypt_jobs_get(
+	struct smbXsrv_connection *xconn)
+{
+	struct smbd_server_connection *sconn = xconn->client->sconn;
+	struct pthreadpool_tevent *pool = NULL;
+	struct smbd_smb2_crypt_jobs *jobs = NULL;
+	bool own_pool = false;
+	int ret;
+
+	if (xconn->smb2.crypt_jobs != NULL) {
+		return xconn->smb2.crypt_jobs;
+	}
+
+	pool = sconn->pool;
+
+	if (lp_smb2_channel_threads()) {
+		ret = pthreadpool_tevent_init(xconn, 1, &pool);
+		if (ret == 0) {
+			own_pool = true;
+		} else {
+			DBG_WARNING("pthreadpool_tevent_init() failed: %s, "
+				    "using the aio thread pool\n",
+				    strerror(ret));
+			pool = sconn->pool;
+		}
+	}
+
+	if (pool == NULL) {
+		return NULL;
+	}
+
+	jobs = talloc_zero(pool, struct smbd_smb2_crypt_jobs);
+	if (jobs == NULL) {
+		goto fail;
+	}
+	*jobs = (struct smbd_smb2_crypt_jobs) {
+		.pool = pool,
+		.own_pool = own_pool,
+		.ev = xconn->client->raw_ev_ctx,
+	};
+
+	jobs->im = tevent_create_immediate(jobs);
+	if (jobs->im == NULL) {
+		goto fail;
+	}
+
+	xconn->smb2.crypt_jobs = jobs;
+	return jobs;
+
+fail:
+	if (own_pool) {
+		TALLOC_FREE(pool);
+	} else {
+		TALLOC_FREE(jobs);
+	}
+	return NULL;
+}
+
+/*
+ * The connection is going away while a job still works on the
+ * buffers of the request: move it to the job context, the job's
+ * callback frees it.
+ */
+static void smbd_smb2_crypt_job_orphan(struct smbd_smb2_crypt_job_state *state)
+{
+	struct smbd_smb2_crypt_jobs *jobs = state->jobs;
+	struct smbd_smb2_request *req = state->req;
+
+	DLIST_REMOVE(jobs->pending, state);
+	req->crypt_job_orphaned = true;
+	talloc_steal(jobs, req);
+}
+
+void smbd_smb2_crypt_jobs_orphan(struct smbXsrv_connection *xconn)
+{
+	struct smbd_smb2_crypt_jobs *jobs = xconn->smb2.crypt_jobs;
+
+	if (jobs == NULL) {
+		return;
+	}
+	xconn->smb2.crypt_jobs = NULL;
+
+	while (jobs->pending != NULL) {
+		smbd_smb2_crypt_job_orphan(jobs->pending);
+	}
+
+	if (jobs->num_jobs == 0) {
+		smbd_smb2_crypt_jobs_free(jobs);
+		return;
+	}
+
+	if (jobs->own_pool) {
+		/*
+		 * Freeing the pool doesn't wait for the
+		 * running job, keep it until the job is done.
+		 */
+		talloc_steal(NULL, jobs->pool);
+	}
+	jobs->detached = true;
+}
+
+static bool smbd_smb2_crypt_job_possible(struct smbXsrv_connection *xconn,
+					 enum smbd_smb2_crypt_job_op op,
+					 const struct smb2_signing_key *key,
+					 size_t len)
+{
+	struct smbd_smb2_crypt_jobs *jobs = NULL;
+	size_t min_size = lp_smb_encryption_offload_min_size();
+
+	if (min_size == 0 || len < min_size) {
+		return false;
+	}
+
+	if (op == SMBD_SMB2_CRYPT_JOB_SIGN && !lp_smb2_channel_threads()) {
+		return false;
+	}
+
+	jobs = smbd_smb2_crypt_jobs_get(xconn);
+	if (jobs == NULL) {
+		return false;
+	}
+
+	if (pthreadpool_tevent_max_threads(jobs->pool) == 0) {
+		return false;
+	}
+
+	if (op == SMBD_SMB2_CRYPT_JOB_SIGN) {
+		return smb2_signing_key_valid(key);
+	}
+
+	return smb2_signing_key_cipher_threadsafe(key);
+}
+
+/*
+ * Takes over *pkey, also on failure.
+ */
+static NTSTATUS smbd_smb2_crypt_job_start(struct smbd_smb2_request *req,
+					  enum smbd_smb2_crypt_job_op op,
+					  struct smb2_signing_key **pkey,
+					  struct iovec *vector,
+					  int count,
+					  tevent_req_fn done_fn)
+{
+	struct smbd_smb2_crypt_jobs *jobs = req->xconn->smb2.crypt_jobs;
+	struct smbd_smb2_crypt_job_state *state = NULL;
+
+	/* set up by smbd_smb2_crypt_job_possible() */
+	SMB_ASSERT(jobs != NULL);
+
+	state = talloc_zero(req, struct smbd_smb2_crypt_job_state);
+	if (state == NULL) {
+		TALLOC_FREE(*pkey);
+		return NT_STATUS_NO_MEMORY;
+	}
+	state->jobs = jobs;
+	state->req = req;
+	state->op = op;
+	state->key = talloc_move(state, pkey);
+	state->count = count;
+	state->status = NT_STATUS_INTERNAL_ERROR;
+
+	state->vector = talloc_memdup(state,
+				      vector,
+				      sizeof(struct iovec) * count);
+	if (state->vector == NULL) {
+		TALLOC_FREE(state);
+		return NT_STATUS_NO_MEMORY;
+	}
+
+	state->subreq = pthreadpool_tevent_job_send(state,
+						    jobs->ev,
+						    jobs->pool,
+						    smbd_smb2_crypt_job_do,
+						    state);
+	if (state->subreq == NULL) {
+		TALLOC_FREE(state);
+		return NT_STATUS_NO_MEMORY;
+	}
+	tevent_req_set_callback(state->subreq, done_fn, req);
+
+	DLIST_ADD_END(jobs->pending, state);
+	jobs->num_jobs += 1;
+	req->crypt_job = state;
+	return NT_STATUS_OK;
+}
+
+/*
+ * Returns false if the request was orphaned,
+ * it's gone then and the status is not set.
+ */
+static bool smbd_smb2_crypt_job_finish(struct smbd_smb2_request *req,
+				       NTSTATUS *pstatus)
+{
+	struct smbd_smb2_crypt_job_state *state = req->crypt_job;
+	struct smbd_smb2_crypt_jobs *jobs = state->jobs;
+	NTSTATUS status;
+	int ret;
+
+	ret = pthreadpool_tevent_job_recv(state->subreq);
+	TALLOC_FREE(state->subreq);
+	if (ret == EAGAIN) {
+		/*
+		 * The pthreadpool failed to create a new thread,
+		 * fallback to sync processing in that case.
+		 */
+		smbd_smb2_crypt_job_do(state);
+	} else if (ret != 0) {
+		state->status = map_nt_error_from_unix_common(ret);
+	}
+
+	status = state->status;
+	if (state->gnutls_rc != 0) {
+		status = gnutls_error_to_ntstatus(
+			state->gnutls_rc,
+			state->op == SMBD_SMB2_CRYPT_JOB_SIGN ?
+			NT_STATUS_HMAC_NOT_SUPPORTED :
+			NT_STATUS_INTERNAL_ERROR);
+	}
+	if (!NT_STATUS_IS_OK(status)) {
+		DBG_WARNING("crypt job op[%d] failed: %s\n",
+			    (int)state->op,
+			    nt_errstr(status));
+	}
+
+	if (!req->crypt_job_orphaned) {
+		DLIST_REMOVE(jobs->pending, state);
+	}
+	req->crypt_job = NULL;
+	TALLOC_FREE(state);
+
+	SMB_ASSERT(jobs->num_jobs > 0);
+	jobs->num_jobs -= 1;
+
+	if (!req->crypt_job_orphaned) {
+		*pstatus = status;
+		return true;
+	}
+
+	TALLOC_FREE(req);
+
+	if (jobs->detached && jobs->num_jobs == 0) {
+		/*
+		 * We're in the callback of the last job of
+		 * the pool, free it from the main loop.
+		 */
+		tevent_schedule_immediate(jobs->im,
+					  jobs->ev,
+					  smbd_smb2_crypt_jobs_free_fn,
+					  jobs);
+	}
+	return false;
+}
+
+static size_t smbd_smb2_max_decompressed_size(
+		const struct smbXsrv_connection *xconn)
+{
+	uint32_t max_payload = MAX(xconn->smb2.server.max_trans,
+				   MAX(xconn->smb2.server.max_read,
+				       xconn->smb2.server.max_write));
+
+	/*
+	 * Leave room for the headers of a compound
+	 * chain, but never more than an NBT frame can carry.
+	 */
+	return MIN((size_t)max_payload + 0x10000, 0xFFFFFF);
+}
+
 static NTSTATUS smbd_smb2_inbuf_parse_compound(struct smbXsrv_connection *xconn,
 					       NTTIME now,
 					       uint8_t *buf,
@@ -438,6 +815,7 @@ static NTSTATUS smbd_smb2_inbuf_parse_compound(struct smbXsrv_connection *xconn,
 	size_t verified_buflen = 0;
 	uint8_t *tf = NULL;
 	size_t tf_len = 0;
+	bool decompressed = false;
 
 	/*
 	 * Note: index '0' is reserved for the transport protocol
@@ -545,8 +923,17 @@ static NTSTATUS smbd_smb2_inbuf_parse_compound(struct smbXsrv_connection *xconn,
 			tf_iov[1].iov_base = (void *)hdr;
 			tf_iov[1].iov_len = enc_len;
 
-			status = smb2_signing_decrypt_pdu(s->global->decryption_key,
-							  tf_iov, 2);
+			if (req->tf_decrypted) {
+				/*
+				 * smbd_smb2_request_decrypt_job()
+				 * already did the work.
+				 */
+				status = NT_STATUS_OK;
+			} else {
+				status = smb2_signing_decrypt_pdu(
+					s->global->decryption_key,
+					tf_iov, 2);
+			}
 			if (!NT_STATUS_IS_OK(status)) {
 				TALLOC_FREE(iov_alloc);
 				return status;
@@ -556,6 +943,57 @@ static NTSTATUS smbd_smb2_inbuf_parse_compound(struct smbXsrv_connection *xconn,
 			len = enc_len;
 		}
 
+		if ((len >= 4) && (IVAL(hdr, 0) == SMB2_COMP_TF_MAGIC)) {
+			DATA_BLOB blob;
+			NTSTATUS status;
+
+			if (xconn->smb2.server.compression.num_algos == 0) {
+				DEBUG(10, ("Got SMB2_COMPRESSION_TRANSFORM "
+					   "header, but not negotiated\n"));
+				goto inval;
+			}
+
+			/*
+			 * The compression transform header
+			 * has to cover the whole message.
+			 */
+			if (decompressed || (taken + len != buflen) ||
+			    (taken != tf_len)) {
+				DEBUG(10, ("Got SMB2_COMPRESSION_TRANSFORM "
+					   "header within a compound\n"));
+				goto inval;
+			}
+
+			status = smb2_compression_decompress_pdu(
+				mem_ctx,
+				&xconn->smb2.server.compression,
+				hdr,
+				len,
+				smbd_smb2_max_decompressed_size(xconn),
+				&blob);
+			if (!NT_STATUS_IS_OK(status)) {
+				DBG_NOTICE("decompression failed: %s\n",
+					   nt_errstr(status));
+				TALLOC_FREE(iov_alloc);
+				return status;
+			}
+			decompressed = true;
+
+			/*
+			 * Continue parsing in the decompressed buffer,
+			 * all PDUs in it are covered by the
+			 * SMB2_TRANSFORM header (if any).
+			 */
+			first_hdr = blob.data;
+			buflen = blob.length;
+			taken = 0;
+			hdr = first_hdr;
+			len = buflen;
+			if (tf != NULL) {
+				verified_buflen = buflen;
+			}
+		}
+
 		/*
 		 * We need the header plus the body length field
 		 */
@@ -939,6 +1377,7 @@ static void smb2_set_operation_credit(struct smbXsrv_connection *xconn,
 	uint16_t credits_granted = 0;
 	uint64_t credits_possible;
 	uint16_t current_max_credits;
+	uint16_t window;
 
 	/*
 	 * first we grant only 1/16th of the max range.
@@ -1022,6 +1461,29 @@ static void smb2_set_operation_credit(struct smbXsrv_connection *xconn,
 		additional_credits = MIN(additional_credits, additional_max);
 
 		credits_granted = credit_charge + additional_credits;
+
+		/*
+		 * The adaptive window limits the number of credits
+		 * the client holds, see smbd_smb2_credits_adjust_window().
+		 * This may even give back less than the credit charge,
+		 * but never leaves the client without any credit.
+		 */
+		window = xconn->smb2.credits.adaptive.window;
+		if ((window != 0) && (cmd != SMB2_OP_NEGPROT)) {
+			uint16_t held = xconn->smb2.credits.granted;
+			uint16_t limit = 0;
+
+			if (window > held) {
+				limit = window - held;
+			}
+			if (held == 0) {
+				limit = MAX(limit, 1);
+			}
+			if (credits_granted > limit) {
+				credits_granted = limit;
+				DO_PROFILE_INC(smb2_credits_limited);
+			}
+		}
 	}
 
 	/*
@@ -1288,6 +1750,204 @@ static NTSTATUS smbXsrv_connection_get_rto_usecs(struct smbXsrv_connection *xcon
 	return NT_STATUS_OK;
 }
 
+static uint32_t smbXsrv_connection_get_rtt_usecs(struct smbXsrv_connection *xconn)
+{
+	/*
+	 * 0 means we don't know the round trip time.
+	 */
+	uint32_t rtt_usecs = 0;
+
+#ifdef __HAVE_TCP_INFO_RTO
+	{
+		struct tcp_info info;
+		socklen_t ilen = sizeof(info);
+		int ret;
+
+		ZERO_STRUCT(info);
+		ret = getsockopt(xconn->transport.sock,
+				 IPPROTO_TCP, TCP_INFO,
+				 (void *)&info, &ilen);
+		if (ret == 0) {
+			rtt_usecs = info.tcpi_rtt;
+		}
+	}
+#endif /* __HAVE_TCP_INFO_RTO */
+
+	return rtt_usecs;
+}
+
+/*
+ * With "smb2 credits target latency" the credits a client may hold
+ * are limited to a window, which follows the time the requests of
+ * the connection need from arrival to the response.
+ *
+ * The window shrinks by a quarter if the average latency is above
+ * the target and by half if in addition more than half of the
+ * window is stuck in pending requests, which means the backend
+ * can't keep up. It grows by an eighth if the latency is below half
+ * of the target and the client uses most of its credits.
+ *
+ * The target is at least the round trip time of the connection,
+ * a latency that is small compared to the network doesn't matter
+ * to the client.
+ */
+#define SMBD_SMB2_CREDITS_ADJUST_USECS (100 * 1000)
+#define SMBD_SMB2_CREDITS_MIN_WINDOW 64
+
+static uint16_t smbd_smb2_credits_min_window(struct smbXsrv_connection *xconn)
+{
+	uint32_t max_io = 0;
+	uint32_t max_charge = 1;
+	uint32_t min_window;
+
+	if (xconn->smb2.credits.multicredit) {
+		max_io = MAX(xconn->smb2.server.max_trans,
+			     xconn->smb2.server.max_read);
+		max_io = MAX(max_io, xconn->smb2.server.max_write);
+		max_charge = MAX(max_io / 65536, 1);
+	}
+
+	/*
+	 * Leave room for two requests with the highest
+	 * possible credit charge.
+	 */
+	min_window = MAX(SMBD_SMB2_CREDITS_MIN_WINDOW, 2 * max_charge);
+	min_window = MIN(min_window, xconn->smb2.credits.max);
+
+	return min_window;
+}
+
+static void smbd_smb2_credits_adjust_window(struct smbXsrv_connection *xconn,
+					    uint64_t target_usecs)
+{
+	struct smbd_smb2_request *preq = NULL;
+	uint64_t latency_usecs = xconn->smb2.credits.adaptive.latency_usecs;
+	uint16_t window = xconn->smb2.credits.adaptive.window;
+	uint16_t max_window = xconn->smb2.credits.max;
+	uint16_t min_window = smbd_smb2_credits_min_window(xconn);
+	uint16_t held = xconn->smb2.credits.granted;
+	uint32_t rtt_usecs = smbXsrv_connection_get_rtt_usecs(xconn);
+	size_t num_pending = 0;
+
+	for (preq = xconn->smb2.requests; preq != NULL; preq = preq->next) {
+		num_pending += 1;
+	}
+
+	target_usecs = MAX(target_usecs, rtt_usecs);
+
+	if (latency_usecs > target_usecs) {
+		if (num_pending > window / 2) {
+			window -= window / 2;
+		} else {
+			window -= window / 4;
+		}
+		window = MAX(window, min_window);
+	} else if ((latency_usecs < target_usecs / 2) && (held < window / 4)) {
+		window += MAX(window / 8, 1);
+		window = MIN(window, max_window);
+	}
+
+	if (window == xconn->smb2.credits.adaptive.window) {
+		return;
+	}
+
+	if (window > xconn->smb2.credits.adaptive.window) {
+		DO_PROFILE_INC(smb2_credits_window_grow);
+	} else {
+		DO_PROFILE_INC(smb2_credits_window_shrink);
+	}
+
+	DBGC_DEBUG(DBGC_SMB2_CREDITS,
+		   "window %u => %u (min/max %u/%u), latency %llu usecs, "
+		   "target %llu usecs, rtt %u usecs, held %u, pending %zu\n",
+		   (unsigned int)xconn->smb2.credits.adaptive.window,
+		   (unsigned int)window,
+		   (unsigned int)min_window,
+		   (unsigned int)max_window,
+		   (unsigned long long)latency_usecs,
+		   (unsigned long long)target_usecs,
+		   (unsigned int)rtt_usecs,
+		   (unsigned int)held,
+		   num_pending);
+
+	xconn->smb2.credits.adaptive.window = window;
+}
+
+static void smbd_smb2_credits_update(struct smbd_smb2_request *req)
+{
+	struct smbXsrv_connection *xconn = req->xconn;
+	uint64_t target_usecs = lp_smb2_credits_target_latency() * 1000ULL;
+	struct timeval now;
+	uint64_t now_usecs;
+	int64_t latency_usecs;
+	bool waited_for_others = req->waited_for_others;
+
+	/* The flag is per element of a compound chain */
+	req->waited_for_others = false;
+
+	if (target_usecs == 0) {
+		xconn->smb2.credits.adaptive.window = 0;
+		return;
+	}
+
+	/*
+	 * Only sample requests that we answered without waiting
+	 * for someone else: a change notify, a blocked lock or an
+	 * open waiting for a break can take arbitrarily long
+	 * without the server being slow. The same goes for
+	 * anything that got an interim response.
+	 */
+	if (waited_for_others) {
+		return;
+	}
+	if (IVAL(SMBD_SMB2_OUT_HDR_PTR(req), SMB2_HDR_FLAGS) &
+	    SMB2_HDR_FLAG_ASYNC)
+	{
+		return;
+	}
+	if (SVAL(SMBD_SMB2_IN_HDR_PTR(req), SMB2_HDR_OPCODE) ==
+	    SMB2_OP_NOTIFY)
+	{
+		return;
+	}
+
+	now = timeval_current();
+	now_usecs = (uint64_t)now.tv_sec * 1000000 + now.tv_usec;
+	latency_usecs = usec_time_diff(&now, &req->request_time);
+	latency_usecs = MAX(latency_usecs, 1);
+
+	/*
+	 * An exponential moving average over
+	 * the last 8 or so requests.
+	 */
+	if (xconn->smb2.credits.adaptive.latency_usecs == 0) {
+		xconn->smb2.credits.adaptive.latency_usecs = latency_usecs;
+	} else {
+		xconn->smb2.credits.adaptive.latency_usecs =
+			(xconn->smb2.credits.adaptive.latency_usecs * 7 +
+			 latency_usecs) / 8;
+	}
+
+	if (xconn->smb2.credits.adaptive.window == 0) {
+		/*
+		 * Start with all credits,
+		 * the window only shrinks under load.
+		 */
+		xconn->smb2.credits.adaptive.window = xconn->smb2.credits.max;
+		xconn->smb2.credits.adaptive.next_adjust_usecs =
+			now_usecs + SMBD_SMB2_CREDITS_ADJUST_USECS;
+		return;
+	}
+
+	if (now_usecs < xconn->smb2.credits.adaptive.next_adjust_usecs) {
+		return;
+	}
+	xconn->smb2.credits.adaptive.next_adjust_usecs =
+		now_usecs + SMBD_SMB2_CREDITS_ADJUST_USECS;
+
+	smbd_smb2_credits_adjust_window(xconn, target_usecs);
+}
+
 static NTSTATUS smbXsrv_connection_get_acked_bytes(struct smbXsrv_connection *xconn,
 						   uint64_t *_acked_bytes)
 {
@@ -1567,6 +2227,7 @@ void smbXsrv_connection_disconnect_transport(struct smbXsrv_connection *xconn,
 	}
 
 	xconn->transport.status = status;
+	smbd_smb2_uring_stop(xconn);
 	TALLOC_FREE(xconn->transport.fde);
 	if (xconn->transport.sock != -1) {
 		xconn->transport.sock = -1;
@@ -1923,6 +2584,67 @@ static bool dup_smb2_vec4(TALLOC_CTX *ctx,
 	return true;
 }
 
+static NTSTATUS smbd_smb2_sign_pdu(struct smb2_signing_key *signing_key,
+				   struct iovec *hdr_iov)
+{
+	NTSTATUS status;
+	START_PROFILE_BYTES(smb2_sign,
+			    iov_buflen(hdr_iov,
+				       SMBD_SMB2_NUM_IOV_PER_REQ - 1));
+
+	status = smb2_signing_sign_pdu(signing_key,
+				       hdr_iov,
+				       SMBD_SMB2_NUM_IOV_PER_REQ - 1);
+
+	END_PROFILE_BYTES(smb2_sign);
+	return status;
+}
+
+static NTSTATUS smbd_smb2_check_pdu(struct smb2_signing_key *signing_key,
+				    const struct iovec *hdr_iov)
+{
+	NTSTATUS status;
+	START_PROFILE_BYTES(smb2_sign_check,
+			    iov_buflen(hdr_iov,
+				       SMBD_SMB2_NUM_IOV_PER_REQ - 1));
+
+	status = smb2_signing_check_pdu(signing_key,
+					hdr_iov,
+					SMBD_SMB2_NUM_IOV_PER_REQ - 1);
+
+	END_PROFILE_BYTES(smb2_sign_check);
+	return status;
+}
+
+/*
+ * The responses of a compound chain can only be signed once
+ * their headers don't change anymore. As long as the chain
+ * uses the same signing key we defer that and sign them
+ * in one go, with a single initialized copy of the key.
+ */
+static NTSTATUS smbd_smb2_sign_deferred(struct smbd_smb2_request *outreq,
+					struct smb2_signing_key *signing_key,
+					int first_idx,
+					int end_idx)
+{
+	int idx;
+
+	for (idx = first_idx;
+	     idx < end_idx;
+	     idx += SMBD_SMB2_NUM_IOV_PER_REQ)
+	{
+		struct iovec *hdr_iov = SMBD_SMB2_IDX_HDR_IOV(outreq,out,idx);
+		NTSTATUS status;
+
+		status = smbd_smb2_sign_pdu(signing_key, hdr_iov);
+		if (!NT_STATUS_IS_OK(status)) {
+			return status;
+		}
+	}
+
+	return NT_STATUS_OK;
+}
+
 static struct smbd_smb2_request *dup_smb2_req(const struct smbd_smb2_request *req)
 {
 	struct smbd_smb2_request *newreq = NULL;
@@ -1982,7 +2704,6 @@ static NTSTATUS smb2_send_async_interim_response(const struct smbd_smb2_request
 	struct smbXsrv_connection *xconn = req->xconn;
 	int first_idx = 1;
 	struct iovec *firsttf = NULL;
-	struct iovec *outhdr_v = NULL;
 	uint8_t *outhdr = NULL;
 	struct smbd_smb2_request *nreq = NULL;
 	NTSTATUS status;
@@ -2008,7 +2729,6 @@ static NTSTATUS smb2_send_async_interim_response(const struct smbd_smb2_request
 	/* Step back to the previous reply. */
 	nreq->current_idx -= SMBD_SMB2_NUM_IOV_PER_REQ;
 	firsttf = SMBD_SMB2_IDX_TF_IOV(nreq,out,first_idx);
-	outhdr_v = SMBD_SMB2_OUT_HDR_IOV(nreq);
 	outhdr = SMBD_SMB2_OUT_HDR_PTR(nreq);
 	/* And end the chain. */
 	SIVAL(outhdr, SMB2_HDR_NEXT_COMMAND, 0);
@@ -2036,9 +2756,11 @@ static NTSTATUS smb2_send_async_interim_response(const struct smbd_smb2_request
 			return status;
 		}
 	} else if (smb2_signing_key_valid(req->last_sign_key)) {
-		status = smb2_signing_sign_pdu(req->last_sign_key,
-					       outhdr_v,
-					       SMBD_SMB2_NUM_IOV_PER_REQ - 1);
+		status = smbd_smb2_sign_deferred(nreq,
+						 req->last_sign_key,
+						 req->first_unsigned_idx,
+						 nreq->current_idx +
+						 SMBD_SMB2_NUM_IOV_PER_REQ);
 		if (!NT_STATUS_IS_OK(status)) {
 			return status;
 		}
@@ -2092,6 +2814,14 @@ NTSTATUS smbd_smb2_request_pending_queue(struct smbd_smb2_request *req,
 	req->subreq = subreq;
 	subreq = NULL;
 
+	if (req->waited_for_others) {
+		/*
+		 * A deferred open or a blocked lock, don't hold a
+		 * slot of "smb2 fair queue depth" while waiting.
+		 */
+		smbd_smb2_fairq_release(req);
+	}
+
 	if (req->async_te) {
 		/* We're already async. */
 		return NT_STATUS_OK;
@@ -2191,6 +2921,7 @@ NTSTATUS smbd_smb2_request_pending_queue(struct smbd_smb2_request *req,
 		}
 	}
 	TALLOC_FREE(req->last_sign_key);
+	req->first_unsigned_idx = 0;
 
 	/*
 	 * smbd_smb2_request_pending_timer() just send a packet
@@ -2308,6 +3039,12 @@ static void smbd_smb2_request_pending_timer(struct tevent_context *ev,
 	SIVAL(outhdr, SMB2_HDR_FLAGS, flags | SMB2_HDR_FLAG_ASYNC);
 	SBVAL(outhdr, SMB2_HDR_ASYNC_ID, async_id);
 
+	/*
+	 * The client knows it has to wait,
+	 * let the other requests run.
+	 */
+	smbd_smb2_fairq_release(req);
+
 	DEBUG(10,("smbd_smb2_request_pending_queue: opcode[%s] mid %llu "
 		"going async\n",
 		smb2_opcode_name(SVAL(inhdr, SMB2_HDR_OPCODE)),
@@ -3218,9 +3955,8 @@ NTSTATUS smbd_smb2_request_dispatch(struct smbd_smb2_request *req)
 			req->do_signing = true;
 		}
 
-		status = smb2_signing_check_pdu(signing_key,
-						SMBD_SMB2_IN_HDR_IOV(req),
-						SMBD_SMB2_NUM_IOV_PER_REQ - 1);
+		status = smbd_smb2_check_pdu(signing_key,
+					     SMBD_SMB2_IN_HDR_IOV(req));
 		if (NT_STATUS_EQUAL(status, NT_STATUS_ACCESS_DENIED) &&
 		    opcode == SMB2_OP_SESSSETUP && !has_channel &&
 		    NT_STATUS_IS_OK(session_status))
@@ -3634,6 +4370,135 @@ static void smbd_smb2_request_reply_update_counts(struct smbd_smb2_request *req)
 	}
 }
 
+static NTSTATUS smbd_smb2_request_compress(struct smbd_smb2_request *req,
+					   int first_idx)
+{
+	struct smbXsrv_connection *xconn = req->xconn;
+	struct smb2_compression_capabilities *c =
+		&xconn->smb2.server.compression;
+	struct iovec *vector = SMBD_SMB2_IDX_HDR_IOV(req,out,first_idx);
+	int count = req->out.vector_count - first_idx - SMBD_SMB2_HDR_IOV_OFS;
+	const struct iovec *largest = NULL;
+	DATA_BLOB blob = data_blob_null;
+	ssize_t len;
+	size_t offset;
+	NTSTATUS status;
+	int i;
+	bool ok;
+
+	len = iov_buflen(vector, count);
+	if (len == -1) {
+		return NT_STATUS_INVALID_PARAMETER_MIX;
+	}
+	if (len < lp_smb_compression_min_size()) {
+		return NT_STATUS_OK;
+	}
+
+	/*
+	 * Only look at the biggest dynamic part (typically
+	 * the READ data), it dominates the result.
+	 */
+	for (i = first_idx; i < req->out.vector_count;
+	     i += SMBD_SMB2_NUM_IOV_PER_REQ)
+	{
+		const struct iovec *dyn = SMBD_SMB2_IDX_DYN_IOV(req,out,i);
+
+		if ((largest == NULL) || (dyn->iov_len > largest->iov_len)) {
+			largest = dyn;
+		}
+	}
+	if ((largest == NULL) ||
+	    (largest->iov_base == NULL) ||
+	    !smb2_compression_is_compressible(largest->iov_base,
+					      largest->iov_len))
+	{
+		return NT_STATUS_OK;
+	}
+
+	if ((xconn->smb2.compression_mem == NULL) &&
+	    (smb2_compression_capabilities_select(c) ==
+	     SMB2_COMPRESSION_LZ77_HUFFMAN))
+	{
+		xconn->smb2.compression_mem = talloc(
+			xconn, struct lzxhuff_compressor_mem);
+		if (xconn->smb2.compression_mem == NULL) {
+			return NT_STATUS_NO_MEMORY;
+		}
+	}
+
+	/*
+	 * The SMB2 header and the fixed body of the first
+	 * response go out uncompressed.
+	 */
+	offset = vector[0].iov_len + vector[1].iov_len;
+
+	status = smb2_compression_compress_pdu(req,
+					       c,
+					       xconn->smb2.compression_mem,
+					       vector,
+					       count,
+					       offset,
+					       &blob);
+	if (!NT_STATUS_IS_OK(status)) {
+		return status;
+	}
+	if (blob.length == 0) {
+		/* Not worth it, send it as is */
+		return NT_STATUS_OK;
+	}
+
+	DBG_DEBUG("compressed %zd bytes to %zu bytes\n", len, blob.length);
+
+	/*
+	 * Replace the whole chain by the compressed blob,
+	 * keeping the layout of one SMB2 request.
+	 */
+	vector[0] = (struct iovec) {
+		.iov_base = blob.data,
+		.iov_len = blob.length,
+	};
+	vector[1] = (struct iovec) { .iov_len = 0, };
+	vector[2] = (struct iovec) { .iov_len = 0, };
+	req->out.vector_count = first_idx + SMBD_SMB2_NUM_IOV_PER_REQ;
+
+	ok = smb2_setup_nbt_length(req->out.vector, req->out.vector_count);
+	if (!ok) {
+		return NT_STATUS_INVALID_PARAMETER_MIX;
+	}
+
+	return NT_STATUS_OK;
+}
+
+static void smbd_smb2_request_crypt_done(struct tevent_req *subreq)
+{
+	struct smbd_smb2_request *req =
+		tevent_req_callback_data(subreq,
+		struct smbd_smb2_request);
+	struct smbXsrv_connection *xconn = req->xconn;
+	NTSTATUS status = NT_STATUS_INTERNAL_ERROR;
+	bool ok;
+
+	ok = smbd_smb2_crypt_job_finish(req, &status);
+	if (!ok) {
+		/*
+		 * The send queue was already cleared,
+		 * xconn might be gone.
+		 */
+		return;
+	}
+	req->queue_entry.crypt_pending = false;
+	if (!NT_STATUS_IS_OK(status)) {
+		smbd_server_connection_terminate(xconn, nt_errstr(status));
+		return;
+	}
+
+	status = smbd_smb2_flush_send_queue(xconn);
+	if (!NT_STATUS_IS_OK(status)) {
+		smbd_server_connection_terminate(xconn, nt_errstr(status));
+		return;
+	}
+}
+
 static NTSTATUS smbd_smb2_request_reply(struct smbd_smb2_request *req)
 {
 	struct smbXsrv_connection *xconn = req->xconn;
@@ -3703,26 +4568,31 @@ static NTSTATUS smbd_smb2_request_reply(struct smbd_smb2_request *req)
 		firsttf->iov_len = SMB2_TF_HDR_SIZE;
 	}
 
-	if ((req->current_idx > SMBD_SMB2_NUM_IOV_PER_REQ) &&
-	    (smb2_signing_key_valid(req->last_sign_key)) &&
-	    (firsttf->iov_len == 0))
+	if ((req->first_unsigned_idx != 0) &&
+	    (!req->do_signing ||
+	     (req->current_idx >= req->out.vector_count -
+				  SMBD_SMB2_NUM_IOV_PER_REQ) ||
+	     !smb2_signing_key_equal(req->last_sign_key,
+				     smbd_smb2_signing_key(req->session,
+							   xconn,
+							   NULL))))
 	{
-		int last_idx = req->current_idx - SMBD_SMB2_NUM_IOV_PER_REQ;
-		struct iovec *lasthdr = SMBD_SMB2_IDX_HDR_IOV(req,out,last_idx);
-
 		/*
-		 * As we are sure the header of the last request in the
-		 * compound chain will not change, we can to sign here
-		 * with the last signing key we remembered.
+		 * As we are sure the headers of the previous
+		 * requests in the compound chain will not change,
+		 * we can sign them here with the last signing key
+		 * we remembered.
 		 */
-		status = smb2_signing_sign_pdu(req->last_sign_key,
-					       lasthdr,
-					       SMBD_SMB2_NUM_IOV_PER_REQ - 1);
+		status = smbd_smb2_sign_deferred(req,
+						 req->last_sign_key,
+						 req->first_unsigned_idx,
+						 req->current_idx);
 		if (!NT_STATUS_IS_OK(status)) {
 			return status;
 		}
+		TALLOC_FREE(req->last_sign_key);
+		req->first_unsigned_idx = 0;
 	}
-	TALLOC_FREE(req->last_sign_key);
 
 	SMBPROFILE_IOBYTES_ASYNC_END(req->profile,
 		iov_buflen(outhdr, SMBD_SMB2_NUM_IOV_PER_REQ-1));
@@ -3754,11 +4624,16 @@ static NTSTATUS smbd_smb2_request_reply(struct smbd_smb2_request *req)
 			 * we are sure that we do not change
 			 * the header again.
 			 */
-			status = smb2_signing_key_copy(req,
-						       signing_key,
-						       &req->last_sign_key);
-			if (!NT_STATUS_IS_OK(status)) {
-				return status;
+			if (req->last_sign_key == NULL) {
+				status = smb2_signing_key_copy(
+						req,
+						signing_key,
+						&req->last_sign_key);
+				if (!NT_STATUS_IS_OK(status)) {
+					return status;
+				}
+				req->first_unsigned_idx = req->current_idx -
+					SMBD_SMB2_NUM_IOV_PER_REQ;
 			}
 		}
 
@@ -3783,6 +4658,8 @@ static NTSTATUS smbd_smb2_request_reply(struct smbd_smb2_request *req)
 		return NT_STATUS_INVALID_PARAMETER_MIX;
 	}
 
+	smbd_smb2_credits_update(req);
+
 	/* Set credit for these operations (zero credits if this
 	   is a final reply for an async operation). */
 	smb2_calculate_credits(req, req);
@@ -3790,25 +4667,96 @@ static NTSTATUS smbd_smb2_request_reply(struct smbd_smb2_request *req)
 	/*
 	 * now check if we need to sign the current response
 	 */
-	if (firsttf->iov_len == SMB2_TF_HDR_SIZE) {
-		status = smb2_signing_encrypt_pdu(req->first_enc_key,
-					firsttf,
-					req->out.vector_count - first_idx);
-		if (!NT_STATUS_IS_OK(status)) {
-			return status;
-		}
-	} else if (req->do_signing) {
+	if ((firsttf->iov_len != SMB2_TF_HDR_SIZE) && req->do_signing) {
 		struct smbXsrv_session *x = req->session;
 		struct smb2_signing_key *signing_key =
 			smbd_smb2_signing_key(x, xconn, NULL);
+		int count = SMBD_SMB2_NUM_IOV_PER_REQ - 1;
+		size_t len = iov_buflen(outhdr, count);
+
+		if (!req->do_compression &&
+		    (req->preauth == NULL) &&
+		    smbd_smb2_crypt_job_possible(xconn,
+						 SMBD_SMB2_CRYPT_JOB_SIGN,
+						 signing_key,
+						 len))
+		{
+			struct smb2_signing_key *key = NULL;
+
+			status = smb2_signing_key_copy(req, signing_key, &key);
+			if (!NT_STATUS_IS_OK(status)) {
+				return status;
+			}
+
+			/*
+			 * Like the encryption below, the response
+			 * is only sent once the job is done.
+			 */
+			status = smbd_smb2_crypt_job_start(
+					req,
+					SMBD_SMB2_CRYPT_JOB_SIGN,
+					&key,
+					outhdr,
+					count,
+					smbd_smb2_request_crypt_done);
+			if (!NT_STATUS_IS_OK(status)) {
+				return status;
+			}
+			req->queue_entry.crypt_pending = true;
+		} else {
+			status = smbd_smb2_sign_pdu(signing_key, outhdr);
+			if (!NT_STATUS_IS_OK(status)) {
+				return status;
+			}
+		}
+	}
 
-		status = smb2_signing_sign_pdu(signing_key,
-					       outhdr,
-					       SMBD_SMB2_NUM_IOV_PER_REQ - 1);
+	/*
+	 * MS-SMB2: 3.1.4.4 Compressing the Message,
+	 * this happens after signing and before encryption.
+	 */
+	if (req->do_compression) {
+		status = smbd_smb2_request_compress(req, first_idx);
 		if (!NT_STATUS_IS_OK(status)) {
 			return status;
 		}
 	}
+
+	if (firsttf->iov_len == SMB2_TF_HDR_SIZE) {
+		int count = req->out.vector_count - first_idx;
+		size_t len = iov_buflen(firsttf, count);
+
+		if ((req->preauth == NULL) &&
+		    smbd_smb2_crypt_job_possible(xconn,
+						 SMBD_SMB2_CRYPT_JOB_ENCRYPT,
+						 req->first_enc_key,
+						 len))
+		{
+			/*
+			 * The response is queued below, but it's
+			 * only sent once the job is done, see
+			 * smbd_smb2_request_crypt_done().
+			 */
+			status = smbd_smb2_crypt_job_start(
+					req,
+					SMBD_SMB2_CRYPT_JOB_ENCRYPT,
+					&req->first_enc_key,
+					firsttf,
+					count,
+					smbd_smb2_request_crypt_done);
+			if (!NT_STATUS_IS_OK(status)) {
+				return status;
+			}
+			req->queue_entry.crypt_pending = true;
+		} else {
+			status = smb2_signing_encrypt_pdu(req->first_enc_key,
+							  firsttf,
+							  count);
+			if (!NT_STATUS_IS_OK(status)) {
+				return status;
+			}
+		}
+	}
 	TALLOC_FREE(req->first_enc_key);
 
 	if (req->preauth != NULL) {
@@ -3873,6 +4821,7 @@ static NTSTATUS smbd_smb2_request_reply(struct smbd_smb2_request *req)
 	 * move it off the "being processed" queue.
 	 */
 	DLIST_REMOVE(xconn->smb2.requests, req);
+	smbd_smb2_fairq_release(req);
 
 	req->queue_entry.mem_ctx = req;
 	req->queue_entry.vector = req->out.vector;
@@ -4570,6 +5519,19 @@ static bool is_smb2_recvfile_write(struct smbd_smb2_request_read_state *state)
 	return true;
 }
 
+static size_t smbd_smb2_min_recv_size(struct smbXsrv_connection *xconn)
+{
+	if (smbd_smb2_uring_active(xconn)) {
+		/*
+		 * The io_uring transport reads into its own
+		 * buffers, so there's no receivefile.
+		 */
+		return 0;
+	}
+
+	return lp_min_receive_file_size();
+}
+
 static NTSTATUS smbd_smb2_request_next_incoming(struct smbXsrv_connection *xconn)
 {
 	struct smbd_smb2_request_read_state *state = &xconn->smb2.request_read_state;
@@ -4604,6 +5566,16 @@ static NTSTATUS smbd_smb2_request_next_incoming(struct smbXsrv_connection *xconn
 		return NT_STATUS_OK;
 	}
 
+	if (xconn->smb2.got_authenticated_session) {
+		/*
+		 * Once there's an authenticated session the
+		 * connection can't be passed to another process
+		 * anymore, so it's safe to switch to io_uring
+		 * (if configured).
+		 */
+		smbd_smb2_uring_start(xconn);
+	}
+
 	/* ask for the next request */
 	req = smbd_smb2_request_allocate(xconn);
 	if (req == NULL) {
@@ -4611,7 +5583,7 @@ static NTSTATUS smbd_smb2_request_next_incoming(struct smbXsrv_connection *xconn
 	}
 	*state = (struct smbd_smb2_request_read_state) {
 		.req = req,
-		.min_recv_size = lp_min_receive_file_size(),
+		.min_recv_size = smbd_smb2_min_recv_size(xconn),
 		._vector = {
 			[0] = (struct iovec) {
 				.iov_base = (void *)state->hdr.nbt,
@@ -4622,6 +5594,11 @@ static NTSTATUS smbd_smb2_request_next_incoming(struct smbXsrv_connection *xconn
 		.count = 1,
 	};
 
+	if (smbd_smb2_uring_active(xconn)) {
+		smbd_smb2_uring_resume_read(xconn);
+		return NT_STATUS_OK;
+	}
+
 	TEVENT_FD_READABLE(xconn->transport.fde);
 
 	return NT_STATUS_OK;
@@ -4755,9 +5732,9 @@ static int socket_error_from_errno(int ret,
 	return sys_errno;
 }
 
-static NTSTATUS smbd_smb2_advance_send_queue(struct smbXsrv_connection *xconn,
-					     struct smbd_smb2_send_queue **_e,
-					     size_t n)
+NTSTATUS smbd_smb2_advance_send_queue(struct smbXsrv_connection *xconn,
+				      struct smbd_smb2_send_queue **_e,
+				      size_t n)
 {
 	struct smbd_smb2_send_queue *e = *_e;
 	bool ok;
@@ -4812,10 +5789,29 @@ static NTSTATUS smbd_smb2_flush_with_sendmsg(struct smbXsrv_connection *xconn)
 			xconn->smb2.send_queue_len--;
 			DLIST_REMOVE(xconn->smb2.send_queue, e);
 
+			if (e->crypt_pending) {
+				struct smbd_smb2_request *req =
+					talloc_get_type_abort(
+						e->mem_ctx,
+						struct smbd_smb2_request);
+
+				smbd_smb2_crypt_job_orphan(req->crypt_job);
+				continue;
+			}
+
 			talloc_free(e->mem_ctx);
 			continue;
 		}
 
+		if (e->crypt_pending) {
+			/*
+			 * smbd_smb2_request_crypt_done()
+			 * will flush again.
+			 */
+			TEVENT_FD_NOT_WRITEABLE(xconn->transport.fde);
+			return NT_STATUS_OK;
+		}
+
 		if (e->sendfile_header != NULL) {
 			size_t size = 0;
 			size_t i = 0;
@@ -4915,11 +5911,26 @@ static NTSTATUS smbd_smb2_flush_with_sendmsg(struct smbXsrv_connection *xconn)
 	return NT_STATUS_MORE_PROCESSING_REQUIRED;
 }
 
-static NTSTATUS smbd_smb2_flush_send_queue(struct smbXsrv_connection *xconn)
+NTSTATUS smbd_smb2_flush_send_queue(struct smbXsrv_connection *xconn)
 {
+	struct smbd_smb2_send_queue *e = xconn->smb2.send_queue;
 	NTSTATUS status;
 
-	status = smbd_smb2_flush_with_sendmsg(xconn);
+	if (smbd_smb2_uring_active(xconn) &&
+	    (e == NULL || e->sendfile_header == NULL))
+	{
+		/*
+		 * A sendfile entry at the head of the queue
+		 * is sent synchronously by the sendmsg code.
+		 * As the io_uring transport only sends
+		 * from the head of the queue, the order
+		 * on the wire is kept.
+		 */
+		TEVENT_FD_NOT_WRITEABLE(xconn->transport.fde);
+		status = smbd_smb2_uring_flush(xconn);
+	} else {
+		status = smbd_smb2_flush_with_sendmsg(xconn);
+	}
 	if (!NT_STATUS_EQUAL(status, NT_STATUS_MORE_PROCESSING_REQUIRED)) {
 		return status;
 	}
@@ -4937,14 +5948,214 @@ static NTSTATUS smbd_smb2_flush_send_queue(struct smbXsrv_connection *xconn)
 	return NT_STATUS_OK;
 }
 
-static NTSTATUS smbd_smb2_advance_incoming(struct smbXsrv_connection *xconn, size_t n)
+static NTSTATUS smbd_smb2_request_process_full(struct smbXsrv_connection *xconn)
 {
 	struct smbd_server_connection *sconn = xconn->client->sconn;
+	struct smbd_smb2_request_read_state *state = &xconn->smb2.request_read_state;
+	struct smbd_smb2_request *req = state->req;
+	NTTIME now = timeval_to_nttime(&req->request_time);
+	NTSTATUS status;
+
+	status = smbd_smb2_inbuf_parse_compound(xconn,
+						now,
+						state->pktbuf,
+						state->pktlen,
+						req,
+						&req->in.vector,
+						&req->in.vector_count);
+	if (!NT_STATUS_IS_OK(status)) {
+		return status;
+	}
+
+	if (state->doing_receivefile) {
+		req->smb1req = talloc_zero(req, struct smb_request);
+		if (req->smb1req == NULL) {
+			return NT_STATUS_NO_MEMORY;
+		}
+		req->smb1req->unread_bytes = state->pktfull - state->pktlen;
+	}
+
+	*state = (struct smbd_smb2_request_read_state) {
+		.req = NULL,
+	};
+
+	req->current_idx = 1;
+
+	DEBUG(10,("smbd_smb2_request idx[%d] of %d vectors\n",
+		 req->current_idx, req->in.vector_count));
+
+	status = smbd_smb2_request_validate(req);
+	if (!NT_STATUS_IS_OK(status)) {
+		return status;
+	}
+
+	status = smbd_smb2_request_setup_out(req);
+	if (!NT_STATUS_IS_OK(status)) {
+		return status;
+	}
+
+	status = smbd_smb2_fairq_dispatch(req);
+	if (!NT_STATUS_IS_OK(status)) {
+		return status;
+	}
+
+	sconn->num_requests++;
+
+	/* The timeout_processing function isn't run nearly
+	   often enough to implement 'max log size' without
+	   overrunning the size of the file by many megabytes.
+	   This is especially true if we are running at debug
+	   level 10.  Checking every 50 SMB2s is a nice
+	   tradeoff of performance vs log file size overrun. */
+
+	if ((sconn->num_requests % 50) == 0 &&
+	    need_to_check_log_size()) {
+		change_to_root_user();
+		check_log_size();
+	}
+
+	status = smbd_smb2_request_next_incoming(xconn);
+	if (!NT_STATUS_IS_OK(status)) {
+		return status;
+	}
+
+	return NT_STATUS_OK;
+}
+
+static void smbd_smb2_request_decrypt_done(struct tevent_req *subreq)
+{
+	struct smbd_smb2_request *req =
+		tevent_req_callback_data(subreq,
+		struct smbd_smb2_request);
+	struct smbXsrv_connection *xconn = req->xconn;
+	NTSTATUS status = NT_STATUS_INTERNAL_ERROR;
+	bool ok;
+
+	ok = smbd_smb2_crypt_job_finish(req, &status);
+	if (!ok) {
+		/* xconn is gone */
+		return;
+	}
+	xconn->smb2.request_read_state.decrypt_pending = false;
+
+	if (!NT_STATUS_IS_OK(xconn->transport.status)) {
+		/*
+		 * we're not supposed to do any io
+		 */
+		return;
+	}
+
+	if (!NT_STATUS_IS_OK(status)) {
+		smbd_server_connection_terminate(xconn, nt_errstr(status));
+		return;
+	}
+	req->tf_decrypted = true;
+
+	status = smbd_smb2_request_process_full(xconn);
+	if (!NT_STATUS_IS_OK(status)) {
+		smbd_server_connection_terminate(xconn, nt_errstr(status));
+		return;
+	}
+}
+
+/*
+ * A large message with a single SMB2_TRANSFORM header,
+ * typically a WRITE request, is decrypted in the thread pool.
+ * We don't read the next request before it's done, so
+ * the requests are still processed in order.
+ */
+static NTSTATUS smbd_smb2_request_decrypt_job(struct smbXsrv_connection *xconn,
+					      NTTIME now,
+					      bool *_started)
+{
+	struct smbd_smb2_request_read_state *state = &xconn->smb2.request_read_state;
+	struct smbd_smb2_request *req = state->req;
+	struct smbXsrv_session *session = NULL;
+	struct smb2_signing_key *key = NULL;
+	struct iovec tf_iov[2];
+	uint32_t enc_len;
+	uint64_t uid;
+	NTSTATUS status;
+
+	*_started = false;
+
+	if (state->doing_receivefile) {
+		return NT_STATUS_OK;
+	}
+	if (state->pktlen < SMB2_TF_HDR_SIZE) {
+		return NT_STATUS_OK;
+	}
+	if (IVAL(state->pktbuf, 0) != SMB2_TF_MAGIC) {
+		return NT_STATUS_OK;
+	}
+
+	enc_len = IVAL(state->pktbuf, SMB2_TF_MSG_SIZE);
+	if (state->pktlen != SMB2_TF_HDR_SIZE + (size_t)enc_len) {
+		/*
+		 * Several transform headers in one
+		 * message or an invalid length,
+		 * smbd_smb2_inbuf_parse_compound() deals with it.
+		 */
+		return NT_STATUS_OK;
+	}
+
+	uid = BVAL(state->pktbuf, SMB2_TF_SESSION_ID);
+	status = smb2srv_session_lookup_conn(xconn, uid, now, &session);
+	if (!NT_STATUS_IS_OK(status)) {
+		return NT_STATUS_OK;
+	}
+
+	if (!smbd_smb2_crypt_job_possible(xconn,
+					  SMBD_SMB2_CRYPT_JOB_DECRYPT,
+					  session->global->decryption_key,
+					  enc_len))
+	{
+		return NT_STATUS_OK;
+	}
+
+	status = smb2_signing_key_copy(req,
+				       session->global->decryption_key,
+				       &key);
+	if (!NT_STATUS_IS_OK(status)) {
+		return status;
+	}
+
+	tf_iov[0] = (struct iovec) {
+		.iov_base = (void *)state->pktbuf,
+		.iov_len = SMB2_TF_HDR_SIZE,
+	};
+	tf_iov[1] = (struct iovec) {
+		.iov_base = (void *)(state->pktbuf + SMB2_TF_HDR_SIZE),
+		.iov_len = enc_len,
+	};
+
+	status = smbd_smb2_crypt_job_start(req,
+					   SMBD_SMB2_CRYPT_JOB_DECRYPT,
+					   &key,
+					   tf_iov,
+					   ARRAY_SIZE(tf_iov),
+					   smbd_smb2_request_decrypt_done);
+	if (!NT_STATUS_IS_OK(status)) {
+		return status;
+	}
+
+	state->decrypt_pending = true;
+	if (!smbd_smb2_uring_active(xconn)) {
+		TEVENT_FD_NOT_READABLE(xconn->transport.fde);
+	}
+
+	*_started = true;
+	return NT_STATUS_OK;
+}
+
+NTSTATUS smbd_smb2_advance_incoming(struct smbXsrv_connection *xconn, size_t n)
+{
 	struct smbd_smb2_request_read_state *state = &xconn->smb2.request_read_state;
 	struct smbd_smb2_request *req = NULL;
 	size_t min_recvfile_size = UINT32_MAX;
 	NTSTATUS status;
 	NTTIME now;
+	bool started = false;
 	bool ok;
 
 	ok = iov_advance(&state->vector, &state->count, n);
@@ -5053,7 +6264,7 @@ got_full:
 		req = state->req;
 		*state = (struct smbd_smb2_request_read_state) {
 			.req = req,
-			.min_recv_size = lp_min_receive_file_size(),
+			.min_recv_size = smbd_smb2_min_recv_size(xconn),
 			._vector = {
 				[0] = (struct iovec) {
 					.iov_base = (void *)state->hdr.nbt,
@@ -5071,70 +6282,18 @@ got_full:
 	req->request_time = timeval_current();
 	now = timeval_to_nttime(&req->request_time);
 
-	status = smbd_smb2_inbuf_parse_compound(xconn,
-						now,
-						state->pktbuf,
-						state->pktlen,
-						req,
-						&req->in.vector,
-						&req->in.vector_count);
-	if (!NT_STATUS_IS_OK(status)) {
-		return status;
-	}
-
-	if (state->doing_receivefile) {
-		req->smb1req = talloc_zero(req, struct smb_request);
-		if (req->smb1req == NULL) {
-			return NT_STATUS_NO_MEMORY;
-		}
-		req->smb1req->unread_bytes = state->pktfull - state->pktlen;
-	}
-
-	*state = (struct smbd_smb2_request_read_state) {
-		.req = NULL,
-	};
-
-	req->current_idx = 1;
-
-	DEBUG(10,("smbd_smb2_request idx[%d] of %d vectors\n",
-		 req->current_idx, req->in.vector_count));
-
-	status = smbd_smb2_request_validate(req);
-	if (!NT_STATUS_IS_OK(status)) {
-		return status;
-	}
-
-	status = smbd_smb2_request_setup_out(req);
-	if (!NT_STATUS_IS_OK(status)) {
-		return status;
-	}
-
-	status = smbd_smb2_request_dispatch(req);
+	status = smbd_smb2_request_decrypt_job(xconn, now, &started);
 	if (!NT_STATUS_IS_OK(status)) {
 		return status;
 	}
-
-	sconn->num_requests++;
-
-	/* The timeout_processing function isn't run nearly
-	   often enough to implement 'max log size' without
-	   overrunning the size of the file by many megabytes.
-	   This is especially true if we are running at debug
-	   level 10.  Checking every 50 SMB2s is a nice
-	   tradeoff of performance vs log file size overrun. */
-
-	if ((sconn->num_requests % 50) == 0 &&
-	    need_to_check_log_size()) {
-		change_to_root_user();
-		check_log_size();
-	}
-
-	status = smbd_smb2_request_next_incoming(xconn);
-	if (!NT_STATUS_IS_OK(status)) {
-		return status;
+	if (started) {
+		/*
+		 * smbd_smb2_request_decrypt_done() continues
+		 */
+		return NT_STATUS_OK;
 	}
 
-	return NT_STATUS_OK;
+	return smbd_smb2_request_process_full(xconn);
 }
 
 static NTSTATUS smbd_smb2_io_handler(struct smbXsrv_connection *xconn,
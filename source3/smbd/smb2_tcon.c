@@ -425,6 +425,13 @@ static NTSTATUS smbd_smb2_tree_connect(struct smbd_smb2_request *req,
 		*out_share_flags |= SMB2_SHAREFLAG_ENCRYPT_DATA;
 	}
 
+	if ((conn->smb2.server.compression.num_algos != 0) &&
+	    (*out_share_type == SMB2_SHARE_TYPE_DISK) &&
+	    (lp_smb_compression(SNUM(tcon->compat)) == SMB_COMPRESSION_YES))
+	{
+		*out_share_flags |= SMB2_SHAREFLAG_COMPRESS_DATA;
+	}
+
 	/*
 	 * For disk shares we can change the client
 	 * behavior on a cluster...
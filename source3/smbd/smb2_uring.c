@@ -0,0 +1,1016 @@
+/*
+ * Unix SMB/CIFS implementation.
+ *
+ * io_uring based socket io for SMB2 connections
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * With "smb2 io uring = yes" a connection with an authenticated
+ * session moves its socket io from recvmsg()/sendmsg() on the
+ * socket to an io_uring:
+ *
+ * - A single multishot recv with provided buffers delivers
+ *   the incoming stream. The chunks are copied into the
+ *   vectors of smbd_smb2_request_read_state and fed to
+ *   smbd_smb2_advance_incoming(), just as the data from
+ *   recvmsg() in smbd_smb2_io_handler().
+ *
+ * - The send queue is flushed with one IORING_OP_SENDMSG
+ *   covering as many queue entries as possible, only
+ *   one sendmsg is in flight at a time.
+ *
+ * - Large batches (typically READ responses) are sent with
+ *   IORING_OP_SENDMSG_ZC if the kernel supports it. The data
+ *   is not copied into the socket buffers, so the memory of
+ *   the sent queue entries is kept until the kernel notified
+ *   us that it's done with it. As signing and encryption
+ *   happen before a response is queued, this works for all
+ *   sessions. Sockets without zero copy support (e.g. unix
+ *   domain sockets) fail the send with EOPNOTSUPP, the
+ *   connection then falls back to IORING_OP_SENDMSG. The
+ *   same happens if the kernel keeps copying the data.
+ *
+ * - New submissions are collected and submitted from a
+ *   tevent immediate, so there's at most one io_uring_enter()
+ *   per event loop iteration, no matter how many requests
+ *   were processed.
+ *
+ * The socket fde of the connection stays for error
+ * detection and for sendfile, which still goes via
+ * the sendmsg path.
+ */
+
+#include "replace.h"
+
+#ifdef WITH_SMB2_URING
+/*
+ * See the comment in source3/modules/vfs_io_uring.c
+ */
+struct open_how;
+#ifdef HAVE_STRUCT_OPEN_HOW_LIBURING_COMPAT_H
+#define open_how __ignore_liburing_compat_h_open_how
+#include <liburing/compat.h>
+#undef open_how
+#endif /* HAVE_STRUCT_OPEN_HOW_LIBURING_COMPAT_H */
+#endif /* WITH_SMB2_URING */
+
+#include "includes.h"
+#include "smbd/smbd.h"
+#include "smbd/globals.h"
+#include "lib/util/iov_buf.h"
+
+#ifdef WITH_SMB2_URING
+
+#include <liburing.h>
+
+#undef DBGC_CLASS
+#define DBGC_CLASS DBGC_SMB2
+
+/*
+ * We only ever have one recv and one sendmsg in flight.
+ */
+#define SMBD_SMB2_URING_ENTRIES 4
+
+/*
+ * The number of provided receive buffers (must be a power of 2)
+ * and their size. This limits the data the kernel can hand
+ * over before we consumed it.
+ */
+#define SMBD_SMB2_URING_NUM_BUFS 32
+#define SMBD_SMB2_URING_BUF_SIZE (16 * 1024)
+#define SMBD_SMB2_URING_BGID 0
+
+/*
+ * The max number of iovecs for a sendmsg covering
+ * more than one send queue entry.
+ */
+#define SMBD_SMB2_URING_MAX_IOV 128
+
+/*
+ * Below this size copying the data is cheaper than
+ * pinning the pages and waiting for the notification.
+ */
+#define SMBD_SMB2_URING_ZC_MIN_SIZE (64 * 1024)
+
+/*
+ * If the kernel had to copy the data of that many zero
+ * copy sends in a row (e.g. on loopback), it won't get
+ * better, stop pinning pages for nothing.
+ */
+#define SMBD_SMB2_URING_ZC_MAX_COPIED 8
+
+/*
+ * The user_data of a submission is the operation in
+ * the low byte and for zero copy sends a sequence
+ * number in the upper bits.
+ */
+enum smbd_smb2_uring_op {
+	SMBD_SMB2_URING_OP_RECV = 1,
+	SMBD_SMB2_URING_OP_SEND = 2,
+};
+#define SMBD_SMB2_URING_OP(data) ((data) & 0xff)
+#define SMBD_SMB2_URING_SEQ(data) ((data) >> 8)
+
+/*
+ * A zero copy send waiting for its notification.
+ *
+ * Queue entries sent while zero copy sends are in flight
+ * are kept on the newest one, they might share pages with
+ * it (or an older one). They're freed once this and all
+ * older sends are notified.
+ */
+struct smbd_smb2_uring_zc {
+	struct smbd_smb2_uring_zc *prev, *next;
+	uint64_t seq;
+	bool notified;
+	struct smbd_smb2_send_queue *retired;
+};
+
+struct smbd_smb2_uring_chunk {
+	uint16_t bid;
+	uint32_t ofs;
+	uint32_t len;
+};
+
+struct smbd_smb2_uring {
+	struct smbXsrv_connection *xconn;
+	struct io_uring ring;
+	struct tevent_fd *fde;
+	struct tevent_immediate *im;
+	bool stopped;
+
+	struct io_uring_buf_ring *buf_ring;
+	uint8_t *bufs;
+	bool recv_armed;
+	NTSTATUS recv_status;
+
+	/*
+	 * Received data not yet consumed,
+	 * each chunk holds one provided buffer.
+	 */
+	struct smbd_smb2_uring_chunk chunks[SMBD_SMB2_URING_NUM_BUFS];
+	unsigned first_chunk;
+	unsigned num_chunks;
+
+	bool send_busy;
+	struct msghdr send_msg;
+	struct iovec *send_iov;
+	size_t num_send_iov;
+
+	bool zc_supported;
+	unsigned zc_copied;
+	uint64_t zc_seq;
+	struct smbd_smb2_uring_zc *zc_list;
+};
+
+static void smbd_smb2_uring_zc_free(struct smbd_smb2_uring *u,
+				    struct smbd_smb2_uring_zc *z)
+{
+	while (z->retired != NULL) {
+		struct smbd_smb2_send_queue *e = z->retired;
+
+		DLIST_REMOVE(z->retired, e);
+		talloc_free(e->mem_ctx);
+	}
+	DLIST_REMOVE(u->zc_list, z);
+	TALLOC_FREE(z);
+}
+
+static void smbd_smb2_uring_zc_notified(struct smbd_smb2_uring *u,
+					uint64_t seq)
+{
+	struct smbd_smb2_uring_zc *z = NULL;
+
+	for (z = u->zc_list; z != NULL; z = z->next) {
+		if (z->seq == seq) {
+			z->notified = true;
+			break;
+		}
+	}
+}
+
+#ifdef IORING_NOTIF_USAGE_ZC_COPIED
+static void smbd_smb2_uring_zc_usage(struct smbd_smb2_uring *u, int res)
+{
+	if (!(res & IORING_NOTIF_USAGE_ZC_COPIED)) {
+		u->zc_copied = 0;
+		return;
+	}
+
+	DO_PROFILE_INC(smb2_uring_send_zc_copied);
+
+	u->zc_copied += 1;
+	if (u->zc_supported &&
+	    u->zc_copied >= SMBD_SMB2_URING_ZC_MAX_COPIED)
+	{
+		DBG_NOTICE("kernel copied the last %u zero copy sends on "
+			   "socket %d, falling back to copying\n",
+			   u->zc_copied,
+			   u->xconn->transport.sock);
+		u->zc_supported = false;
+	}
+}
+#endif
+
+static void smbd_smb2_uring_zc_cleanup(struct smbd_smb2_uring *u)
+{
+	while (u->zc_list != NULL && u->zc_list->notified) {
+		smbd_smb2_uring_zc_free(u, u->zc_list);
+	}
+}
+
+static int smbd_smb2_uring_destructor(struct smbd_smb2_uring *u)
+{
+	if (!u->stopped) {
+		u->stopped = true;
+		TALLOC_FREE(u->fde);
+		io_uring_free_buf_ring(&u->ring,
+				       u->buf_ring,
+				       SMBD_SMB2_URING_NUM_BUFS,
+				       SMBD_SMB2_URING_BGID);
+		io_uring_queue_exit(&u->ring);
+	}
+	return 0;
+}
+
+static void smbd_smb2_uring_fde_handler(struct tevent_context *ev,
+					struct tevent_fd *fde,
+					uint16_t flags,
+					void *private_data);
+static void smbd_smb2_uring_immediate(struct tevent_context *ctx,
+				      struct tevent_immediate *im,
+				      void *private_data);
+
+static void smbd_smb2_uring_schedule_submit(struct smbd_smb2_uring *u)
+{
+	tevent_schedule_immediate(u->im,
+				  u->xconn->client->raw_ev_ctx,
+				  smbd_smb2_uring_immediate,
+				  u);
+}
+
+static struct io_uring_sqe *smbd_smb2_uring_get_sqe(struct smbd_smb2_uring *u)
+{
+	struct io_uring_sqe *sqe = NULL;
+
+	sqe = io_uring_get_sqe(&u->ring);
+	if (sqe == NULL) {
+		/*
+		 * Can't happen with SMBD_SMB2_URING_ENTRIES,
+		 * but submit and try again.
+		 */
+		io_uring_submit(&u->ring);
+		sqe = io_uring_get_sqe(&u->ring);
+	}
+	if (sqe != NULL) {
+		smbd_smb2_uring_schedule_submit(u);
+	}
+	return sqe;
+}
+
+static NTSTATUS smbd_smb2_uring_arm_recv(struct smbd_smb2_uring *u)
+{
+	struct io_uring_sqe *sqe = NULL;
+
+	sqe = smbd_smb2_uring_get_sqe(u);
+	if (sqe == NULL) {
+		return NT_STATUS_INTERNAL_ERROR;
+	}
+
+	io_uring_prep_recv_multishot(sqe, u->xconn->transport.sock, NULL, 0, 0);
+	sqe->flags |= IOSQE_BUFFER_SELECT;
+	sqe->buf_group = SMBD_SMB2_URING_BGID;
+	io_uring_sqe_set_data64(sqe, SMBD_SMB2_URING_OP_RECV);
+
+	u->recv_armed = true;
+	return NT_STATUS_OK;
+}
+
+static void smbd_smb2_uring_return_buf(struct smbd_smb2_uring *u,
+				       uint16_t bid)
+{
+	io_uring_buf_ring_add(u->buf_ring,
+			      u->bufs + (size_t)bid * SMBD_SMB2_URING_BUF_SIZE,
+			      SMBD_SMB2_URING_BUF_SIZE,
+			      bid,
+			      io_uring_buf_ring_mask(SMBD_SMB2_URING_NUM_BUFS),
+			      0);
+	io_uring_buf_ring_advance(u->buf_ring, 1);
+}
+
+void smbd_smb2_uring_start(struct smbXsrv_connection *xconn)
+{
+	struct smbd_smb2_uring *u = NULL;
+	struct io_uring_probe *probe = NULL;
+	unsigned i;
+	int ret;
+	NTSTATUS status;
+
+	if (xconn->smb2.uring_checked) {
+		return;
+	}
+	xconn->smb2.uring_checked = true;
+
+	if (!lp_smb2_io_uring()) {
+		return;
+	}
+	if (!NT_STATUS_IS_OK(xconn->transport.status)) {
+		return;
+	}
+
+	u = talloc_zero(xconn, struct smbd_smb2_uring);
+	if (u == NULL) {
+		return;
+	}
+	u->xconn = xconn;
+	u->recv_status = NT_STATUS_OK;
+
+	/*
+	 * IORING_SETUP_SINGLE_ISSUER was added in the same kernel
+	 * version (6.0) as multishot recv, so this also tells us
+	 * that we can use it.
+	 */
+	ret = io_uring_queue_init(SMBD_SMB2_URING_ENTRIES,
+				  &u->ring,
+				  IORING_SETUP_SINGLE_ISSUER);
+	if (ret < 0) {
+		DBG_NOTICE("io_uring_queue_init failed: %s, "
+			   "using the socket directly\n",
+			   strerror(-ret));
+		TALLOC_FREE(u);
+		return;
+	}
+
+#ifdef HAVE_IO_URING_RING_DONTFORK
+	ret = io_uring_ring_dontfork(&u->ring);
+	if (ret < 0) {
+		DBG_NOTICE("io_uring_ring_dontfork failed: %s\n",
+			   strerror(-ret));
+		io_uring_queue_exit(&u->ring);
+		TALLOC_FREE(u);
+		return;
+	}
+#endif
+
+	u->buf_ring = io_uring_setup_buf_ring(&u->ring,
+					      SMBD_SMB2_URING_NUM_BUFS,
+					      SMBD_SMB2_URING_BGID,
+					      0,
+					      &ret);
+	if (u->buf_ring == NULL) {
+		DBG_NOTICE("io_uring_setup_buf_ring failed: %s, "
+			   "using the socket directly\n",
+			   strerror(-ret));
+		io_uring_queue_exit(&u->ring);
+		TALLOC_FREE(u);
+		return;
+	}
+	talloc_set_destructor(u, smbd_smb2_uring_destructor);
+
+	probe = io_uring_get_probe_ring(&u->ring);
+	if (probe != NULL) {
+		u->zc_supported = io_uring_opcode_supported(
+			probe, IORING_OP_SENDMSG_ZC);
+		io_uring_free_probe(probe);
+	}
+
+	u->bufs = talloc_array(u,
+			       uint8_t,
+			       SMBD_SMB2_URING_NUM_BUFS *
+			       SMBD_SMB2_URING_BUF_SIZE);
+	u->send_iov = talloc_array(u, struct iovec, SMBD_SMB2_URING_MAX_IOV);
+	u->num_send_iov = SMBD_SMB2_URING_MAX_IOV;
+	u->im = tevent_create_immediate(u);
+	if (u->bufs == NULL || u->send_iov == NULL || u->im == NULL) {
+		TALLOC_FREE(u);
+		return;
+	}
+
+	for (i = 0; i < SMBD_SMB2_URING_NUM_BUFS; i++) {
+		io_uring_buf_ring_add(
+			u->buf_ring,
+			u->bufs + (size_t)i * SMBD_SMB2_URING_BUF_SIZE,
+			SMBD_SMB2_URING_BUF_SIZE,
+			i,
+			io_uring_buf_ring_mask(SMBD_SMB2_URING_NUM_BUFS),
+			i);
+	}
+	io_uring_buf_ring_advance(u->buf_ring, SMBD_SMB2_URING_NUM_BUFS);
+
+	u->fde = tevent_add_fd(xconn->client->raw_ev_ctx,
+			       u,
+			       u->ring.ring_fd,
+			       TEVENT_FD_READ,
+			       smbd_smb2_uring_fde_handler,
+			       u);
+	if (u->fde == NULL) {
+		TALLOC_FREE(u);
+		return;
+	}
+
+	status = smbd_smb2_uring_arm_recv(u);
+	if (!NT_STATUS_IS_OK(status)) {
+		TALLOC_FREE(u);
+		return;
+	}
+
+	/*
+	 * From now on all reads go via the ring.
+	 */
+	TEVENT_FD_NOT_READABLE(xconn->transport.fde);
+	xconn->smb2.uring = u;
+	DO_PROFILE_INC(smb2_uring_start);
+
+	DBG_DEBUG("conn[%s] using io_uring\n", smbXsrv_connection_dbg(xconn));
+}
+
+void smbd_smb2_uring_stop(struct smbXsrv_connection *xconn)
+{
+	struct smbd_smb2_uring *u = xconn->smb2.uring;
+
+	if (u == NULL || u->stopped) {
+		return;
+	}
+
+	/*
+	 * Cancel everything in flight, but keep
+	 * the buffers until the connection goes away,
+	 * smbd_smb2_uring_fde_handler() and the
+	 * immediate might be on the stack.
+	 */
+	u->stopped = true;
+	TALLOC_FREE(u->fde);
+	TALLOC_FREE(u->im);
+	io_uring_free_buf_ring(&u->ring,
+			       u->buf_ring,
+			       SMBD_SMB2_URING_NUM_BUFS,
+			       SMBD_SMB2_URING_BGID);
+	io_uring_queue_exit(&u->ring);
+
+	while (u->zc_list != NULL) {
+		smbd_smb2_uring_zc_free(u, u->zc_list);
+	}
+}
+
+bool smbd_smb2_uring_active(struct smbXsrv_connection *xconn)
+{
+	struct smbd_smb2_uring *u = xconn->smb2.uring;
+
+	return (u != NULL && !u->stopped);
+}
+
+void smbd_smb2_uring_resume_read(struct smbXsrv_connection *xconn)
+{
+	struct smbd_smb2_uring *u = xconn->smb2.uring;
+
+	/*
+	 * Buffered data is processed from the immediate,
+	 * just like the fde of the socket would fire.
+	 */
+	smbd_smb2_uring_schedule_submit(u);
+}
+
+NTSTATUS smbd_smb2_uring_flush(struct smbXsrv_connection *xconn)
+{
+	struct smbd_smb2_uring *u = xconn->smb2.uring;
+	struct smbd_smb2_send_queue *e = NULL;
+	struct io_uring_sqe *sqe = NULL;
+	struct smbd_smb2_uring_zc *z = NULL;
+	unsigned sendmsg_flags = 0;
+	size_t num_iov = 0;
+	size_t num_bytes = 0;
+	bool need_ack = false;
+
+	if (u->send_busy) {
+		/*
+		 * smbd_smb2_uring_sent() will come back
+		 */
+		return NT_STATUS_OK;
+	}
+
+	if (xconn->smb2.send_queue == NULL) {
+		return NT_STATUS_MORE_PROCESSING_REQUIRED;
+	}
+
+	if (xconn->smb2.send_queue->crypt_pending) {
+		/*
+		 * smbd_smb2_request_crypt_done() will come back
+		 */
+		return NT_STATUS_OK;
+	}
+
+	for (e = xconn->smb2.send_queue; e != NULL; e = e->next) {
+		if (e->sendfile_header != NULL) {
+			break;
+		}
+		if (e->crypt_pending) {
+			break;
+		}
+		if (num_iov + e->count > u->num_send_iov) {
+			struct iovec *tmp = NULL;
+
+			if (num_iov > 0) {
+				break;
+			}
+			/* a large compound */
+			tmp = talloc_realloc(u,
+					     u->send_iov,
+					     struct iovec,
+					     e->count);
+			if (tmp == NULL) {
+				return NT_STATUS_NO_MEMORY;
+			}
+			u->send_iov = tmp;
+			u->num_send_iov = e->count;
+		}
+		memcpy(u->send_iov + num_iov,
+		       e->vector,
+		       sizeof(struct iovec) * e->count);
+		num_iov += e->count;
+		num_bytes += iov_buflen(e->vector, e->count);
+		if (e->ack.req != NULL) {
+			need_ack = true;
+		}
+	}
+
+	if (num_iov == 0) {
+		return NT_STATUS_INTERNAL_ERROR;
+	}
+
+	/*
+	 * Entries waiting for an ack are freed by the ack
+	 * tracking, don't let them reference pinned pages.
+	 */
+	if (u->zc_supported &&
+	    !need_ack &&
+	    num_bytes >= SMBD_SMB2_URING_ZC_MIN_SIZE)
+	{
+		z = talloc_zero(u, struct smbd_smb2_uring_zc);
+		if (z == NULL) {
+			return NT_STATUS_NO_MEMORY;
+		}
+	}
+
+	sqe = smbd_smb2_uring_get_sqe(u);
+	if (sqe == NULL) {
+		TALLOC_FREE(z);
+		return NT_STATUS_INTERNAL_ERROR;
+	}
+
+	u->send_msg = (struct msghdr) {
+		.msg_iov = u->send_iov,
+		.msg_iovlen = num_iov,
+	};
+
+#ifdef MSG_NOSIGNAL
+	sendmsg_flags |= MSG_NOSIGNAL;
+#endif
+
+	if (z != NULL) {
+		z->seq = ++u->zc_seq;
+		DLIST_ADD_END(u->zc_list, z);
+
+		io_uring_prep_sendmsg_zc(sqe,
+					 xconn->transport.sock,
+					 &u->send_msg,
+					 sendmsg_flags);
+#ifdef IORING_SEND_ZC_REPORT_USAGE
+		/*
+		 * Let the notification tell us if the
+		 * kernel had to copy the data anyway.
+		 */
+		sqe->ioprio |= IORING_SEND_ZC_REPORT_USAGE;
+#endif
+		io_uring_sqe_set_data64(sqe,
+					SMBD_SMB2_URING_OP_SEND |
+					(z->seq << 8));
+		DO_PROFILE_INC(smb2_uring_send_zc);
+	} else {
+		io_uring_prep_sendmsg(sqe,
+				      xconn->transport.sock,
+				      &u->send_msg,
+				      sendmsg_flags);
+		io_uring_sqe_set_data64(sqe, SMBD_SMB2_URING_OP_SEND);
+		DO_PROFILE_INC(smb2_uring_send);
+	}
+	u->send_busy = true;
+
+	return NT_STATUS_OK;
+}
+
+static NTSTATUS smbd_smb2_uring_advance_send_queue(
+	struct smbd_smb2_uring *u,
+	struct smbd_smb2_send_queue *e,
+	size_t n)
+{
+	struct smbXsrv_connection *xconn = u->xconn;
+	struct smbd_smb2_uring_zc *z = DLIST_TAIL(u->zc_list);
+	bool ok;
+
+	if (z == NULL || e->ack.req != NULL) {
+		return smbd_smb2_advance_send_queue(xconn, &e, n);
+	}
+
+	/*
+	 * Like smbd_smb2_advance_send_queue(), but the kernel
+	 * might still reference the memory of the entry.
+	 */
+	xconn->ack.unacked_bytes += n;
+
+	ok = iov_advance(&e->vector, &e->count, n);
+	if (!ok) {
+		return NT_STATUS_INTERNAL_ERROR;
+	}
+
+	if (e->count > 0) {
+		return NT_STATUS_RETRY;
+	}
+
+	xconn->smb2.send_queue_len--;
+	DLIST_REMOVE(xconn->smb2.send_queue, e);
+	DLIST_ADD_END(z->retired, e);
+
+	return NT_STATUS_OK;
+}
+
+static NTSTATUS smbd_smb2_uring_sent(struct smbd_smb2_uring *u,
+				     int res,
+				     bool zc)
+{
+	struct smbXsrv_connection *xconn = u->xconn;
+	size_t n;
+	NTSTATUS status;
+
+	u->send_busy = false;
+
+	if (zc && (res == -EOPNOTSUPP)) {
+		/*
+		 * The ring supports IORING_OP_SENDMSG_ZC, but
+		 * the socket does not. Nothing was sent, send
+		 * the queue again with copying.
+		 */
+		DBG_NOTICE("zero copy send not supported on socket %d, "
+			   "falling back to copying\n",
+			   xconn->transport.sock);
+		DO_PROFILE_INC(smb2_uring_send_zc_unsupported);
+		u->zc_supported = false;
+		return smbd_smb2_flush_send_queue(xconn);
+	}
+
+	if (res < 0) {
+		return map_nt_error_from_unix_common(-res);
+	}
+	if (res == 0) {
+		/* propagate end of file */
+		return NT_STATUS_INTERNAL_ERROR;
+	}
+
+	n = res;
+	while (n > 0) {
+		struct smbd_smb2_send_queue *e = xconn->smb2.send_queue;
+		ssize_t buflen;
+		size_t len;
+
+		if (e == NULL) {
+			return NT_STATUS_INTERNAL_ERROR;
+		}
+
+		buflen = iov_buflen(e->vector, e->count);
+		if (buflen <= 0) {
+			return NT_STATUS_INTERNAL_ERROR;
+		}
+		len = MIN((size_t)buflen, n);
+
+		status = smbd_smb2_uring_advance_send_queue(u, e, len);
+		if (!NT_STATUS_IS_OK(status) &&
+		    !NT_STATUS_EQUAL(status, NT_STATUS_RETRY))
+		{
+			return status;
+		}
+		n -= len;
+	}
+
+	/*
+	 * Send the rest and restart reads if we
+	 * were blocked on draining the send queue.
+	 */
+	return smbd_smb2_flush_send_queue(xconn);
+}
+
+static void smbd_smb2_uring_received(struct smbd_smb2_uring *u,
+				     const struct io_uring_cqe *cqe)
+{
+	struct smbd_smb2_uring_chunk *c = NULL;
+	unsigned idx;
+
+	if (!(cqe->flags & IORING_CQE_F_MORE)) {
+		u->recv_armed = false;
+	}
+
+	if (cqe->res == -ENOBUFS) {
+		/*
+		 * We'll rearm once buffers are returned.
+		 */
+		return;
+	}
+	if (cqe->res == 0) {
+		u->recv_status = NT_STATUS_END_OF_FILE;
+		return;
+	}
+	if (cqe->res < 0) {
+		u->recv_status = map_nt_error_from_unix_common(-cqe->res);
+		return;
+	}
+	if (!(cqe->flags & IORING_CQE_F_BUFFER) ||
+	    u->num_chunks == SMBD_SMB2_URING_NUM_BUFS)
+	{
+		u->recv_status = NT_STATUS_INTERNAL_ERROR;
+		return;
+	}
+
+	idx = (u->first_chunk + u->num_chunks) % SMBD_SMB2_URING_NUM_BUFS;
+	c = &u->chunks[idx];
+	*c = (struct smbd_smb2_uring_chunk) {
+		.bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT,
+		.len = cqe->res,
+	};
+	u->num_chunks++;
+}
+
+static size_t smbd_smb2_uring_fill_vector(
+	struct smbd_smb2_request_read_state *state,
+	const uint8_t *buf,
+	size_t len)
+{
+	size_t copied = 0;
+	int i;
+
+	for (i = 0; i < state->count && copied < len; i++) {
+		size_t n = MIN(state->vector[i].iov_len, len - copied);
+
+		memcpy(state->vector[i].iov_base, buf + copied, n);
+		copied += n;
+	}
+
+	return copied;
+}
+
+static NTSTATUS smbd_smb2_uring_process_incoming(struct smbd_smb2_uring *u)
+{
+	struct smbXsrv_connection *xconn = u->xconn;
+	struct smbd_smb2_request_read_state *state =
+		&xconn->smb2.request_read_state;
+	NTSTATUS status;
+
+	while (u->num_chunks > 0) {
+		struct smbd_smb2_uring_chunk *c = &u->chunks[u->first_chunk];
+		const uint8_t *buf = NULL;
+		size_t n;
+
+		if (u->stopped) {
+			return NT_STATUS_OK;
+		}
+
+		if (state->req == NULL || state->decrypt_pending) {
+			/*
+			 * smbd_smb2_request_next_incoming() holds
+			 * back reads while the send queue is long
+			 * or the last request is still being decrypted,
+			 * it calls smbd_smb2_uring_resume_read()
+			 * later.
+			 */
+			return NT_STATUS_OK;
+		}
+
+		buf = u->bufs + (size_t)c->bid * SMBD_SMB2_URING_BUF_SIZE;
+		n = smbd_smb2_uring_fill_vector(state, buf + c->ofs, c->len);
+		if (n == 0) {
+			return NT_STATUS_INTERNAL_ERROR;
+		}
+		c->ofs += n;
+		c->len -= n;
+
+		if (c->len == 0) {
+			smbd_smb2_uring_return_buf(u, c->bid);
+			u->first_chunk += 1;
+			u->first_chunk %= SMBD_SMB2_URING_NUM_BUFS;
+			u->num_chunks -= 1;
+		}
+
+		status = smbd_smb2_advance_incoming(xconn, n);
+		if (NT_STATUS_EQUAL(status, NT_STATUS_PENDING)) {
+			/* we have more to read */
+			continue;
+		}
+		if (NT_STATUS_EQUAL(status, NT_STATUS_RETRY)) {
+			/* smbd_smb2_advance_incoming setup a new vector */
+			continue;
+		}
+		if (!NT_STATUS_IS_OK(status)) {
+			return status;
+		}
+	}
+
+	if (u->stopped) {
+		return NT_STATUS_OK;
+	}
+
+	if (!NT_STATUS_IS_OK(u->recv_status)) {
+		return u->recv_status;
+	}
+
+	if (!u->recv_armed && u->num_chunks < SMBD_SMB2_URING_NUM_BUFS) {
+		status = smbd_smb2_uring_arm_recv(u);
+		if (!NT_STATUS_IS_OK(status)) {
+			return status;
+		}
+	}
+
+	return NT_STATUS_OK;
+}
+
+static void smbd_smb2_uring_error(struct smbd_smb2_uring *u,
+				  NTSTATUS status)
+{
+	struct smbXsrv_connection *xconn = u->xconn;
+
+	smbXsrv_connection_disconnect_transport(xconn, status);
+	smbd_server_connection_terminate(xconn, nt_errstr(status));
+}
+
+static void smbd_smb2_uring_submit(struct smbd_smb2_uring *u)
+{
+	int ret;
+
+	if (io_uring_sq_ready(&u->ring) == 0) {
+		return;
+	}
+
+	ret = io_uring_submit(&u->ring);
+	if (ret == -EAGAIN || ret == -EBUSY || ret == -EINTR) {
+		/*
+		 * Try again once the completions
+		 * are consumed.
+		 */
+		return;
+	}
+	if (ret < 0) {
+		smbd_smb2_uring_error(u, map_nt_error_from_unix_common(-ret));
+		return;
+	}
+}
+
+static void smbd_smb2_uring_immediate(struct tevent_context *ctx,
+				      struct tevent_immediate *im,
+				      void *private_data)
+{
+	struct smbd_smb2_uring *u = talloc_get_type_abort(
+		private_data, struct smbd_smb2_uring);
+	NTSTATUS status;
+
+	if (u->stopped) {
+		return;
+	}
+
+	status = smbd_smb2_uring_process_incoming(u);
+	if (!NT_STATUS_IS_OK(status)) {
+		smbd_smb2_uring_error(u, status);
+		return;
+	}
+
+	if (u->stopped) {
+		return;
+	}
+
+	smbd_smb2_uring_submit(u);
+}
+
+static void smbd_smb2_uring_fde_handler(struct tevent_context *ev,
+					struct tevent_fd *fde,
+					uint16_t flags,
+					void *private_data)
+{
+	struct smbd_smb2_uring *u = talloc_get_type_abort(
+		private_data, struct smbd_smb2_uring);
+	struct io_uring_cqe *cqe = NULL;
+	unsigned head;
+	unsigned nr = 0;
+	bool sent = false;
+	bool send_zc = false;
+	int send_res = 0;
+	NTSTATUS status;
+
+	/*
+	 * First collect all completions, the callbacks
+	 * into the SMB2 layer below might tear down
+	 * the ring.
+	 */
+	io_uring_for_each_cqe(&u->ring, head, cqe) {
+		uint64_t data = io_uring_cqe_get_data64(cqe);
+		uint64_t seq = SMBD_SMB2_URING_SEQ(data);
+
+		switch (SMBD_SMB2_URING_OP(data)) {
+		case SMBD_SMB2_URING_OP_RECV:
+			smbd_smb2_uring_received(u, cqe);
+			break;
+		case SMBD_SMB2_URING_OP_SEND:
+			if (cqe->flags & IORING_CQE_F_NOTIF) {
+#ifdef IORING_NOTIF_USAGE_ZC_COPIED
+				smbd_smb2_uring_zc_usage(u, cqe->res);
+#endif
+				smbd_smb2_uring_zc_notified(u, seq);
+				break;
+			}
+			sent = true;
+			send_zc = (seq != 0);
+			send_res = cqe->res;
+			if (seq != 0 && !(cqe->flags & IORING_CQE_F_MORE)) {
+				/*
+				 * No notification will follow,
+				 * e.g. on error.
+				 */
+				smbd_smb2_uring_zc_notified(u, seq);
+			}
+			break;
+		}
+		nr++;
+	}
+	io_uring_cq_advance(&u->ring, nr);
+
+	if (sent) {
+		status = smbd_smb2_uring_sent(u, send_res, send_zc);
+		if (!NT_STATUS_IS_OK(status)) {
+			smbd_smb2_uring_error(u, status);
+			return;
+		}
+		if (u->stopped) {
+			return;
+		}
+	}
+
+	smbd_smb2_uring_zc_cleanup(u);
+
+	status = smbd_smb2_uring_process_incoming(u);
+	if (!NT_STATUS_IS_OK(status)) {
+		smbd_smb2_uring_error(u, status);
+		return;
+	}
+
+	if (u->stopped) {
+		return;
+	}
+
+	if (io_uring_sq_ready(&u->ring) > 0) {
+		smbd_smb2_uring_schedule_submit(u);
+	}
+}
+
+#else /* WITH_SMB2_URING */
+
+void smbd_smb2_uring_start(struct smbXsrv_connection *xconn)
+{
+	if (xconn->smb2.uring_checked) {
+		return;
+	}
+	xconn->smb2.uring_checked = true;
+
+	if (lp_smb2_io_uring()) {
+		DBG_NOTICE("smbd was built without io_uring support, "
+			   "ignoring 'smb2 io uring = yes'\n");
+	}
+}
+
+void smbd_smb2_uring_stop(struct smbXsrv_connection *xconn)
+{
+	return;
+}
+
+bool smbd_smb2_uring_active(struct smbXsrv_connection *xconn)
+{
+	return false;
+}
+
+void smbd_smb2_uring_resume_read(struct smbXsrv_connection *xconn)
+{
+	return;
+}
+
+NTSTATUS smbd_smb2_uring_flush(struct smbXsrv_connection *xconn)
+{
+	return NT_STATUS_NOT_SUPPORTED;
+}
+
+#endif /* WITH_SMB2_URING */
@@ -0,0 +1,240 @@
+/*
+ *  Unix SMB/CIFS implementation.
+ *  Count the mallocs smbd needs per SMB2 request
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * This replays the allocations smbd does for a synchronous SMB2
+ * request or compound chain within one iteration of its main loop,
+ * once the way smbd does it and once with each request being a
+ * talloc_pooled_object() with vectors and headers embedded for
+ * chains of up to three requests. The sizes are the real ones from
+ * smbd/globals.h, the per-operation state stands for the
+ * tevent_req_create() and response buffer of a typical operation.
+ *
+ * Every malloc of the process goes through the replacement below,
+ * so the count includes what talloc does behind our back.
+ */
+
+#include "replace.h"
+#include "includes.h"
+#include "smbd/globals.h"
+#include <stdio.h>
+
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t nmemb, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+void __libc_free(void *ptr);
+
+static bool counting;
+static unsigned long num_mallocs;
+
+void *malloc(size_t size)
+{
+	num_mallocs += counting;
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+	num_mallocs += counting;
+	return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	num_mallocs += counting;
+	return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr)
+{
+	__libc_free(ptr);
+}
+
+/* As in smbd_tevent_trace_callback_before_loop_once() */
+#define LOOP_POOL_SIZE 8192
+
+#define NUM_IOV (1 + SMBD_SMB2_NUM_IOV_PER_REQ)
+
+#define POOLED_NUM_REQS 3
+#define POOLED_NUM_IOV (1 + SMBD_SMB2_NUM_IOV_PER_REQ * POOLED_NUM_REQS)
+#define POOLED_REQUEST_SIZE \
+	(sizeof(struct smbd_smb2_request) \
+	 + 2 * (POOLED_NUM_IOV - NUM_IOV) * sizeof(struct iovec) \
+	 + (POOLED_NUM_REQS - 1) * OUTVEC_ALLOC_SIZE)
+#define POOLED_OBJECTS 32
+#define POOLED_SIZE 4096
+
+/* An average CREATE, QUERY_INFO or CLOSE */
+#define OP_REQUEST_SIZE 120
+#define OP_RESPONSE_SIZE 104
+
+struct bench_op_state {
+	uint8_t buf[256];
+};
+
+static bool replay(int num_ops, bool pooled)
+{
+	TALLOC_CTX *req = NULL;
+	TALLOC_CTX *mem_ctx = NULL;
+	struct iovec *in_vector = NULL;
+	int num_iov = 1 + num_ops * SMBD_SMB2_NUM_IOV_PER_REQ;
+	int max_iov;
+	int i;
+
+	/* smbd_smb2_request_allocate() */
+	if (pooled) {
+		req = _talloc_pooled_object(NULL,
+					    POOLED_REQUEST_SIZE,
+					    "struct smbd_smb2_request",
+					    POOLED_OBJECTS,
+					    POOLED_SIZE);
+		max_iov = POOLED_NUM_IOV;
+	} else {
+		req = talloc_size(talloc_tos(),
+				  sizeof(struct smbd_smb2_request));
+		talloc_reparent(talloc_tos(), NULL, req);
+		max_iov = NUM_IOV;
+	}
+	if (req == NULL) {
+		return false;
+	}
+
+	if (talloc_array(req, uint8_t, num_ops * OP_REQUEST_SIZE) == NULL) {
+		goto fail;
+	}
+
+	/* smbd_smb2_inbuf_parse_compound() */
+	for (i = max_iov; i < num_iov; i += SMBD_SMB2_NUM_IOV_PER_REQ) {
+		in_vector = talloc_realloc(req, in_vector, struct iovec,
+					   i + SMBD_SMB2_NUM_IOV_PER_REQ);
+		if (in_vector == NULL) {
+			goto fail;
+		}
+	}
+
+	/* smbd_smb2_request_setup_out() */
+	if (num_iov > max_iov) {
+		mem_ctx = talloc_zero_array(req, struct iovec, num_iov);
+		if (mem_ctx == NULL) {
+			goto fail;
+		}
+		for (i = 1; i < num_ops; i++) {
+			if (talloc_zero_array(mem_ctx, uint8_t,
+					      OUTVEC_ALLOC_SIZE) == NULL) {
+				goto fail;
+			}
+		}
+	}
+
+	for (i = 0; i < num_ops; i++) {
+		struct tevent_req *subreq = NULL;
+		struct bench_op_state *state = NULL;
+
+		/* smbd_smb2_fake_smb_request() */
+		if (talloc_zero(req, struct smb_request) == NULL) {
+			goto fail;
+		}
+		subreq = tevent_req_create(req, &state,
+					   struct bench_op_state);
+		if (subreq == NULL) {
+			goto fail;
+		}
+		if (talloc_size(req, OP_RESPONSE_SIZE) == NULL) {
+			goto fail;
+		}
+		TALLOC_FREE(subreq);
+	}
+
+	TALLOC_FREE(req);
+	return true;
+fail:
+	TALLOC_FREE(req);
+	return false;
+}
+
+static bool run_replay(int num_ops, bool pooled, int num_requests)
+{
+	unsigned long loop_mallocs = 0;
+	int i;
+
+	/*
+	 * The stackframe pool smbd allocates for every iteration of
+	 * its main loop is counted separately, it is there with or
+	 * without requests.
+	 */
+	num_mallocs = 0;
+	counting = true;
+	for (i = 0; i < num_requests; i++) {
+		TALLOC_CTX *frame = talloc_stackframe_pool(LOOP_POOL_SIZE);
+		TALLOC_FREE(frame);
+	}
+	loop_mallocs = num_mallocs;
+
+	num_mallocs = 0;
+	for (i = 0; i < num_requests; i++) {
+		TALLOC_CTX *frame = talloc_stackframe_pool(LOOP_POOL_SIZE);
+		bool ok = replay(num_ops, pooled);
+
+		TALLOC_FREE(frame);
+		if (!ok) {
+			counting = false;
+			fprintf(stderr, "replay of %d ops failed\n", num_ops);
+			return false;
+		}
+	}
+	counting = false;
+
+	printf("%-10s %d ops: %.2f mallocs per request\n",
+	       pooled ? "pooled" : "talloc_tos",
+	       num_ops,
+	       (double)(num_mallocs - loop_mallocs) / num_requests);
+	return true;
+}
+
+int main(int argc, const char *argv[])
+{
+	TALLOC_CTX *frame = NULL;
+	int num_requests = 10000;
+	int num_ops;
+	bool ok;
+
+	if (argc > 1) {
+		num_requests = atoi(argv[1]);
+	}
+	if (num_requests <= 0) {
+		fprintf(stderr, "Usage: %s [NUM_REQUESTS]\n", argv[0]);
+		return 1;
+	}
+
+	/* Set up the per-thread stackframe list outside the counting */
+	frame = talloc_stackframe();
+	TALLOC_FREE(frame);
+
+	for (num_ops = 1; num_ops <= 5; num_ops++) {
+		ok = run_replay(num_ops, false, num_requests);
+		if (!ok) {
+			return 1;
+		}
+		ok = run_replay(num_ops, true, num_requests);
+		if (!ok) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
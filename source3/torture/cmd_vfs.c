@@ -28,6 +28,7 @@
 #include "libcli/security/security.h"
 #include "passdb/machine_sid.h"
 #include "source3/smbd/dir.h"
+#include "include/ntioctl.h"
 
 static const char *null_string = "";
 
@@ -2106,6 +2107,92 @@ static NTSTATUS cmd_sys_acl_delete_def_file(struct vfs_state *vfs, TALLOC_CTX *m
 	return NT_STATUS_OK;
 }
 
+/*
+ * Ask for the snapshots the way FSCTL_GET_SHADOW_COPY_DATA does, first
+ * for the number of snapshots, then for the labels. With a count the
+ * pair of calls is repeated and timed.
+ */
+static NTSTATUS cmd_get_shadow_copy_data(struct vfs_state *vfs,
+					 TALLOC_CTX *mem_ctx,
+					 int argc, const char **argv)
+{
+	struct smb_filename *pathref_fname = NULL;
+	struct shadow_copy_data *shadow_data = NULL;
+	struct timeval start;
+	int count = 1;
+	int i;
+	uint32_t l;
+	int ret;
+	NTSTATUS status;
+
+	if (argc < 2 || argc > 3) {
+		printf("Usage: get_shadow_copy_data <path> [<count>]\n");
+		return NT_STATUS_OK;
+	}
+
+	if (argc == 3) {
+		count = atoi(argv[2]);
+		if (count < 1) {
+			printf("count must be at least 1\n");
+			return NT_STATUS_INVALID_PARAMETER;
+		}
+	}
+
+	status = synthetic_pathref(mem_ctx,
+				   vfs->conn->cwd_fsp,
+				   argv[1],
+				   NULL,
+				   NULL,
+				   0,
+				   ssf_flags(),
+				   &pathref_fname);
+	if (!NT_STATUS_IS_OK(status)) {
+		return status;
+	}
+
+	start = timeval_current();
+
+	for (i = 0; i < count; i++) {
+		TALLOC_FREE(shadow_data);
+		shadow_data = talloc_zero(mem_ctx, struct shadow_copy_data);
+		if (shadow_data == NULL) {
+			TALLOC_FREE(pathref_fname);
+			return NT_STATUS_NO_MEMORY;
+		}
+
+		ret = SMB_VFS_GET_SHADOW_COPY_DATA(pathref_fname->fsp,
+						   shadow_data,
+						   false);
+		if (ret == 0) {
+			ret = SMB_VFS_GET_SHADOW_COPY_DATA(pathref_fname->fsp,
+							   shadow_data,
+							   true);
+		}
+		if (ret != 0) {
+			int err = errno;
+			printf("get_shadow_copy_data: error=%d (%s)\n",
+			       err, strerror(err));
+			TALLOC_FREE(shadow_data);
+			TALLOC_FREE(pathref_fname);
+			return map_nt_error_from_unix(err);
+		}
+	}
+
+	printf("get_shadow_copy_data: %u snapshots, %d calls in %.6f "
+	       "seconds\n",
+	       shadow_data->num_volumes,
+	       count,
+	       timeval_elapsed(&start));
+
+	for (l = 0; l < shadow_data->num_volumes; l++) {
+		printf("%s\n", shadow_data->labels[l]);
+	}
+
+	TALLOC_FREE(shadow_data);
+	TALLOC_FREE(pathref_fname);
+	return NT_STATUS_OK;
+}
+
 /* Afaik translate name was first introduced with vfs_catia, to be able
    to translate unix file/dir-names, containing invalid windows characters,
    to valid windows names.
@@ -2352,6 +2439,9 @@ struct cmd_set vfs_commands[] = {
 	{ "test_chain", cmd_test_chain, "test chain code",
 	  "test_chain" },
 #endif
+	{ "get_shadow_copy_data", cmd_get_shadow_copy_data,
+	  "VFS get_shadow_copy_data()",
+	  "get_shadow_copy_data <path> [<count>]" },
 	{ "translate_name", cmd_translate_name, "VFS translate_name()", "translate_name unix_filename" },
 	{ "create_file",
 	  cmd_create_file,
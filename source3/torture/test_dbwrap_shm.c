@@ -0,0 +1,472 @@
+/*
+ * Unix SMB/CIFS implementation.
+ * Test the shared memory dbwrap backend
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "includes.h"
+#include "torture/proto.h"
+#include "system/filesys.h"
+#include "system/shmem.h"
+#include "system/wait.h"
+#include "lib/dbwrap/dbwrap.h"
+#include "lib/dbwrap/dbwrap_shm.h"
+#include "lib/util/util_tdb.h"
+
+struct dbwrap_shm1_state {
+	TDB_DATA value;
+	NTSTATUS status;
+};
+
+static void dbwrap_shm1_check(TDB_DATA key, TDB_DATA value,
+			      void *private_data)
+{
+	struct dbwrap_shm1_state *state = private_data;
+
+	if (!tdb_data_equal(value, state->value)) {
+		state->status = NT_STATUS_DATA_ERROR;
+		return;
+	}
+	state->status = NT_STATUS_OK;
+}
+
+static void dbwrap_shm1_grow(struct db_record *rec,
+			     TDB_DATA value,
+			     void *private_data)
+{
+	struct dbwrap_shm1_state *state = private_data;
+	TDB_DATA dbufs[] = { value, state->value };
+
+	state->status = dbwrap_record_storev(rec, dbufs, ARRAY_SIZE(dbufs), 0);
+}
+
+static struct db_context *dbwrap_shm1_open(const char *dbname,
+					   uint32_t num_buckets,
+					   uint32_t bucket_size)
+{
+	return db_open_shm(talloc_tos(),
+			   dbname,
+			   num_buckets,
+			   bucket_size,
+			   TDB_CLEAR_IF_FIRST|TDB_SEQNUM,
+			   O_RDWR|O_CREAT,
+			   0600,
+			   DBWRAP_LOCK_ORDER_NONE);
+}
+
+/*
+ * Open the table from another process and look at key
+ */
+static bool dbwrap_shm1_child_check(struct db_context *parent_db,
+				    const char *dbname,
+				    TDB_DATA key,
+				    TDB_DATA value)
+{
+	struct dbwrap_shm1_state state = { .value = value };
+	struct db_context *db = NULL;
+	NTSTATUS status;
+	pid_t pid;
+	int wstatus;
+
+	pid = fork();
+	if (pid == -1) {
+		fprintf(stderr, "fork failed: %s\n", strerror(errno));
+		return false;
+	}
+
+	if (pid == 0) {
+		/*
+		 * Only one open per process, drop the one we inherited
+		 */
+		TALLOC_FREE(parent_db);
+
+		/*
+		 * Different geometry, the child has to use the one
+		 * from the file
+		 */
+		db = dbwrap_shm1_open(dbname, 1024, 65536);
+		if (db == NULL) {
+			fprintf(stderr, "child db_open_shm failed: %s\n",
+				strerror(errno));
+			_exit(1);
+		}
+		status = dbwrap_parse_record(
+			db, key, dbwrap_shm1_check, &state);
+		if (!NT_STATUS_IS_OK(status) ||
+		    !NT_STATUS_IS_OK(state.status)) {
+			fprintf(stderr, "child parse_record returned %s/%s\n",
+				nt_errstr(status), nt_errstr(state.status));
+			_exit(1);
+		}
+		_exit(0);
+	}
+
+	if (waitpid(pid, &wstatus, 0) == -1) {
+		fprintf(stderr, "waitpid failed: %s\n", strerror(errno));
+		return false;
+	}
+	return (WIFEXITED(wstatus) && (WEXITSTATUS(wstatus) == 0));
+}
+
+static int dbwrap_shm1_count(struct db_record *rec, void *private_data)
+{
+	return 0;
+}
+
+static int dbwrap_shm1_delete(struct db_record *rec, void *private_data)
+{
+	NTSTATUS status = dbwrap_record_delete(rec);
+	return NT_STATUS_IS_OK(status) ? 0 : -1;
+}
+
+bool run_dbwrap_shm1(int dummy)
+{
+	const char *dbname = "test_dbwrap_shm.shm";
+	const char *overflow = "test_dbwrap_shm.shm.overflow";
+	struct db_context *db1 = NULL;
+	struct db_context *db2 = NULL;
+	DATA_BLOB grown;
+	struct db_record *rec = NULL;
+	TDB_DATA key = string_term_tdb_data("key");
+	TDB_DATA value = string_term_tdb_data("value");
+	struct dbwrap_shm1_state state = { .value = value };
+	uint8_t big[512] = { 0 };
+	char keystr[16];
+	int seqnum, count, i;
+	bool ok, ret = false;
+	NTSTATUS status;
+
+	unlink(dbname);
+	unlink(overflow);
+
+	/*
+	 * 4 buckets of 256 bytes so that we can easily fill one
+	 */
+	db1 = dbwrap_shm1_open(dbname, 4, 256);
+	if (db1 == NULL) {
+		if (errno == ENOSYS) {
+			printf("No robust mutexes, skipping\n");
+			return true;
+		}
+		fprintf(stderr, "db_open_shm failed: %s\n", strerror(errno));
+		return false;
+	}
+
+	seqnum = dbwrap_get_seqnum(db1);
+
+	status = dbwrap_store(db1, key, value, 0);
+	if (!NT_STATUS_IS_OK(status)) {
+		fprintf(stderr, "dbwrap_store failed: %s\n",
+			nt_errstr(status));
+		goto fail;
+	}
+	if (dbwrap_get_seqnum(db1) == seqnum) {
+		fprintf(stderr, "seqnum did not change\n");
+		goto fail;
+	}
+
+	status = dbwrap_store(db1, key, value, TDB_INSERT);
+	if (!NT_STATUS_EQUAL(status, NT_STATUS_OBJECT_NAME_COLLISION)) {
+		fprintf(stderr, "TDB_INSERT returned %s\n", nt_errstr(status));
+		goto fail;
+	}
+
+	/*
+	 * Only one open per process, like tdb
+	 */
+	db2 = dbwrap_shm1_open(dbname, 4, 256);
+	if ((db2 != NULL) || (errno != EBUSY)) {
+		fprintf(stderr, "second db_open_shm did not fail with "
+			"EBUSY: %s\n", strerror(errno));
+		goto fail;
+	}
+
+	if (!dbwrap_shm1_child_check(db1, dbname, key, value)) {
+		goto fail;
+	}
+
+	/*
+	 * Locks nest: store and parse while holding the record
+	 */
+	rec = dbwrap_fetch_locked(db1, talloc_tos(), key);
+	if (rec == NULL) {
+		fprintf(stderr, "dbwrap_fetch_locked failed\n");
+		goto fail;
+	}
+	status = dbwrap_do_locked(db1, key, dbwrap_shm1_grow, &state);
+	if (!NT_STATUS_IS_OK(status) || !NT_STATUS_IS_OK(state.status)) {
+		fprintf(stderr, "do_locked returned %s/%s\n",
+			nt_errstr(status), nt_errstr(state.status));
+		goto fail;
+	}
+	TALLOC_FREE(rec);
+
+	grown = data_blob_talloc_zero(talloc_tos(), 2 * value.dsize);
+	if (grown.data == NULL) {
+		goto fail;
+	}
+	memcpy(grown.data, value.dptr, value.dsize);
+	memcpy(grown.data + value.dsize, value.dptr, value.dsize);
+	ok = dbwrap_shm1_child_check(
+		db1, dbname, key, make_tdb_data(grown.data, grown.length));
+	data_blob_free(&grown);
+	if (!ok) {
+		goto fail;
+	}
+
+	/*
+	 * A record larger than a bucket goes to the overflow tdb
+	 */
+	memset(big, 'x', sizeof(big));
+	status = dbwrap_store(db1, key, make_tdb_data(big, sizeof(big)), 0);
+	if (!NT_STATUS_IS_OK(status)) {
+		fprintf(stderr, "big store returned %s\n", nt_errstr(status));
+		goto fail;
+	}
+	if (!dbwrap_shm1_child_check(
+		    db1, dbname, key, make_tdb_data(big, sizeof(big)))) {
+		goto fail;
+	}
+	status = dbwrap_store(db1, key, make_tdb_data(big, sizeof(big)),
+			      TDB_INSERT);
+	if (!NT_STATUS_EQUAL(status, NT_STATUS_OBJECT_NAME_COLLISION)) {
+		fprintf(stderr, "big TDB_INSERT returned %s\n",
+			nt_errstr(status));
+		goto fail;
+	}
+
+	/*
+	 * Shrinking it moves it back into the bucket
+	 */
+	status = dbwrap_store(db1, key, value, 0);
+	if (!NT_STATUS_IS_OK(status)) {
+		fprintf(stderr, "small store returned %s\n",
+			nt_errstr(status));
+		goto fail;
+	}
+	if (!dbwrap_shm1_child_check(db1, dbname, key, value)) {
+		goto fail;
+	}
+
+	status = dbwrap_store(db1, key, make_tdb_data(big, sizeof(big)), 0);
+	if (!NT_STATUS_IS_OK(status)) {
+		fprintf(stderr, "big store returned %s\n", nt_errstr(status));
+		goto fail;
+	}
+
+	for (i = 0; i < 5; i++) {
+		snprintf(keystr, sizeof(keystr), "key%d", i);
+		status = dbwrap_store(db1,
+				      string_term_tdb_data(keystr),
+				      value,
+				      0);
+		if (!NT_STATUS_IS_OK(status)) {
+			fprintf(stderr, "dbwrap_store failed: %s\n",
+				nt_errstr(status));
+			goto fail;
+		}
+	}
+
+	status = dbwrap_traverse_read(db1, dbwrap_shm1_count, NULL, &count);
+	if (!NT_STATUS_IS_OK(status) || (count != 6)) {
+		fprintf(stderr, "traverse_read returned %s, count=%d\n",
+			nt_errstr(status), count);
+		goto fail;
+	}
+
+	status = dbwrap_traverse(db1, dbwrap_shm1_delete, NULL, &count);
+	if (!NT_STATUS_IS_OK(status) || (count != 6)) {
+		fprintf(stderr, "traverse returned %s, count=%d\n",
+			nt_errstr(status), count);
+		goto fail;
+	}
+
+	status = dbwrap_parse_record(db1, key, dbwrap_shm1_check, &state);
+	if (!NT_STATUS_EQUAL(status, NT_STATUS_NOT_FOUND)) {
+		fprintf(stderr, "parse_record returned %s, "
+			"expected NOT_FOUND\n", nt_errstr(status));
+		goto fail;
+	}
+
+	if (dbwrap_check(db1) != 0) {
+		fprintf(stderr, "dbwrap_check failed\n");
+		goto fail;
+	}
+
+	ret = true;
+fail:
+	TALLOC_FREE(rec);
+	TALLOC_FREE(db2);
+	TALLOC_FREE(db1);
+	unlink(dbname);
+	unlink(overflow);
+	return ret;
+}
+
+/*
+ * Fork a child that dies while it holds the mutex of key's bucket.
+ * With a NULL value it just holds the record lock, otherwise it
+ * stores value, which has to fault in the middle of the store.
+ */
+static bool dbwrap_shm2_kill_writer(struct db_context *db,
+				    TDB_DATA key,
+				    const uint8_t *fault)
+{
+	struct db_record *rec = NULL;
+	pid_t pid;
+	int wstatus;
+
+	pid = fork();
+	if (pid == -1) {
+		fprintf(stderr, "fork failed: %s\n", strerror(errno));
+		return false;
+	}
+
+	if (pid == 0) {
+		struct rlimit rl = { .rlim_cur = 0, .rlim_max = 0 };
+
+		setrlimit(RLIMIT_CORE, &rl);
+		CatchSignal(SIGSEGV, SIG_DFL);
+
+		rec = dbwrap_fetch_locked(db, talloc_tos(), key);
+		if (rec == NULL) {
+			fprintf(stderr, "child fetch_locked failed\n");
+			_exit(1);
+		}
+		if (fault != NULL) {
+			dbwrap_record_store(rec, make_tdb_data(fault, 16), 0);
+			fprintf(stderr, "child store did not fault\n");
+			_exit(1);
+		}
+		kill(getpid(), SIGKILL);
+		_exit(1);
+	}
+
+	if (waitpid(pid, &wstatus, 0) == -1) {
+		fprintf(stderr, "waitpid failed: %s\n", strerror(errno));
+		return false;
+	}
+	if (!WIFSIGNALED(wstatus)) {
+		fprintf(stderr, "child was not killed\n");
+		return false;
+	}
+	return true;
+}
+
+bool run_dbwrap_shm2(int dummy)
+{
+	const char *dbname = "test_dbwrap_shm2.shm";
+	const char *overflow = "test_dbwrap_shm2.shm.overflow";
+	struct db_context *db = NULL;
+	TDB_DATA key1 = string_term_tdb_data("key1");
+	TDB_DATA key2 = string_term_tdb_data("key2");
+	TDB_DATA value = string_term_tdb_data("value");
+	struct dbwrap_shm1_state state = { .value = value };
+	uint8_t *fault = MAP_FAILED;
+	size_t pagesize = getpagesize();
+	bool ret = false;
+	NTSTATUS status;
+
+	unlink(dbname);
+	unlink(overflow);
+
+	/*
+	 * A single bucket, all keys share its mutex
+	 */
+	db = dbwrap_shm1_open(dbname, 1, 4096);
+	if (db == NULL) {
+		if (errno == ENOSYS) {
+			printf("No robust mutexes, skipping\n");
+			return true;
+		}
+		fprintf(stderr, "db_open_shm failed: %s\n", strerror(errno));
+		return false;
+	}
+
+	fault = mmap(NULL, pagesize, PROT_NONE, MAP_PRIVATE|MAP_ANON, -1, 0);
+	if (fault == MAP_FAILED) {
+		fprintf(stderr, "mmap failed: %s\n", strerror(errno));
+		goto fail;
+	}
+
+	status = dbwrap_store(db, key1, value, 0);
+	if (!NT_STATUS_IS_OK(status)) {
+		fprintf(stderr, "dbwrap_store failed: %s\n",
+			nt_errstr(status));
+		goto fail;
+	}
+
+	/*
+	 * A process dying with the lock but without changing
+	 * anything leaves the bucket as it was
+	 */
+	if (!dbwrap_shm2_kill_writer(db, key2, NULL)) {
+		goto fail;
+	}
+	status = dbwrap_parse_record(db, key1, dbwrap_shm1_check, &state);
+	if (!NT_STATUS_IS_OK(status) || !NT_STATUS_IS_OK(state.status)) {
+		fprintf(stderr, "parse_record after a clean death "
+			"returned %s/%s\n",
+			nt_errstr(status), nt_errstr(state.status));
+		goto fail;
+	}
+
+	/*
+	 * A process dying in the middle of a store. The lengths in
+	 * the bucket still add up, only the dirty flag tells that
+	 * it can't be trusted.
+	 */
+	if (!dbwrap_shm2_kill_writer(db, key2, fault)) {
+		goto fail;
+	}
+	status = dbwrap_parse_record(db, key1, dbwrap_shm1_check, &state);
+	if (!NT_STATUS_EQUAL(status, NT_STATUS_NOT_FOUND)) {
+		fprintf(stderr, "parse_record after a dirty death "
+			"returned %s, expected NOT_FOUND\n",
+			nt_errstr(status));
+		goto fail;
+	}
+	if (dbwrap_check(db) != 0) {
+		fprintf(stderr, "dbwrap_check failed\n");
+		goto fail;
+	}
+
+	/*
+	 * The bucket is usable again
+	 */
+	status = dbwrap_store(db, key2, value, 0);
+	if (!NT_STATUS_IS_OK(status)) {
+		fprintf(stderr, "dbwrap_store after recovery failed: %s\n",
+			nt_errstr(status));
+		goto fail;
+	}
+	status = dbwrap_parse_record(db, key2, dbwrap_shm1_check, &state);
+	if (!NT_STATUS_IS_OK(status) || !NT_STATUS_IS_OK(state.status)) {
+		fprintf(stderr, "parse_record after recovery "
+			"returned %s/%s\n",
+			nt_errstr(status), nt_errstr(state.status));
+		goto fail;
+	}
+
+	ret = true;
+fail:
+	if (fault != MAP_FAILED) {
+		munmap(fault, pagesize);
+	}
+	TALLOC_FREE(db);
+	unlink(dbname);
+	unlink(overflow);
+	return ret;
+}
@@ -16075,6 +16075,14 @@ static struct {
 		.name  = "LOCAL-DBWRAP-DO-LOCKED1",
 		.fn    = run_dbwrap_do_locked1,
 	},
+	{
+		.name  = "LOCAL-DBWRAP-SHM1",
+		.fn    = run_dbwrap_shm1,
+	},
+	{
+		.name  = "LOCAL-DBWRAP-SHM2",
+		.fn    = run_dbwrap_shm2,
+	},
 	{
 		.name  = "LOCAL-MESSAGING-READ1",
 		.fn    = run_messaging_read1,
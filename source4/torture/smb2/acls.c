@@ -2989,6 +2989,206 @@ done:
 	return ret;
 }
 
+static NTSTATUS open_other_conn_file(struct torture_context *tctx,
+				     struct smb2_tree *tree,
+				     const char *fname,
+				     uint32_t access_mask,
+				     uint32_t *attrib)
+{
+	struct smb2_create cr = {
+		.in.desired_access = access_mask,
+		.in.file_attributes = FILE_ATTRIBUTE_NORMAL,
+		.in.share_access = NTCREATEX_SHARE_ACCESS_MASK,
+		.in.create_disposition = NTCREATEX_DISP_OPEN,
+		.in.impersonation_level = NTCREATEX_IMPERSONATION_ANONYMOUS,
+		.in.fname = fname,
+	};
+	NTSTATUS status;
+
+	status = smb2_create(tree, tctx, &cr);
+	if (!NT_STATUS_IS_OK(status)) {
+		return status;
+	}
+	if (attrib != NULL) {
+		*attrib = cr.out.file_attr;
+	}
+	return smb2_util_close(tree, cr.out.file.handle);
+}
+
+/*
+ * Change the ACL and the DOS attributes of a file on a second
+ * connection, served by another smbd process, and check that opens on
+ * the first connection see the change right away. The changes happen
+ * in quick succession, within the time a file's change time might
+ * not change, and with ACLs in xattr_tdb it doesn't change at all.
+ */
+static bool test_acl_other_conn(struct torture_context *tctx,
+				struct smb2_tree *tree)
+{
+	const char *fname = BASEDIR "\\test_acl_other_conn.txt";
+	struct smb2_tree *tree2 = NULL;
+	struct smb2_create cr;
+	struct smb2_handle handle = {{0}};
+	union smb_fileinfo gi;
+	union smb_setfileinfo si;
+	struct security_descriptor *sd_read = NULL;
+	struct security_descriptor *sd_noread = NULL;
+	const char *owner_sid = NULL;
+	uint32_t attrib = 0;
+	NTSTATUS status;
+	bool ret = true;
+	int i;
+
+	smb2_deltree(tree, BASEDIR);
+
+	ret = smb2_util_setup_dir(tctx, tree, BASEDIR);
+	torture_assert_goto(tctx, ret, ret, done,
+			    "smb2_util_setup_dir failed\n");
+
+	ret = torture_smb2_connection(tctx, &tree2);
+	torture_assert_goto(tctx, ret, ret, done,
+			    "second connection failed\n");
+
+	cr = (struct smb2_create) {
+		.in.desired_access = SEC_STD_READ_CONTROL,
+		.in.file_attributes = FILE_ATTRIBUTE_NORMAL,
+		.in.share_access = NTCREATEX_SHARE_ACCESS_MASK,
+		.in.create_disposition = NTCREATEX_DISP_CREATE,
+		.in.impersonation_level = NTCREATEX_IMPERSONATION_ANONYMOUS,
+		.in.fname = fname,
+	};
+	status = smb2_create(tree, tctx, &cr);
+	torture_assert_ntstatus_ok_goto(tctx, status, ret, done,
+					"smb2_create failed\n");
+	handle = cr.out.file.handle;
+
+	gi = (union smb_fileinfo) {
+		.query_secdesc.level = RAW_FILEINFO_SEC_DESC,
+		.query_secdesc.in.file.handle = handle,
+		.query_secdesc.in.secinfo_flags = SECINFO_OWNER,
+	};
+	status = smb2_getinfo_file(tree, tctx, &gi);
+	torture_assert_ntstatus_ok_goto(tctx, status, ret, done,
+					"smb2_getinfo_file failed\n");
+	owner_sid = dom_sid_string(tctx, gi.query_secdesc.out.sd->owner_sid);
+
+	smb2_util_close(tree, handle);
+	ZERO_STRUCT(handle);
+
+	sd_read = security_descriptor_dacl_create(tctx, 0, NULL, NULL,
+					owner_sid,
+					SEC_ACE_TYPE_ACCESS_ALLOWED,
+					SEC_RIGHTS_FILE_ALL,
+					0,
+					NULL);
+	torture_assert_not_null_goto(tctx, sd_read, ret, done,
+				     "SD create failed\n");
+
+	sd_noread = security_descriptor_dacl_create(tctx, 0, NULL, NULL,
+					owner_sid,
+					SEC_ACE_TYPE_ACCESS_ALLOWED,
+					SEC_STD_READ_CONTROL |
+					SEC_STD_WRITE_DAC |
+					SEC_FILE_READ_ATTRIBUTE |
+					SEC_FILE_WRITE_ATTRIBUTE,
+					0,
+					NULL);
+	torture_assert_not_null_goto(tctx, sd_noread, ret, done,
+				     "SD create failed\n");
+
+	/*
+	 * Let the change time get old enough for the server to cache
+	 * what it reads, then open twice to make sure it has.
+	 */
+	smb_msleep(3000);
+
+	for (i = 0; i < 2; i++) {
+		status = open_other_conn_file(
+			tctx, tree, fname, SEC_FILE_READ_DATA, &attrib);
+		torture_assert_ntstatus_ok_goto(tctx, status, ret, done,
+						"open for reading failed\n");
+		torture_assert_int_equal_goto(
+			tctx, attrib & FILE_ATTRIBUTE_HIDDEN, 0,
+			ret, done, "file is hidden\n");
+	}
+
+	for (i = 0; i < 3; i++) {
+		cr = (struct smb2_create) {
+			.in.desired_access = SEC_STD_WRITE_DAC |
+				SEC_FILE_WRITE_ATTRIBUTE,
+			.in.file_attributes = FILE_ATTRIBUTE_NORMAL,
+			.in.share_access = NTCREATEX_SHARE_ACCESS_MASK,
+			.in.create_disposition = NTCREATEX_DISP_OPEN,
+			.in.impersonation_level =
+				NTCREATEX_IMPERSONATION_ANONYMOUS,
+			.in.fname = fname,
+		};
+		status = smb2_create(tree2, tctx, &cr);
+		torture_assert_ntstatus_ok_goto(tctx, status, ret, done,
+						"open on tree2 failed\n");
+		handle = cr.out.file.handle;
+
+		si = (union smb_setfileinfo) {
+			.set_secdesc.level = RAW_SFILEINFO_SEC_DESC,
+			.set_secdesc.in.file.handle = handle,
+			.set_secdesc.in.secinfo_flags = SECINFO_DACL,
+			.set_secdesc.in.sd = sd_noread,
+		};
+		status = smb2_setinfo_file(tree2, &si);
+		torture_assert_ntstatus_ok_goto(tctx, status, ret, done,
+						"setting the SD failed\n");
+
+		status = open_other_conn_file(
+			tctx, tree, fname, SEC_FILE_READ_DATA, NULL);
+		torture_assert_ntstatus_equal_goto(
+			tctx, status, NT_STATUS_ACCESS_DENIED,
+			ret, done, "read allowed after ACL change\n");
+
+		si.set_secdesc.in.sd = sd_read;
+		status = smb2_setinfo_file(tree2, &si);
+		torture_assert_ntstatus_ok_goto(tctx, status, ret, done,
+						"setting the SD failed\n");
+
+		status = open_other_conn_file(
+			tctx, tree, fname, SEC_FILE_READ_DATA, NULL);
+		torture_assert_ntstatus_ok_goto(
+			tctx, status, ret, done,
+			"read denied after ACL change\n");
+
+		si = (union smb_setfileinfo) {
+			.basic_info.level = RAW_SFILEINFO_BASIC_INFORMATION,
+			.basic_info.in.file.handle = handle,
+			.basic_info.in.attrib = (i % 2 == 0) ?
+				FILE_ATTRIBUTE_HIDDEN :
+				FILE_ATTRIBUTE_NORMAL,
+		};
+		status = smb2_setinfo_file(tree2, &si);
+		torture_assert_ntstatus_ok_goto(tctx, status, ret, done,
+						"setting attributes failed\n");
+
+		status = open_other_conn_file(
+			tctx, tree, fname, SEC_FILE_READ_ATTRIBUTE, &attrib);
+		torture_assert_ntstatus_ok_goto(tctx, status, ret, done,
+						"open failed\n");
+		torture_assert_int_equal_goto(
+			tctx,
+			attrib & FILE_ATTRIBUTE_HIDDEN,
+			(i % 2 == 0) ? FILE_ATTRIBUTE_HIDDEN : 0,
+			ret, done, "attribute change not seen\n");
+
+		smb2_util_close(tree2, handle);
+		ZERO_STRUCT(handle);
+	}
+
+done:
+	if (!smb2_util_handle_empty(handle)) {
+		smb2_util_close(tree2, handle);
+	}
+	TALLOC_FREE(tree2);
+	smb2_deltree(tree, BASEDIR);
+	return ret;
+}
+
 static bool test_overwrite_read_only_file(struct torture_context *tctx,
 					  struct smb2_tree *tree)
 {
@@ -3160,6 +3360,7 @@ struct torture_suite *torture_smb2_acls_init(TALLOC_CTX *ctx)
 	torture_suite_add_1smb2_test(suite, "MXAC-NOT-GRANTED",
 			test_mxac_not_granted);
 	torture_suite_add_1smb2_test(suite, "OVERWRITE_READ_ONLY_FILE", test_overwrite_read_only_file);
+	torture_suite_add_1smb2_test(suite, "ACL-OTHER-CONN", test_acl_other_conn);
 
 	suite->description = talloc_strdup(suite, "SMB2-ACLS tests");
 
@@ -28,6 +28,7 @@
 #include "torture/util.h"
 #include "torture/smb2/proto.h"
 #include "librpc/gen_ndr/ndr_security.h"
+#include "librpc/gen_ndr/ndr_ioctl.h"
 #include "libcli/security/security.h"
 
 #include "system/filesys.h"
@@ -963,6 +964,7 @@ struct test_smb2_bench_read_state {
 	struct test_smb2_bench_read_loop *loops;
 	size_t pending_loops;
 	uint32_t io_size;
+	uint64_t file_size;
 	struct timeval starttime;
 	int timecount;
 	int timelimit;
@@ -987,6 +989,7 @@ struct test_smb2_bench_read_loop {
 	struct tevent_immediate *im;
 	char *fname;
 	struct smb2_handle handle;
+	uint64_t offset;
 	struct tevent_req *req;
 	struct timeval starttime;
 	uint64_t num_started;
@@ -1032,7 +1035,7 @@ static void test_smb2_bench_read_loop_do(
 				      loop->conn->tree->session->smbXcli,
 				      loop->conn->tree->smbXcli,
 				      state->io_size, /* length */
-				      0,              /* offset */
+				      loop->offset,   /* offset */
 				      loop->handle.data[0],/* fid_persistent */
 				      loop->handle.data[1],/* fid_volatile */
 				      state->io_size, /* minimum_count */
@@ -1074,6 +1077,11 @@ static void test_smb2_bench_read_loop_done(struct tevent_req *req)
 		loop->max_latency = latency;
 	}
 
+	loop->offset += state->io_size;
+	if (loop->offset + state->io_size > state->file_size) {
+		loop->offset = 0;
+	}
+
 	loop->num_finished += 1;
 	loop->total_finished += 1;
 	loop->total_latency += latency;
@@ -1200,14 +1208,19 @@ asserted:
 	state->stop = true;
 }
 
-static bool test_smb2_bench_read(struct torture_context *tctx,
-			         struct smb2_tree *tree)
+static bool test_smb2_bench_read_common(struct torture_context *tctx,
+					struct smb2_tree *tree,
+					int default_io_size,
+					int default_num_ios)
 {
 	struct test_smb2_bench_read_state *state = NULL;
 	bool ret = true;
 	int torture_nprocs = torture_setting_int(tctx, "nprocs", 4);
 	int torture_qdepth = torture_setting_int(tctx, "qdepth", 1);
-	int torture_io_size = torture_setting_int(tctx, "io_size", 4096);
+	int torture_io_size = torture_setting_int(tctx, "io_size",
+						  default_io_size);
+	int torture_num_ios = torture_setting_int(tctx, "num_ios",
+						  default_num_ios);
 	size_t i;
 	size_t li = 0;
 	int looplimit = torture_setting_int(tctx, "looplimit", -1);
@@ -1243,6 +1256,7 @@ static bool test_smb2_bench_read(struct torture_context *tctx,
 	state->timelimit = MAX(timelimit, 1);
 	state->io_size = MAX(torture_io_size, 1);
 	state->io_size = MIN(state->io_size, 16*1024*1024);
+	state->file_size = (uint64_t)state->io_size * MAX(torture_num_ios, 1);
 
 	timeout_msec = tree->session->transport->options.request_timeout * 1000;
 
@@ -1307,7 +1321,7 @@ static bool test_smb2_bench_read(struct torture_context *tctx,
 			/* reasonable default parameters */
 			ZERO_STRUCT(cr);
 			cr.in.create_flags = NTCREATEX_FLAGS_EXTENDED;
-			cr.in.alloc_size = state->io_size;
+			cr.in.alloc_size = state->file_size;
 			cr.in.desired_access = SEC_RIGHTS_FILE_ALL;
 			cr.in.file_attributes = FILE_ATTRIBUTE_NORMAL;
 			cr.in.share_access = NTCREATEX_SHARE_ACCESS_NONE;
@@ -1325,7 +1339,7 @@ static bool test_smb2_bench_read(struct torture_context *tctx,
 			ZERO_STRUCT(sfinfo);
 			sfinfo.end_of_file_info.level = RAW_SFILEINFO_END_OF_FILE_INFORMATION;
 			sfinfo.end_of_file_info.in.file.handle = loop->handle;
-			sfinfo.end_of_file_info.in.size = state->io_size;
+			sfinfo.end_of_file_info.in.size = state->file_size;
 			status = smb2_setinfo_file(state->conns[i].tree, &sfinfo);
 			CHECK_STATUS(status, NT_STATUS_OK);
 
@@ -1362,6 +1376,26 @@ static bool test_smb2_bench_read(struct torture_context *tctx,
 	return ret;
 }
 
+static bool test_smb2_bench_read(struct torture_context *tctx,
+				 struct smb2_tree *tree)
+{
+	return test_smb2_bench_read_common(tctx, tree, 4096, 1);
+}
+
+/*
+   stress testing large sequential reads
+
+   Every loop reads its own file of num_ios * io_size bytes
+   from the start to the end and starts again. Running it
+   against a server with and without "smb2 io uring = yes"
+   compares the READ paths.
+ */
+static bool test_smb2_bench_read_sequential(struct torture_context *tctx,
+					    struct smb2_tree *tree)
+{
+	return test_smb2_bench_read_common(tctx, tree, 1024*1024, 64);
+}
+
 /*
    stress testing session setups
  */
@@ -1837,6 +1871,1386 @@ static bool test_smb2_bench_session_setup(struct torture_context *tctx,
 	return ret;
 }
 
+/*
+   stress testing related compound CREATE/GETINFO/CLOSE iops
+ */
+
+struct test_smb2_bench_compound_conn;
+struct test_smb2_bench_compound_loop;
+
+struct test_smb2_bench_compound_state {
+	struct torture_context *tctx;
+	const char *fname;
+	size_t num_conns;
+	struct test_smb2_bench_compound_conn *conns;
+	size_t num_loops;
+	struct test_smb2_bench_compound_loop *loops;
+	size_t pending_loops;
+	struct timeval starttime;
+	int timecount;
+	int timelimit;
+	uint64_t num_finished;
+	double total_latency;
+	double min_latency;
+	double max_latency;
+	bool ok;
+	bool stop;
+};
+
+struct test_smb2_bench_compound_conn {
+	struct test_smb2_bench_compound_state *state;
+	int idx;
+	struct smb2_tree *tree;
+};
+
+struct test_smb2_bench_compound_loop {
+	struct test_smb2_bench_compound_state *state;
+	struct test_smb2_bench_compound_conn *conn;
+	int idx;
+	struct tevent_immediate *im;
+	struct {
+		struct smb2_create io;
+		struct smb2_request *req;
+	} opens;
+	struct {
+		struct smb2_getinfo io;
+		struct smb2_request *req;
+	} getinfos;
+	struct {
+		struct smb2_close io;
+		struct smb2_request *req;
+	} closes;
+	struct timeval starttime;
+	uint64_t num_started;
+	uint64_t num_finished;
+	uint64_t total_finished;
+	uint64_t max_finished;
+	double total_latency;
+	double min_latency;
+	double max_latency;
+	NTSTATUS error;
+};
+
+static void test_smb2_bench_compound_loop_do(
+	struct test_smb2_bench_compound_loop *loop);
+
+static void test_smb2_bench_compound_loop_start(struct tevent_context *ctx,
+						struct tevent_immediate *im,
+						void *private_data)
+{
+	struct test_smb2_bench_compound_loop *loop =
+		(struct test_smb2_bench_compound_loop *)
+		private_data;
+
+	test_smb2_bench_compound_loop_do(loop);
+}
+
+static void test_smb2_bench_compound_loop_done(struct smb2_request *req);
+
+static void test_smb2_bench_compound_loop_do(
+	struct test_smb2_bench_compound_loop *loop)
+{
+	struct test_smb2_bench_compound_state *state = loop->state;
+	struct smb2_tree *tree = loop->conn->tree;
+	struct smb2_transport *transport = tree->session->transport;
+	struct smb2_handle h = {
+		.data = { UINT64_MAX, UINT64_MAX },
+	};
+	NTSTATUS status;
+
+	loop->num_started += 1;
+	loop->starttime = timeval_current();
+
+	status = smb2_transport_compound_start(transport, 3);
+	torture_assert_ntstatus_ok_goto(state->tctx, status,
+					state->ok, asserted,
+					"smb2_transport_compound_start");
+
+	loop->opens.io = (struct smb2_create) {
+		.in.desired_access = SEC_FILE_READ_ATTRIBUTE,
+		.in.file_attributes = FILE_ATTRIBUTE_NORMAL,
+		.in.share_access = NTCREATEX_SHARE_ACCESS_MASK,
+		.in.create_disposition = NTCREATEX_DISP_OPEN,
+		.in.impersonation_level = SMB2_IMPERSONATION_IMPERSONATION,
+		.in.fname = state->fname,
+	};
+	loop->opens.req = smb2_create_send(tree, &loop->opens.io);
+	torture_assert_goto(state->tctx, loop->opens.req != NULL,
+			    state->ok, asserted, "smb2_create_send");
+
+	smb2_transport_compound_set_related(transport, true);
+
+	loop->getinfos.io = (struct smb2_getinfo) {
+		.in.info_type = SMB2_0_INFO_FILE,
+		.in.info_class = 0x12, /* FileAllInformation */
+		.in.output_buffer_length = 0x1000,
+		.in.file.handle = h,
+	};
+	loop->getinfos.req = smb2_getinfo_send(tree, &loop->getinfos.io);
+	torture_assert_goto(state->tctx, loop->getinfos.req != NULL,
+			    state->ok, asserted, "smb2_getinfo_send");
+
+	loop->closes.io = (struct smb2_close) {
+		.in.file.handle = h,
+	};
+	loop->closes.req = smb2_close_send(tree, &loop->closes.io);
+	torture_assert_goto(state->tctx, loop->closes.req != NULL,
+			    state->ok, asserted, "smb2_close_send");
+
+	smb2_transport_compound_set_related(transport, false);
+
+	/*
+	 * The responses arrive in one compound, so the
+	 * CREATE and GETINFO replies are already there
+	 * once the CLOSE reply is processed.
+	 */
+	loop->closes.req->async.fn = test_smb2_bench_compound_loop_done;
+	loop->closes.req->async.private_data = loop;
+	return;
+asserted:
+	state->stop = true;
+}
+
+static void test_smb2_bench_compound_loop_done(struct smb2_request *req)
+{
+	struct test_smb2_bench_compound_loop *loop =
+		(struct test_smb2_bench_compound_loop *)
+		req->async.private_data;
+	struct test_smb2_bench_compound_state *state = loop->state;
+	double latency = timeval_elapsed(&loop->starttime);
+	TALLOC_CTX *frame = talloc_stackframe();
+
+	torture_assert_goto(state->tctx, loop->closes.req == req,
+			    state->ok, asserted, __location__);
+	loop->error = smb2_create_recv(loop->opens.req, frame,
+				       &loop->opens.io);
+	loop->opens.req = NULL;
+	torture_assert_ntstatus_ok_goto(state->tctx, loop->error,
+					state->ok, asserted, __location__);
+	loop->error = smb2_getinfo_recv(loop->getinfos.req, frame,
+					&loop->getinfos.io);
+	loop->getinfos.req = NULL;
+	torture_assert_ntstatus_ok_goto(state->tctx, loop->error,
+					state->ok, asserted, __location__);
+	loop->error = smb2_close_recv(req, &loop->closes.io);
+	loop->closes.req = NULL;
+	torture_assert_ntstatus_ok_goto(state->tctx, loop->error,
+					state->ok, asserted, __location__);
+	SMB_ASSERT(latency >= 0.000001);
+
+	if (loop->num_finished == 0) {
+		/* first round */
+		loop->min_latency = latency;
+		loop->max_latency = latency;
+	}
+
+	loop->num_finished += 1;
+	loop->total_finished += 1;
+	loop->total_latency += latency;
+
+	if (latency < loop->min_latency) {
+		loop->min_latency = latency;
+	}
+
+	if (latency > loop->max_latency) {
+		loop->max_latency = latency;
+	}
+
+	if (loop->total_finished >= loop->max_finished) {
+		if (state->pending_loops > 0) {
+			state->pending_loops -= 1;
+		}
+		if (state->pending_loops == 0) {
+			goto asserted;
+		}
+	}
+
+	TALLOC_FREE(frame);
+	test_smb2_bench_compound_loop_do(loop);
+	return;
+asserted:
+	state->stop = true;
+	TALLOC_FREE(frame);
+}
+
+static void test_smb2_bench_compound_progress(struct tevent_context *ev,
+					      struct tevent_timer *te,
+					      struct timeval current_time,
+					      void *private_data)
+{
+	struct test_smb2_bench_compound_state *state =
+		(struct test_smb2_bench_compound_state *)private_data;
+	uint64_t num_compounds = 0;
+	double total_compound_latency = 0;
+	double min_compound_latency = 0;
+	double max_compound_latency = 0;
+	double avs_compound_latency = 0;
+	size_t i;
+
+	state->timecount += 1;
+
+	for (i=0;i<state->num_loops;i++) {
+		struct test_smb2_bench_compound_loop *loop =
+			&state->loops[i];
+
+		num_compounds += loop->num_finished;
+		total_compound_latency += loop->total_latency;
+		if (min_compound_latency == 0.0 && loop->min_latency != 0.0) {
+			min_compound_latency = loop->min_latency;
+		}
+		if (loop->min_latency < min_compound_latency) {
+			min_compound_latency = loop->min_latency;
+		}
+		if (max_compound_latency == 0.0) {
+			max_compound_latency = loop->max_latency;
+		}
+		if (loop->max_latency > max_compound_latency) {
+			max_compound_latency = loop->max_latency;
+		}
+		loop->num_finished = 0;
+		loop->total_latency = 0.0;
+	}
+
+	state->num_finished += num_compounds;
+	state->total_latency += total_compound_latency;
+	if (state->min_latency == 0.0 && min_compound_latency != 0.0) {
+		state->min_latency = min_compound_latency;
+	}
+	if (min_compound_latency < state->min_latency) {
+		state->min_latency = min_compound_latency;
+	}
+	if (state->max_latency == 0.0) {
+		state->max_latency = max_compound_latency;
+	}
+	if (max_compound_latency > state->max_latency) {
+		state->max_latency = max_compound_latency;
+	}
+
+	if (state->timecount < state->timelimit) {
+		te = tevent_add_timer(state->tctx->ev,
+				      state,
+				      timeval_current_ofs(1, 0),
+				      test_smb2_bench_compound_progress,
+				      state);
+		torture_assert_goto(state->tctx, te != NULL,
+				    state->ok, asserted, "tevent_add_timer");
+
+		if (!torture_setting_bool(state->tctx, "progress", true)) {
+			return;
+		}
+
+		avs_compound_latency = total_compound_latency / num_compounds;
+
+		torture_comment(state->tctx,
+				"%.2f second: "
+				"compound[num/s=%llu,avslat=%.6f,minlat=%.6f,maxlat=%.6f]      \r",
+				timeval_elapsed(&state->starttime),
+				(unsigned long long)num_compounds,
+				avs_compound_latency,
+				min_compound_latency,
+				max_compound_latency);
+		return;
+	}
+
+	avs_compound_latency = state->total_latency / state->num_finished;
+	num_compounds = state->num_finished / state->timelimit;
+
+	torture_comment(state->tctx,
+			"%.2f second: "
+			"compound[num/s=%llu,avslat=%.6f,minlat=%.6f,maxlat=%.6f]\n",
+			timeval_elapsed(&state->starttime),
+			(unsigned long long)num_compounds,
+			avs_compound_latency,
+			state->min_latency,
+			state->max_latency);
+
+asserted:
+	state->stop = true;
+}
+
+static bool test_smb2_bench_compound(struct torture_context *tctx,
+				     struct smb2_tree *tree)
+{
+	struct test_smb2_bench_compound_state *state = NULL;
+	bool ret = true;
+	int torture_nprocs = torture_setting_int(tctx, "nprocs", 4);
+	int torture_qdepth = torture_setting_int(tctx, "qdepth", 1);
+	size_t i;
+	size_t li = 0;
+	int looplimit = torture_setting_int(tctx, "looplimit", -1);
+	int timelimit = torture_setting_int(tctx, "timelimit", 10);
+	struct tevent_timer *te = NULL;
+	const char *fname = "bench_compound.dat";
+	struct smb2_handle fh;
+	NTSTATUS status;
+
+	smb2_util_unlink(tree, fname);
+
+	status = torture_smb2_testfile(tree, fname, &fh);
+	CHECK_STATUS(status, NT_STATUS_OK);
+	status = smb2_util_close(tree, fh);
+	CHECK_STATUS(status, NT_STATUS_OK);
+
+	state = talloc_zero(tctx, struct test_smb2_bench_compound_state);
+	torture_assert(tctx, state != NULL, __location__);
+	state->tctx = tctx;
+	state->fname = fname;
+	state->num_conns = torture_nprocs;
+	state->conns = talloc_zero_array(state,
+			struct test_smb2_bench_compound_conn,
+			state->num_conns);
+	torture_assert(tctx, state->conns != NULL, __location__);
+	state->num_loops = torture_nprocs * torture_qdepth;
+	state->loops = talloc_zero_array(state,
+			struct test_smb2_bench_compound_loop,
+			state->num_loops);
+	torture_assert(tctx, state->loops != NULL, __location__);
+	state->ok = true;
+	state->timelimit = MAX(timelimit, 1);
+
+	torture_comment(tctx, "Opening %zu connections\n", state->num_conns);
+
+	for (i=0;i<state->num_conns;i++) {
+		struct smb2_tree *ct = NULL;
+		size_t pcli;
+
+		state->conns[i].state = state;
+		state->conns[i].idx = i;
+
+		if (!torture_smb2_connection(tctx, &ct)) {
+			torture_comment(tctx, "Failed opening %zu/%zu connections\n", i, state->num_conns);
+			return false;
+		}
+		state->conns[i].tree = talloc_steal(state->conns, ct);
+
+		smb2cli_conn_set_max_credits(ct->session->transport->conn, 8192);
+
+		for (pcli = 0; pcli < torture_qdepth; pcli++) {
+			struct test_smb2_bench_compound_loop *loop = &state->loops[li];
+
+			loop->idx = li++;
+			if (looplimit != -1) {
+				loop->max_finished = looplimit;
+			} else {
+				loop->max_finished = UINT64_MAX;
+			}
+			loop->state = state;
+			loop->conn = &state->conns[i];
+			loop->im = tevent_create_immediate(state->loops);
+			torture_assert(tctx, loop->im != NULL, __location__);
+
+			tevent_schedule_immediate(loop->im,
+						  tctx->ev,
+						  test_smb2_bench_compound_loop_start,
+						  loop);
+		}
+	}
+
+	torture_comment(tctx, "Opened %zu connections with qdepth=%d => %zu loops\n",
+			state->num_conns, torture_qdepth, state->num_loops);
+
+	torture_comment(tctx, "Running for %d seconds\n", state->timelimit);
+
+	state->starttime = timeval_current();
+	state->pending_loops = state->num_loops;
+
+	te = tevent_add_timer(tctx->ev,
+			      state,
+			      timeval_current_ofs(1, 0),
+			      test_smb2_bench_compound_progress,
+			      state);
+	torture_assert(tctx, te != NULL, __location__);
+
+	while (!state->stop) {
+		int rc = tevent_loop_once(tctx->ev);
+		torture_assert_int_equal(tctx, rc, 0, "tevent_loop_once");
+	}
+
+	torture_comment(tctx, "%.2f seconds\n", timeval_elapsed(&state->starttime));
+	ret = state->ok;
+	TALLOC_FREE(state);
+	smb2_util_unlink(tree, fname);
+	return ret;
+}
+
+/*
+   measure the directory enumeration rate in entries per second
+ */
+
+static bool test_smb2_bench_find(struct torture_context *tctx,
+				 struct smb2_tree *tree)
+{
+	TALLOC_CTX *mem_ctx = talloc_new(tctx);
+	int num_files = torture_setting_int(tctx, "num_files", 10000);
+	int timelimit = torture_setting_int(tctx, "timelimit", 10);
+	const char *dname = "bench_find_dir";
+	struct smb2_handle dh = {};
+	struct timeval starttime;
+	uint64_t num_listings = 0;
+	uint64_t num_entries = 0;
+	double total_latency = 0;
+	double min_latency = 0;
+	double max_latency = 0;
+	double elapsed;
+	bool ret = true;
+	NTSTATUS status;
+	int i;
+
+	torture_assert(tctx, mem_ctx != NULL, __location__);
+	num_files = MAX(num_files, 1);
+	timelimit = MAX(timelimit, 1);
+
+	smb2_deltree(tree, dname);
+
+	status = torture_smb2_testdir(tree, dname, &dh);
+	CHECK_STATUS(status, NT_STATUS_OK);
+
+	torture_comment(tctx, "Creating %d files\n", num_files);
+
+	for (i = 0; i < num_files; i++) {
+		char *fname = NULL;
+		struct smb2_handle fh;
+
+		fname = talloc_asprintf(mem_ctx, "%s\\file%08d", dname, i);
+		torture_assert_goto(tctx, fname != NULL,
+				    ret, done, "talloc_asprintf");
+		status = torture_smb2_testfile(tree, fname, &fh);
+		torture_assert_ntstatus_ok_goto(tctx, status,
+						ret, done, "create");
+		status = smb2_util_close(tree, fh);
+		torture_assert_ntstatus_ok_goto(tctx, status,
+						ret, done, "close");
+		TALLOC_FREE(fname);
+	}
+
+	torture_comment(tctx, "Running for %d seconds\n", timelimit);
+
+	starttime = timeval_current();
+
+	while (timeval_elapsed(&starttime) < timelimit) {
+		struct smb2_find f = {
+			.in.file.handle = dh,
+			.in.pattern = "*",
+			.in.continue_flags = SMB2_CONTINUE_FLAG_RESTART,
+			.in.max_response_size = 0x10000,
+			.in.level = SMB2_FIND_ID_BOTH_DIRECTORY_INFO,
+		};
+		struct timeval listing_start = timeval_current();
+		uint64_t num_listed = 0;
+		unsigned int count = 0;
+		double latency;
+
+		do {
+			TALLOC_CTX *frame = talloc_stackframe();
+			union smb_search_data *d = NULL;
+
+			status = smb2_find_level(tree, frame, &f, &count, &d);
+			TALLOC_FREE(frame);
+			if (NT_STATUS_EQUAL(status, STATUS_NO_MORE_FILES)) {
+				break;
+			}
+			torture_assert_ntstatus_ok_goto(tctx, status,
+							ret, done, "find");
+			num_listed += count;
+			f.in.continue_flags = 0;
+		} while (count != 0);
+
+		latency = timeval_elapsed(&listing_start);
+
+		/* all files plus . and .. */
+		torture_assert_u64_equal_goto(tctx,
+					      num_listed,
+					      (uint64_t)num_files + 2,
+					      ret, done,
+					      "number of entries");
+
+		if (num_listings == 0 || latency < min_latency) {
+			min_latency = latency;
+		}
+		if (latency > max_latency) {
+			max_latency = latency;
+		}
+		total_latency += latency;
+		num_listings += 1;
+		num_entries += num_listed;
+
+		if (torture_setting_bool(tctx, "progress", true)) {
+			torture_comment(tctx,
+					"%.2f second: "
+					"find[listings=%llu,entries/s=%.0f]      \r",
+					timeval_elapsed(&starttime),
+					(unsigned long long)num_listings,
+					num_entries / timeval_elapsed(&starttime));
+		}
+	}
+
+	elapsed = timeval_elapsed(&starttime);
+
+	torture_comment(tctx,
+			"%.2f second: "
+			"find[listings=%llu,entries/s=%.0f,"
+			"avslat=%.6f,minlat=%.6f,maxlat=%.6f]\n",
+			elapsed,
+			(unsigned long long)num_listings,
+			num_entries / elapsed,
+			total_latency / num_listings,
+			min_latency,
+			max_latency);
+
+done:
+	smb2_util_close(tree, dh);
+	smb2_deltree(tree, dname);
+	TALLOC_FREE(mem_ctx);
+	return ret;
+}
+
+/*
+   measure the create rate while a directory grows, with a
+   case-insensitive name lookup for every new file it should not
+   depend on the number of files already in the directory
+ */
+
+static bool test_smb2_bench_create_dir(struct torture_context *tctx,
+				       struct smb2_tree *tree)
+{
+	TALLOC_CTX *mem_ctx = talloc_new(tctx);
+	int num_files = torture_setting_int(tctx, "num_files", 20000);
+	int num_steps = torture_setting_int(tctx, "num_steps", 10);
+	const char *dname = "bench_create_dir";
+	struct smb2_handle dh = {};
+	struct timeval starttime;
+	struct timeval steptime;
+	double first_rate = 0;
+	double last_rate = 0;
+	int step_size;
+	bool ret = true;
+	NTSTATUS status;
+	int i;
+
+	torture_assert(tctx, mem_ctx != NULL, __location__);
+	num_steps = MAX(num_steps, 1);
+	num_files = MAX(num_files, num_steps);
+	step_size = num_files / num_steps;
+
+	smb2_deltree(tree, dname);
+
+	status = torture_smb2_testdir(tree, dname, &dh);
+	CHECK_STATUS(status, NT_STATUS_OK);
+
+	torture_comment(tctx,
+			"Creating %d files in %d steps\n",
+			num_files,
+			num_steps);
+
+	starttime = timeval_current();
+	steptime = starttime;
+
+	for (i = 0; i < step_size * num_steps; i++) {
+		char *fname = NULL;
+		struct smb2_handle fh;
+		double rate;
+
+		fname = talloc_asprintf(mem_ctx,
+					"%s\\File%08d.Dat",
+					dname,
+					i);
+		torture_assert_goto(tctx, fname != NULL,
+				    ret, done, "talloc_asprintf");
+		status = torture_smb2_testfile(tree, fname, &fh);
+		torture_assert_ntstatus_ok_goto(tctx, status,
+						ret, done, "create");
+		status = smb2_util_close(tree, fh);
+		torture_assert_ntstatus_ok_goto(tctx, status,
+						ret, done, "close");
+		TALLOC_FREE(fname);
+
+		if (((i + 1) % step_size) != 0) {
+			continue;
+		}
+
+		rate = step_size / timeval_elapsed(&steptime);
+		if (i + 1 == step_size) {
+			first_rate = rate;
+		}
+		last_rate = rate;
+
+		torture_comment(tctx,
+				"%.2f second: "
+				"create[files=%d,creates/s=%.0f]\n",
+				timeval_elapsed(&starttime),
+				i + 1,
+				rate);
+		steptime = timeval_current();
+	}
+
+	torture_comment(tctx,
+			"%.2f second: "
+			"create[files=%d,creates/s=%.0f,"
+			"last/first=%.2f]\n",
+			timeval_elapsed(&starttime),
+			step_size * num_steps,
+			(step_size * num_steps) /
+				timeval_elapsed(&starttime),
+			last_rate / first_rate);
+
+done:
+	smb2_util_close(tree, dh);
+	smb2_deltree(tree, dname);
+	TALLOC_FREE(mem_ctx);
+	return ret;
+}
+
+/*
+   measure open/read/close cycles per second on a few small files
+   opened without oplocks, and check that a conflicting open from
+   another connection is not blocked afterwards
+ */
+
+static bool test_smb2_bench_open_close(struct torture_context *tctx,
+				       struct smb2_tree *tree)
+{
+	TALLOC_CTX *mem_ctx = talloc_new(tctx);
+	int num_files = torture_setting_int(tctx, "num_files", 16);
+	int timelimit = torture_setting_int(tctx, "timelimit", 10);
+	const char *dname = "bench_open_close";
+	struct smb2_tree *tree2 = NULL;
+	struct smb2_handle dh = {};
+	struct smb2_create io;
+	struct timeval starttime;
+	uint64_t num_cycles = 0;
+	double total_latency = 0;
+	double min_latency = 0;
+	double max_latency = 0;
+	double elapsed;
+	bool ret = true;
+	NTSTATUS status;
+	int i;
+
+	torture_assert(tctx, mem_ctx != NULL, __location__);
+	num_files = MAX(num_files, 1);
+	timelimit = MAX(timelimit, 1);
+
+	smb2_deltree(tree, dname);
+
+	status = torture_smb2_testdir(tree, dname, &dh);
+	CHECK_STATUS(status, NT_STATUS_OK);
+
+	torture_comment(tctx, "Creating %d files\n", num_files);
+
+	for (i = 0; i < num_files; i++) {
+		char *fname = NULL;
+		struct smb2_handle fh;
+
+		fname = talloc_asprintf(mem_ctx, "%s\\file%04d", dname, i);
+		torture_assert_goto(tctx, fname != NULL,
+				    ret, done, "talloc_asprintf");
+		status = torture_smb2_testfile(tree, fname, &fh);
+		torture_assert_ntstatus_ok_goto(tctx, status,
+						ret, done, "create");
+		status = smb2_util_write(tree, fh, "data", 0, 4);
+		torture_assert_ntstatus_ok_goto(tctx, status,
+						ret, done, "write");
+		status = smb2_util_close(tree, fh);
+		torture_assert_ntstatus_ok_goto(tctx, status,
+						ret, done, "close");
+		TALLOC_FREE(fname);
+	}
+
+	torture_comment(tctx, "Running for %d seconds\n", timelimit);
+
+	starttime = timeval_current();
+
+	while (timeval_elapsed(&starttime) < timelimit) {
+		TALLOC_CTX *frame = talloc_stackframe();
+		struct timeval cycle_start = timeval_current();
+		struct smb2_read rd;
+		double latency;
+
+		io = (struct smb2_create) {
+			.in.desired_access = SEC_RIGHTS_FILE_READ,
+			.in.share_access = NTCREATEX_SHARE_ACCESS_READ |
+					   NTCREATEX_SHARE_ACCESS_WRITE,
+			.in.create_disposition = NTCREATEX_DISP_OPEN,
+			.in.impersonation_level =
+				SMB2_IMPERSONATION_IMPERSONATION,
+			.in.oplock_level = SMB2_OPLOCK_LEVEL_NONE,
+			.in.fname = talloc_asprintf(frame,
+						    "%s\\file%04d",
+						    dname,
+						    (int)(num_cycles %
+							  num_files)),
+		};
+		torture_assert_goto(tctx, io.in.fname != NULL,
+				    ret, done, "talloc_asprintf");
+
+		status = smb2_create(tree, frame, &io);
+		torture_assert_ntstatus_ok_goto(tctx, status,
+						ret, done, "open");
+
+		rd = (struct smb2_read) {
+			.in.file.handle = io.out.file.handle,
+			.in.length = 4,
+		};
+		status = smb2_read(tree, frame, &rd);
+		torture_assert_ntstatus_ok_goto(tctx, status,
+						ret, done, "read");
+
+		status = smb2_util_close(tree, io.out.file.handle);
+		torture_assert_ntstatus_ok_goto(tctx, status,
+						ret, done, "close");
+		TALLOC_FREE(frame);
+
+		latency = timeval_elapsed(&cycle_start);
+		if (num_cycles == 0 || latency < min_latency) {
+			min_latency = latency;
+		}
+		if (latency > max_latency) {
+			max_latency = latency;
+		}
+		total_latency += latency;
+		num_cycles += 1;
+
+		if (torture_setting_bool(tctx, "progress", true) &&
+		    ((num_cycles % 100) == 0))
+		{
+			torture_comment(tctx,
+					"%.2f second: "
+					"open-close[cycles=%llu,"
+					"cycles/s=%.0f]      \r",
+					timeval_elapsed(&starttime),
+					(unsigned long long)num_cycles,
+					num_cycles /
+					timeval_elapsed(&starttime));
+		}
+	}
+
+	elapsed = timeval_elapsed(&starttime);
+
+	torture_comment(tctx,
+			"%.2f second: "
+			"open-close[cycles=%llu,cycles/s=%.0f,"
+			"avslat=%.6f,minlat=%.6f,maxlat=%.6f]\n",
+			elapsed,
+			(unsigned long long)num_cycles,
+			num_cycles / elapsed,
+			total_latency / num_cycles,
+			min_latency,
+			max_latency);
+
+	/*
+	 * Handles the server still keeps open for us must not
+	 * get in the way of an exclusive open from elsewhere.
+	 */
+	torture_assert_goto(tctx, torture_smb2_connection(tctx, &tree2),
+			    ret, done, "second connection");
+
+	io = (struct smb2_create) {
+		.in.desired_access = SEC_RIGHTS_FILE_ALL,
+		.in.share_access = NTCREATEX_SHARE_ACCESS_NONE,
+		.in.create_disposition = NTCREATEX_DISP_OPEN,
+		.in.impersonation_level = SMB2_IMPERSONATION_IMPERSONATION,
+		.in.oplock_level = SMB2_OPLOCK_LEVEL_NONE,
+		.in.fname = talloc_asprintf(mem_ctx,
+					    "%s\\file%04d",
+					    dname,
+					    (int)((num_cycles - 1) % num_files)),
+	};
+	torture_assert_goto(tctx, io.in.fname != NULL,
+			    ret, done, "talloc_asprintf");
+
+	status = smb2_create(tree2, mem_ctx, &io);
+	torture_assert_ntstatus_ok_goto(tctx, status,
+					ret, done, "exclusive open");
+	smb2_util_close(tree2, io.out.file.handle);
+
+done:
+	TALLOC_FREE(tree2);
+	smb2_util_close(tree, dh);
+	smb2_deltree(tree, dname);
+	TALLOC_FREE(mem_ctx);
+	return ret;
+}
+
+/*
+   measure create/close cycles per second of new files with delete
+   on close. These are exclusive creates, which "aio_pthread:aio open"
+   and "io_uring:openat" run asynchronously
+ */
+
+static bool test_smb2_bench_create_delete(struct torture_context *tctx,
+					  struct smb2_tree *tree)
+{
+	TALLOC_CTX *mem_ctx = talloc_new(tctx);
+	int timelimit = torture_setting_int(tctx, "timelimit", 10);
+	const char *dname = "bench_create_delete";
+	struct smb2_handle dh = {};
+	struct timeval starttime;
+	uint64_t num_cycles = 0;
+	double total_latency = 0;
+	double min_latency = 0;
+	double max_latency = 0;
+	double elapsed;
+	bool ret = true;
+	NTSTATUS status;
+
+	torture_assert(tctx, mem_ctx != NULL, __location__);
+	timelimit = MAX(timelimit, 1);
+
+	smb2_deltree(tree, dname);
+
+	status = torture_smb2_testdir(tree, dname, &dh);
+	CHECK_STATUS(status, NT_STATUS_OK);
+
+	torture_comment(tctx, "Running for %d seconds\n", timelimit);
+
+	starttime = timeval_current();
+
+	while (timeval_elapsed(&starttime) < timelimit) {
+		TALLOC_CTX *frame = talloc_stackframe();
+		struct timeval cycle_start = timeval_current();
+		struct smb2_create io;
+		double latency;
+
+		io = (struct smb2_create) {
+			.in.desired_access = SEC_RIGHTS_FILE_ALL,
+			.in.file_attributes = FILE_ATTRIBUTE_NORMAL,
+			.in.share_access = NTCREATEX_SHARE_ACCESS_NONE,
+			.in.create_disposition = NTCREATEX_DISP_CREATE,
+			.in.create_options =
+				NTCREATEX_OPTIONS_DELETE_ON_CLOSE |
+				NTCREATEX_OPTIONS_NON_DIRECTORY_FILE,
+			.in.impersonation_level =
+				SMB2_IMPERSONATION_IMPERSONATION,
+			.in.oplock_level = SMB2_OPLOCK_LEVEL_NONE,
+			.in.fname = talloc_asprintf(frame,
+						    "%s\\file%llu",
+						    dname,
+						    (unsigned long long)
+						    num_cycles),
+		};
+		torture_assert_goto(tctx, io.in.fname != NULL,
+				    ret, done, "talloc_asprintf");
+
+		status = smb2_create(tree, frame, &io);
+		torture_assert_ntstatus_ok_goto(tctx, status,
+						ret, done, "create");
+
+		status = smb2_util_close(tree, io.out.file.handle);
+		torture_assert_ntstatus_ok_goto(tctx, status,
+						ret, done, "close");
+		TALLOC_FREE(frame);
+
+		latency = timeval_elapsed(&cycle_start);
+		if (num_cycles == 0 || latency < min_latency) {
+			min_latency = latency;
+		}
+		if (latency > max_latency) {
+			max_latency = latency;
+		}
+		total_latency += latency;
+		num_cycles += 1;
+
+		if (torture_setting_bool(tctx, "progress", true) &&
+		    ((num_cycles % 100) == 0))
+		{
+			torture_comment(tctx,
+					"%.2f second: "
+					"create-delete[cycles=%llu,"
+					"cycles/s=%.0f]      \r",
+					timeval_elapsed(&starttime),
+					(unsigned long long)num_cycles,
+					num_cycles /
+					timeval_elapsed(&starttime));
+		}
+	}
+
+	elapsed = timeval_elapsed(&starttime);
+
+	torture_comment(tctx,
+			"%.2f second: "
+			"create-delete[cycles=%llu,cycles/s=%.0f,"
+			"avslat=%.6f,minlat=%.6f,maxlat=%.6f]\n",
+			elapsed,
+			(unsigned long long)num_cycles,
+			num_cycles / elapsed,
+			total_latency / num_cycles,
+			min_latency,
+			max_latency);
+
+done:
+	smb2_util_close(tree, dh);
+	smb2_deltree(tree, dname);
+	TALLOC_FREE(mem_ctx);
+	return ret;
+}
+
+/*
+   measure the byte range lock rate while the number of locks on a
+   file grows, with a lock or unlock request it should not depend
+   on the number of locks already held
+ */
+
+static bool test_smb2_bench_byte_range_locks(struct torture_context *tctx,
+					     struct smb2_tree *tree)
+{
+	TALLOC_CTX *mem_ctx = talloc_new(tctx);
+	int num_locks = torture_setting_int(tctx, "num_locks", 10000);
+	int num_steps = torture_setting_int(tctx, "num_steps", 10);
+	const char *fname = "bench_byte_range_locks.dat";
+	struct smb2_handle h = {};
+	struct smb2_handle h2 = {};
+	struct smb2_lock lck;
+	struct smb2_lock_element el;
+	struct timeval starttime;
+	struct timeval steptime;
+	double first_rate = 0;
+	double last_rate = 0;
+	double elapsed;
+	int step_size;
+	bool ret = true;
+	NTSTATUS status;
+	int i;
+
+	torture_assert(tctx, mem_ctx != NULL, __location__);
+	num_steps = MAX(num_steps, 1);
+	num_locks = MAX(num_locks, num_steps);
+	step_size = num_locks / num_steps;
+	num_locks = step_size * num_steps;
+
+	smb2_util_unlink(tree, fname);
+
+	status = torture_smb2_testfile(tree, fname, &h);
+	CHECK_STATUS(status, NT_STATUS_OK);
+	status = torture_smb2_testfile(tree, fname, &h2);
+	CHECK_STATUS(status, NT_STATUS_OK);
+
+	torture_comment(tctx,
+			"Taking %d locks in %d steps\n",
+			num_locks,
+			num_steps);
+
+	lck = (struct smb2_lock) {
+		.in.lock_count = 1,
+		.in.file.handle = h,
+		.in.locks = &el,
+	};
+
+	starttime = timeval_current();
+	steptime = starttime;
+
+	for (i = 0; i < num_locks; i++) {
+		double rate;
+
+		/*
+		 * Leave a gap between the locks for the reads below
+		 */
+		el = (struct smb2_lock_element) {
+			.offset = 2 * (uint64_t)i,
+			.length = 1,
+			.flags = SMB2_LOCK_FLAG_EXCLUSIVE |
+				 SMB2_LOCK_FLAG_FAIL_IMMEDIATELY,
+		};
+		status = smb2_lock(tree, &lck);
+		torture_assert_ntstatus_ok_goto(tctx, status,
+						ret, done, "lock");
+
+		if (((i + 1) % step_size) != 0) {
+			continue;
+		}
+
+		rate = step_size / timeval_elapsed(&steptime);
+		if (i + 1 == step_size) {
+			first_rate = rate;
+		}
+		last_rate = rate;
+
+		torture_comment(tctx,
+				"%.2f second: "
+				"lock[locks=%d,locks/s=%.0f]\n",
+				timeval_elapsed(&starttime),
+				i + 1,
+				rate);
+		steptime = timeval_current();
+	}
+
+	torture_comment(tctx,
+			"%.2f second: "
+			"lock[locks=%d,locks/s=%.0f,last/first=%.2f]\n",
+			timeval_elapsed(&starttime),
+			num_locks,
+			num_locks / timeval_elapsed(&starttime),
+			last_rate / first_rate);
+
+	/*
+	 * Reads from another handle have to be checked against the
+	 * locks, but only the ones around them matter.
+	 */
+	starttime = timeval_current();
+
+	for (i = 0; i < num_locks; i += step_size) {
+		struct smb2_read rd = {
+			.in.file.handle = h2,
+			.in.length = 1,
+			.in.offset = 2 * (uint64_t)i + 1,
+		};
+
+		status = smb2_read(tree, mem_ctx, &rd);
+		if (!NT_STATUS_EQUAL(status, NT_STATUS_END_OF_FILE)) {
+			torture_assert_ntstatus_ok_goto(tctx, status,
+							ret, done, "read");
+		}
+
+		rd.in.offset = 2 * (uint64_t)i;
+		status = smb2_read(tree, mem_ctx, &rd);
+		torture_assert_ntstatus_equal_goto(
+			tctx, status, NT_STATUS_FILE_LOCK_CONFLICT,
+			ret, done, "read of a locked byte");
+	}
+
+	elapsed = timeval_elapsed(&starttime);
+	torture_comment(tctx,
+			"%.2f second: read[reads=%d,reads/s=%.0f]\n",
+			elapsed,
+			2 * num_steps,
+			2 * num_steps / elapsed);
+
+	starttime = timeval_current();
+
+	for (i = num_locks - 1; i >= 0; i--) {
+		el = (struct smb2_lock_element) {
+			.offset = 2 * (uint64_t)i,
+			.length = 1,
+			.flags = SMB2_LOCK_FLAG_UNLOCK,
+		};
+		status = smb2_lock(tree, &lck);
+		torture_assert_ntstatus_ok_goto(tctx, status,
+						ret, done, "unlock");
+	}
+
+	elapsed = timeval_elapsed(&starttime);
+	torture_comment(tctx,
+			"%.2f second: unlock[locks=%d,unlocks/s=%.0f]\n",
+			elapsed,
+			num_locks,
+			num_locks / elapsed);
+
+done:
+	smb2_util_close(tree, h2);
+	smb2_util_close(tree, h);
+	smb2_util_unlink(tree, fname);
+	TALLOC_FREE(mem_ctx);
+	return ret;
+}
+
+/*
+   measure the rate at which a client can reopen and close a file it
+   holds a lease on
+ */
+
+static bool test_smb2_bench_lease_reopen(struct torture_context *tctx,
+					 struct smb2_tree *tree)
+{
+	TALLOC_CTX *mem_ctx = talloc_new(tctx);
+	int timelimit = torture_setting_int(tctx, "timelimit", 10);
+	const char *fname = "bench_lease_reopen.dat";
+	uint32_t rwh = smb2_util_lease_state("RWH");
+	uint64_t lease_key = 0x4c454153455245ULL;
+	struct smb2_create io;
+	struct smb2_lease ls;
+	struct smb2_handle h = {};
+	struct timeval starttime;
+	uint64_t num_cycles = 0;
+	double total_latency = 0;
+	double min_latency = 0;
+	double max_latency = 0;
+	double elapsed;
+	bool ret = true;
+	NTSTATUS status;
+
+	torture_assert(tctx, mem_ctx != NULL, __location__);
+	timelimit = MAX(timelimit, 1);
+
+	smb2_util_unlink(tree, fname);
+
+	/*
+	 * Keep one handle open so that the lease stays around
+	 */
+	smb2_lease_create(&io, &ls, false, fname, lease_key, rwh);
+	status = smb2_create(tree, mem_ctx, &io);
+	CHECK_STATUS(status, NT_STATUS_OK);
+	h = io.out.file.handle;
+	torture_assert_int_equal_goto(tctx,
+				      io.out.lease_response.lease_state,
+				      rwh,
+				      ret, done, "lease state");
+
+	torture_comment(tctx, "Running for %d seconds\n", timelimit);
+
+	starttime = timeval_current();
+
+	while (timeval_elapsed(&starttime) < timelimit) {
+		TALLOC_CTX *frame = talloc_stackframe();
+		struct timeval cycle_start = timeval_current();
+		double latency;
+
+		smb2_lease_create(&io, &ls, false, fname, lease_key, rwh);
+		status = smb2_create(tree, frame, &io);
+		torture_assert_ntstatus_ok_goto(tctx, status,
+						ret, done, "open");
+		torture_assert_int_equal_goto(
+			tctx,
+			io.out.lease_response.lease_state,
+			rwh,
+			ret, done, "lease state");
+
+		status = smb2_util_close(tree, io.out.file.handle);
+		torture_assert_ntstatus_ok_goto(tctx, status,
+						ret, done, "close");
+		TALLOC_FREE(frame);
+
+		latency = timeval_elapsed(&cycle_start);
+		if (num_cycles == 0 || latency < min_latency) {
+			min_latency = latency;
+		}
+		if (latency > max_latency) {
+			max_latency = latency;
+		}
+		total_latency += latency;
+		num_cycles += 1;
+
+		if (torture_setting_bool(tctx, "progress", true) &&
+		    ((num_cycles % 100) == 0))
+		{
+			torture_comment(tctx,
+					"%.2f second: "
+					"lease-reopen[cycles=%llu,"
+					"cycles/s=%.0f]      \r",
+					timeval_elapsed(&starttime),
+					(unsigned long long)num_cycles,
+					num_cycles /
+					timeval_elapsed(&starttime));
+		}
+	}
+
+	elapsed = timeval_elapsed(&starttime);
+
+	torture_comment(tctx,
+			"%.2f second: "
+			"lease-reopen[cycles=%llu,cycles/s=%.0f,"
+			"avslat=%.6f,minlat=%.6f,maxlat=%.6f]\n",
+			elapsed,
+			(unsigned long long)num_cycles,
+			num_cycles / elapsed,
+			total_latency / num_cycles,
+			min_latency,
+			max_latency);
+
+done:
+	smb2_util_close(tree, h);
+	smb2_util_unlink(tree, fname);
+	TALLOC_FREE(mem_ctx);
+	return ret;
+}
+
+/*
+   measure the server side copy throughput with
+   FSCTL_SRV_COPYCHUNK, each request copying the maximum of
+   16 chunks of 1 MiB
+ */
+
+#define BENCH_COPY_CHUNK_LEN (1024 * 1024)
+#define BENCH_COPY_CHUNK_COUNT 16
+
+static bool test_smb2_bench_copy_chunk(struct torture_context *tctx,
+				       struct smb2_tree *tree)
+{
+	TALLOC_CTX *mem_ctx = talloc_new(tctx);
+	int size_mb = torture_setting_int(tctx, "copy_mb", 256);
+	bool sparse = torture_setting_bool(tctx, "sparse", false);
+	const char *src_name = "bench_copy_chunk_src.dat";
+	const char *dst_name = "bench_copy_chunk_dst.dat";
+	struct smb2_handle src_h = {};
+	struct smb2_handle dst_h = {};
+	union smb_setfileinfo sfinfo;
+	union smb_ioctl ioctl;
+	struct req_resume_key_rsp res_key;
+	struct srv_copychunk_copy cc_copy;
+	struct srv_copychunk_rsp cc_rsp;
+	struct srv_copychunk chunks[BENCH_COPY_CHUNK_COUNT];
+	enum ndr_err_code ndr_ret;
+	struct timeval starttime;
+	uint64_t size;
+	uint64_t off;
+	uint8_t *buf = NULL;
+	double elapsed;
+	bool ret = true;
+	NTSTATUS status;
+	int i;
+
+	torture_assert(tctx, mem_ctx != NULL, __location__);
+	size_mb = MAX(size_mb, 16);
+	size_mb -= size_mb % 16;
+	size = (uint64_t)size_mb * BENCH_COPY_CHUNK_LEN;
+
+	buf = talloc_array(mem_ctx, uint8_t, BENCH_COPY_CHUNK_LEN);
+	torture_assert_goto(tctx, buf != NULL, ret, done, "talloc_array");
+	for (i = 0; i < BENCH_COPY_CHUNK_LEN; i++) {
+		buf[i] = i % 251;
+	}
+
+	smb2_util_unlink(tree, src_name);
+	smb2_util_unlink(tree, dst_name);
+
+	status = torture_smb2_testfile(tree, src_name, &src_h);
+	CHECK_STATUS(status, NT_STATUS_OK);
+	status = torture_smb2_testfile(tree, dst_name, &dst_h);
+	CHECK_STATUS(status, NT_STATUS_OK);
+
+	/*
+	 * With "sparse" only every other MiB of the source has data
+	 * and the destination is extended to its size before the
+	 * copy, the server does not need to copy the holes.
+	 */
+	ZERO_STRUCT(sfinfo);
+	sfinfo.end_of_file_info.level = RAW_SFILEINFO_END_OF_FILE_INFORMATION;
+	sfinfo.end_of_file_info.in.file.handle = src_h;
+	sfinfo.end_of_file_info.in.size = size;
+	status = smb2_setinfo_file(tree, &sfinfo);
+	torture_assert_ntstatus_ok_goto(tctx, status, ret, done, "src eof");
+
+	if (sparse) {
+		sfinfo.end_of_file_info.in.file.handle = dst_h;
+		status = smb2_setinfo_file(tree, &sfinfo);
+		torture_assert_ntstatus_ok_goto(tctx, status,
+						ret, done, "dst eof");
+	}
+
+	for (off = 0; off < size; off += BENCH_COPY_CHUNK_LEN) {
+		if (sparse && ((off / BENCH_COPY_CHUNK_LEN) % 2) != 0) {
+			continue;
+		}
+		status = smb2_util_write(tree,
+					 src_h,
+					 buf,
+					 off,
+					 BENCH_COPY_CHUNK_LEN);
+		torture_assert_ntstatus_ok_goto(tctx, status,
+						ret, done, "write");
+	}
+
+	ZERO_STRUCT(ioctl);
+	ioctl.smb2.level = RAW_IOCTL_SMB2;
+	ioctl.smb2.in.file.handle = src_h;
+	ioctl.smb2.in.function = FSCTL_SRV_REQUEST_RESUME_KEY;
+	ioctl.smb2.in.max_output_response = 32;
+	ioctl.smb2.in.flags = SMB2_IOCTL_FLAG_IS_FSCTL;
+
+	status = smb2_ioctl(tree, mem_ctx, &ioctl.smb2);
+	torture_assert_ntstatus_ok_goto(tctx, status, ret, done,
+					"FSCTL_SRV_REQUEST_RESUME_KEY");
+
+	ndr_ret = ndr_pull_struct_blob(&ioctl.smb2.out.out, mem_ctx, &res_key,
+			(ndr_pull_flags_fn_t)ndr_pull_req_resume_key_rsp);
+	torture_assert_ndr_success_goto(tctx, ndr_ret, ret, done,
+					"ndr_pull_req_resume_key_rsp");
+
+	ZERO_STRUCT(cc_copy);
+	memcpy(cc_copy.source_key,
+	       res_key.resume_key,
+	       ARRAY_SIZE(cc_copy.source_key));
+	cc_copy.chunk_count = BENCH_COPY_CHUNK_COUNT;
+	cc_copy.chunks = chunks;
+
+	torture_comment(tctx,
+			"Copying %d MiB%s\n",
+			size_mb,
+			sparse ? " with holes" : "");
+
+	starttime = timeval_current();
+
+	for (off = 0; off < size;
+	     off += BENCH_COPY_CHUNK_COUNT * BENCH_COPY_CHUNK_LEN)
+	{
+		TALLOC_CTX *frame = talloc_new(mem_ctx);
+
+		torture_assert_goto(tctx, frame != NULL, ret, done, "talloc_new");
+
+		for (i = 0; i < BENCH_COPY_CHUNK_COUNT; i++) {
+			chunks[i] = (struct srv_copychunk) {
+				.source_off = off + i * BENCH_COPY_CHUNK_LEN,
+				.target_off = off + i * BENCH_COPY_CHUNK_LEN,
+				.length = BENCH_COPY_CHUNK_LEN,
+			};
+		}
+
+		ZERO_STRUCT(ioctl);
+		ioctl.smb2.level = RAW_IOCTL_SMB2;
+		ioctl.smb2.in.file.handle = dst_h;
+		ioctl.smb2.in.function = FSCTL_SRV_COPYCHUNK;
+		ioctl.smb2.in.max_output_response =
+			sizeof(struct srv_copychunk_rsp);
+		ioctl.smb2.in.flags = SMB2_IOCTL_FLAG_IS_FSCTL;
+
+		ndr_ret = ndr_push_struct_blob(&ioctl.smb2.in.out, frame,
+					       &cc_copy,
+				(ndr_push_flags_fn_t)ndr_push_srv_copychunk_copy);
+		torture_assert_ndr_success_goto(tctx, ndr_ret, ret, done,
+						"ndr_push_srv_copychunk_copy");
+
+		status = smb2_ioctl(tree, frame, &ioctl.smb2);
+		torture_assert_ntstatus_ok_goto(tctx, status, ret, done,
+						"FSCTL_SRV_COPYCHUNK");
+
+		ndr_ret = ndr_pull_struct_blob(&ioctl.smb2.out.out, frame,
+					       &cc_rsp,
+				(ndr_pull_flags_fn_t)ndr_pull_srv_copychunk_rsp);
+		torture_assert_ndr_success_goto(tctx, ndr_ret, ret, done,
+						"ndr_pull_srv_copychunk_rsp");
+		torture_assert_int_equal_goto(
+			tctx,
+			cc_rsp.total_bytes_written,
+			BENCH_COPY_CHUNK_COUNT * BENCH_COPY_CHUNK_LEN,
+			ret, done, "total bytes written");
+		TALLOC_FREE(frame);
+	}
+
+	elapsed = timeval_elapsed(&starttime);
+
+	torture_comment(tctx,
+			"%.2f second: copy-chunk[MiB=%d,MiB/s=%.1f]\n",
+			elapsed,
+			size_mb,
+			size_mb / elapsed);
+
+	/*
+	 * Spot check the last MiB with data
+	 */
+	{
+		struct smb2_read rd = {
+			.in.file.handle = dst_h,
+			.in.length = BENCH_COPY_CHUNK_LEN,
+			.in.offset = size - 2 * BENCH_COPY_CHUNK_LEN,
+		};
+
+		status = smb2_read(tree, mem_ctx, &rd);
+		torture_assert_ntstatus_ok_goto(tctx, status,
+						ret, done, "read");
+		torture_assert_mem_equal_goto(tctx,
+					      rd.out.data.data,
+					      buf,
+					      BENCH_COPY_CHUNK_LEN,
+					      ret, done, "copied data");
+	}
+
+done:
+	smb2_util_close(tree, dst_h);
+	smb2_util_close(tree, src_h);
+	smb2_util_unlink(tree, dst_name);
+	smb2_util_unlink(tree, src_name);
+	TALLOC_FREE(mem_ctx);
+	return ret;
+}
+
 struct torture_suite *torture_smb2_bench_init(TALLOC_CTX *ctx)
 {
 	struct torture_suite *suite = torture_suite_create(ctx, "bench");
@@ -1845,7 +3259,16 @@ struct torture_suite *torture_smb2_bench_init(TALLOC_CTX *ctx)
 	torture_suite_add_1smb2_test(suite, "echo", test_smb2_bench_echo);
 	torture_suite_add_1smb2_test(suite, "path-contention-shared", test_smb2_bench_path_contention_shared);
 	torture_suite_add_1smb2_test(suite, "read", test_smb2_bench_read);
+	torture_suite_add_1smb2_test(suite, "read-sequential", test_smb2_bench_read_sequential);
 	torture_suite_add_1smb2_test(suite, "session-setup", test_smb2_bench_session_setup);
+	torture_suite_add_1smb2_test(suite, "compound", test_smb2_bench_compound);
+	torture_suite_add_1smb2_test(suite, "find", test_smb2_bench_find);
+	torture_suite_add_1smb2_test(suite, "create-dir", test_smb2_bench_create_dir);
+	torture_suite_add_1smb2_test(suite, "open-close", test_smb2_bench_open_close);
+	torture_suite_add_1smb2_test(suite, "create-delete", test_smb2_bench_create_delete);
+	torture_suite_add_1smb2_test(suite, "byte-range-locks", test_smb2_bench_byte_range_locks);
+	torture_suite_add_1smb2_test(suite, "lease-reopen", test_smb2_bench_lease_reopen);
+	torture_suite_add_1smb2_test(suite, "copy-chunk", test_smb2_bench_copy_chunk);
 
 	suite->description = talloc_strdup(suite, "SMB2-BENCH tests");
 
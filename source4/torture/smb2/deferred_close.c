@@ -0,0 +1,547 @@
+/*
+   Unix SMB/CIFS implementation.
+
+   test suite for SMB2 closes the server might defer
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * With "smbd deferred close" Samba keeps files open for a while after
+ * the client closed them. None of this may be visible to clients: the
+ * tests here pass against a server that closes files right away, and
+ * they must pass against one that defers the close.
+ */
+
+#include "includes.h"
+#include "libcli/smb2/smb2.h"
+#include "libcli/smb2/smb2_calls.h"
+#include "libcli/security/security.h"
+#include "torture/torture.h"
+#include "torture/smb2/proto.h"
+#include "oplock_break_handler.h"
+
+#define BASEDIR "deferred_close"
+
+#define CHECK_STATUS(status, correct) do { \
+	const char *_cmt = "(" __location__ ")"; \
+	torture_assert_ntstatus_equal_goto(tctx,status,correct, \
+					   ret,done,_cmt); \
+	} while (0)
+
+static NTSTATUS dc_create_file(struct smb2_tree *tree,
+			       const char *fname,
+			       const char *data)
+{
+	struct smb2_handle h;
+	NTSTATUS status;
+
+	status = torture_smb2_testfile(tree, fname, &h);
+	if (!NT_STATUS_IS_OK(status)) {
+		return status;
+	}
+	status = smb2_util_write(tree, h, data, 0, strlen(data));
+	smb2_util_close(tree, h);
+	return status;
+}
+
+/*
+ * The kind of open the server may keep around after the close: no
+ * oplock, lease or create contexts.
+ */
+static NTSTATUS dc_open(struct smb2_tree *tree,
+			TALLOC_CTX *mem_ctx,
+			const char *fname,
+			uint32_t desired_access,
+			uint32_t share_access,
+			struct smb2_handle *h)
+{
+	struct smb2_create io = {
+		.in.desired_access = desired_access,
+		.in.share_access = share_access,
+		.in.create_disposition = NTCREATEX_DISP_OPEN,
+		.in.impersonation_level = SMB2_IMPERSONATION_IMPERSONATION,
+		.in.oplock_level = SMB2_OPLOCK_LEVEL_NONE,
+		.in.fname = fname,
+	};
+	NTSTATUS status;
+
+	status = smb2_create(tree, mem_ctx, &io);
+	if (NT_STATUS_IS_OK(status)) {
+		*h = io.out.file.handle;
+	}
+	return status;
+}
+
+static bool dc_check_data(struct torture_context *tctx,
+			  struct smb2_tree *tree,
+			  struct smb2_handle h,
+			  const char *expected)
+{
+	struct smb2_read rd = {
+		.in.file.handle = h,
+		.in.length = 64,
+	};
+	NTSTATUS status;
+
+	status = smb2_read(tree, tctx, &rd);
+	torture_assert_ntstatus_ok(tctx, status, "read");
+	torture_assert_int_equal(tctx,
+				 rd.out.data.length,
+				 strlen(expected),
+				 "length");
+	torture_assert_mem_equal(tctx,
+				 rd.out.data.data,
+				 expected,
+				 strlen(expected),
+				 "data");
+	return true;
+}
+
+/*
+ * Open, read and close a file again and again. A handle the client
+ * closed must stay closed, a new open must see changes made through
+ * another connection in between.
+ */
+static bool test_deferred_close_reopen(struct torture_context *tctx,
+				       struct smb2_tree *tree1,
+				       struct smb2_tree *tree2)
+{
+	const char *fname = BASEDIR "\\reopen.dat";
+	const uint32_t share = NTCREATEX_SHARE_ACCESS_READ |
+			       NTCREATEX_SHARE_ACCESS_WRITE;
+	struct smb2_handle dh = {};
+	struct smb2_handle h1 = {};
+	struct smb2_handle old = {};
+	struct smb2_read rd;
+	bool ret = true;
+	NTSTATUS status;
+	int i;
+
+	smb2_deltree(tree1, BASEDIR);
+	status = torture_smb2_testdir(tree1, BASEDIR, &dh);
+	CHECK_STATUS(status, NT_STATUS_OK);
+	smb2_util_close(tree1, dh);
+
+	status = dc_create_file(tree1, fname, "first");
+	CHECK_STATUS(status, NT_STATUS_OK);
+
+	for (i = 0; i < 10; i++) {
+		status = dc_open(tree1, tctx, fname,
+				 SEC_RIGHTS_FILE_READ, share, &h1);
+		CHECK_STATUS(status, NT_STATUS_OK);
+		torture_assert_goto(tctx,
+				    dc_check_data(tctx, tree1, h1, "first"),
+				    ret, done, "first");
+		status = smb2_util_close(tree1, h1);
+		CHECK_STATUS(status, NT_STATUS_OK);
+		old = h1;
+	}
+
+	torture_comment(tctx, "A closed handle must stay closed\n");
+
+	rd = (struct smb2_read) {
+		.in.file.handle = old,
+		.in.length = 64,
+	};
+	status = smb2_read(tree1, tctx, &rd);
+	CHECK_STATUS(status, NT_STATUS_FILE_CLOSED);
+
+	status = dc_open(tree1, tctx, fname, SEC_RIGHTS_FILE_READ, share, &h1);
+	CHECK_STATUS(status, NT_STATUS_OK);
+	status = smb2_util_close(tree1, h1);
+	CHECK_STATUS(status, NT_STATUS_OK);
+
+	torture_comment(tctx, "Change the file through another connection\n");
+
+	status = dc_open(tree2, tctx, fname,
+			 SEC_RIGHTS_FILE_ALL, share, &h1);
+	CHECK_STATUS(status, NT_STATUS_OK);
+	status = smb2_util_write(tree2, h1, "second", 0, strlen("second"));
+	CHECK_STATUS(status, NT_STATUS_OK);
+	status = smb2_util_close(tree2, h1);
+	CHECK_STATUS(status, NT_STATUS_OK);
+
+	status = dc_open(tree1, tctx, fname, SEC_RIGHTS_FILE_READ, share, &h1);
+	CHECK_STATUS(status, NT_STATUS_OK);
+	torture_assert_goto(tctx,
+			    dc_check_data(tctx, tree1, h1, "second"),
+			    ret, done, "second");
+	status = smb2_util_close(tree1, h1);
+	CHECK_STATUS(status, NT_STATUS_OK);
+
+done:
+	smb2_deltree(tree1, BASEDIR);
+	return ret;
+}
+
+/*
+ * After a close, another client must get an exclusive open and a
+ * batch oplock right away.
+ */
+static bool test_deferred_close_conflict(struct torture_context *tctx,
+					 struct smb2_tree *tree1,
+					 struct smb2_tree *tree2)
+{
+	const char *fname = BASEDIR "\\conflict.dat";
+	const uint32_t share = NTCREATEX_SHARE_ACCESS_READ |
+			       NTCREATEX_SHARE_ACCESS_WRITE;
+	struct smb2_handle dh = {};
+	struct smb2_handle h1 = {};
+	struct smb2_handle h2 = {};
+	struct smb2_create io;
+	struct timeval start;
+	bool ret = true;
+	NTSTATUS status;
+
+	torture_reset_break_info(tctx, &break_info);
+	tree2->session->transport->oplock.handler = torture_oplock_ack_handler;
+	tree2->session->transport->oplock.private_data = tree2;
+
+	smb2_deltree(tree1, BASEDIR);
+	status = torture_smb2_testdir(tree1, BASEDIR, &dh);
+	CHECK_STATUS(status, NT_STATUS_OK);
+	smb2_util_close(tree1, dh);
+
+	status = dc_create_file(tree1, fname, "data");
+	CHECK_STATUS(status, NT_STATUS_OK);
+
+	status = dc_open(tree1, tctx, fname, SEC_RIGHTS_FILE_READ, share, &h1);
+	CHECK_STATUS(status, NT_STATUS_OK);
+	status = smb2_util_close(tree1, h1);
+	CHECK_STATUS(status, NT_STATUS_OK);
+
+	io = (struct smb2_create) {
+		.in.desired_access = SEC_RIGHTS_FILE_ALL,
+		.in.share_access = NTCREATEX_SHARE_ACCESS_NONE,
+		.in.create_disposition = NTCREATEX_DISP_OPEN,
+		.in.impersonation_level = SMB2_IMPERSONATION_IMPERSONATION,
+		.in.oplock_level = SMB2_OPLOCK_LEVEL_BATCH,
+		.in.fname = fname,
+	};
+
+	start = timeval_current();
+	status = smb2_create(tree2, tctx, &io);
+	CHECK_STATUS(status, NT_STATUS_OK);
+	h2 = io.out.file.handle;
+
+	torture_assert_int_equal_goto(tctx,
+				      io.out.oplock_level,
+				      SMB2_OPLOCK_LEVEL_BATCH,
+				      ret, done,
+				      "batch oplock");
+	torture_assert_goto(tctx,
+			    timeval_elapsed(&start) < 5,
+			    ret, done,
+			    "exclusive open was delayed");
+
+	torture_comment(tctx, "The exclusive open must win\n");
+
+	status = dc_open(tree1, tctx, fname, SEC_RIGHTS_FILE_READ, share, &h1);
+	CHECK_STATUS(status, NT_STATUS_SHARING_VIOLATION);
+	torture_wait_for_oplock_break(tctx);
+	torture_assert_int_equal_goto(tctx, break_info.count, 1,
+				      ret, done, "oplock break");
+	torture_assert_int_equal_goto(tctx, break_info.failures, 0,
+				      ret, done, "oplock break ack");
+
+	status = smb2_util_close(tree2, h2);
+	CHECK_STATUS(status, NT_STATUS_OK);
+	ZERO_STRUCT(h2);
+
+	status = dc_open(tree1, tctx, fname, SEC_RIGHTS_FILE_READ, share, &h1);
+	CHECK_STATUS(status, NT_STATUS_OK);
+	status = smb2_util_close(tree1, h1);
+	CHECK_STATUS(status, NT_STATUS_OK);
+
+done:
+	if (!smb2_util_handle_empty(h2)) {
+		smb2_util_close(tree2, h2);
+	}
+	smb2_deltree(tree1, BASEDIR);
+	return ret;
+}
+
+static NTSTATUS dc_rename(struct smb2_tree *tree,
+			  TALLOC_CTX *mem_ctx,
+			  const char *fname,
+			  bool is_dir,
+			  const char *new_name)
+{
+	struct smb2_create io = {
+		.in.desired_access = SEC_STD_DELETE |
+				     SEC_FILE_READ_ATTRIBUTE,
+		.in.share_access = NTCREATEX_SHARE_ACCESS_MASK,
+		.in.create_disposition = NTCREATEX_DISP_OPEN,
+		.in.create_options = is_dir ?
+				     NTCREATEX_OPTIONS_DIRECTORY : 0,
+		.in.impersonation_level = SMB2_IMPERSONATION_IMPERSONATION,
+		.in.fname = fname,
+	};
+	union smb_setfileinfo sinfo;
+	NTSTATUS status;
+
+	status = smb2_create(tree, mem_ctx, &io);
+	if (!NT_STATUS_IS_OK(status)) {
+		return status;
+	}
+
+	ZERO_STRUCT(sinfo);
+	sinfo.rename_information.level = RAW_SFILEINFO_RENAME_INFORMATION;
+	sinfo.rename_information.in.file.handle = io.out.file.handle;
+	sinfo.rename_information.in.new_name = new_name;
+	status = smb2_setinfo_file(tree, &sinfo);
+
+	smb2_util_close(tree, io.out.file.handle);
+	return status;
+}
+
+/*
+ * A file the client closed does not keep anybody from renaming it or
+ * the directory it is in.
+ */
+static bool test_deferred_close_rename(struct torture_context *tctx,
+				       struct smb2_tree *tree1,
+				       struct smb2_tree *tree2)
+{
+	const char *dname = BASEDIR "\\dir";
+	const char *fname = BASEDIR "\\dir\\rename.dat";
+	const uint32_t share = NTCREATEX_SHARE_ACCESS_READ |
+			       NTCREATEX_SHARE_ACCESS_WRITE;
+	struct smb2_handle dh = {};
+	struct smb2_handle h1 = {};
+	bool ret = true;
+	NTSTATUS status;
+
+	smb2_deltree(tree1, BASEDIR);
+	status = torture_smb2_testdir(tree1, BASEDIR, &dh);
+	CHECK_STATUS(status, NT_STATUS_OK);
+	smb2_util_close(tree1, dh);
+	status = smb2_util_mkdir(tree1, dname);
+	CHECK_STATUS(status, NT_STATUS_OK);
+
+	status = dc_create_file(tree1, fname, "data");
+	CHECK_STATUS(status, NT_STATUS_OK);
+
+	torture_comment(tctx, "Rename the file from another connection\n");
+
+	status = dc_open(tree1, tctx, fname, SEC_RIGHTS_FILE_READ, share, &h1);
+	CHECK_STATUS(status, NT_STATUS_OK);
+	status = smb2_util_close(tree1, h1);
+	CHECK_STATUS(status, NT_STATUS_OK);
+
+	status = dc_rename(tree2, tctx, fname, false,
+			   BASEDIR "\\dir\\renamed.dat");
+	CHECK_STATUS(status, NT_STATUS_OK);
+
+	status = dc_open(tree1, tctx, fname, SEC_RIGHTS_FILE_READ, share, &h1);
+	CHECK_STATUS(status, NT_STATUS_OBJECT_NAME_NOT_FOUND);
+
+	torture_comment(tctx, "Rename the directory from the same "
+			"connection\n");
+
+	status = dc_open(tree1, tctx, BASEDIR "\\dir\\renamed.dat",
+			 SEC_RIGHTS_FILE_READ, share, &h1);
+	CHECK_STATUS(status, NT_STATUS_OK);
+	status = smb2_util_close(tree1, h1);
+	CHECK_STATUS(status, NT_STATUS_OK);
+
+	status = dc_rename(tree1, tctx, dname, true, BASEDIR "\\dir2");
+	CHECK_STATUS(status, NT_STATUS_OK);
+
+	status = dc_open(tree1, tctx, BASEDIR "\\dir2\\renamed.dat",
+			 SEC_RIGHTS_FILE_READ, share, &h1);
+	CHECK_STATUS(status, NT_STATUS_OK);
+	torture_assert_goto(tctx,
+			    dc_check_data(tctx, tree1, h1, "data"),
+			    ret, done, "data");
+	status = smb2_util_close(tree1, h1);
+	CHECK_STATUS(status, NT_STATUS_OK);
+
+done:
+	smb2_deltree(tree1, BASEDIR);
+	return ret;
+}
+
+/*
+ * A file the client closed is deleted as soon as another client
+ * closes its delete-on-close handle.
+ */
+static bool test_deferred_close_delete(struct torture_context *tctx,
+				       struct smb2_tree *tree1,
+				       struct smb2_tree *tree2)
+{
+	const char *fname = BASEDIR "\\delete.dat";
+	const uint32_t share = NTCREATEX_SHARE_ACCESS_READ |
+			       NTCREATEX_SHARE_ACCESS_WRITE |
+			       NTCREATEX_SHARE_ACCESS_DELETE;
+	struct smb2_handle dh = {};
+	struct smb2_handle h1 = {};
+	struct smb2_create io;
+	bool ret = true;
+	NTSTATUS status;
+
+	smb2_deltree(tree1, BASEDIR);
+	status = torture_smb2_testdir(tree1, BASEDIR, &dh);
+	CHECK_STATUS(status, NT_STATUS_OK);
+	smb2_util_close(tree1, dh);
+
+	status = dc_create_file(tree1, fname, "data");
+	CHECK_STATUS(status, NT_STATUS_OK);
+
+	status = dc_open(tree1, tctx, fname, SEC_RIGHTS_FILE_READ, share, &h1);
+	CHECK_STATUS(status, NT_STATUS_OK);
+	status = smb2_util_close(tree1, h1);
+	CHECK_STATUS(status, NT_STATUS_OK);
+
+	status = smb2_util_unlink(tree2, fname);
+	CHECK_STATUS(status, NT_STATUS_OK);
+
+	io = (struct smb2_create) {
+		.in.desired_access = SEC_RIGHTS_FILE_ALL,
+		.in.share_access = NTCREATEX_SHARE_ACCESS_NONE,
+		.in.create_disposition = NTCREATEX_DISP_CREATE,
+		.in.impersonation_level = SMB2_IMPERSONATION_IMPERSONATION,
+		.in.fname = fname,
+	};
+	status = smb2_create(tree2, tctx, &io);
+	CHECK_STATUS(status, NT_STATUS_OK);
+	smb2_util_close(tree2, io.out.file.handle);
+
+	status = smb2_util_unlink(tree2, fname);
+	CHECK_STATUS(status, NT_STATUS_OK);
+
+	status = dc_open(tree1, tctx, fname, SEC_RIGHTS_FILE_READ, share, &h1);
+	CHECK_STATUS(status, NT_STATUS_OBJECT_NAME_NOT_FOUND);
+
+done:
+	smb2_deltree(tree1, BASEDIR);
+	return ret;
+}
+
+static NTSTATUS dc_set_dacl(struct smb2_tree *tree,
+			    TALLOC_CTX *mem_ctx,
+			    const char *fname,
+			    uint32_t access_mask)
+{
+	struct security_descriptor *sd = NULL;
+	union smb_setfileinfo set;
+	struct smb2_create io = {
+		.in.desired_access = SEC_STD_WRITE_DAC,
+		.in.share_access = NTCREATEX_SHARE_ACCESS_READ |
+				   NTCREATEX_SHARE_ACCESS_WRITE |
+				   NTCREATEX_SHARE_ACCESS_DELETE,
+		.in.create_disposition = NTCREATEX_DISP_OPEN,
+		.in.impersonation_level = SMB2_IMPERSONATION_IMPERSONATION,
+		.in.fname = fname,
+	};
+	NTSTATUS status;
+
+	sd = security_descriptor_dacl_create(mem_ctx,
+					     0, NULL, NULL,
+					     SID_NT_AUTHENTICATED_USERS,
+					     SEC_ACE_TYPE_ACCESS_ALLOWED,
+					     access_mask,
+					     0,
+					     NULL);
+	if (sd == NULL) {
+		return NT_STATUS_NO_MEMORY;
+	}
+
+	status = smb2_create(tree, mem_ctx, &io);
+	if (!NT_STATUS_IS_OK(status)) {
+		return status;
+	}
+
+	set = (union smb_setfileinfo) {
+		.set_secdesc.level = RAW_SFILEINFO_SEC_DESC,
+		.set_secdesc.in.file.handle = io.out.file.handle,
+		.set_secdesc.in.secinfo_flags = SECINFO_DACL,
+		.set_secdesc.in.sd = sd,
+	};
+	status = smb2_setinfo_file(tree, &set);
+	smb2_util_close(tree, io.out.file.handle);
+	return status;
+}
+
+/*
+ * Access taken away by another client while the file was closed must
+ * be denied on the next open.
+ */
+static bool test_deferred_close_acl(struct torture_context *tctx,
+				    struct smb2_tree *tree1,
+				    struct smb2_tree *tree2)
+{
+	const char *fname = BASEDIR "\\acl.dat";
+	const uint32_t share = NTCREATEX_SHARE_ACCESS_READ |
+			       NTCREATEX_SHARE_ACCESS_WRITE |
+			       NTCREATEX_SHARE_ACCESS_DELETE;
+	struct smb2_handle dh = {};
+	struct smb2_handle h1 = {};
+	bool ret = true;
+	NTSTATUS status;
+
+	smb2_deltree(tree1, BASEDIR);
+	status = torture_smb2_testdir(tree1, BASEDIR, &dh);
+	CHECK_STATUS(status, NT_STATUS_OK);
+	smb2_util_close(tree1, dh);
+
+	status = dc_create_file(tree1, fname, "data");
+	CHECK_STATUS(status, NT_STATUS_OK);
+
+	status = dc_open(tree1, tctx, fname, SEC_RIGHTS_FILE_READ, share, &h1);
+	CHECK_STATUS(status, NT_STATUS_OK);
+	status = smb2_util_close(tree1, h1);
+	CHECK_STATUS(status, NT_STATUS_OK);
+
+	status = dc_set_dacl(tree2, tctx, fname, SEC_FILE_READ_ATTRIBUTE);
+	CHECK_STATUS(status, NT_STATUS_OK);
+
+	status = dc_open(tree1, tctx, fname, SEC_RIGHTS_FILE_READ, share, &h1);
+	CHECK_STATUS(status, NT_STATUS_ACCESS_DENIED);
+
+	status = dc_set_dacl(tree1, tctx, fname, SEC_RIGHTS_FILE_ALL);
+	CHECK_STATUS(status, NT_STATUS_OK);
+
+	status = dc_open(tree1, tctx, fname, SEC_RIGHTS_FILE_READ, share, &h1);
+	CHECK_STATUS(status, NT_STATUS_OK);
+	ret &= dc_check_data(tctx, tree1, h1, "data");
+	smb2_util_close(tree1, h1);
+
+done:
+	smb2_deltree(tree1, BASEDIR);
+	return ret;
+}
+
+struct torture_suite *torture_smb2_deferred_close_init(TALLOC_CTX *ctx)
+{
+	struct torture_suite *suite =
+		torture_suite_create(ctx, "deferred_close");
+
+	torture_suite_add_2smb2_test(suite, "reopen",
+				     test_deferred_close_reopen);
+	torture_suite_add_2smb2_test(suite, "conflict",
+				     test_deferred_close_conflict);
+	torture_suite_add_2smb2_test(suite, "rename",
+				     test_deferred_close_rename);
+	torture_suite_add_2smb2_test(suite, "delete",
+				     test_deferred_close_delete);
+	torture_suite_add_2smb2_test(suite, "acl",
+				     test_deferred_close_acl);
+
+	suite->description = talloc_strdup(
+		suite, "SMB2 closes the server might defer");
+
+	return suite;
+}
@@ -141,12 +141,189 @@ done:
 	return ret;
 }
 
+static bool set_ea(struct smb2_tree *tree,
+		   struct smb2_handle h,
+		   const char *name,
+		   const char *value)
+{
+	struct ea_struct ea = {
+		.name.s = name,
+		.name.private_length = strlen(name) + 1,
+		.value = data_blob_string_const(value),
+	};
+	union smb_setfileinfo sfinfo = {
+		.generic.level = RAW_SFILEINFO_FULL_EA_INFORMATION,
+		.generic.in.file.handle = h,
+		.full_ea_information.in.eas.num_eas = 1,
+		.full_ea_information.in.eas.eas = &ea,
+	};
+
+	return NT_STATUS_IS_OK(smb2_setinfo_file(tree, &sfinfo));
+}
+
+static bool check_ea(struct torture_context *tctx,
+		     struct smb2_tree *tree,
+		     struct smb2_handle h,
+		     const char *name,
+		     bool expected)
+{
+	union smb_fileinfo finfo = {
+		.generic.level = RAW_FILEINFO_SMB2_ALL_EAS,
+		.generic.in.file.handle = h,
+	};
+	NTSTATUS status;
+
+	status = smb2_getinfo_file(tree, tctx, &finfo);
+	torture_assert_ntstatus_ok(tctx, status, "getinfo ALL_EAS failed\n");
+
+	torture_assert_int_equal(tctx,
+				 find_returned_ea(&finfo, name),
+				 expected,
+				 talloc_asprintf(tctx, "EA %s", name));
+	return true;
+}
+
+static bool check_attrib(struct torture_context *tctx,
+			 struct smb2_tree *tree,
+			 struct smb2_handle h,
+			 uint32_t expected)
+{
+	union smb_fileinfo finfo = {
+		.generic.level = RAW_FILEINFO_BASIC_INFORMATION,
+		.generic.in.file.handle = h,
+	};
+	NTSTATUS status;
+
+	status = smb2_getinfo_file(tree, tctx, &finfo);
+	torture_assert_ntstatus_ok(tctx, status, "getinfo BASIC failed\n");
+
+	torture_assert_int_equal(tctx,
+				 finfo.basic_info.out.attrib &
+				 FILE_ATTRIBUTE_HIDDEN,
+				 expected,
+				 "hidden attribute");
+	return true;
+}
+
+/*
+ * Change EAs and DOS attributes through other handles, on the same
+ * connection and on a second one (another smbd process), while the
+ * first handle stays open. The first handle must see every change,
+ * even if something like vfs_xattr_cache remembers what it read.
+ */
+static bool torture_smb2_ea_second_handle(struct torture_context *tctx,
+					  struct smb2_tree *tree)
+{
+	const char *fname = BASEDIR "\\test_second_handle";
+	struct smb2_tree *tree2 = NULL;
+	struct smb2_handle h1 = {};
+	struct smb2_handle h2 = {};
+	struct smb2_handle h3 = {};
+	union smb_setfileinfo sfinfo;
+	NTSTATUS status;
+	bool ret = true;
+
+	smb2_deltree(tree, BASEDIR);
+
+	status = torture_smb2_testdir(tree, BASEDIR, &h1);
+	torture_assert_ntstatus_ok_goto(tctx, status, ret, done,
+					"torture_smb2_testdir\n");
+	smb2_util_close(tree, h1);
+
+	status = torture_smb2_testfile(tree, fname, &h1);
+	torture_assert_ntstatus_ok_goto(tctx, status, ret, done,
+					"torture_smb2_testfile failed\n");
+
+	if (!set_ea(tree, h1, "first", "one")) {
+		torture_skip_goto(tctx, done, "Can't set EAs\n");
+	}
+
+	/*
+	 * Let the change time get old enough for caches to trust it.
+	 */
+	smb_msleep(3000);
+
+	torture_assert_goto(tctx,
+			    check_ea(tctx, tree, h1, "first", true),
+			    ret, done, "first EA missing\n");
+	torture_assert_goto(tctx,
+			    check_ea(tctx, tree, h1, "second", false),
+			    ret, done, "second EA there\n");
+	torture_assert_goto(tctx,
+			    check_attrib(tctx, tree, h1, 0),
+			    ret, done, "attributes wrong\n");
+
+	status = torture_smb2_testfile(tree, fname, &h2);
+	torture_assert_ntstatus_ok_goto(tctx, status, ret, done,
+					"second open failed\n");
+	torture_assert_goto(tctx,
+			    set_ea(tree, h2, "second", "two"),
+			    ret, done, "set EA on second handle failed\n");
+
+	torture_assert_goto(tctx,
+			    check_ea(tctx, tree, h1, "second", true),
+			    ret, done, "first handle misses second EA\n");
+
+	torture_assert_goto(tctx,
+			    torture_smb2_connection(tctx, &tree2),
+			    ret, done, "second connection failed\n");
+
+	status = torture_smb2_testfile(tree2, fname, &h3);
+	torture_assert_ntstatus_ok_goto(tctx, status, ret, done,
+					"open on second connection failed\n");
+
+	smb_msleep(3000);
+
+	torture_assert_goto(tctx,
+			    check_ea(tctx, tree, h1, "third", false),
+			    ret, done, "third EA there\n");
+
+	torture_assert_goto(tctx,
+			    set_ea(tree2, h3, "third", "three"),
+			    ret, done, "set EA on second connection failed\n");
+
+	torture_assert_goto(tctx,
+			    check_ea(tctx, tree, h1, "third", true),
+			    ret, done, "first handle misses third EA\n");
+
+	ZERO_STRUCT(sfinfo);
+	sfinfo.generic.level = RAW_SFILEINFO_BASIC_INFORMATION;
+	sfinfo.generic.in.file.handle = h3;
+	sfinfo.basic_info.in.attrib = FILE_ATTRIBUTE_HIDDEN;
+	status = smb2_setinfo_file(tree2, &sfinfo);
+	torture_assert_ntstatus_ok_goto(tctx, status, ret, done,
+					"setting attributes failed\n");
+
+	torture_assert_goto(tctx,
+			    check_attrib(tctx, tree, h1, FILE_ATTRIBUTE_HIDDEN),
+			    ret, done, "first handle misses hidden\n");
+
+done:
+	if (!smb2_util_handle_empty(h3)) {
+		smb2_util_close(tree2, h3);
+	}
+	if (!smb2_util_handle_empty(h2)) {
+		smb2_util_close(tree, h2);
+	}
+	if (!smb2_util_handle_empty(h1)) {
+		smb2_util_close(tree, h1);
+	}
+	TALLOC_FREE(tree2);
+
+	smb2_deltree(tree, BASEDIR);
+
+	return ret;
+}
+
 struct torture_suite *torture_smb2_ea(TALLOC_CTX *ctx)
 {
 	struct torture_suite *suite = torture_suite_create(ctx, "ea");
 	suite->description = talloc_strdup(suite, "SMB2-EA tests");
 
 	torture_suite_add_1smb2_test(suite, "acl_xattr", torture_smb2_acl_xattr);
+	torture_suite_add_1smb2_test(suite,
+				     "second_handle",
+				     torture_smb2_ea_second_handle);
 
 	return suite;
 }
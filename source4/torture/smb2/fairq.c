@@ -0,0 +1,283 @@
+/*
+   Unix SMB/CIFS implementation.
+
+   Test the fair queueing of SMB2 requests in smbd
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * These tests expect a server with "smb2 fair queue depth = 1", a
+ * share under test that delays its reads, so that they queue up,
+ * and a share "fairq_limited" with "smb2 bandwidth limit = 2M" on
+ * the same directory.
+ */
+
+#include "includes.h"
+#include "system/time.h"
+#include "libcli/smb2/smb2.h"
+#include "libcli/smb2/smb2_calls.h"
+#include "../libcli/smb/smbXcli_base.h"
+#include "torture/torture.h"
+#include "torture/smb2/proto.h"
+
+#define FNAME "fairq.dat"
+#define CHUNK_SIZE (1024 * 1024)
+
+#define FAIRQ_FAIRNESS_READS 16
+
+#define FAIRQ_LIMITED_RATE (2 * 1024 * 1024)
+#define FAIRQ_LIMITED_READS 8
+
+/*
+ * Make sure we can send num_reads reads of CHUNK_SIZE at once, the
+ * server grants more credits with every response.
+ */
+static bool test_fairq_get_credits(struct torture_context *tctx,
+				   struct smb2_tree *tree,
+				   int num_reads)
+{
+	struct smbXcli_conn *conn = tree->session->transport->conn;
+	uint16_t needed = num_reads * (CHUNK_SIZE / 65536);
+	int i;
+
+	smb2cli_conn_set_max_credits(conn, 8192);
+
+	for (i = 0; i < 100; i++) {
+		NTSTATUS status;
+
+		if (smb2cli_conn_get_cur_credits(conn) >= needed) {
+			return true;
+		}
+		status = smb2_keepalive(tree->session->transport);
+		torture_assert_ntstatus_ok(tctx, status, "smb2_keepalive");
+	}
+
+	torture_fail(tctx,
+		     talloc_asprintf(tctx,
+				     "Server only granted %"PRIu16" "
+				     "credits, need %"PRIu16"\n",
+				     smb2cli_conn_get_cur_credits(conn),
+				     needed));
+}
+
+static bool test_fairq_create_file(struct torture_context *tctx,
+				   struct smb2_tree *tree,
+				   struct smb2_handle *h)
+{
+	struct smb2_write w = {};
+	NTSTATUS status;
+
+	smb2_util_unlink(tree, FNAME);
+
+	status = torture_smb2_testfile(tree, FNAME, h);
+	torture_assert_ntstatus_ok(tctx, status, "torture_smb2_testfile");
+
+	w.in.file.handle = *h;
+	w.in.offset = 0;
+	w.in.data = data_blob_talloc_zero(tctx, CHUNK_SIZE);
+	torture_assert(tctx, w.in.data.data != NULL, "no memory");
+
+	status = smb2_write(tree, &w);
+	torture_assert_ntstatus_ok(tctx, status, "smb2_write");
+
+	return true;
+}
+
+static struct smb2_request *test_fairq_read_send(struct smb2_tree *tree,
+						 struct smb2_handle h)
+{
+	struct smb2_read r = {
+		.in.file.handle = h,
+		.in.length = CHUNK_SIZE,
+		.in.offset = 0,
+	};
+
+	return smb2_read_send(tree, &r);
+}
+
+/*
+ * A tree connect that queued a lot of large reads must not keep the
+ * read of another tree connect of the same session waiting until all
+ * of them are done: with one request at a time each tree connect
+ * gets a 1 MiB read per round.
+ */
+static bool test_fairq_fairness(struct torture_context *tctx,
+				struct smb2_tree *tree1)
+{
+	const int num_reads = FAIRQ_FAIRNESS_READS;
+	struct smb2_tree *tree2 = NULL;
+	struct smb2_handle h1 = {};
+	struct smb2_handle h2 = {};
+	struct smb2_request *reqs[FAIRQ_FAIRNESS_READS] = {};
+	struct smb2_request *req2 = NULL;
+	struct smb2_read r = {};
+	int num_done = 0;
+	int i;
+	NTSTATUS status;
+	bool ret = true;
+
+	ret = torture_smb2_tree_connect(tctx, tree1->session, tctx, &tree2);
+	torture_assert(tctx, ret, "torture_smb2_tree_connect");
+
+	ret = test_fairq_create_file(tctx, tree1, &h1);
+	torture_assert(tctx, ret, "test_fairq_create_file");
+
+	status = torture_smb2_testfile(tree2, FNAME, &h2);
+	torture_assert_ntstatus_ok_goto(tctx, status, ret, done,
+					"torture_smb2_testfile");
+
+	ret = test_fairq_get_credits(tctx, tree1, num_reads + 1);
+	torture_assert_goto(tctx, ret, ret, done, "not enough credits");
+
+	for (i = 0; i < num_reads; i++) {
+		reqs[i] = test_fairq_read_send(tree1, h1);
+		torture_assert_goto(tctx, reqs[i] != NULL, ret, done,
+				    "smb2_read_send failed");
+	}
+	req2 = test_fairq_read_send(tree2, h2);
+	torture_assert_goto(tctx, req2 != NULL, ret, done,
+			    "smb2_read_send failed");
+
+	while (req2->state <= SMB2_REQUEST_RECV) {
+		int rc = tevent_loop_once(tctx->ev);
+		torture_assert_goto(tctx, rc == 0, ret, done,
+				    "tevent_loop_once failed");
+	}
+
+	for (i = 0; i < num_reads; i++) {
+		if (reqs[i]->state > SMB2_REQUEST_RECV) {
+			num_done += 1;
+		}
+	}
+	torture_comment(tctx,
+			"The read on the second tree connect finished "
+			"after %d of %d reads on the first one\n",
+			num_done,
+			num_reads);
+
+	status = smb2_read_recv(req2, tctx, &r);
+	torture_assert_ntstatus_ok_goto(tctx, status, ret, done,
+					"smb2_read_recv failed");
+	torture_assert_int_equal_goto(tctx, r.out.data.length, CHUNK_SIZE,
+				      ret, done, "short read");
+
+	torture_assert_goto(tctx, num_done < num_reads / 2, ret, done,
+			    "read was not scheduled fairly");
+
+done:
+	for (i = 0; i < num_reads; i++) {
+		if (reqs[i] != NULL) {
+			smb2_read_recv(reqs[i], tctx, &r);
+		}
+	}
+	smb2_util_close(tree2, h2);
+	smb2_util_close(tree1, h1);
+	smb2_util_unlink(tree1, FNAME);
+	return ret;
+}
+
+/*
+ * Reads on a share with "smb2 bandwidth limit" stay below the limit,
+ * allowing for the first read that may go into debt.
+ */
+static bool test_fairq_bandwidth_limit(struct torture_context *tctx,
+				       struct smb2_tree *tree)
+{
+	const int num_reads = FAIRQ_LIMITED_READS;
+	struct smb2_tree *limited = NULL;
+	struct smb2_handle h = {};
+	struct smb2_handle hl = {};
+	struct smb2_request *reqs[FAIRQ_LIMITED_READS] = {};
+	struct smb2_read r = {};
+	struct timeval start;
+	double elapsed;
+	double expected;
+	int i;
+	NTSTATUS status;
+	bool ret = true;
+
+	ret = test_fairq_create_file(tctx, tree, &h);
+	torture_assert(tctx, ret, "test_fairq_create_file");
+
+	ret = torture_smb2_con_share(tctx, "fairq_limited", &limited);
+	torture_assert_goto(tctx, ret, ret, done,
+			    "torture_smb2_con_share failed");
+
+	status = torture_smb2_testfile(limited, FNAME, &hl);
+	torture_assert_ntstatus_ok_goto(tctx, status, ret, done,
+					"torture_smb2_testfile");
+
+	ret = test_fairq_get_credits(tctx, limited, num_reads);
+	torture_assert_goto(tctx, ret, ret, done, "not enough credits");
+
+	start = timeval_current();
+
+	for (i = 0; i < num_reads; i++) {
+		reqs[i] = test_fairq_read_send(limited, hl);
+		torture_assert_goto(tctx, reqs[i] != NULL, ret, done,
+				    "smb2_read_send failed");
+	}
+	for (i = 0; i < num_reads; i++) {
+		status = smb2_read_recv(reqs[i], tctx, &r);
+		reqs[i] = NULL;
+		torture_assert_ntstatus_ok_goto(tctx, status, ret, done,
+						"smb2_read_recv failed");
+		torture_assert_int_equal_goto(tctx, r.out.data.length,
+					      CHUNK_SIZE, ret, done,
+					      "short read");
+	}
+
+	elapsed = timeval_elapsed(&start);
+	expected = (double)(num_reads - 1) * CHUNK_SIZE / FAIRQ_LIMITED_RATE;
+
+	torture_comment(tctx,
+			"%d MiB at %d MiB/s took %.2f seconds\n",
+			num_reads * CHUNK_SIZE / (1024 * 1024),
+			FAIRQ_LIMITED_RATE / (1024 * 1024),
+			elapsed);
+
+	torture_assert_goto(tctx, elapsed >= expected * 0.9, ret, done,
+			    "reads were faster than the bandwidth limit");
+	torture_assert_goto(tctx, elapsed < expected * 3, ret, done,
+			    "reads were much slower than the bandwidth limit");
+
+done:
+	for (i = 0; i < num_reads; i++) {
+		if (reqs[i] != NULL) {
+			smb2_read_recv(reqs[i], tctx, &r);
+		}
+	}
+	if (limited != NULL) {
+		smb2_util_close(limited, hl);
+		TALLOC_FREE(limited);
+	}
+	smb2_util_close(tree, h);
+	smb2_util_unlink(tree, FNAME);
+	return ret;
+}
+
+struct torture_suite *torture_smb2_fairq_init(TALLOC_CTX *ctx)
+{
+	struct torture_suite *suite = torture_suite_create(ctx, "fairq");
+
+	torture_suite_add_1smb2_test(suite, "fairness",
+				     test_fairq_fairness);
+	torture_suite_add_1smb2_test(suite, "bandwidth-limit",
+				     test_fairq_bandwidth_limit);
+
+	suite->description = talloc_strdup(suite, "SMB2 fair queue tests");
+
+	return suite;
+}
@@ -2781,6 +2781,238 @@ done:
 	return correct;
 }
 
+/**
+ * Test conflicts with many locks on a file taken out of order: a lock
+ * starting in front of lots of smaller ones still has to be found when
+ * its end reaches into the requested range.
+ */
+static bool test_sorted_overlap(struct torture_context *torture,
+				struct smb2_tree *tree)
+{
+	NTSTATUS status;
+	bool ret = true;
+	struct smb2_handle h = {{0}};
+	struct smb2_handle h2 = {{0}};
+	uint8_t buf[4096];
+	struct smb2_read rd;
+	const int num_small = 64;
+	int i;
+
+	const char *fname = BASEDIR "\\sorted_overlap.txt";
+
+	status = torture_smb2_testdir(tree, BASEDIR, &h);
+	CHECK_STATUS(status, NT_STATUS_OK);
+	smb2_util_close(tree, h);
+
+	status = torture_smb2_testfile(tree, fname, &h);
+	CHECK_STATUS(status, NT_STATUS_OK);
+
+	ZERO_STRUCT(buf);
+	status = smb2_util_write(tree, h, buf, 0, ARRAY_SIZE(buf));
+	CHECK_STATUS(status, NT_STATUS_OK);
+
+	status = torture_smb2_testfile(tree, fname, &h2);
+	CHECK_STATUS(status, NT_STATUS_OK);
+
+	torture_comment(torture, "Testing overlaps with locks taken out "
+				 "of order\n");
+
+	/* Small locks at 2000, 2010, ..., in descending order */
+	for (i = num_small - 1; i >= 0; i--) {
+		status = test_smb2_lock(tree, h, 2000 + i * 10, 5, true);
+		CHECK_STATUS(status, NT_STATUS_OK);
+	}
+	/* Small shared locks in front of the long one */
+	for (i = num_small - 1; i >= 0; i--) {
+		status = test_smb2_lock(tree, h, i * 2, 1, false);
+		CHECK_STATUS(status, NT_STATUS_OK);
+	}
+	/* One long lock spanning behind lots of the small ones */
+	status = test_smb2_lock(tree, h, 200, 1800, true);
+	CHECK_STATUS(status, NT_STATUS_OK);
+	/* And more small ones stacked inside that range */
+	for (i = 0; i < num_small; i++) {
+		status = test_smb2_lock(tree, h, 1999 - i * 2, 1, false);
+		CHECK_STATUS(status, NT_STATUS_OK);
+	}
+
+	torture_comment(torture, "  the long lock conflicts at its end\n");
+	status = test_smb2_lock(tree, h2, 1999, 1, false);
+	CHECK_STATUS(status, NT_STATUS_LOCK_NOT_GRANTED);
+	status = test_smb2_lock(tree, h2, 500, 1, false);
+	CHECK_STATUS(status, NT_STATUS_LOCK_NOT_GRANTED);
+
+	torture_comment(torture, "  reads conflict with the long lock\n");
+	ZERO_STRUCT(rd);
+	rd.in.file.handle = h2;
+	rd.in.offset = 1900;
+	rd.in.length = 10;
+	status = smb2_read(tree, tree, &rd);
+	CHECK_STATUS(status, NT_STATUS_FILE_LOCK_CONFLICT);
+
+	torture_comment(torture, "  each small lock conflicts, the gaps "
+				 "between them don't\n");
+	for (i = 0; i < num_small; i++) {
+		status = test_smb2_lock(tree, h2, 2000 + i * 10 + 4, 1, false);
+		CHECK_STATUS(status, NT_STATUS_LOCK_NOT_GRANTED);
+
+		status = test_smb2_lock(tree, h2, 2000 + i * 10 + 5, 5, true);
+		CHECK_STATUS(status, NT_STATUS_OK);
+		status = test_smb2_unlock(tree, h2, 2000 + i * 10 + 5, 5);
+		CHECK_STATUS(status, NT_STATUS_OK);
+	}
+
+	torture_comment(torture, "  shared locks only conflict with "
+				 "exclusive ones\n");
+	status = test_smb2_lock(tree, h2, 0, 1, false);
+	CHECK_STATUS(status, NT_STATUS_OK);
+	status = test_smb2_unlock(tree, h2, 0, 1);
+	CHECK_STATUS(status, NT_STATUS_OK);
+	status = test_smb2_lock(tree, h2, 0, 1, true);
+	CHECK_STATUS(status, NT_STATUS_LOCK_NOT_GRANTED);
+	status = test_smb2_lock(tree, h2, 1, 1, true);
+	CHECK_STATUS(status, NT_STATUS_OK);
+	status = test_smb2_unlock(tree, h2, 1, 1);
+	CHECK_STATUS(status, NT_STATUS_OK);
+
+	torture_comment(torture, "  a range over all locks conflicts, "
+				 "one behind them doesn't\n");
+	status = test_smb2_lock(tree, h2, 150, 10000, false);
+	CHECK_STATUS(status, NT_STATUS_LOCK_NOT_GRANTED);
+	status = test_smb2_lock(tree, h2, 2000 + num_small * 10, 100, true);
+	CHECK_STATUS(status, NT_STATUS_OK);
+	status = test_smb2_unlock(tree, h2, 2000 + num_small * 10, 100);
+	CHECK_STATUS(status, NT_STATUS_OK);
+
+	torture_comment(torture, "  without the long lock its range is "
+				 "free up to the small locks inside\n");
+	status = test_smb2_unlock(tree, h, 200, 1800);
+	CHECK_STATUS(status, NT_STATUS_OK);
+	status = test_smb2_lock(tree, h2, 200, 1800 - num_small * 2, true);
+	CHECK_STATUS(status, NT_STATUS_OK);
+	status = test_smb2_lock(tree, h2, 1999, 1, true);
+	CHECK_STATUS(status, NT_STATUS_LOCK_NOT_GRANTED);
+	status = test_smb2_lock(tree, h2, 1998, 1, true);
+	CHECK_STATUS(status, NT_STATUS_OK);
+
+	ZERO_STRUCT(rd);
+	rd.in.file.handle = h2;
+	rd.in.offset = 1900;
+	rd.in.length = 10;
+	status = smb2_read(tree, tree, &rd);
+	CHECK_STATUS(status, NT_STATUS_OK);
+
+done:
+	smb2_util_close(tree, h2);
+	smb2_util_close(tree, h);
+	smb2_deltree(tree, BASEDIR);
+	return ret;
+}
+
+/**
+ * Test that stacked locks on the same range are removed in the order
+ * they were granted, also with other locks taken around them.
+ */
+static bool test_stacking_order(struct torture_context *torture,
+				struct smb2_tree *tree)
+{
+	NTSTATUS status;
+	bool ret = true;
+	struct smb2_handle h = {{0}};
+	struct smb2_handle h2 = {{0}};
+	uint8_t buf[200];
+
+	const char *fname = BASEDIR "\\stacking_order.txt";
+
+	status = torture_smb2_testdir(tree, BASEDIR, &h);
+	CHECK_STATUS(status, NT_STATUS_OK);
+	smb2_util_close(tree, h);
+
+	status = torture_smb2_testfile(tree, fname, &h);
+	CHECK_STATUS(status, NT_STATUS_OK);
+
+	ZERO_STRUCT(buf);
+	status = smb2_util_write(tree, h, buf, 0, ARRAY_SIZE(buf));
+	CHECK_STATUS(status, NT_STATUS_OK);
+
+	status = torture_smb2_testfile(tree, fname, &h2);
+	CHECK_STATUS(status, NT_STATUS_OK);
+
+	torture_comment(torture, "Testing the order of stacked locks\n");
+
+	status = test_smb2_lock(tree, h, 50, 10, true);
+	CHECK_STATUS(status, NT_STATUS_OK);
+	status = test_smb2_lock(tree, h, 0, 10, true);
+	CHECK_STATUS(status, NT_STATUS_OK);
+	status = test_smb2_lock(tree, h, 50, 10, false);
+	CHECK_STATUS(status, NT_STATUS_OK);
+	status = test_smb2_lock(tree, h, 0, 10, false);
+	CHECK_STATUS(status, NT_STATUS_OK);
+	status = test_smb2_lock(tree, h, 25, 10, true);
+	CHECK_STATUS(status, NT_STATUS_OK);
+	status = test_smb2_lock(tree, h, 50, 10, false);
+	CHECK_STATUS(status, NT_STATUS_OK);
+
+	/* An upgrade of the shared lock is not possible */
+	status = test_smb2_lock(tree, h, 0, 10, true);
+	CHECK_STATUS(status, NT_STATUS_LOCK_NOT_GRANTED);
+
+	status = test_smb2_lock(tree, h2, 50, 10, false);
+	CHECK_STATUS(status, NT_STATUS_LOCK_NOT_GRANTED);
+
+	torture_comment(torture, "  the first unlock removes the exclusive "
+				 "lock taken first\n");
+	status = test_smb2_unlock(tree, h, 50, 10);
+	CHECK_STATUS(status, NT_STATUS_OK);
+	status = test_smb2_lock(tree, h2, 50, 10, false);
+	CHECK_STATUS(status, NT_STATUS_OK);
+	status = test_smb2_unlock(tree, h2, 50, 10);
+	CHECK_STATUS(status, NT_STATUS_OK);
+	status = test_smb2_lock(tree, h2, 50, 10, true);
+	CHECK_STATUS(status, NT_STATUS_LOCK_NOT_GRANTED);
+
+	status = test_smb2_lock(tree, h2, 0, 10, false);
+	CHECK_STATUS(status, NT_STATUS_LOCK_NOT_GRANTED);
+	status = test_smb2_unlock(tree, h, 0, 10);
+	CHECK_STATUS(status, NT_STATUS_OK);
+	status = test_smb2_lock(tree, h2, 0, 10, false);
+	CHECK_STATUS(status, NT_STATUS_OK);
+	status = test_smb2_unlock(tree, h2, 0, 10);
+	CHECK_STATUS(status, NT_STATUS_OK);
+
+	torture_comment(torture, "  the lock in between is untouched\n");
+	status = test_smb2_lock(tree, h2, 25, 10, false);
+	CHECK_STATUS(status, NT_STATUS_LOCK_NOT_GRANTED);
+
+	torture_comment(torture, "  the two shared locks need two "
+				 "unlocks\n");
+	status = test_smb2_unlock(tree, h, 50, 10);
+	CHECK_STATUS(status, NT_STATUS_OK);
+	status = test_smb2_lock(tree, h2, 50, 10, true);
+	CHECK_STATUS(status, NT_STATUS_LOCK_NOT_GRANTED);
+	status = test_smb2_unlock(tree, h, 50, 10);
+	CHECK_STATUS(status, NT_STATUS_OK);
+	status = test_smb2_lock(tree, h2, 50, 10, true);
+	CHECK_STATUS(status, NT_STATUS_OK);
+	status = test_smb2_unlock(tree, h2, 50, 10);
+	CHECK_STATUS(status, NT_STATUS_OK);
+
+	status = test_smb2_unlock(tree, h, 50, 10);
+	CHECK_STATUS(status, NT_STATUS_RANGE_NOT_LOCKED);
+	status = test_smb2_unlock(tree, h, 0, 10);
+	CHECK_STATUS(status, NT_STATUS_OK);
+	status = test_smb2_unlock(tree, h, 0, 10);
+	CHECK_STATUS(status, NT_STATUS_RANGE_NOT_LOCKED);
+	status = test_smb2_unlock(tree, h, 25, 10);
+	CHECK_STATUS(status, NT_STATUS_OK);
+
+done:
+	smb2_util_close(tree, h2);
+	smb2_util_close(tree, h);
+	smb2_deltree(tree, BASEDIR);
+	return ret;
+}
+
 /**
  * Test truncation of locked file
  *  - some tests ported from BASE-LOCK-LOCK7
@@ -3498,6 +3730,10 @@ struct torture_suite *torture_smb2_lock_init(TALLOC_CTX *ctx)
 	torture_suite_add_1smb2_test(suite, "context", test_context);
 	torture_suite_add_1smb2_test(suite, "range", test_range);
 	torture_suite_add_2smb2_test(suite, "overlap", test_overlap);
+	torture_suite_add_1smb2_test(suite, "sorted-overlap",
+				     test_sorted_overlap);
+	torture_suite_add_1smb2_test(suite, "stacking-order",
+				     test_stacking_order);
 	torture_suite_add_1smb2_test(suite, "truncate", test_truncate);
 	torture_suite_add_1smb2_test(suite, "replay_broken_windows",
 				     test_replay_broken_windows);
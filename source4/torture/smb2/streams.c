@@ -2395,6 +2395,301 @@ done:
 	return ret;
 }
 
+/*
+  write and read back a stream that is larger than what one xattr
+  read is meant for, in chunks and at random offsets
+*/
+static bool test_stream_large_io(struct torture_context *tctx,
+				 struct smb2_tree *tree)
+{
+	TALLOC_CTX *mem_ctx = talloc_new(tctx);
+	const char *fname = DNAME "\\stream_large_io.txt";
+	const char *sname = NULL;
+	size_t size = torture_setting_int(tctx, "stream_size", 48 * 1024);
+	size_t chunk = 4096;
+	struct smb2_create create;
+	struct smb2_handle h = {{0}};
+	struct smb2_handle h2 = {{0}};
+	struct smb2_read r;
+	union smb_fileinfo finfo;
+	uint8_t *buf = NULL;
+	size_t ofs, i;
+	NTSTATUS status;
+	bool ret = true;
+
+	sname = talloc_asprintf(mem_ctx, "%s:%s", fname, "Large Stream");
+	torture_assert_goto(tctx, sname != NULL, ret, done, "talloc failed\n");
+
+	buf = talloc_array(mem_ctx, uint8_t, size);
+	torture_assert_goto(tctx, buf != NULL, ret, done, "talloc failed\n");
+	for (i = 0; i < size; i++) {
+		buf[i] = (uint8_t)(i % 251);
+	}
+
+	smb2_deltree(tree, DNAME);
+
+	status = torture_smb2_testdir(tree, DNAME, &h);
+	CHECK_STATUS(status, NT_STATUS_OK);
+
+	ZERO_STRUCT(create);
+	create.in.desired_access = SEC_FILE_READ_DATA | SEC_FILE_WRITE_DATA;
+	create.in.share_access = NTCREATEX_SHARE_ACCESS_MASK;
+	create.in.file_attributes = FILE_ATTRIBUTE_NORMAL;
+	create.in.create_disposition = NTCREATEX_DISP_CREATE;
+	create.in.impersonation_level = SMB2_IMPERSONATION_IMPERSONATION;
+	create.in.fname = sname;
+	status = smb2_create(tree, mem_ctx, &create);
+	CHECK_STATUS(status, NT_STATUS_OK);
+	h2 = create.out.file.handle;
+
+	torture_comment(tctx, "Writing %zu bytes in %zu byte chunks\n",
+			size, chunk);
+
+	for (ofs = 0; ofs < size; ofs += chunk) {
+		status = smb2_util_write(tree, h2, buf + ofs, ofs,
+					 MIN(chunk, size - ofs));
+		CHECK_STATUS(status, NT_STATUS_OK);
+	}
+
+	smb2_util_close(tree, h2);
+	ZERO_STRUCT(h2);
+
+	create.in.create_disposition = NTCREATEX_DISP_OPEN;
+	status = smb2_create(tree, mem_ctx, &create);
+	CHECK_STATUS(status, NT_STATUS_OK);
+	h2 = create.out.file.handle;
+	CHECK_VALUE(create.out.size, size);
+
+	torture_comment(tctx, "Overwriting the middle of the stream\n");
+
+	memset(buf + size / 2, 'X', chunk);
+	status = smb2_util_write(tree, h2, buf + size / 2, size / 2, chunk);
+	CHECK_STATUS(status, NT_STATUS_OK);
+
+	torture_comment(tctx, "Reading back at unaligned offsets\n");
+
+	for (ofs = 0; ofs < size; ofs += chunk - 1) {
+		size_t len = MIN(chunk, size - ofs);
+
+		ZERO_STRUCT(r);
+		r.in.file.handle = h2;
+		r.in.length = len;
+		r.in.offset = ofs;
+		status = smb2_read(tree, mem_ctx, &r);
+		CHECK_STATUS(status, NT_STATUS_OK);
+		CHECK_VALUE(r.out.data.length, len);
+		torture_assert_mem_equal_goto(tctx,
+					      r.out.data.data,
+					      buf + ofs,
+					      len,
+					      ret,
+					      done,
+					      "stream data mismatch\n");
+		data_blob_free(&r.out.data);
+	}
+
+	ZERO_STRUCT(r);
+	r.in.file.handle = h2;
+	r.in.length = chunk;
+	r.in.offset = size;
+	status = smb2_read(tree, mem_ctx, &r);
+	CHECK_STATUS(status, NT_STATUS_END_OF_FILE);
+
+	smb2_util_close(tree, h2);
+	ZERO_STRUCT(h2);
+
+	create.in.desired_access = SEC_FILE_READ_ATTRIBUTE;
+	create.in.fname = fname;
+	status = smb2_create(tree, mem_ctx, &create);
+	CHECK_STATUS(status, NT_STATUS_OK);
+	h2 = create.out.file.handle;
+
+	ZERO_STRUCT(finfo);
+	finfo.generic.level = RAW_FILEINFO_STREAM_INFORMATION;
+	finfo.generic.in.file.handle = h2;
+	status = smb2_getinfo_file(tree, mem_ctx, &finfo);
+	CHECK_STATUS(status, NT_STATUS_OK);
+	CHECK_VALUE(finfo.stream_info.out.num_streams, 2);
+	for (i = 0; i < finfo.stream_info.out.num_streams; i++) {
+		struct stream_struct *st = &finfo.stream_info.out.streams[i];
+
+		if (strcmp(st->stream_name.s, ":Large Stream:$DATA") == 0) {
+			CHECK_VALUE(st->size, size);
+		}
+	}
+
+	smb2_util_close(tree, h2);
+	ZERO_STRUCT(h2);
+
+	status = smb2_util_unlink(tree, sname);
+	CHECK_STATUS(status, NT_STATUS_OK);
+
+	create.in.desired_access = SEC_FILE_READ_DATA;
+	create.in.fname = sname;
+	status = smb2_create(tree, mem_ctx, &create);
+	CHECK_STATUS(status, NT_STATUS_OBJECT_NAME_NOT_FOUND);
+
+done:
+	if (!smb2_util_handle_empty(h2)) {
+		smb2_util_close(tree, h2);
+	}
+	if (!smb2_util_handle_empty(h)) {
+		smb2_util_close(tree, h);
+	}
+	smb2_deltree(tree, DNAME);
+	talloc_free(mem_ctx);
+
+	return ret;
+}
+
+/*
+  two connections write to a small stream at the same time, both
+  writes grow it beyond the sidecar threshold of streams_xattr. Neither
+  write may get lost when the stream is moved into a sidecar.
+*/
+static bool test_stream_concurrent_migrate(struct torture_context *tctx,
+					   struct smb2_tree *tree1,
+					   struct smb2_tree *tree2)
+{
+	TALLOC_CTX *mem_ctx = talloc_new(tctx);
+	const char *fname = DNAME "\\stream_concurrent_migrate.txt";
+	int nstreams = torture_setting_int(tctx, "stream_count", 10);
+	size_t chunk = 8192;
+	struct smb2_create create;
+	struct smb2_handle h = {{0}};
+	struct smb2_handle h1 = {{0}};
+	struct smb2_handle h2 = {{0}};
+	struct smb2_request *req1 = NULL;
+	struct smb2_request *req2 = NULL;
+	struct smb2_write w1;
+	struct smb2_write w2;
+	struct smb2_read r;
+	uint8_t *buf = NULL;
+	uint8_t small[100];
+	NTSTATUS status;
+	bool ret = true;
+	int i;
+
+	if (!torture_setting_bool(tctx, "stream_sidecar", false)) {
+		torture_skip(tctx, "Needs streams_xattr:sidecar_threshold "
+			     "below 8192, set torture:stream_sidecar=yes\n");
+	}
+
+	buf = talloc_array(mem_ctx, uint8_t, 2 * chunk);
+	torture_assert_goto(tctx, buf != NULL, ret, done, "talloc failed\n");
+	memset(buf, 'A', chunk);
+	memset(buf + chunk, 'B', chunk);
+	memset(small, 's', sizeof(small));
+
+	smb2_deltree(tree1, DNAME);
+
+	status = torture_smb2_testdir(tree1, DNAME, &h);
+	CHECK_STATUS(status, NT_STATUS_OK);
+
+	status = torture_smb2_testfile(tree1, fname, &h1);
+	CHECK_STATUS(status, NT_STATUS_OK);
+	smb2_util_close(tree1, h1);
+	ZERO_STRUCT(h1);
+
+	for (i = 0; i < nstreams; i++) {
+		const char *sname = talloc_asprintf(mem_ctx,
+						    "%s:stream%d",
+						    fname,
+						    i);
+		torture_assert_goto(tctx, sname != NULL, ret, done,
+				    "talloc failed\n");
+
+		ZERO_STRUCT(create);
+		create.in.desired_access = SEC_FILE_READ_DATA |
+			SEC_FILE_WRITE_DATA;
+		create.in.share_access = NTCREATEX_SHARE_ACCESS_MASK;
+		create.in.file_attributes = FILE_ATTRIBUTE_NORMAL;
+		create.in.create_disposition = NTCREATEX_DISP_CREATE;
+		create.in.impersonation_level =
+			SMB2_IMPERSONATION_IMPERSONATION;
+		create.in.fname = sname;
+		status = smb2_create(tree1, mem_ctx, &create);
+		CHECK_STATUS(status, NT_STATUS_OK);
+		h1 = create.out.file.handle;
+
+		status = smb2_util_write(tree1, h1, small, 0, sizeof(small));
+		CHECK_STATUS(status, NT_STATUS_OK);
+
+		create.in.create_disposition = NTCREATEX_DISP_OPEN;
+		status = smb2_create(tree2, mem_ctx, &create);
+		CHECK_STATUS(status, NT_STATUS_OK);
+		h2 = create.out.file.handle;
+
+		ZERO_STRUCT(w1);
+		w1.in.file.handle = h1;
+		w1.in.offset = 0;
+		w1.in.data = data_blob_const(buf, chunk);
+
+		ZERO_STRUCT(w2);
+		w2.in.file.handle = h2;
+		w2.in.offset = chunk;
+		w2.in.data = data_blob_const(buf + chunk, chunk);
+
+		req1 = smb2_write_send(tree1, &w1);
+		torture_assert_goto(tctx, req1 != NULL, ret, done,
+				    "smb2_write_send failed\n");
+		req2 = smb2_write_send(tree2, &w2);
+		torture_assert_goto(tctx, req2 != NULL, ret, done,
+				    "smb2_write_send failed\n");
+
+		status = smb2_write_recv(req1, &w1);
+		CHECK_STATUS(status, NT_STATUS_OK);
+		CHECK_VALUE(w1.out.nwritten, chunk);
+		status = smb2_write_recv(req2, &w2);
+		CHECK_STATUS(status, NT_STATUS_OK);
+		CHECK_VALUE(w2.out.nwritten, chunk);
+
+		smb2_util_close(tree2, h2);
+		ZERO_STRUCT(h2);
+		smb2_util_close(tree1, h1);
+		ZERO_STRUCT(h1);
+
+		status = smb2_create(tree1, mem_ctx, &create);
+		CHECK_STATUS(status, NT_STATUS_OK);
+		h1 = create.out.file.handle;
+		CHECK_VALUE(create.out.size, 2 * chunk);
+
+		ZERO_STRUCT(r);
+		r.in.file.handle = h1;
+		r.in.length = 2 * chunk;
+		r.in.offset = 0;
+		status = smb2_read(tree1, mem_ctx, &r);
+		CHECK_STATUS(status, NT_STATUS_OK);
+		CHECK_VALUE(r.out.data.length, 2 * chunk);
+		torture_assert_mem_equal_goto(tctx,
+					      r.out.data.data,
+					      buf,
+					      2 * chunk,
+					      ret,
+					      done,
+					      "lost a concurrent write\n");
+		data_blob_free(&r.out.data);
+
+		smb2_util_close(tree1, h1);
+		ZERO_STRUCT(h1);
+	}
+
+done:
+	if (!smb2_util_handle_empty(h2)) {
+		smb2_util_close(tree2, h2);
+	}
+	if (!smb2_util_handle_empty(h1)) {
+		smb2_util_close(tree1, h1);
+	}
+	if (!smb2_util_handle_empty(h)) {
+		smb2_util_close(tree1, h);
+	}
+	smb2_deltree(tree1, DNAME);
+	talloc_free(mem_ctx);
+
+	return ret;
+}
+
 /*
    basic testing of streams calls SMB2
 */
@@ -2418,6 +2713,9 @@ struct torture_suite *torture_smb2_streams_init(TALLOC_CTX *ctx)
 	torture_suite_add_1smb2_test(suite, "zero-byte", test_zero_byte_stream);
 	torture_suite_add_1smb2_test(suite, "basefile-rename-with-open-stream",
 					test_basefile_rename_with_open_stream);
+	torture_suite_add_1smb2_test(suite, "large-io", test_stream_large_io);
+	torture_suite_add_2smb2_test(suite, "concurrent-migrate",
+				     test_stream_concurrent_migrate);
 
 	suite->description = talloc_strdup(suite, "SMB2-STREAM tests");
 	return suite;
@@ -3788,6 +3788,238 @@ done:
 	return true;
 }
 
+/*
+ * Larger than three of the 16 MiB segments smbd copies at the same
+ * time, the last one shorter.
+ */
+#define COPYFILE_SEGMENTS_SIZE (40 * 1024 * 1024)
+
+/*
+ * Issue an AAPL copyfile of src_h to dest_h and check that it copied
+ * size bytes.
+ */
+static bool test_copyfile_run(struct torture_context *torture,
+			      struct smb2_tree *tree,
+			      TALLOC_CTX *mem_ctx,
+			      union smb_ioctl *io,
+			      struct srv_copychunk_copy *cc_copy,
+			      uint32_t size)
+{
+	struct srv_copychunk_rsp cc_rsp;
+	enum ndr_err_code ndr_ret;
+	NTSTATUS status;
+	bool ok;
+
+	ndr_ret = ndr_push_struct_blob(&io->smb2.in.out, mem_ctx,
+				       cc_copy,
+			(ndr_push_flags_fn_t)ndr_push_srv_copychunk_copy);
+	torture_assert_ndr_success(torture, ndr_ret,
+				   "ndr_push_srv_copychunk_copy");
+
+	status = smb2_ioctl(tree, mem_ctx, &io->smb2);
+	torture_assert_ntstatus_ok(torture, status, "FSCTL_SRV_COPYCHUNK");
+
+	ndr_ret = ndr_pull_struct_blob(&io->smb2.out.out, mem_ctx,
+				       &cc_rsp,
+			(ndr_pull_flags_fn_t)ndr_pull_srv_copychunk_rsp);
+	torture_assert_ndr_success(torture, ndr_ret,
+				   "ndr_pull_srv_copychunk_rsp");
+
+	ok = check_copy_chunk_rsp(torture, &cc_rsp,
+				  0,	/* chunks written */
+				  0,	/* chunk bytes unsuccessfully written */
+				  size); /* total bytes written */
+	torture_assert(torture, ok, "bad copy chunk response data");
+
+	return true;
+}
+
+/*
+ * A copyfile of a whole file is split into segments that are copied
+ * in parallel. On a share with "vfs_default:copy_file_range EXDEV
+ * offset" the segments after the first fail and the server has to
+ * start over with reads and writes.
+ */
+static bool test_copyfile_segments(struct torture_context *torture,
+				   struct smb2_tree *tree)
+{
+	struct smb2_handle src_h = {};
+	struct smb2_handle dest_h = {};
+	union smb_ioctl io;
+	TALLOC_CTX *tmp_ctx = talloc_new(tree);
+	struct srv_copychunk_copy cc_copy;
+	bool ret = true;
+	bool ok;
+
+	ok = neg_aapl_copyfile(torture, tree,
+			       SMB2_CRTCTX_AAPL_SUPPORTS_OSX_COPYFILE);
+	if (!ok) {
+		torture_skip_goto(torture, done, "missing AAPL copyfile");
+	}
+
+	ok = test_setup_copy_chunk(torture, tree, tmp_ctx,
+				   0, /* 0 chunks, copyfile semantics */
+				   FNAME_CC_SRC,
+				   &src_h, COPYFILE_SEGMENTS_SIZE,
+				   SEC_FILE_READ_DATA | SEC_FILE_WRITE_DATA,
+				   FNAME_CC_DST,
+				   &dest_h, 0,	/* 0 byte dest file */
+				   SEC_FILE_READ_DATA | SEC_FILE_WRITE_DATA,
+				   &cc_copy,
+				   &io);
+	torture_assert_goto(torture, ok, ret, done,
+			    "setup copy chunk error");
+
+	ok = test_copyfile_run(torture, tree, tmp_ctx, &io, &cc_copy,
+			       COPYFILE_SEGMENTS_SIZE);
+	torture_assert_goto(torture, ok, ret, done, "copyfile failed");
+
+	ok = check_pattern(torture, tree, tmp_ctx, dest_h,
+			   0, COPYFILE_SEGMENTS_SIZE, 0);
+	torture_assert_goto(torture, ok, ret, done,
+			    "inconsistent file data");
+
+done:
+	smb2_util_close(tree, src_h);
+	smb2_util_close(tree, dest_h);
+	smb2_util_unlink(tree, FNAME_CC_SRC);
+	smb2_util_unlink(tree, FNAME_CC_DST);
+	talloc_free(tmp_ctx);
+	return ret;
+}
+
+static bool test_copyfile_get_alloc_size(struct torture_context *torture,
+					 struct smb2_tree *tree,
+					 TALLOC_CTX *mem_ctx,
+					 struct smb2_handle h,
+					 uint64_t *alloc_size)
+{
+	union smb_fileinfo finfo;
+	NTSTATUS status;
+
+	ZERO_STRUCT(finfo);
+	finfo.generic.level = RAW_FILEINFO_STANDARD_INFORMATION;
+	finfo.generic.in.file.handle = h;
+	status = smb2_getinfo_file(tree, mem_ctx, &finfo);
+	torture_assert_ntstatus_ok(torture, status, "smb2_getinfo_file");
+
+	*alloc_size = finfo.standard_info.out.alloc_size;
+	return true;
+}
+
+/*
+ * A sparse source copied into a destination that the client sized
+ * before: the data has to arrive, the hole has to read back as zeros
+ * and should stay a hole.
+ */
+static bool test_copyfile_sparse(struct torture_context *torture,
+				 struct smb2_tree *tree)
+{
+	const uint64_t size = COPYFILE_SEGMENTS_SIZE;
+	const uint64_t data_len = 64 * 1024;
+	struct smb2_handle src_h = {};
+	struct smb2_handle dest_h = {};
+	union smb_ioctl io;
+	union smb_setfileinfo sfinfo;
+	struct smb2_read r;
+	TALLOC_CTX *tmp_ctx = talloc_new(tree);
+	struct srv_copychunk_copy cc_copy;
+	uint64_t src_alloc = 0;
+	uint64_t dest_alloc = 0;
+	NTSTATUS status;
+	size_t i;
+	bool ret = true;
+	bool ok;
+
+	ok = neg_aapl_copyfile(torture, tree,
+			       SMB2_CRTCTX_AAPL_SUPPORTS_OSX_COPYFILE);
+	if (!ok) {
+		torture_skip_goto(torture, done, "missing AAPL copyfile");
+	}
+
+	ok = test_setup_copy_chunk(torture, tree, tmp_ctx,
+				   0, /* 0 chunks, copyfile semantics */
+				   FNAME_CC_SRC,
+				   &src_h, 0,
+				   SEC_FILE_READ_DATA | SEC_FILE_WRITE_DATA,
+				   FNAME_CC_DST,
+				   &dest_h, 0,
+				   SEC_FILE_READ_DATA | SEC_FILE_WRITE_DATA,
+				   &cc_copy,
+				   &io);
+	torture_assert_goto(torture, ok, ret, done,
+			    "setup copy chunk error");
+
+	/* Data at the start and the end, a hole in between */
+	ok = write_pattern(torture, tree, tmp_ctx, src_h,
+			   0, data_len, 0);
+	torture_assert_goto(torture, ok, ret, done, "write pattern");
+	ok = write_pattern(torture, tree, tmp_ctx, src_h,
+			   size - data_len, data_len, size - data_len);
+	torture_assert_goto(torture, ok, ret, done, "write pattern");
+
+	ZERO_STRUCT(sfinfo);
+	sfinfo.generic.in.file.handle = dest_h;
+	sfinfo.generic.level = RAW_SFILEINFO_END_OF_FILE_INFORMATION;
+	sfinfo.end_of_file_info.in.size = size;
+	status = smb2_setinfo_file(tree, &sfinfo);
+	torture_assert_ntstatus_ok_goto(torture, status, ret, done,
+					"set eof failed");
+
+	ok = test_copyfile_run(torture, tree, tmp_ctx, &io, &cc_copy, size);
+	torture_assert_goto(torture, ok, ret, done, "copyfile failed");
+
+	ok = check_pattern(torture, tree, tmp_ctx, dest_h,
+			   0, data_len, 0);
+	torture_assert_goto(torture, ok, ret, done,
+			    "inconsistent file data at the start");
+	ok = check_pattern(torture, tree, tmp_ctx, dest_h,
+			   size - data_len, data_len, size - data_len);
+	torture_assert_goto(torture, ok, ret, done,
+			    "inconsistent file data at the end");
+
+	ZERO_STRUCT(r);
+	r.in.file.handle = dest_h;
+	r.in.length = data_len;
+	r.in.offset = size / 2;
+	status = smb2_read(tree, tmp_ctx, &r);
+	torture_assert_ntstatus_ok_goto(torture, status, ret, done, "read");
+	torture_assert_u64_equal_goto(torture, r.out.data.length, data_len,
+				      ret, done, "short read");
+	for (i = 0; i < r.out.data.length; i++) {
+		torture_assert_goto(torture, r.out.data.data[i] == 0,
+				    ret, done, "hole has data");
+	}
+
+	ok = test_copyfile_get_alloc_size(torture, tree, tmp_ctx, src_h,
+					  &src_alloc);
+	torture_assert_goto(torture, ok, ret, done, "getinfo src");
+	if (src_alloc >= size) {
+		torture_comment(torture, "The file system does not create "
+				"holes, not checking the destination\n");
+		goto done;
+	}
+
+	ok = test_copyfile_get_alloc_size(torture, tree, tmp_ctx, dest_h,
+					  &dest_alloc);
+	torture_assert_goto(torture, ok, ret, done, "getinfo dest");
+	torture_comment(torture,
+			"Allocation size of the source %"PRIu64", "
+			"the destination %"PRIu64"\n",
+			src_alloc,
+			dest_alloc);
+	torture_assert_goto(torture, dest_alloc < size / 2, ret, done,
+			    "the hole of the source was copied as data");
+
+done:
+	smb2_util_close(tree, src_h);
+	smb2_util_close(tree, dest_h);
+	smb2_util_unlink(tree, FNAME_CC_SRC);
+	smb2_util_unlink(tree, FNAME_CC_DST);
+	talloc_free(tmp_ctx);
+	return ret;
+}
+
 static bool check_stream_list(struct smb2_tree *tree,
 			      struct torture_context *tctx,
 			      const char *fname,
@@ -5221,6 +5453,177 @@ done:
 	return ret;
 }
 
+/*
+ * Enumerate BASEDIR with AAPL readdir_attr and check that every
+ * "cache-N" entry has the expected resource fork length and
+ * FinderInfo type/creator.
+ */
+static bool readdir_attr_meta_cache_check(struct torture_context *tctx,
+					  struct smb2_tree *tree,
+					  int numfiles,
+					  int changed,
+					  const char *type_creator,
+					  const char *changed_type_creator)
+{
+	TALLOC_CTX *mem_ctx = talloc_new(tctx);
+	struct smb2_create io;
+	struct smb2_find f;
+	union smb_search_data *d = NULL;
+	struct timeval start = timeval_current();
+	unsigned int count;
+	unsigned int i;
+	int found = 0;
+	NTSTATUS status;
+	bool ret = true;
+
+	ZERO_STRUCT(io);
+	io.in.desired_access = SEC_RIGHTS_DIR_READ;
+	io.in.create_options = NTCREATEX_OPTIONS_DIRECTORY;
+	io.in.file_attributes = FILE_ATTRIBUTE_DIRECTORY;
+	io.in.share_access = (NTCREATEX_SHARE_ACCESS_READ |
+			      NTCREATEX_SHARE_ACCESS_WRITE |
+			      NTCREATEX_SHARE_ACCESS_DELETE);
+	io.in.create_disposition = NTCREATEX_DISP_OPEN;
+	io.in.fname = BASEDIR;
+	status = smb2_create(tree, mem_ctx, &io);
+	torture_assert_ntstatus_ok_goto(tctx, status, ret, done, "smb2_create failed");
+
+	ZERO_STRUCT(f);
+	f.in.file.handle	= io.out.file.handle;
+	f.in.pattern		= "*";
+	f.in.max_response_size	= 0x10000;
+	f.in.level              = SMB2_FIND_ID_BOTH_DIRECTORY_INFO;
+
+	do {
+		status = smb2_find_level(tree, mem_ctx, &f, &count, &d);
+		if (NT_STATUS_EQUAL(status, STATUS_NO_MORE_FILES)) {
+			break;
+		}
+		torture_assert_ntstatus_ok_goto(tctx, status, ret, close,
+						"smb2_find_level failed");
+
+		for (i = 0; i < count; i++) {
+			const char *name = d[i].id_both_directory_info.name.s;
+			const uint8_t *buf =
+				d[i].id_both_directory_info.short_name_buf;
+			const char *expected = type_creator;
+			uint64_t rfork_len;
+			int n;
+
+			if (sscanf(name, "cache-%d", &n) != 1) {
+				continue;
+			}
+			found++;
+
+			if (n == changed) {
+				expected = changed_type_creator;
+			}
+
+			rfork_len = BVAL(buf, 0);
+			torture_assert_int_equal_goto(tctx, rfork_len, 3,
+						      ret, close,
+						      "bad resource fork length");
+			torture_assert_mem_equal_goto(tctx, expected, buf + 8, 8,
+						      ret, close,
+						      "Bad FinderInfo");
+		}
+	} while (count != 0);
+
+	torture_assert_int_equal_goto(tctx, found, numfiles, ret, close,
+				      "bad number of entries");
+
+	torture_comment(tctx, "Enumerated %d files in %.3f seconds\n",
+			found, timeval_elapsed(&start));
+
+close:
+	smb2_util_close(tree, io.out.file.handle);
+done:
+	talloc_free(mem_ctx);
+	return ret;
+}
+
+/*
+ * With "fruit:metadata cache size" repeated enumerations are served
+ * from the cache, changes must still show up.
+ */
+static bool test_readdir_attr_meta_cache(struct torture_context *tctx,
+					 struct smb2_tree *tree)
+{
+	TALLOC_CTX *mem_ctx = talloc_new(tctx);
+	int numfiles = torture_setting_int(tctx, "numfiles", 100);
+	const char *type_creator = "SMB,OLE!";
+	const char *changed_type_creator = "TEXTttxt";
+	struct smb2_handle testdirh;
+	AfpInfo *info = NULL;
+	char *fname = NULL;
+	NTSTATUS status;
+	bool ret = true;
+	int i;
+
+	smb2_deltree(tree, BASEDIR);
+
+	status = torture_smb2_testdir(tree, BASEDIR, &testdirh);
+	torture_assert_ntstatus_ok_goto(tctx, status, ret, done, "torture_smb2_testdir failed");
+	smb2_util_close(tree, testdirh);
+
+	ret = enable_aapl(tctx, tree);
+	torture_assert_goto(tctx, ret == true, ret, done, "enable_aapl failed");
+
+	info = torture_afpinfo_new(mem_ctx);
+	torture_assert_not_null_goto(tctx, info, ret, done, "torture_afpinfo_new failed");
+	memcpy(info->afpi_FinderInfo, type_creator, 8);
+
+	torture_comment(tctx, "Preparing %d files\n", numfiles);
+
+	for (i = 0; i < numfiles; i++) {
+		fname = talloc_asprintf(mem_ctx, BASEDIR "\\cache-%d", i);
+		torture_assert_not_null_goto(tctx, fname, ret, done, "talloc_asprintf failed");
+
+		ret = torture_setup_file(mem_ctx, tree, fname, false);
+		torture_assert_goto(tctx, ret == true, ret, done, "torture_setup_file failed");
+
+		ret = torture_write_afpinfo(tree, tctx, mem_ctx, fname, info);
+		torture_assert_goto(tctx, ret == true, ret, done, "torture_write_afpinfo failed");
+
+		ret = write_stream(tree, __location__, tctx, mem_ctx,
+				   fname, AFPRESOURCE_STREAM_NAME,
+				   0, 3, "foo");
+		torture_assert_goto(tctx, ret == true, ret, done, "write_stream failed");
+		TALLOC_FREE(fname);
+	}
+
+	/* Entries are only created for files with an older ctime */
+	sleep(3);
+
+	torture_comment(tctx, "Enumerating, populating the cache\n");
+	ret = readdir_attr_meta_cache_check(tctx, tree, numfiles, -1,
+					    type_creator, NULL);
+	torture_assert_goto(tctx, ret == true, ret, done, "first enumeration failed");
+
+	torture_comment(tctx, "Enumerating again\n");
+	ret = readdir_attr_meta_cache_check(tctx, tree, numfiles, -1,
+					    type_creator, NULL);
+	torture_assert_goto(tctx, ret == true, ret, done, "second enumeration failed");
+
+	torture_comment(tctx, "Changing the FinderInfo of one file\n");
+
+	fname = talloc_asprintf(mem_ctx, BASEDIR "\\cache-%d", numfiles / 2);
+	torture_assert_not_null_goto(tctx, fname, ret, done, "talloc_asprintf failed");
+
+	memcpy(info->afpi_FinderInfo, changed_type_creator, 8);
+	ret = torture_write_afpinfo(tree, tctx, mem_ctx, fname, info);
+	torture_assert_goto(tctx, ret == true, ret, done, "torture_write_afpinfo failed");
+
+	ret = readdir_attr_meta_cache_check(tctx, tree, numfiles, numfiles / 2,
+					    type_creator, changed_type_creator);
+	torture_assert_goto(tctx, ret == true, ret, done, "enumeration after change failed");
+
+done:
+	smb2_deltree(tree, BASEDIR);
+	talloc_free(mem_ctx);
+	return ret;
+}
+
 static bool test_invalid_afpinfo(struct torture_context *tctx,
 				 struct smb2_tree *tree1,
 				 struct smb2_tree *tree2)
@@ -8008,6 +8411,7 @@ struct torture_suite *torture_vfs_fruit(TALLOC_CTX *ctx)
 	torture_suite_add_1smb2_test(suite, "delete", test_delete_file_with_rfork);
 	torture_suite_add_1smb2_test(suite, "read open rsrc after rename", test_rename_and_read_rsrc);
 	torture_suite_add_1smb2_test(suite, "readdir_attr with names with illegal ntfs characters", test_readdir_attr_illegal_ntfs);
+	torture_suite_add_1smb2_test(suite, "readdir_attr metadata cache", test_readdir_attr_meta_cache);
 	torture_suite_add_2ns_smb2_test(suite, "invalid AFP_AfpInfo", test_invalid_afpinfo);
 	torture_suite_add_1smb2_test(suite, "creating rsrc with read-only access", test_rfork_create_ro);
 	torture_suite_add_1smb2_test(suite, "copy-chunk streams", test_copy_chunk_streams);
@@ -8327,6 +8731,22 @@ struct torture_suite *torture_vfs_fruit_timemachine(TALLOC_CTX *ctx)
 	return suite;
 }
 
+struct torture_suite *torture_vfs_fruit_copyfile(TALLOC_CTX *ctx)
+{
+	struct torture_suite *suite = torture_suite_create(
+		ctx, "fruit_copyfile");
+
+	suite->description = talloc_strdup(
+		suite, "vfs_fruit tests for server side copies of whole files");
+
+	torture_suite_add_1smb2_test(suite, "segments",
+				     test_copyfile_segments);
+	torture_suite_add_1smb2_test(suite, "sparse",
+				     test_copyfile_sparse);
+
+	return suite;
+}
+
 static bool test_convert_xattr_and_empty_rfork_then_delete(
 	struct torture_context *tctx,
 	struct smb2_tree *tree1,